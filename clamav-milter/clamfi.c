@@ -79,8 +79,9 @@ struct CLAMFI {
     char *msg_date;
     char *msg_id;
     char **recipients;
+    struct CP_CONN *conn;
+    unsigned int connid;
     int local;
-    int main;
     int alt;
     unsigned int totsz;
     unsigned int bufsz;
@@ -135,8 +136,12 @@ static const char *makesanehdr(char *hdr) {
 }
 
 static void nullify(SMFICTX *ctx, struct CLAMFI *cf, enum CFWHAT closewhat) {
-    if(closewhat & CF_MAIN || ((closewhat & CF_ANY) && cf->main >= 0))
-	close(cf->main);
+    /* a session we give up on half way is closed once
+     * the other messages pipelined on it are done */
+    if(cf->conn) {
+	cpool_put_conn(cf->conn, 1);
+	cf->conn = NULL;
+    }
     if(closewhat & CF_ALT || ((closewhat & CF_ANY) && cf->alt >= 0))
 	close(cf->alt);
     if(cf->msg_subj) free(cf->msg_subj);
@@ -159,7 +164,7 @@ static sfsistat sendchunk(struct CLAMFI *cf, unsigned char *bodyp, size_t len, S
 
     if(!cf->totsz) {
 	sfsistat ret;
-	if(nc_connect_rand(&cf->main, &cf->alt, &cf->local)) {
+	if(nc_connect_rand(&cf->conn, &cf->connid, &cf->alt, &cf->local)) {
 	    logg("!Failed to initiate streaming/fdpassing\n");
 	    nullify(ctx, cf, CF_NONE);
 	    return FailAction;
@@ -195,14 +200,14 @@ static sfsistat sendchunk(struct CLAMFI *cf, unsigned char *bodyp, size_t len, S
 	} else if(len < CLAMFIBUFSZ) {
 	    memcpy(&cf->buffer[cf->bufsz], bodyp, CLAMFIBUFSZ - cf->bufsz);
 	    cf->sendme = htonl(CLAMFIBUFSZ);
-	    sendfailed = nc_send(cf->main, &cf->sendme, CLAMFIBUFSZ + 4);
+	    sendfailed = nc_send(cf->conn->sock, &cf->sendme, CLAMFIBUFSZ + 4);
 	    len -= (CLAMFIBUFSZ - cf->bufsz);
 	    memcpy(cf->buffer, &bodyp[CLAMFIBUFSZ - cf->bufsz], len);
 	    cf->bufsz = len;
 	} else {
 	    uint32_t sendmetoo = htonl(len);
 	    cf->sendme = htonl(cf->bufsz);
-	    if((cf->bufsz && nc_send(cf->main, &cf->sendme, cf->bufsz + 4)) || nc_send(cf->main, &sendmetoo, 4) || nc_send(cf->main, bodyp, len))
+	    if((cf->bufsz && nc_send(cf->conn->sock, &cf->sendme, cf->bufsz + 4)) || nc_send(cf->conn->sock, &sendmetoo, 4) || nc_send(cf->conn->sock, bodyp, len))
 		sendfailed = 1;
 	    cf->bufsz = 0;
 	}
@@ -319,7 +324,7 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
     if(cf->local) {
 	lseek(cf->alt, 0, SEEK_SET);
 
-	if(nc_sendmsg(cf->main, cf->alt) == -1) {
+	if(nc_sendmsg(cf->conn->sock, cf->alt) == -1) {
 	    logg("!FD send failed\n");
 	    nullify(ctx, cf, CF_ALT);
 	    free(cf);
@@ -328,7 +333,7 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
     } else {
 	uint32_t sendmetoo = 0;
 	cf->sendme = htonl(cf->bufsz);
-	if((cf->bufsz && nc_send(cf->main, &cf->sendme, cf->bufsz + 4)) || nc_send(cf->main, &sendmetoo, 4))  {
+	if((cf->bufsz && nc_send(cf->conn->sock, &cf->sendme, cf->bufsz + 4)) || nc_send(cf->conn->sock, &sendmetoo, 4))  {
 	    logg("!Failed to flush STREAM\n");
 	    nullify(ctx, cf, CF_NONE);
 	    free(cf);
@@ -336,7 +341,8 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
 	}
     }
 
-    reply = nc_recv(cf->main);
+    cpool_conn_sent(cf->conn);
+    reply = cpool_conn_recv(cf->conn, cf->connid);
 
     if(cf->local)
 	close(cf->alt);
@@ -349,6 +355,8 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
 	free(cf);
 	return FailAction;
     }
+    cpool_put_conn(cf->conn, 0);
+    cf->conn = NULL;
 
     len = strlen(reply);
     if(len>5 && !strcmp(reply + len - 5, ": OK\n")) {
@@ -480,7 +488,7 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
 	ret = FailAction;
     }
 
-    nullify(ctx, cf, CF_MAIN);
+    nullify(ctx, cf, CF_NONE);
     free(cf);
     free(reply);
     return ret;
@@ -709,7 +717,8 @@ sfsistat clamfi_envfrom(SMFICTX *ctx, char **argv) {
     }
     cf->totsz = 0;
     cf->bufsz = 0;
-    cf->main = cf->alt = -1;
+    cf->conn = NULL;
+    cf->alt = -1;
     cf->all_whitelisted = 1;
     cf->gotbody = 0;
     cf->msg_subj = cf->msg_date = cf->msg_id = NULL;
@@ -31,10 +31,13 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <time.h>
 #include <netdb.h>
+#include <errno.h>
 
 #include "shared/optparser.h"
 #include "shared/output.h"
@@ -52,6 +55,10 @@
 #define _UNUSED_
 #endif
 
+/* Idle sessions are not reused past this age (seconds) so they are
+ * dropped well before clamd's own ReadTimeout kicks in */
+#define CPOOL_MAXIDLE 30
+
 struct CPOOL *cp = NULL;
 static pthread_cond_t mon_cond = PTHREAD_COND_INITIALIZER;
 static int quitting = 1;
@@ -145,16 +152,61 @@ static int addslot(void) {
 }
 
 
+static void conn_free(struct CP_CONN *conn) {
+    struct CP_REPLY *r;
+
+    while((r = conn->replies)) {
+	conn->replies = r->next;
+	free(r->reply);
+	free(r);
+    }
+    close(conn->sock);
+    pthread_cond_destroy(&conn->cond);
+    free(conn);
+}
+
+
+/* must be called with cp->mutex held */
+static void conn_unlink(struct CP_CONN *conn) {
+    struct CP_CONN **cc = &conn->cpe->conns;
+
+    while(*cc && *cc != conn)
+	cc = &(*cc)->next;
+    if(*cc) {
+	*cc = conn->next;
+	conn->cpe->nconns--;
+    }
+}
+
+
+/* must be called with cp->mutex held */
+static void conn_reap(struct CP_ENTRY *cpe, time_t now) {
+    struct CP_CONN *conn = cpe->conns, *next;
+
+    while(conn) {
+	next = conn->next;
+	if(!conn->users && (conn->broken || conn->last_used < now - CPOOL_MAXIDLE)) {
+	    conn_unlink(conn);
+	    conn_free(conn);
+	}
+	conn = next;
+    }
+}
+
+
 /* Probe strategy:
-- wake up every minute
+- wake up every minute (or every StatsInterval seconds if shorter)
 - probe alive if last check > 15 min
 - probe dead if (last check > 2 min || no clamd available)
+- ask alive clamd's for their load every StatsInterval seconds
+- close idle sessions
 */
 
 static void cpool_probe(void) {
     unsigned int i, dead=0;
     struct CP_ENTRY *cpe = cp->pool;
     time_t now = time(NULL);
+    int load;
 
     for(i=1; i<=cp->entries; i++) {
 	if((cpe->dead && (cpe->last_poll < now - 120 || !cp->alive)) || cpe->last_poll < now - 15*60*60) {
@@ -162,6 +214,16 @@ static void cpool_probe(void) {
 	    nc_ping_entry(cpe);
 	    logg("*Probe for slot %u returned: %s\n", i, cpe->dead ? "failed" : "success");
 	}
+	if(!cpe->dead && cp->statsint && cpe->last_stats <= now - (time_t)cp->statsint) {
+	    cpe->last_stats = now;
+	    /* -1 when STATS fails, the last known load is kept */
+	    load = nc_stats_entry(cpe);
+	} else load = -1;
+	pthread_mutex_lock(&cp->mutex);
+	if(load >= 0)
+	    cpe->load = load;
+	conn_reap(cpe, now);
+	pthread_mutex_unlock(&cp->mutex);
 	dead += cpe->dead;
 	cpe++;
     }
@@ -182,7 +244,7 @@ static void *cpool_mon(_UNUSED_ void *v) {
 	struct timespec t;
 
 	cpool_probe();
-	t.tv_sec = time(NULL) + 60;
+	t.tv_sec = time(NULL) + (cp->statsint && cp->statsint < 60 ? cp->statsint : 60);
 	t.tv_nsec = 0;
 	pthread_cond_timedwait(&mon_cond, &conv, &t);
     }
@@ -202,6 +264,12 @@ void cpool_init(struct optstruct *opts) {
     }
 
     cp->local_cpe = NULL;
+    cp->maxconns = optget(opts, "ClamdConnections")->numarg;
+    cp->pipeline = optget(opts, "ClamdPipelineDepth")->numarg;
+    if(!cp->pipeline)
+	cp->pipeline = 1;
+    cp->statsint = optget(opts, "ClamdStatsInterval")->numarg;
+    pthread_mutex_init(&cp->mutex, NULL);
 
     if((opt = optget(opts, "ClamdSocket"))->enabled) {
 	while(opt) {
@@ -253,39 +321,291 @@ void cpool_free(void) {
 
     if(cp) {
 	if(cp->pool) {
-	    for(i=0; i<cp->entries; i++)
+	    for(i=0; i<cp->entries; i++) {
+		while(cp->pool[i].conns) {
+		    struct CP_CONN *conn = cp->pool[i].conns;
+
+		    cp->pool[i].conns = conn->next;
+		    conn_free(conn);
+		}
 		FREESRV(cp->pool[i]);
+	    }
 	    free(cp->pool);
 	}
+	pthread_mutex_destroy(&cp->mutex);
 	free(cp);
 	cp = NULL;
     }
 }
 
 
-struct CP_ENTRY *cpool_get_rand(int *s) {
+/* Picks the clamd with the least work ahead of it: the jobs we have in
+ * flight there (or the load it reported, whichever is higher) weighted by
+ * how long it has recently taken to reply.
+ * Must be called with cp->mutex held */
+static struct CP_ENTRY *cpool_pick(void) {
     unsigned int start, i;
-    struct CP_ENTRY *cpe;
+    struct CP_ENTRY *cpe, *best = NULL;
+    uint64_t score, bestscore = 0;
+
+    if(!cp->alive)
+	return NULL;
+    start = rand() % cp->entries;
+    for(i=0; i<cp->entries; i++) {
+	cpe = &cp->pool[(i+start) % cp->entries];
+	if(cpe->dead) continue;
+	if(cpe->local && cp->local_cpe && !cp->local_cpe->dead)
+	    cpe = cp->local_cpe;
+	score = (uint64_t)((cpe->inflight > cpe->load ? cpe->inflight : cpe->load) + 1) * (cpe->latency > 1000 ? cpe->latency : 1000);
+	if(!best || score < bestscore) {
+	    best = cpe;
+	    bestscore = score;
+	}
+    }
+    return best;
+}
+
 
-    if(cp->alive) {
-	start = rand() % cp->entries;
-	for(i=0; i<cp->entries; i++) {
-	    cpe = &cp->pool[(i+start) % cp->entries];
-	    if(cpe->dead) continue;
-	    if(cpe->local && cp->local_cpe && !cp->local_cpe->dead)
-		cpe = cp->local_cpe;
-	    if((*s = nc_connect_entry(cpe)) == -1) {
-		cpe->dead = 1;
+/* Returns the idle or least busy session on cpe that can take one more
+ * request. Must be called with cp->mutex held */
+static struct CP_CONN *conn_checkout(struct CP_ENTRY *cpe) {
+    struct CP_CONN *conn, *best = NULL;
+    time_t now = time(NULL);
+    char c;
+
+    for(conn = cpe->conns; conn; conn = conn->next) {
+	if(conn->busy || conn->broken || conn->pending >= cp->pipeline)
+	    continue;
+	if(!conn->pending) {
+	    /* nothing should be waiting on an idle session: if anything is,
+	     * clamd has either closed it or sent us an error */
+	    if(conn->last_used < now - CPOOL_MAXIDLE || conn->rlen ||
+	       recv(conn->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+		conn->broken = 1;
 		continue;
 	    }
-	    return cpe;
 	}
+	if(!best || conn->pending < best->pending)
+	    best = conn;
+    }
+    conn_reap(cpe, now);
+    return best;
+}
+
+
+static struct CP_CONN *conn_new(struct CP_ENTRY *cpe, int session) {
+    struct CP_CONN *conn;
+    int s = nc_connect_entry(cpe);
+
+    if(s == -1)
+	return NULL;
+    if(session && cpe->type) {
+	/* several small requests share the session: don't let them wait
+	 * on each other's ACK */
+	int on = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if(session && nc_send(s, "nIDSESSION\n", 11)) {
+	close(s);
+	return NULL;
+    }
+    if(!(conn = (struct CP_CONN *)calloc(1, sizeof(*conn)))) {
+	logg("!Out of memory while allocating a clamd connection\n");
+	close(s);
+	return NULL;
+    }
+    pthread_cond_init(&conn->cond, NULL);
+    conn->cpe = cpe;
+    conn->sock = s;
+    conn->nextid = 1;
+    conn->oneshot = !session;
+    conn->users = 1;
+    conn->busy = 1;
+    conn->last_used = time(NULL);
+    return conn;
+}
+
+
+/* Returns a connection to the least loaded clamd, reserved for sending a
+ * single request whose reply will carry the returned id.
+ * Up to ClamdConnections sessions are kept open to each clamd; once all of
+ * them are busy a one-shot connection is made instead */
+struct CP_CONN *cpool_get_conn(unsigned int *id) {
+    unsigned int i;
+    struct CP_ENTRY *cpe;
+    struct CP_CONN *conn;
+    int session;
+
+    for(i=0; i<cp->entries; i++) {
+	pthread_mutex_lock(&cp->mutex);
+	if(!(cpe = cpool_pick())) {
+	    pthread_mutex_unlock(&cp->mutex);
+	    break;
+	}
+	cpe->inflight++;
+	if((conn = conn_checkout(cpe))) {
+	    conn->busy = 1;
+	    conn->users++;
+	    *id = conn->nextid++;
+	    pthread_mutex_unlock(&cp->mutex);
+	    return conn;
+	}
+	if((session = (cpe->nconns < cp->maxconns)))
+	    cpe->nconns++;
+	pthread_mutex_unlock(&cp->mutex);
+
+	conn = conn_new(cpe, session);
+
+	pthread_mutex_lock(&cp->mutex);
+	if(!conn) {
+	    if(session)
+		cpe->nconns--;
+	    cpe->inflight--;
+	    cpe->dead = 1;
+	    pthread_mutex_unlock(&cp->mutex);
+	    continue;
+	}
+	if(session) {
+	    conn->next = cpe->conns;
+	    cpe->conns = conn;
+	}
+	*id = conn->nextid++;
+	pthread_mutex_unlock(&cp->mutex);
+	return conn;
     }
     pthread_cond_signal(&mon_cond);
     return NULL;
 }
 
 
+/* The request has been fully sent: the session can take the next one
+ * while we wait for the reply */
+void cpool_conn_sent(struct CP_CONN *conn) {
+    pthread_mutex_lock(&cp->mutex);
+    conn->busy = 0;
+    conn->pending++;
+    pthread_mutex_unlock(&cp->mutex);
+}
+
+
+/* Waits for the reply to request id. Whoever gets to the socket first reads
+ * replies on behalf of the others and hands them over through conn->cond */
+char *cpool_conn_recv(struct CP_CONN *conn, unsigned int id) {
+    struct CP_REPLY **rp, *r;
+    struct timeval t0, t1;
+    struct timespec deadline;
+    char *reply = NULL, *line, *eptr;
+    unsigned int rid;
+    size_t len;
+
+    gettimeofday(&t0, NULL);
+    deadline.tv_sec = t0.tv_sec + readtimeout;
+    deadline.tv_nsec = t0.tv_usec * 1000;
+
+    pthread_mutex_lock(&cp->mutex);
+    while(1) {
+	for(rp = &conn->replies; *rp; rp = &(*rp)->next) {
+	    if((*rp)->id == id) {
+		r = *rp;
+		*rp = r->next;
+		reply = r->reply;
+		free(r);
+		break;
+	    }
+	}
+	if(reply || conn->eof)
+	    break;
+
+	if(conn->reading) {
+	    if(!readtimeout)
+		pthread_cond_wait(&conn->cond, &cp->mutex);
+	    else if(pthread_cond_timedwait(&conn->cond, &cp->mutex, &deadline) == ETIMEDOUT) {
+		logg("!Timed out while waiting for clamd reply\n");
+		conn->broken = 1;
+		break;
+	    }
+	    continue;
+	}
+
+	conn->reading = 1;
+	pthread_mutex_unlock(&cp->mutex);
+	line = nc_recvline(conn->sock, conn->rbuf, &conn->rlen, sizeof(conn->rbuf));
+	pthread_mutex_lock(&cp->mutex);
+	conn->reading = 0;
+	pthread_cond_broadcast(&conn->cond);
+
+	if(!line) {
+	    conn->eof = conn->broken = 1;
+	    break;
+	}
+	if(conn->oneshot) {
+	    reply = line;
+	    break;
+	}
+	rid = strtoul(line, &eptr, 10);
+	if(eptr == line || strncmp(eptr, ": ", 2)) {
+	    logg("!Unexpected reply from clamd\n");
+	    free(line);
+	    conn->eof = conn->broken = 1;
+	    break;
+	}
+	memmove(line, eptr + 2, strlen(eptr + 2) + 1);
+	if(rid == id) {
+	    reply = line;
+	    break;
+	}
+	if(!(r = (struct CP_REPLY *)malloc(sizeof(*r)))) {
+	    logg("!Out of memory while queueing a clamd reply\n");
+	    free(line);
+	    conn->eof = conn->broken = 1;
+	    break;
+	}
+	r->id = rid;
+	r->reply = line;
+	r->next = conn->replies;
+	conn->replies = r;
+    }
+    conn->pending--;
+    if(reply) {
+	long elapsed;
+
+	/* clamd ends the session after sending an error */
+	len = strlen(reply);
+	if(len > 7 && !strcmp(reply + len - 7, " ERROR\n"))
+	    conn->broken = 1;
+	gettimeofday(&t1, NULL);
+	elapsed = (t1.tv_sec - t0.tv_sec) * 1000000 + t1.tv_usec - t0.tv_usec;
+	if(conn->cpe->latency)
+	    conn->cpe->latency += (elapsed - (long)conn->cpe->latency) / 8;
+	else
+	    conn->cpe->latency = elapsed > 0 ? elapsed : 1;
+    }
+    pthread_mutex_unlock(&cp->mutex);
+    return reply;
+}
+
+
+/* Gives back a connection obtained from cpool_get_conn(). A discarded
+ * session is closed once every pending reply on it has been collected */
+void cpool_put_conn(struct CP_CONN *conn, int discard) {
+    pthread_mutex_lock(&cp->mutex);
+    if(conn->cpe->inflight)
+	conn->cpe->inflight--;
+    if(discard)
+	conn->broken = 1;
+    conn->users--;
+    conn->last_used = time(NULL);
+    if(conn->oneshot || (conn->broken && !conn->users)) {
+	if(!conn->oneshot)
+	    conn_unlink(conn);
+	pthread_mutex_unlock(&cp->mutex);
+	conn_free(conn);
+	return;
+    }
+    pthread_mutex_unlock(&cp->mutex);
+}
+
+
 /*
  * Local Variables:
  * mode: c
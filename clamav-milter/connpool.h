@@ -34,11 +34,44 @@
 
 #include "shared/optparser.h"
 
+struct CP_REPLY {
+    struct CP_REPLY *next;
+    unsigned int id;
+    char *reply;
+};
+
+/* A clamd connection: either a long lived IDSESSION shared by several
+ * messages (replies are demultiplexed by request id) or a one-shot */
+struct CP_CONN {
+    struct CP_CONN *next;
+    struct CP_ENTRY *cpe;
+    struct CP_REPLY *replies;
+    pthread_cond_t cond;
+    time_t last_used;
+    int sock;
+    unsigned int nextid;
+    unsigned int pending;
+    unsigned int users;
+    unsigned int rlen;
+    uint8_t oneshot;
+    uint8_t busy;
+    uint8_t reading;
+    uint8_t broken;
+    uint8_t eof;
+    char rbuf[128];
+};
+
 struct CP_ENTRY {
     struct sockaddr *server;
     void *gai;
     socklen_t socklen;
     time_t last_poll;
+    time_t last_stats;
+    struct CP_CONN *conns;
+    unsigned int nconns;
+    unsigned int inflight;
+    unsigned int load;
+    unsigned long latency;
     uint8_t type;
     uint8_t dead;
     uint8_t local;
@@ -47,13 +80,20 @@ struct CP_ENTRY {
 struct CPOOL {
     unsigned int entries;
     unsigned int alive;
+    unsigned int maxconns;
+    unsigned int pipeline;
+    unsigned int statsint;
+    pthread_mutex_t mutex;
     struct CP_ENTRY *local_cpe;
     struct CP_ENTRY *pool;
 };
 
 void cpool_init(struct optstruct *copt);
 void cpool_free(void);
-struct CP_ENTRY *cpool_get_rand(int *s);
+struct CP_CONN *cpool_get_conn(unsigned int *id);
+void cpool_conn_sent(struct CP_CONN *conn);
+char *cpool_conn_recv(struct CP_CONN *conn, unsigned int id);
+void cpool_put_conn(struct CP_CONN *conn, int discard);
 
 extern struct CPOOL *cp;
 
@@ -154,7 +154,6 @@ int nc_send(int s, const void *buff, size_t len) {
 
 	if(!res) {
 	    logg("!Connection closed while sending data\n");
-	    close(s);
 	    return 1;
 	}
 	if(res!=-1) {
@@ -164,7 +163,6 @@ int nc_send(int s, const void *buff, size_t len) {
 	}
 	if(errno != EAGAIN && errno != EWOULDBLOCK) {
 	    strerror_print("!send failed");
-	    close(s);
 	    return 1;
 	}
 
@@ -185,7 +183,6 @@ int nc_send(int s, const void *buff, size_t len) {
 		    continue;
 		}
 		logg("!Failed to stream to clamd\n");
-		close(s);
 		return 1;
 	    }
 	    break;
@@ -220,24 +217,44 @@ int nc_sendmsg(int s, int fd) {
     if((ret = sendmsg(s, &msg, 0)) == -1) {
 	char er[256];
 	strerror_print("!clamfi_eom: FD send failed");
-	close(s);
     }
     return ret;
 }
 
-char *nc_recv(int s) {
-    char buf[128], *ret=NULL;
+/* Reads one newline terminated line from s; buf holds *len bytes of data
+ * left over from a previous call (pipelined replies can arrive together).
+ * Lines that don't fit buf fail the read, or are dropped with skiplong */
+static char *recvline(int s, char *buf, unsigned int *len, unsigned int size, int skiplong) {
+    char *ret, *eol;
     time_t now, timeout = time(NULL) + readtimeout;
     struct timeval tv;
     fd_set fds;
-    int res;
-    unsigned int len = 0;
-
-    while(1) {
+    int res, skipping = 0;
+    unsigned int linelen;
+
+    while(!(eol = memchr(buf, '\n', *len)) || skipping) {
+	if(eol) {
+	    /* the tail of an overlong line */
+	    linelen = eol - buf + 1;
+	    *len -= linelen;
+	    memmove(buf, &buf[linelen], *len);
+	    skipping = 0;
+	    continue;
+	}
+	if(*len >= size) {
+	    if(skiplong) {
+		if(!skipping)
+		    logg("*Skipping overlong line from clamd\n");
+		*len = 0;
+		skipping = 1;
+		continue;
+	    }
+	    logg("!Overlong reply from clamd\n");
+	    return NULL;
+	}
 	now = time(NULL);
 	if(now >= timeout) {
 	    logg("!Timed out while reading clamd reply\n");
-	    close(s);
 	    return NULL;
 	}
 	tv.tv_sec = timeout - now;
@@ -253,10 +270,9 @@ char *nc_recv(int s) {
 	    continue;
 	}
 
-	res = recv(s, &buf[len], sizeof(buf) - len, 0);
+	res = recv(s, &buf[*len], size - *len, 0);
 	if(!res) {
 	    logg("!Connection closed while reading from socket\n");
-	    close(s);
 	    return NULL;
 	}
 	if(res==-1) {
@@ -264,27 +280,34 @@ char *nc_recv(int s) {
 	    if (errno == EAGAIN)
 		continue;
 	    strerror_print("!recv failed after successful select");
-	    close(s);
-	    return NULL;
-	}
-	len += res;
-	if(len && buf[len-1] == '\n') break;
-	if(len >= sizeof(buf)) {
-	    logg("!Overlong reply from clamd\n");
-	    close(s);
 	    return NULL;
 	}
+	*len += res;
     }
-    if(!(ret = (char *)malloc(len+1))) {
-	logg("!malloc(%d) failed\n", len+1);
-	close(s);
+    linelen = eol - buf + 1;
+    if(!(ret = (char *)malloc(linelen+1))) {
+	logg("!malloc(%d) failed\n", linelen+1);
 	return NULL;
     }
-    memcpy(ret, buf, len);
-    ret[len]='\0';
+    memcpy(ret, buf, linelen);
+    ret[linelen]='\0';
+    *len -= linelen;
+    memmove(buf, &buf[linelen], *len);
     return ret;
 }
 
+char *nc_recvline(int s, char *buf, unsigned int *len, unsigned int size) {
+    return recvline(s, buf, len, size, 0);
+}
+
+
+char *nc_recv(int s) {
+    char buf[128];
+    unsigned int len = 0;
+
+    return nc_recvline(s, buf, &len, sizeof(buf));
+}
+
 
 int nc_connect_entry(struct CP_ENTRY *cpe) {
     int s = nc_socket(cpe);
@@ -310,30 +333,60 @@ void nc_ping_entry(struct CP_ENTRY *cpe) {
 }
 
 
-int nc_connect_rand(int *main, int *alt, int *local) {
-    struct CP_ENTRY *cpe = cpool_get_rand(main);
+/* Returns the number of jobs clamd is busy with (running plus queued)
+ * according to STATS, or -1 if it can't be told */
+int nc_stats_entry(struct CP_ENTRY *cpe) {
+    int s = nc_connect_entry(cpe);
+    char buf[1024], *reply;
+    unsigned int len = 0, live, idle, items;
+    int load = -1, gotend = 0; /* not counting the STATS job itself */
+
+    if(s<0) return -1;
+    if(nc_send(s, "nSTATS\n", 7)) {
+	close(s);
+	return -1;
+    }
+    /* per task lines can be longer than buf, the totals aren't */
+    while((reply = recvline(s, buf, &len, sizeof(buf), 1))) {
+	if(sscanf(reply, "THREADS: live %u idle %u", &live, &idle) == 2 && live >= idle)
+	    load += live - idle;
+	else if(sscanf(reply, "QUEUE: %u items", &items) == 1)
+	    load += items;
+	gotend = !strcmp(reply, "END\n");
+	free(reply);
+	if(gotend) break;
+    }
+    close(s);
+    if(!gotend) return -1;
+    return load > 0 ? load : 0;
+}
+
 
-    if(!cpe) return 1;
-    *local = (cpe->server->sa_family == AF_UNIX);
+int nc_connect_rand(struct CP_CONN **conn, unsigned int *id, int *alt, int *local) {
+    if(!(*conn = cpool_get_conn(id))) return 1;
+    *local = ((*conn)->cpe->server->sa_family == AF_UNIX);
     if(*local) {
 	char *unlinkme;
 	if(cli_gentempfd(tempdir, &unlinkme, alt) != CL_SUCCESS) {
 	    logg("!Failed to create temporary file\n");
-	    close(*main);
+	    cpool_put_conn(*conn, 1);
+	    *conn = NULL;
 	    return 1;
 	}
 	unlink(unlinkme);
 	free(unlinkme);
-	if(nc_send(*main, "nFILDES\n", 8)) {
+	if(nc_send((*conn)->sock, "nFILDES\n", 8)) {
 	    logg("!FD scan request failed\n");
 	    close(*alt);
-	    close(*main);
+	    cpool_put_conn(*conn, 1);
+	    *conn = NULL;
 	    return 1;
 	}
     } else {
-	if(nc_send(*main, "nINSTREAM\n", 10)) {
+	if(nc_send((*conn)->sock, "nINSTREAM\n", 10)) {
 	    logg("!Failed to communicate with clamd\n");
-	    close(*main);
+	    cpool_put_conn(*conn, 1);
+	    *conn = NULL;
 	    return 1;
 	}
     }
@@ -29,9 +29,11 @@
 #include "connpool.h"
 
 void nc_ping_entry(struct CP_ENTRY *cpe);
-int nc_connect_rand(int *main, int *alt, int *local);
+int nc_stats_entry(struct CP_ENTRY *cpe);
+int nc_connect_rand(struct CP_CONN **conn, unsigned int *id, int *alt, int *local);
 int nc_send(int s, const void *buf, size_t len);
 char *nc_recv(int s);
+char *nc_recvline(int s, char *buf, unsigned int *len, unsigned int size);
 int nc_sendmsg(int s, int fd);
 int nc_connect_entry(struct CP_ENTRY *cpe);
 int localnets_init(struct optstruct *opts);
@@ -45,6 +45,7 @@
 #include "libclamav/readdb.h"
 #include "libclamav/bytecode.h"
 #include "libclamav/bytecode_detect.h"
+#include "libclamav/inflate_iface.h"
 #include "target.h"
 #include "fpu.h"
 
@@ -253,6 +254,8 @@ static void print_platform(struct cli_environment *env)
     printf("zlib version: %s (%s)\n",
 	   ZLIB_VERSION, zlibVersion());
 #endif
+    if (cli_inflate_native())
+	printf("Native inflate: %s\n", cli_inflate_native());
 
     if (env->triple[0])
     printf("Triple: %s\n", env->triple);
@@ -374,6 +374,9 @@ int main(int argc, char **argv)
         if (optget(opts, "disable-cache")->enabled)
             cl_engine_set_num(engine, CL_ENGINE_DISABLE_CACHE, 1);
 
+        if (optget(opts, "FastCacheKey")->enabled)
+            cl_engine_set_num(engine, CL_ENGINE_FAST_CACHE_KEY, 1);
+
         /* load the database(s) */
         dbdir = optget(opts, "DatabaseDirectory")->strarg;
         logg("#Reading databases from %s\n", dbdir);
@@ -517,6 +520,9 @@ int main(int argc, char **argv)
         if(optget(opts, "ForceToDisk")->enabled)
             cl_engine_set_num(engine, CL_ENGINE_FORCETODISK, 1);
 
+        if(optget(opts, "DirectMapping")->enabled)
+            cl_engine_set_num(engine, CL_ENGINE_DIRECT_MMAP, 1);
+
         if(optget(opts, "PhishingSignatures")->enabled)
             dboptions |= CL_DB_PHISHING;
         else
@@ -55,6 +55,7 @@
 #include "server.h"
 #include "others.h"
 #include "scanner.h"
+#include "vcache.h"
 
 static int onas_ddd_init_ht(uint32_t ht_size);
 static int onas_ddd_init_wdlt(uint64_t nwatches);
@@ -295,6 +296,7 @@ void *onas_ddd_th(void *arg) {
 	char buf[4096];
 	ssize_t bread;
 	const struct inotify_event *event;
+	STATBUF sb;
 	int ret, len;
 
 	/* ignore all signals except SIGUSR1 */
@@ -424,6 +426,12 @@ void *onas_ddd_th(void *arg) {
 				else
 					snprintf(child_path, size, "%s/%s", path, child);
 
+				/* a file created or moved in here may reuse the
+				 * inode of one with a cached verdict */
+				if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !(event->mask & IN_ISDIR))
+					if (CLAMSTAT(child_path, &sb) == 0)
+						vcache_remove(&sb);
+
 				if (event->mask & IN_DELETE) {
 					onas_ddd_handle_in_delete(tharg, path, child_path, event, wd);
 
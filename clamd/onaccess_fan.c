@@ -26,9 +26,12 @@
 #if defined(FANOTIFY)
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <pthread.h>
@@ -47,17 +50,65 @@
 #include "server.h"
 #include "others.h"
 #include "scanner.h"
+#include "thrmgr.h"
+#include "vcache.h"
 
 #include "onaccess_fan.h"
 #include "onaccess_hash.h"
 #include "onaccess_ddd.h"
 
+/* an event handed from the reader to the worker pool */
+struct onas_fan_event {
+    int fd;
+    uint64_t mask;
+    int responded;
+    struct timeval tv_read;
+    struct timeval tv_deadline;
+    struct cl_engine *engine;
+    struct onas_fan_event *prev;
+    struct onas_fan_event *next;
+    char fname[1024];
+};
+
 static pthread_t ddd_pid;
 static int onas_fan_fd;
-
+static threadpool_t *onas_fan_pool;
+static const struct thrarg *onas_fan_tharg;
+static int onas_fan_extinfo;
+static unsigned int onas_fan_timeout;
+static int onas_fan_timeout_response;
+
+/* events waiting for a permission response, oldest first */
+static pthread_mutex_t onas_fan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t onas_fan_cond = PTHREAD_COND_INITIALIZER;
+static struct onas_fan_event *onas_fan_pending_head;
+static struct onas_fan_event *onas_fan_pending_tail;
+static pthread_t onas_fan_reaper_pid;
+static int onas_fan_reaper_stop;
+
+static volatile sig_atomic_t onas_fan_quit;
+
+static struct {
+    int running;
+    unsigned int pending;
+    unsigned long long events;
+    unsigned long long responses;
+    unsigned long long timeouts;
+    long resp_min;
+    long resp_max;
+    double resp_sum;
+} onas_fan_stats;
+
+/* SIGUSR1: the reader loop notices and shuts the scanner down */
 static void onas_fan_exit(int sig)
 {
-	logg("*ScanOnAccess: onas_fan_exit(), signal %d\n", sig);
+	UNUSEDPARAM(sig);
+	onas_fan_quit = 1;
+}
+
+static void onas_fan_abort(int sig)
+{
+	logg("*ScanOnAccess: onas_fan_abort(), signal %d\n", sig);
 
 	close(onas_fan_fd);
 
@@ -70,53 +121,229 @@ static void onas_fan_exit(int sig)
 	logg("ScanOnAccess: stopped\n");
 }
 
-static int onas_fan_scanfile(int fan_fd, const char *fname, struct fanotify_event_metadata *fmd, int scan, int extinfo, struct thrarg *tharg)
+static long onas_fan_usec(const struct timeval *from, const struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_usec - from->tv_usec);
+}
+
+/* must be called with onas_fan_mutex held */
+static void onas_fan_unlink(struct onas_fan_event *ev)
+{
+    if(ev->prev)
+	ev->prev->next = ev->next;
+    else
+	onas_fan_pending_head = ev->next;
+    if(ev->next)
+	ev->next->prev = ev->prev;
+    else
+	onas_fan_pending_tail = ev->prev;
+    ev->prev = ev->next = NULL;
+    onas_fan_stats.pending--;
+}
+
+/* must be called with onas_fan_mutex held */
+static int onas_fan_write_response(struct onas_fan_event *ev, uint32_t response)
 {
 	struct fanotify_response res;
+	struct timeval tv_now;
+	long delta;
+
+    ev->responded = 1;
+    gettimeofday(&tv_now, NULL);
+    delta = onas_fan_usec(&ev->tv_read, &tv_now);
+    if(delta < 0)
+	delta = 0;
+    if(!onas_fan_stats.responses || delta < onas_fan_stats.resp_min)
+	onas_fan_stats.resp_min = delta;
+    if(delta > onas_fan_stats.resp_max)
+	onas_fan_stats.resp_max = delta;
+    onas_fan_stats.resp_sum += delta;
+    onas_fan_stats.responses++;
+
+    if(!(ev->mask & FAN_ALL_PERM_EVENTS))
+	return 0;
+
+    res.fd = ev->fd;
+    res.response = response;
+    if(write(onas_fan_fd, &res, sizeof(res)) == -1) {
+	logg("!ScanOnAccess: Internal error (can't write to fanotify)\n");
+	return -1;
+    }
+    return 0;
+}
+
+static void onas_fan_respond(struct onas_fan_event *ev, uint32_t response)
+{
+    pthread_mutex_lock(&onas_fan_mutex);
+    if(!ev->responded) {
+	onas_fan_write_response(ev, response);
+	if(ev->mask & FAN_ALL_PERM_EVENTS)
+	    onas_fan_unlink(ev);
+    }
+    pthread_mutex_unlock(&onas_fan_mutex);
+}
+
+/* answers the permission events whose deadline has passed; it runs in its
+ * own thread since the reader may be stuck handing events to a full pool */
+static void *onas_fan_reaper(void *arg)
+{
+	struct onas_fan_event *ev;
+	struct timeval tv_now;
+	struct timespec ts_wait;
+
+    UNUSEDPARAM(arg);
+
+    pthread_mutex_lock(&onas_fan_mutex);
+    while(!onas_fan_reaper_stop) {
+	if(!(ev = onas_fan_pending_head)) {
+	    pthread_cond_wait(&onas_fan_cond, &onas_fan_mutex);
+	    continue;
+	}
+	gettimeofday(&tv_now, NULL);
+	if(onas_fan_usec(&tv_now, &ev->tv_deadline) > 0) {
+	    ts_wait.tv_sec = ev->tv_deadline.tv_sec;
+	    ts_wait.tv_nsec = ev->tv_deadline.tv_usec * 1000;
+	    pthread_cond_timedwait(&onas_fan_cond, &onas_fan_mutex, &ts_wait);
+	    continue;
+	}
+	logg("^ScanOnAccess: %s: no verdict within %u seconds, %s access\n", ev->fname, onas_fan_timeout, onas_fan_timeout_response == FAN_DENY ? "denying" : "allowing");
+	onas_fan_write_response(ev, onas_fan_timeout_response);
+	onas_fan_unlink(ev);
+	onas_fan_stats.timeouts++;
+    }
+    pthread_mutex_unlock(&onas_fan_mutex);
+
+    return NULL;
+}
+
+static void onas_fan_scanfile(void *arg)
+{
+	struct onas_fan_event *ev = (struct onas_fan_event *) arg;
+	const struct thrarg *tharg = onas_fan_tharg;
 	struct cb_context context;
 	const char *virname;
-	int ret = 0;
+	uint32_t response = FAN_ALLOW;
+	int expired, ret, nostat;
+	STATBUF sb, post;
+	time_t stat_time;
+
+    pthread_mutex_lock(&onas_fan_mutex);
+    expired = ev->responded;
+    pthread_mutex_unlock(&onas_fan_mutex);
+
+    /* the access has already been decided on, don't let a backlog of stale
+     * events delay the fresh ones */
+    if(expired) {
+	logg("*ScanOnAccess: %s skipped (response timeout)\n", ev->fname);
+    } else {
+	thrmgr_setactiveengine(ev->engine);
+	thrmgr_setactivetask(ev->fname, "ONACCESS");
+
+	context.filename = ev->fname;
+	context.virsize = 0;
+	context.scandata = NULL;
+	stat_time = time(NULL);
+	nostat = FSTAT(ev->fd, &sb);
+	ret = cl_scandesc_callback(ev->fd, &virname, NULL, ev->engine, tharg->options, &context);
+	/* only if the file didn't change while it was scanned */
+	if(ret == CL_CLEAN && !nostat && !FSTAT(ev->fd, &post))
+	    vcache_add(ev->engine, tharg->options, &sb, stat_time, &post);
+	if(ret == CL_VIRUS) {
+	    if(onas_fan_extinfo && context.virsize)
+		logg("ScanOnAccess: %s: %s(%s:%llu) FOUND\n", ev->fname, virname, context.virhash, context.virsize);
+	    else
+		logg("ScanOnAccess: %s: %s FOUND\n", ev->fname, virname);
+	    virusaction(ev->fname, virname, tharg->opts);
+
+	    response = FAN_DENY;
+	}
+	thrmgr_setactivetask(NULL, NULL);
+    }
 
-    res.fd = fmd->fd;
-    res.response = FAN_ALLOW;
-    context.filename = fname;
-    context.virsize = 0;
-    context.scandata = NULL;
-    if(scan && cl_scandesc_callback(fmd->fd, &virname, NULL, tharg->engine, tharg->options, &context) == CL_VIRUS) {
-	if(extinfo && context.virsize)
-	    logg("ScanOnAccess: %s: %s(%s:%llu) FOUND\n", fname, virname, context.virhash, context.virsize);
-	else
-	    logg("ScanOnAccess: %s: %s FOUND\n", fname, virname);
-	virusaction(fname, virname, tharg->opts);
+    onas_fan_respond(ev, response);
 
-	res.response = FAN_DENY;
-    }
+    if(close(ev->fd) == -1)
+	logg("!ScanOnAccess: Internal error (close(%d) failed)\n", ev->fd);
+    cl_engine_free(ev->engine);
+    free(ev);
+}
 
-    if(fmd->mask & FAN_ALL_PERM_EVENTS) {
-	ret = write(fan_fd, &res, sizeof(res));
-	if(ret == -1)
-	    logg("!ScanOnAccess: Internal error (can't write to fanotify)\n");
+static int onas_fan_dispatch(const char *fname, struct fanotify_event_metadata *fmd, struct thrarg *tharg)
+{
+	struct onas_fan_event *ev;
+
+    if(!(ev = (struct onas_fan_event *) calloc(1, sizeof(*ev)))) {
+	logg("!ScanOnAccess: Can't allocate memory for event\n");
+	return -1;
+    }
+    ev->fd = fmd->fd;
+    ev->mask = fmd->mask;
+    strncpy(ev->fname, fname, sizeof(ev->fname) - 1);
+    ev->engine = (struct cl_engine *) tharg->engine;
+    if(cl_engine_addref(ev->engine)) {
+	logg("!ScanOnAccess: cl_engine_addref() failed\n");
+	free(ev);
+	return -1;
+    }
+    gettimeofday(&ev->tv_read, NULL);
+    ev->tv_deadline.tv_sec = ev->tv_read.tv_sec + onas_fan_timeout;
+    ev->tv_deadline.tv_usec = ev->tv_read.tv_usec;
+
+    pthread_mutex_lock(&onas_fan_mutex);
+    if(ev->mask & FAN_ALL_PERM_EVENTS) {
+	ev->prev = onas_fan_pending_tail;
+	if(onas_fan_pending_tail)
+	    onas_fan_pending_tail->next = ev;
+	else
+	    onas_fan_pending_head = ev;
+	onas_fan_pending_tail = ev;
+	onas_fan_stats.pending++;
+	/* deadlines only grow, the reaper cares about a new head only */
+	if(onas_fan_pending_head == ev)
+	    pthread_cond_signal(&onas_fan_cond);
+    }
+    onas_fan_stats.events++;
+    pthread_mutex_unlock(&onas_fan_mutex);
+
+    /* blocks while the queue is full; the kernel keeps queueing meanwhile
+     * and the reaper answers whatever expires */
+    if(!thrmgr_dispatch(onas_fan_pool, ev)) {
+	logg("!ScanOnAccess: thread dispatch failed, scanning %s in the reader\n", fname);
+	onas_fan_scanfile(ev);
     }
 
-    return ret;
+    return 0;
+}
+
+void onas_fan_printstats(int f)
+{
+    pthread_mutex_lock(&onas_fan_mutex);
+    if(onas_fan_stats.running) {
+	mdprintf(f, "ONACCESS: events %llu pending %u timeouts %llu", onas_fan_stats.events, onas_fan_stats.pending, onas_fan_stats.timeouts);
+	if(onas_fan_stats.responses)
+	    mdprintf(f, " min_resp: %.6f max_resp: %.6f avg_resp: %.6f", onas_fan_stats.resp_min/1e6, onas_fan_stats.resp_max/1e6, onas_fan_stats.resp_sum/(1e6*onas_fan_stats.responses));
+	mdprintf(f, "\n\n");
+    }
+    pthread_mutex_unlock(&onas_fan_mutex);
 }
 
 void *onas_fan_th(void *arg)
 {
 	struct thrarg *tharg = (struct thrarg *) arg;
-	sigset_t sigset;
+	sigset_t sigset, blockset;
         struct sigaction act;
 	const struct optstruct *pt;
 	short int scan;
-	int sizelimit = 0, extinfo;
+	int sizelimit = 0, max_threads, max_queue;
 	STATBUF sb;
         uint64_t fan_mask = FAN_EVENT_ON_CHILD | FAN_CLOSE;
         fd_set rfds;
 	char buf[4096];
 	ssize_t bread;
 	struct fanotify_event_metadata *fmd;
+	struct fanotify_response res;
 	char fname[1024];
-	int ret, len;
+	int ret, len, reaper = 0, quit = 0;
 	char err[128];
 
 	pthread_attr_t ddd_attr;
@@ -135,11 +362,16 @@ void *onas_fan_th(void *arg)
 #ifdef SIGBUS    
     sigdelset(&sigset, SIGBUS);
 #endif
-    pthread_sigmask(SIG_SETMASK, &sigset, NULL);
+    /* SIGUSR1 is only let in while waiting for events, so that it never
+     * interrupts a dispatch, and the worker threads inherit it blocked */
+    memcpy(&blockset, &sigset, sizeof(sigset_t));
+    sigaddset(&blockset, SIGUSR1);
+    pthread_sigmask(SIG_SETMASK, &blockset, NULL);
     memset(&act, 0, sizeof(struct sigaction));
     act.sa_handler = onas_fan_exit;
     sigfillset(&(act.sa_mask));
     sigaction(SIGUSR1, &act, NULL);
+    act.sa_handler = onas_fan_abort;
     sigaction(SIGSEGV, &act, NULL);
 
     /* Initialize fanotify */
@@ -218,28 +450,73 @@ void *onas_fan_th(void *arg)
     else
 	logg("ScanOnAccess: File size limit disabled\n");
 
-    extinfo = optget(tharg->opts, "ExtendedDetectionInfo")->enabled;
+    onas_fan_tharg = tharg;
+    onas_fan_extinfo = optget(tharg->opts, "ExtendedDetectionInfo")->enabled;
+
+    if(fan_mask & FAN_ALL_PERM_EVENTS) {
+	onas_fan_timeout = optget(tharg->opts, "OnAccessResponseTimeout")->numarg;
+	onas_fan_timeout_response = optget(tharg->opts, "OnAccessDenyOnTimeout")->enabled ? FAN_DENY : FAN_ALLOW;
+	if(onas_fan_timeout)
+	    logg("ScanOnAccess: %s access when no verdict is reached within %u seconds\n", onas_fan_timeout_response == FAN_DENY ? "Denying" : "Allowing", onas_fan_timeout);
+    }
+
+    max_threads = optget(tharg->opts, "OnAccessMaxThreads")->numarg;
+    if(max_threads < 1)
+	max_threads = 1;
+    max_queue = optget(tharg->opts, "OnAccessMaxQueue")->numarg;
+    if(max_queue <= max_threads) {
+	max_queue = 2 * max_threads;
+	logg("^ScanOnAccess: OnAccessMaxQueue is not greater than OnAccessMaxThreads, increasing to: %d\n", max_queue);
+    }
+    if(!(onas_fan_pool = thrmgr_new(max_threads, optget(tharg->opts, "IdleTimeout")->numarg, max_queue, onas_fan_scanfile))) {
+	logg("!ScanOnAccess: thrmgr_new failed\n");
+	return NULL;
+    }
+    logg("ScanOnAccess: Scanning with up to %d threads\n", max_threads);
 
-    FD_ZERO(&rfds);
-    FD_SET(onas_fan_fd, &rfds);
-    do {
-	if (reload) sleep(1);
-        ret = select(onas_fan_fd + 1, &rfds, NULL, NULL, NULL);
-    } while((ret == -1 && errno == EINTR) || reload);
+    if(onas_fan_timeout) {
+	onas_fan_reaper_stop = 0;
+	if(pthread_create(&onas_fan_reaper_pid, NULL, onas_fan_reaper, NULL))
+	    logg("!ScanOnAccess: Can't start the response timeout thread, OnAccessResponseTimeout disabled\n");
+	else
+	    reaper = 1;
+    }
 
+    pthread_mutex_lock(&onas_fan_mutex);
+    onas_fan_stats.running = 1;
+    pthread_mutex_unlock(&onas_fan_mutex);
 
     time_t start = time(NULL) - 30;
-    while(((bread = read(onas_fan_fd, buf, sizeof(buf))) > 0) || errno == EOVERFLOW) {
+    while(!onas_fan_quit) {
+	FD_ZERO(&rfds);
+	FD_SET(onas_fan_fd, &rfds);
+	ret = pselect(onas_fan_fd + 1, &rfds, NULL, NULL, NULL, &sigset);
+	if(ret == -1 && errno == EINTR)
+	    continue;
+	if(ret == -1) {
+	    logg("!ScanOnAccess: Internal error (select() failed) ... %s\n", strerror(errno));
+	    break;
+	}
+	if(!ret)
+	    continue;
+	if(reload) {
+	    sleep(1);
+	    continue;
+	}
 
-	if (errno == EOVERFLOW) {
+	errno = 0;
+	if((bread = read(onas_fan_fd, buf, sizeof(buf))) <= 0) {
+	    if(errno == EOVERFLOW) {
 		if (time(NULL) - start >= 30) {
 			logg("!ScanOnAccess: Internal error (failed to read data) ... %s\n", strerror(errno));
 			logg("!ScanOnAccess: File too large for fanotify ... recovering and continuing scans...\n");
 			start = time(NULL);
 		}
-
-		errno = 0;
 		continue;
+	    }
+	    if(bread < 0)
+		logg("!ScanOnAccess: Internal error (failed to read data) ... %s\n", strerror(errno));
+	    break;
 	}
 
 	fmd = (struct fanotify_event_metadata *) buf;
@@ -251,7 +528,8 @@ void *onas_fan_th(void *arg)
 		if(len == -1) {
 		    close(fmd->fd);
 		    logg("!ScanOnAccess: Internal error (readlink() failed)\n");
-		    return NULL;
+		    quit = 1;
+		    break;
 		}
 		fname[len] = 0;
 
@@ -260,35 +538,83 @@ void *onas_fan_th(void *arg)
 		    logg("*ScanOnAccess: %s skipped (excluded UID)\n", fname);
 		}
 
-		if(sizelimit) {
-		    if(FSTAT(fmd->fd, &sb) != 0 || sb.st_size > sizelimit) {
+		if(FSTAT(fmd->fd, &sb) != 0) {
+		    if(sizelimit)
+			scan = 0;
+		} else {
+		    if(sizelimit && sb.st_size > sizelimit) {
 			scan = 0;
 			/* logg("*ScanOnAccess: %s skipped (size > %d)\n", fname, sizelimit); */
 		    }
+		    if(fmd->mask & FAN_CLOSE_WRITE)
+			vcache_remove(&sb);
+		    else if(scan && vcache_check(tharg->engine, tharg->options, &sb))
+			scan = 0;
 		}
 
-		if(onas_fan_scanfile(onas_fan_fd, fname, fmd, scan, extinfo, tharg) == -1) {
-		    close(fmd->fd);
-		    return NULL;
+		res.response = FAN_ALLOW;
+		if(scan) {
+		    if(onas_fan_dispatch(fname, fmd, tharg) == 0) {
+			/* the worker answers and closes the descriptor */
+			fmd = FAN_EVENT_NEXT(fmd, bread);
+			continue;
+		    }
+		    /* a file that should have been scanned isn't let through unscanned */
+		    if(fmd->mask & FAN_ALL_PERM_EVENTS) {
+			logg("!ScanOnAccess: %s could not be scanned, denying access\n", fname);
+			res.response = FAN_DENY;
+		    } else {
+			logg("!ScanOnAccess: %s could not be scanned\n", fname);
+		    }
+		}
+
+		if(fmd->mask & FAN_ALL_PERM_EVENTS) {
+		    res.fd = fmd->fd;
+		    if(write(onas_fan_fd, &res, sizeof(res)) == -1) {
+			logg("!ScanOnAccess: Internal error (can't write to fanotify)\n");
+			close(fmd->fd);
+			quit = 1;
+			break;
+		    }
 		}
 
 		if(close(fmd->fd) == -1) {
 		    printf("!ScanOnAccess: Internal error (close(%d) failed)\n", fmd->fd);
 		    close(fmd->fd);
-		    return NULL;
+		    quit = 1;
+		    break;
 		}
 	    }
 	    fmd = FAN_EVENT_NEXT(fmd, bread);
 	}
-	do {
-	    if (reload) sleep(1);
-	    ret = select(onas_fan_fd + 1, &rfds, NULL, NULL, NULL);
-	} while((ret == -1 && errno == EINTR) || reload);
+	if(quit)
+	    break;
     }
 
-    if(bread < 0)
-	logg("!ScanOnAccess: Internal error (failed to read data) ... %s\n", strerror(errno));
+    if(onas_fan_quit)
+	logg("*ScanOnAccess: stopping on request\n");
+
+    /* let the workers answer whatever is still queued before the
+     * descriptor goes away */
+    thrmgr_destroy(onas_fan_pool);
+    onas_fan_pool = NULL;
 
+    pthread_mutex_lock(&onas_fan_mutex);
+    onas_fan_stats.running = 0;
+    onas_fan_reaper_stop = 1;
+    pthread_cond_signal(&onas_fan_cond);
+    pthread_mutex_unlock(&onas_fan_mutex);
+    if(reaper)
+	pthread_join(onas_fan_reaper_pid, NULL);
+
+    close(onas_fan_fd);
+
+    if (ddd_pid > 0) {
+	pthread_kill(ddd_pid, SIGUSR1);
+	pthread_join(ddd_pid, NULL);
+    }
+
+    logg("ScanOnAccess: stopped\n");
     return NULL;
 }
 
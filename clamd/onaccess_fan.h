@@ -23,5 +23,6 @@
 #define __FAN_H
 
 void *onas_fan_th(void *arg);
+void onas_fan_printstats(int f);
 
 #endif
@@ -30,6 +30,7 @@
 #include <unistd.h>
 #endif
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
@@ -60,6 +61,7 @@
 
 #include "others.h"
 #include "scanner.h"
+#include "vcache.h"
 #include "shared.h"
 #include "thrmgr.h"
 #include "server.h"
@@ -133,6 +135,35 @@ void clamd_virus_found_cb(int fd, const char *virname, void *ctx)
     return;
 }
 
+#ifndef _WIN32
+/* files smaller than this are covered by the kernel's own initial readahead */
+#define PREFETCH_MIN_SIZE (128*1024)
+#define PREFETCH_MAX_SIZE (4*1024*1024)
+
+/* Open a queued file for the worker that is going to scan it and, when it
+ * is large enough, ask the kernel to start reading its head in the
+ * background, so that by the time the worker picks it up the data is (at
+ * least partly) in the page cache. The walk doesn't stat files for
+ * MULTISCAN, so the size comes from the descriptor. */
+static int prefetch_file(const char *filename)
+{
+    int fd;
+#if defined(POSIX_FADV_WILLNEED)
+    STATBUF sb;
+#endif
+
+    if((fd = safe_open(filename, O_RDONLY|O_BINARY)) == -1)
+	return -1;
+#if defined(POSIX_FADV_WILLNEED)
+    if(!FSTAT(fd, &sb) && S_ISREG(sb.st_mode) && sb.st_size >= PREFETCH_MIN_SIZE)
+	posix_fadvise(fd, 0, MIN(sb.st_size, PREFETCH_MAX_SIZE), POSIX_FADV_WILLNEED);
+#endif
+    return fd;
+}
+#else
+#define prefetch_file(filename) (-1)
+#endif
+
 #define BUFFSIZE 1024
 int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_reason reason, struct cli_ftw_cbdata *data)
 {
@@ -141,6 +172,11 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
     int ret;
     int type = scandata->type;
     struct cb_context context;
+#ifndef _WIN32
+    int fd, nostat = 1;
+    STATBUF fsb, post;
+    time_t stat_time;
+#endif
 
     /* detect disconnected socket, 
      * this should NOT detect half-shutdown sockets (SHUT_WR) */
@@ -227,8 +263,12 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
 		pthread_mutex_lock(&reload_mutex);
 		client_conn->engine_timestamp = reloaded_time;
 		pthread_mutex_unlock(&reload_mutex);
+		/* the worker scans this descriptor instead of opening the file again */
+		client_conn->scanfd = prefetch_file(filename);
 		if(!thrmgr_group_dispatch(scandata->thr_pool, scandata->group, client_conn, 1)) {
 		    logg("!thread dispatch failed\n");
+		    if(client_conn->scanfd != -1)
+			close(client_conn->scanfd);
 		    cl_engine_free(scandata->engine);
 		    free(filename);
 		    free(client_conn);
@@ -255,11 +295,41 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
 	return CL_SUCCESS;
     }
 
+    if(sb && vcache_check(scandata->engine, scandata->options, sb)) {
+	if(logok)
+	    logg("~%s: OK\n", filename);
+	free(filename);
+	return CL_SUCCESS;
+    }
+
     thrmgr_setactivetask(filename, NULL);
     context.filename = filename;
     context.virsize = 0;
     context.scandata = scandata;
-    ret = cl_scanfile_callback(filename, &virname, &scandata->scanned, scandata->engine, scandata->options, &context);
+#ifndef _WIN32
+    if(scandata->fd != -1 || vcache_enabled()) {
+	/* scan the descriptor opened when the file was queued, if there is
+	 * one, and stat the descriptor that gets scanned, the path may change
+	 * under us */
+	if((fd = scandata->fd) == -1 && (fd = safe_open(filename, O_RDONLY|O_BINARY)) == -1) {
+	    ret = CL_EOPEN;
+	} else {
+	    stat_time = time(NULL);
+	    if(!vcache_enabled() || (nostat = FSTAT(fd, &fsb)) || !vcache_check(scandata->engine, scandata->options, &fsb)) {
+		ret = cl_scandesc_callback(fd, &virname, &scandata->scanned, scandata->engine, scandata->options, &context);
+		/* cached under the metadata from before the scan, if it didn't
+		 * change while the file was scanned */
+		if(ret == CL_CLEAN && vcache_enabled() && !nostat && !FSTAT(fd, &post))
+		    vcache_add(scandata->engine, scandata->options, &fsb, stat_time, &post);
+	    } else {
+		ret = CL_CLEAN;
+	    }
+	    if(fd != scandata->fd)
+		close(fd);
+	}
+    } else
+#endif
+	ret = cl_scanfile_callback(filename, &virname, &scandata->scanned, scandata->engine, scandata->options, &context);
     thrmgr_setactivetask(NULL, NULL);
 
     if (thrmgr_group_need_terminate(scandata->conn->group)) {
@@ -48,6 +48,7 @@ struct scan_cb_data {
     threadpool_t *thr_pool;
     jobgroup_t *group;
     dev_t dev;
+    int fd; /* descriptor opened when the file was queued, or -1 */
 };
 
 struct cb_context {
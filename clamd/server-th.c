@@ -59,8 +59,10 @@
 #include "session.h"
 #include "others.h"
 #include "shared.h"
+#include "vcache.h"
 #include "libclamav/others.h"
 #include "libclamav/readdb.h"
+#include "libclamav/delta.h"
 #include "libclamav/cltypes.h"
 
 #define BUFFSIZE 1024
@@ -248,6 +250,46 @@ static struct cl_engine *reload_db(struct cl_engine *engine, unsigned int dbopti
     return engine;
 }
 
+/* applies freshclam.delta to the running engine, returns NULL if it can't */
+static struct cl_engine *reload_delta(struct cl_engine *engine, unsigned int dboptions, const struct optstruct *opts)
+{
+	const char *dbdir;
+	char *journal;
+	struct cl_engine *new;
+	unsigned int sigs = 0;
+	int retval;
+
+    dbdir = optget(opts, "DatabaseDirectory")->strarg;
+    if(!(journal = malloc(strlen(dbdir) + strlen(CLI_DELTA_JOURNAL) + 2))) {
+	logg("!Can't allocate memory for the delta journal name\n");
+	return NULL;
+    }
+    sprintf(journal, "%s"PATHSEP"%s", dbdir, CLI_DELTA_JOURNAL);
+
+    new = cl_engine_delta(engine, journal, &sigs, dboptions, &retval);
+    free(journal);
+    if(!new) {
+	logg("Can't apply the database delta (%s), reloading\n", cl_strerror(retval));
+	return NULL;
+    }
+    if(new == engine) {
+	cl_engine_free(new);
+	return engine;
+    }
+
+    thrmgr_setactiveengine(new);
+    cl_engine_free(engine);
+
+    if(dbstat.entries)
+	cl_statfree(&dbstat);
+    memset(&dbstat, 0, sizeof(struct cl_stat));
+    if((retval = cl_statinidir(dbdir, &dbstat)))
+	logg("^cl_statinidir() failed: %s\n", cl_strerror(retval));
+
+    logg("Database delta applied (%u signatures added)\n", sigs);
+    return new;
+}
+
 /*
  * zCOMMANDS are delimited by \0
  * nCOMMANDS are delimited by \n
@@ -920,6 +962,44 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     val = cl_engine_get_num(engine, CL_ENGINE_PCRE_MAX_FILESIZE, NULL);
     logg("Limits: PCREMaxFileSize limit set to %llu.\n", val);
 
+    if((opt = optget(opts, "MaxScanWork"))->active) {
+        if((ret = cl_engine_set_num(engine, CL_ENGINE_MAX_SCANWORK, opt->numarg))) {
+            logg("!cli_engine_set_num(MaxScanWork) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 1;
+        }
+    }
+    val = cl_engine_get_num(engine, CL_ENGINE_MAX_SCANWORK, NULL);
+    logg("Limits: MaxScanWork limit set to %llu.\n", val);
+
+    if((opt = optget(opts, "MaxScanWorkAction"))->enabled) {
+        enum scanwork_action action = CL_SCANWORK_ALERT;
+
+        if(!strcmp(opt->strarg, "Clean"))
+            action = CL_SCANWORK_CLEAN;
+        else if(!strcmp(opt->strarg, "Error"))
+            action = CL_SCANWORK_ERROR;
+        if((ret = cl_engine_set_num(engine, CL_ENGINE_SCANWORK_ACTION, action))) {
+            logg("!cli_engine_set_num(MaxScanWorkAction) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 1;
+        }
+        logg("Limits: MaxScanWorkAction set to %s.\n", opt->strarg);
+    }
+
+    if((opt = optget(opts, "MaxCompressionRatio"))->active) {
+        if((ret = cl_engine_set_num(engine, CL_ENGINE_MAX_RATIO, opt->numarg))) {
+            logg("!cli_engine_set_num(MaxCompressionRatio) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 1;
+        }
+    }
+    val = cl_engine_get_num(engine, CL_ENGINE_MAX_RATIO, NULL);
+    if(val)
+        logg("Limits: MaxCompressionRatio limit set to %llu.\n", val);
+    else
+        logg("^Limits: MaxCompressionRatio limit disabled.\n");
+
     if(optget(opts, "ScanArchive")->enabled) {
 	logg("Archive support enabled.\n");
 	options |= CL_SCAN_ARCHIVE;
@@ -1198,26 +1278,10 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     logg("*MaxQueue set to: %d\n", max_queue);
     acceptdata.max_queue = max_queue;
 
-    if(optget(opts, "ScanOnAccess")->enabled)
-
-#if defined(FANOTIFY) || defined(CLAMAUTH)
-    {
-        do {
-	    if(pthread_attr_init(&fan_attr)) break;
-	    pthread_attr_setdetachstate(&fan_attr, PTHREAD_CREATE_JOINABLE);
-	    if(!(tharg = (struct thrarg *) malloc(sizeof(struct thrarg)))) break;
-	    tharg->opts = opts;
-	    tharg->engine = engine;
-	    tharg->options = options;
-	    if(!pthread_create(&fan_pid, &fan_attr, onas_fan_th, tharg)) break;
-	    free(tharg);
-	    tharg=NULL;
-	} while(0);
-	if (!tharg) logg("!Unable to start on-access scan\n");
+    if(vcache_init(opts, engine)) {
+	cl_engine_free(engine);
+	return 1;
     }
-#else
-	logg("!On-access scan is not available\n");
-#endif
 
 
 #ifndef	_WIN32
@@ -1288,6 +1352,28 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
 	exit(-1);
     }
 
+    /* started after the main pool so that it stays the PRIMARY one in STATS */
+    if(optget(opts, "ScanOnAccess")->enabled)
+
+#if defined(FANOTIFY) || defined(CLAMAUTH)
+    {
+        do {
+	    if(pthread_attr_init(&fan_attr)) break;
+	    pthread_attr_setdetachstate(&fan_attr, PTHREAD_CREATE_JOINABLE);
+	    if(!(tharg = (struct thrarg *) malloc(sizeof(struct thrarg)))) break;
+	    tharg->opts = opts;
+	    tharg->engine = engine;
+	    tharg->options = options;
+	    if(!pthread_create(&fan_pid, &fan_attr, onas_fan_th, tharg)) break;
+	    free(tharg);
+	    tharg=NULL;
+	} while(0);
+	if (!tharg) logg("!Unable to start on-access scan\n");
+    }
+#else
+	logg("!On-access scan is not available\n");
+#endif
+
     if (pthread_create(&accept_th, NULL, acceptloop_th, &acceptdata)) {
 	logg("!pthread_create failed\n");
 	exit(-1);
@@ -1490,9 +1576,19 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
 	/* DB reload */
 	pthread_mutex_lock(&reload_mutex);
 	if(reload) {
+		struct cl_engine *delta = NULL;
+		int delta_only = reload == 2;
+
 	    pthread_mutex_unlock(&reload_mutex);
 
-	    engine = reload_db(engine, dboptions, opts, FALSE, &ret);
+	    if(delta_only)
+		delta = reload_delta(engine, dboptions, opts);
+	    if(delta) {
+		engine = delta;
+		ret = 0;
+	    } else {
+		engine = reload_db(engine, dboptions, opts, FALSE, &ret);
+	    }
 	    if(ret) {
 		logg("Terminating because of a fatal error.\n");
 		if(new_sd >= 0)
@@ -1505,6 +1601,7 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
 	    time(&reloaded_time);
 	    pthread_mutex_unlock(&reload_mutex);
 
+	    vcache_setengine(engine);
 #if defined(FANOTIFY) || defined(CLAMAUTH)
 	    if(optget(opts, "ScanOnAccess")->enabled && tharg) {
 		tharg->engine = engine;
@@ -1541,6 +1638,7 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     free(tharg);
     }
 #endif
+    vcache_free();
     if(engine) {
 	thrmgr_setactiveengine(NULL);
 	cl_engine_free(engine);
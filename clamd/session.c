@@ -63,6 +63,7 @@
 #include "server.h"
 #include "session.h"
 #include "thrmgr.h"
+#include "onaccess_fan.h"
 
 #ifndef HAVE_FDPASSING
 #define FEATURE_FDPASSING 0
@@ -80,6 +81,8 @@ static struct {
 } commands[] = {
     {CMD1,  sizeof(CMD1)-1,	COMMAND_SCAN,	    1,	1, 0},
     {CMD3,  sizeof(CMD3)-1,	COMMAND_SHUTDOWN,   0,	1, 0},
+    /* must be before RELOAD, because they share common prefix! */
+    {CMD22, sizeof(CMD22)-1,	COMMAND_RELOADDELTA, 0,	1, 0},
     {CMD4,  sizeof(CMD4)-1,	COMMAND_RELOAD,	    0,	1, 0},
     {CMD5,  sizeof(CMD5)-1,	COMMAND_PING,	    0,	1, 0},
     {CMD6,  sizeof(CMD6)-1,	COMMAND_CONTSCAN,   1,	1, 0},
@@ -223,6 +226,7 @@ int command(client_conn_t *conn, int *virus)
     scandata.opts = opts;
     scandata.thr_pool = conn->thrpool;
     scandata.toplevel_path = conn->filename;
+    scandata.fd = -1;
 
     switch (conn->cmdtype) {
 	case COMMAND_SCAN:
@@ -280,9 +284,14 @@ int command(client_conn_t *conn, int *virus)
 	    scandata.group = NULL;
 	    scandata.type = TYPE_SCAN;
 	    scandata.thr_pool = NULL;
+	    scandata.fd = conn->scanfd;
 	    /* TODO: check ret value */
 	    ret = scan_callback(NULL, conn->filename, conn->filename, visit_file, &data);	    /* callback freed it */
 	    conn->filename = NULL;
+	    if (conn->scanfd != -1) {
+		close(conn->scanfd);
+		conn->scanfd = -1;
+	    }
 	    *virus = scandata.infected;
 	    if (ret == CL_BREAK) {
 		thrmgr_group_terminate(conn->group);
@@ -324,6 +333,9 @@ int command(client_conn_t *conn, int *virus)
 	     thrmgr_setactivetask(NULL, "STATS");
 	     if (conn->group)
 		 mdprintf(desc, "%u: ", conn->id);
+#if defined(FANOTIFY)
+	     onas_fan_printstats(desc);
+#endif
 	     thrmgr_printstats(desc, conn->term);
 	     return 0;
 	 case COMMAND_STREAM:
@@ -568,8 +580,11 @@ int execute_or_dispatch_command(client_conn_t *conn, enum commands cmd, const ch
 	    pthread_mutex_unlock(&exit_mutex);
 	    return 1;
 	case COMMAND_RELOAD:
+	case COMMAND_RELOADDELTA:
 	    pthread_mutex_lock(&reload_mutex);
-	    reload = 1;
+	    /* a full reload asked for in the meantime wins */
+	    if(cmd == COMMAND_RELOAD || !reload)
+		reload = cmd == COMMAND_RELOAD ? 1 : 2;
 	    pthread_mutex_unlock(&reload_mutex);
 	    mdprintf(desc, "RELOADING%c", term);
 	    /* we set reload flag, and we'll reload before closing the
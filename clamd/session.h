@@ -45,6 +45,7 @@
 #define CMD20 "DETSTATS"
 
 #define CMD21 "ALLMATCHSCAN"
+#define CMD22 "RELOADDELTA"
 
 #include "libclamav/clamav.h"
 #include "shared/optparser.h"
@@ -74,7 +75,8 @@ enum commands {
     /* internal commands */
     COMMAND_MULTISCANFILE,
     COMMAND_INSTREAMSCAN,
-    COMMAND_ALLMATCHSCAN
+    COMMAND_ALLMATCHSCAN,
+    COMMAND_RELOADDELTA
 };
 
 typedef struct client_conn_tag {
@@ -0,0 +1,198 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * Verdict cache keyed by file metadata.
+ *
+ * libclamav's own cache is keyed by the MD5 of the file, so a hit still
+ * costs reading the whole file. clamd remembers the clean verdicts of the
+ * files it scanned by (st_dev, st_ino, st_size, st_mtime, st_ctime) and
+ * skips opening them altogether while none of these change. Any write,
+ * truncation, rename or chmod updates st_ctime, so a stale entry can't
+ * match; the on-access code additionally drops entries on close-after-write
+ * and on files showing up in watched directories.
+ *
+ * Entries are tagged with an engine generation which is bumped on every
+ * database reload, so verdicts of an old engine are never returned for a
+ * new one. A verdict is cached under the metadata taken before the scan,
+ * and only if the file still has exactly that metadata after the scan, so
+ * contents rewritten mid-scan are never cached. Files changed within
+ * VCACHE_RACY_TIME seconds of that first stat are not cached either, as a
+ * write in the same second would leave their times unchanged.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "libclamav/clamav.h"
+
+#include "shared/optparser.h"
+#include "shared/output.h"
+
+#include "vcache.h"
+
+#define VCACHE_SIZE	    65536 /* must be a power of 2 */
+#define VCACHE_RACY_TIME    2
+
+struct vcache_entry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    unsigned int options;
+    unsigned int gen;
+};
+
+static struct vcache_entry *vcache;
+static pthread_mutex_t vcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const struct cl_engine *vcache_engine;
+static unsigned int vcache_gen = 1;
+
+static inline unsigned int vcache_slot(const STATBUF *sb)
+{
+    uint64_t h = ((uint64_t) sb->st_ino * 0x9e3779b97f4a7c15ULL) ^ (uint64_t) sb->st_dev;
+
+    return (unsigned int) (h >> 32 ^ h) & (VCACHE_SIZE - 1);
+}
+
+static inline int vcache_match(const struct vcache_entry *e, const STATBUF *sb)
+{
+    return e->ino == sb->st_ino && e->dev == sb->st_dev && e->size == sb->st_size &&
+	e->mtime == sb->st_mtime && e->ctime == sb->st_ctime;
+}
+
+int vcache_init(const struct optstruct *opts, const struct cl_engine *engine)
+{
+#ifdef _WIN32
+    /* st_ino carries no information here */
+    return 0;
+#else
+    if(optget(opts, "DisableCache")->enabled || !optget(opts, "VerdictCache")->enabled)
+	return 0;
+
+    if(!(vcache = calloc(VCACHE_SIZE, sizeof(*vcache)))) {
+	logg("!Can't allocate memory for the verdict cache\n");
+	return -1;
+    }
+    vcache_engine = engine;
+    logg("Verdict cache enabled.\n");
+    return 0;
+#endif
+}
+
+void vcache_free(void)
+{
+    pthread_mutex_lock(&vcache_mutex);
+    free(vcache);
+    vcache = NULL;
+    vcache_engine = NULL;
+    pthread_mutex_unlock(&vcache_mutex);
+}
+
+int vcache_enabled(void)
+{
+    return vcache != NULL;
+}
+
+void vcache_setengine(const struct cl_engine *engine)
+{
+    pthread_mutex_lock(&vcache_mutex);
+    if(vcache) {
+	/* the new engine may well reuse the address of the old one */
+	vcache_engine = engine;
+	/* 0 marks unused slots */
+	if(!++vcache_gen)
+	    vcache_gen = 1;
+    }
+    pthread_mutex_unlock(&vcache_mutex);
+}
+
+int vcache_check(const struct cl_engine *engine, unsigned int options, const STATBUF *sb)
+{
+	struct vcache_entry *e;
+	int ret = 0;
+
+    if(!vcache || !S_ISREG(sb->st_mode))
+	return 0;
+
+    pthread_mutex_lock(&vcache_mutex);
+    if(vcache && engine == vcache_engine) {
+	e = &vcache[vcache_slot(sb)];
+	ret = e->gen == vcache_gen && e->options == options && vcache_match(e, sb);
+    }
+    pthread_mutex_unlock(&vcache_mutex);
+
+    return ret;
+}
+
+/* sb was taken before the scan, at stat_time or later, and post after it */
+void vcache_add(const struct cl_engine *engine, unsigned int options, const STATBUF *sb, time_t stat_time, const STATBUF *post)
+{
+	struct vcache_entry *e;
+
+    if(!vcache || !S_ISREG(sb->st_mode))
+	return;
+
+    if(sb->st_ino != post->st_ino || sb->st_dev != post->st_dev || sb->st_size != post->st_size ||
+       sb->st_mtime != post->st_mtime || sb->st_ctime != post->st_ctime)
+	return;
+
+    if(stat_time - (sb->st_mtime > sb->st_ctime ? sb->st_mtime : sb->st_ctime) < VCACHE_RACY_TIME)
+	return;
+
+    pthread_mutex_lock(&vcache_mutex);
+    /* a scan still running on the previous engine must not speak for the
+     * current one */
+    if(vcache && engine == vcache_engine) {
+	e = &vcache[vcache_slot(sb)];
+	e->dev = sb->st_dev;
+	e->ino = sb->st_ino;
+	e->size = sb->st_size;
+	e->mtime = sb->st_mtime;
+	e->ctime = sb->st_ctime;
+	e->options = options;
+	e->gen = vcache_gen;
+    }
+    pthread_mutex_unlock(&vcache_mutex);
+}
+
+void vcache_remove(const STATBUF *sb)
+{
+	struct vcache_entry *e;
+
+    if(!vcache)
+	return;
+
+    pthread_mutex_lock(&vcache_mutex);
+    if(vcache) {
+	e = &vcache[vcache_slot(sb)];
+	if(e->ino == sb->st_ino && e->dev == sb->st_dev)
+	    e->gen = 0;
+    }
+    pthread_mutex_unlock(&vcache_mutex);
+}
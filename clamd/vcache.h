@@ -0,0 +1,37 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __VCACHE_H
+#define __VCACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "libclamav/clamav.h"
+#include "shared/optparser.h"
+
+int vcache_init(const struct optstruct *opts, const struct cl_engine *engine);
+void vcache_free(void);
+int vcache_enabled(void);
+void vcache_setengine(const struct cl_engine *engine);
+int vcache_check(const struct cl_engine *engine, unsigned int options, const STATBUF *sb);
+void vcache_add(const struct cl_engine *engine, unsigned int options, const STATBUF *sb, time_t stat_time, const STATBUF *post);
+void vcache_remove(const STATBUF *sb);
+
+#endif
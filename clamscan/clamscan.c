@@ -219,6 +219,7 @@ void help(void)
     mprintf("\n");
     mprintf("    --tempdir=DIRECTORY                  Create temporary files in DIRECTORY\n");
     mprintf("    --leave-temps[=yes/no(*)]            Do not remove temporary files\n");
+    mprintf("    --direct-mapping[=yes/no(*)]         Map regular files directly instead of reading them\n");
     mprintf("    --database=FILE/DIR   -d FILE/DIR    Load virus database from FILE or load\n");
     mprintf("                                         all supported db files from DIR\n");
     mprintf("    --official-db-only[=yes/no(*)]       Only load official signatures\n");
@@ -290,11 +291,15 @@ void help(void)
     mprintf("    --pcre-recmatch-limit=#n             Maximum recursive calls to the PCRE match function.\n");
     mprintf("    --pcre-max-filesize=#n               Maximum size file to perform PCRE subsig matching.\n");
 #endif /* HAVE_PCRE */
+    mprintf("    --max-scanwork=#n                    Maximum work (bytes processed) spent on a single file\n");
+    mprintf("    --max-scanwork-action=ACTION         Alert, Clean or Error when --max-scanwork is exceeded\n");
+    mprintf("    --max-ratio=#n                       Alert on compressed data inflating more than #n times its size\n");
     mprintf("    --enable-stats                       Enable statistical reporting of malware\n");
     mprintf("    --disable-pe-stats                   Disable submission of individual PE sections in stats submissions\n");
     mprintf("    --stats-timeout=#n                   Number of seconds to wait for waiting a response back from the stats server\n");
     mprintf("    --stats-host-id=UUID                 Set the Host ID used when submitting statistical info.\n");
     mprintf("    --disable-cache                      Disable caching and cache checks for hash sums of scanned files.\n");
+    mprintf("    --fast-cache-key[=yes/no(*)]         Key the cache with a fast hash instead of MD5\n");
     mprintf("\n");
     mprintf("(*) Default scan settings\n");
     mprintf("(**) Certain files (e.g. documents, archives, etc.) may in turn contain other\n");
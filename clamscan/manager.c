@@ -289,51 +289,45 @@ static void clamscan_virus_found_cb(int fd, const char *virname, void *context)
     return;
 }
 
-static void scanfile(const char *filename, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+static int excluded(const char *filename, const struct optstruct *opts)
 {
-    int ret = 0, fd, included;
-    unsigned i;
     const struct optstruct *opt;
-    const char *virname;
-    STATBUF sb;
-    struct metachain chain;
-    struct clamscan_cb_data data;
 
     if((opt = optget(opts, "exclude"))->enabled) {
         while(opt) {
-            if(match_regex(filename, opt->strarg) == 1) {
-                if(!printinfected)
-                    logg("~%s: Excluded\n", filename);
-
-                return;
-            }
+            if(match_regex(filename, opt->strarg) == 1)
+                return 1;
 
             opt = opt->nextarg;
         }
     }
 
     if((opt = optget(opts, "include"))->enabled) {
-        included = 0;
-
         while(opt) {
-            if(match_regex(filename, opt->strarg) == 1) {
-                included = 1;
-                break;
-            }
+            if(match_regex(filename, opt->strarg) == 1)
+                return 0;
 
             opt = opt->nextarg;
         }
 
-        if(!included) {
-            if(!printinfected)
-                logg("~%s: Excluded\n", filename);
-
-            return;
-        }
+        return 1;
     }
 
+    return 0;
+}
+
+/* scans filename, from qfd when the directory walk has already opened it */
+static void scanqueued(const char *filename, int qfd, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+{
+    int ret = 0, fd;
+    unsigned i;
+    const char *virname;
+    STATBUF sb;
+    struct metachain chain;
+    struct clamscan_cb_data data;
+
     /* argh, don't scan /proc files */
-    if(CLAMSTAT(filename, &sb) != -1) {
+    if((qfd != -1 ? FSTAT(qfd, &sb) : CLAMSTAT(filename, &sb)) != -1) {
 #ifdef C_LINUX
         if(procdev && sb.st_dev == procdev) {
             if(!printinfected)
@@ -381,7 +375,7 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
 
     logg("*Scanning %s\n", filename);
 
-    if((fd = safe_open(filename, O_RDONLY|O_BINARY)) == -1) {
+    if((fd = qfd) == -1 && (fd = safe_open(filename, O_RDONLY|O_BINARY)) == -1) {
         logg("^Can't open file %s: %s\n", filename, strerror(errno));
         info.errors++;
         return;
@@ -421,12 +415,80 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
         free(chain.chains[i]);
 
     free(chain.chains);
-    close(fd);
+    if(fd != qfd)
+        close(fd);
 
     if(ret == CL_VIRUS && action)
         action(filename);
 }
 
+static void scanfile(const char *filename, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+{
+    if(excluded(filename, opts)) {
+        if(!printinfected)
+            logg("~%s: Excluded\n", filename);
+
+        return;
+    }
+
+    scanqueued(filename, -1, engine, opts, options);
+}
+
+/* files smaller than this are covered by the kernel's own initial readahead */
+#define PREFETCH_MIN_SIZE (128*1024)
+#define PREFETCH_MAX_SIZE (4*1024*1024)
+
+/*
+ * The directory walk keeps one regular file queued: it gets opened, and
+ * the kernel starts reading its head in the background, before the file
+ * found ahead of it is scanned. Scanning it later reuses the descriptor.
+ * Everything is printed when a file is scanned, so the queue is flushed
+ * before any other output of the walk to keep the usual order.
+ */
+struct scan_queue {
+    char *filename;
+    int fd;
+};
+
+static void queue_flush(struct scan_queue *queue, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+{
+    if(!queue->filename)
+        return;
+
+    scanqueued(queue->filename, queue->fd, engine, opts, options);
+    if(queue->fd != -1)
+        close(queue->fd);
+    free(queue->filename);
+    queue->filename = NULL;
+    queue->fd = -1;
+}
+
+/* takes over filename */
+static void queue_file(struct scan_queue *queue, char *filename, const STATBUF *sb, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+{
+    int fd = -1;
+
+    if(excluded(filename, opts)) {
+        queue_flush(queue, engine, opts, options);
+        if(!printinfected)
+            logg("~%s: Excluded\n", filename);
+
+        free(filename);
+        return;
+    }
+
+    if(sb->st_size && (fd = safe_open(filename, O_RDONLY|O_BINARY)) != -1) {
+#if defined(POSIX_FADV_WILLNEED)
+        if(sb->st_size >= PREFETCH_MIN_SIZE)
+            posix_fadvise(fd, 0, MIN(sb->st_size, PREFETCH_MAX_SIZE), POSIX_FADV_WILLNEED);
+#endif
+    }
+
+    queue_flush(queue, engine, opts, options);
+    queue->filename = filename;
+    queue->fd = fd;
+}
+
 static void scandirs(const char *dirname, struct cl_engine *engine, const struct optstruct *opts, unsigned int options, unsigned int depth, dev_t dev)
 {
     DIR *dd;
@@ -436,6 +498,7 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
     int included;
     const struct optstruct *opt;
     unsigned int dirlnk, filelnk;
+    struct scan_queue queue = { NULL, -1 };
 
 
     if((opt = optget(opts, "exclude-dir"))->enabled) {
@@ -498,6 +561,7 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
                     if(LSTAT(fname, &sb) != -1) {
                         if(!optget(opts, "cross-fs")->enabled) {
                             if(sb.st_dev != dev) {
+                                queue_flush(&queue, engine, opts, options);
                                 if(!printinfected)
                                     logg("~%s: Excluded\n", fname);
 
@@ -507,22 +571,28 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
                         }
                         if(S_ISLNK(sb.st_mode)) {
                             if(dirlnk != 2 && filelnk != 2) {
+                                queue_flush(&queue, engine, opts, options);
                                 if(!printinfected)
                                     logg("%s: Symbolic link\n", fname);
                             } else if(CLAMSTAT(fname, &sb) != -1) {
                                 if(S_ISREG(sb.st_mode) && filelnk == 2) {
-                                    scanfile(fname, engine, opts, options);
+                                    queue_file(&queue, fname, &sb, engine, opts, options);
+                                    fname = NULL;
                                 } else if(S_ISDIR(sb.st_mode) && dirlnk == 2) {
+                                    queue_flush(&queue, engine, opts, options);
                                     if(recursion)
                                         scandirs(fname, engine, opts, options, depth, dev);
                                 } else {
+                                    queue_flush(&queue, engine, opts, options);
                                     if(!printinfected)
                                         logg("%s: Symbolic link\n", fname);
                                 }
                             }
                         } else if(S_ISREG(sb.st_mode)) {
-                            scanfile(fname, engine, opts, options);
+                            queue_file(&queue, fname, &sb, engine, opts, options);
+                            fname = NULL;
                         } else if(S_ISDIR(sb.st_mode) && recursion) {
+                            queue_flush(&queue, engine, opts, options);
                             scandirs(fname, engine, opts, options, depth, dev);
                         }
                     }
@@ -531,6 +601,7 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
                 }
             }
         }
+        queue_flush(&queue, engine, opts, options);
         closedir(dd);
     } else {
         if(!printinfected)
@@ -675,6 +746,9 @@ int scanmanager(const struct optstruct *opts)
     if (optget(opts, "disable-cache")->enabled)
         cl_engine_set_num(engine, CL_ENGINE_DISABLE_CACHE, 1);
 
+    if (optget(opts, "fast-cache-key")->enabled)
+        cl_engine_set_num(engine, CL_ENGINE_FAST_CACHE_KEY, 1);
+
     if (optget(opts, "disable-pe-stats")->enabled) {
         cl_engine_set_num(engine, CL_ENGINE_DISABLE_PE_STATS, 1);
     }
@@ -788,6 +862,9 @@ int scanmanager(const struct optstruct *opts)
     if(optget(opts, "force-to-disk")->enabled)
         cl_engine_set_num(engine, CL_ENGINE_FORCETODISK, 1);
 
+    if(optget(opts, "direct-mapping")->enabled)
+        cl_engine_set_num(engine, CL_ENGINE_DIRECT_MMAP, 1);
+
     if(optget(opts, "bytecode-unsigned")->enabled)
         dboptions |= CL_DB_BYTECODE_UNSIGNED;
 
@@ -1031,6 +1108,36 @@ int scanmanager(const struct optstruct *opts)
         }
     }
 
+    if ((opt = optget(opts, "max-scanwork"))->active) {
+        if ((ret = cl_engine_set_num(engine, CL_ENGINE_MAX_SCANWORK, opt->numarg))) {
+            logg("!cli_engine_set_num(CL_ENGINE_MAX_SCANWORK) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 2;
+        }
+    }
+
+    if ((opt = optget(opts, "max-scanwork-action"))->enabled) {
+        enum scanwork_action action = CL_SCANWORK_ALERT;
+
+        if (!strcmp(opt->strarg, "Clean"))
+            action = CL_SCANWORK_CLEAN;
+        else if (!strcmp(opt->strarg, "Error"))
+            action = CL_SCANWORK_ERROR;
+        if ((ret = cl_engine_set_num(engine, CL_ENGINE_SCANWORK_ACTION, action))) {
+            logg("!cli_engine_set_num(CL_ENGINE_SCANWORK_ACTION) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 2;
+        }
+    }
+
+    if ((opt = optget(opts, "max-ratio"))->active) {
+        if ((ret = cl_engine_set_num(engine, CL_ENGINE_MAX_RATIO, opt->numarg))) {
+            logg("!cli_engine_set_num(CL_ENGINE_MAX_RATIO) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 2;
+        }
+    }
+
     /* set scan options */
     if(optget(opts, "allmatch")->enabled) {
         options |= CL_SCAN_ALLMATCHES;
@@ -82,6 +82,7 @@
 #include "libclamav/str.h"
 #include "libclamav/cvd.h"
 #include "libclamav/regex_list.h"
+#include "libclamav/delta.h"
 
 extern char updtmpdir[512], dbdir[512];
 char g_label[33];
@@ -1177,7 +1178,7 @@ getpatch (const char *dbname, const char *tmpdir, int version,
           const char *proxy, int port, const char *user, const char *pass,
           const char *uas, int ctimeout, int rtimeout, struct mirdat *mdat,
           int logerr, unsigned int can_whitelist,
-          const struct optstruct *opts, unsigned int attempt)
+          const struct optstruct *opts, unsigned int attempt, FILE *journal)
 {
     char *tempname, patch[32], olddir[512];
     int ret, fd;
@@ -1226,7 +1227,7 @@ getpatch (const char *dbname, const char *tmpdir, int version,
         return FCE_FILE;
     }
 
-    if (cdiff_apply (fd, 1) == -1)
+    if (cdiff_apply (fd, 1, journal) == -1)
     {
         logg ("!getpatch: Can't apply patch\n");
         close (fd);
@@ -1279,7 +1280,7 @@ buildcld (const char *tmpdir, const char *dbname, const char *newfile,
     char cwd[512], info[32], buff[513], *pt;
     struct dirent *dent;
     int fd, err = 0;
-    gzFile gzs = NULL;
+    struct tar_gzblk *gzs = NULL;
 
     if (!getcwd (cwd, sizeof (cwd)))
     {
@@ -1346,11 +1347,11 @@ buildcld (const char *tmpdir, const char *dbname, const char *newfile,
 
     if (compr)
     {
-        close (fd);
-        if (!(gzs = gzopen (newfile, "ab9f")))
+        if (!(gzs = tar_gzblk_open (fd, 9)))
         {
-            logg ("!buildcld: gzopen() failed for %s\n", newfile);
+            logg ("!buildcld: Can't initialize compression for %s\n", newfile);
             CHDIR_ERR (cwd);
+            close (fd);
             closedir (dir);
             unlink (newfile);
             return -1;
@@ -1397,9 +1398,8 @@ buildcld (const char *tmpdir, const char *dbname, const char *newfile,
     {
         CHDIR_ERR (cwd);
         if (gzs)
-            gzclose (gzs);
-        else
-            close (fd);
+            tar_gzblk_close (gzs);
+        close (fd);
         closedir (dir);
         unlink (newfile);
         return -1;
@@ -1423,9 +1423,8 @@ buildcld (const char *tmpdir, const char *dbname, const char *newfile,
                     logg ("Updates to main.cvd or safebrowsing.cvd may require 200MB of disk space or more\n");
                 CHDIR_ERR (cwd);
                 if (gzs)
-                    gzclose (gzs);
-                else
-                    close (fd);
+                    tar_gzblk_close (gzs);
+                close (fd);
                 closedir (dir);
                 unlink (newfile);
                 return -1;
@@ -1436,21 +1435,19 @@ buildcld (const char *tmpdir, const char *dbname, const char *newfile,
 
     if (gzs)
     {
-        if (gzclose (gzs))
+        if (tar_gzblk_close (gzs))
         {
-            logg ("!buildcld: gzclose() failed for %s\n", newfile);
+            logg ("!buildcld: Can't finish compressed data for %s\n", newfile);
+            close (fd);
             unlink (newfile);
             return -1;
         }
     }
-    else
+    if (close (fd) == -1)
     {
-        if (close (fd) == -1)
-        {
-            logg ("!buildcld: close() failed for %s\n", newfile);
-            unlink (newfile);
-            return -1;
-        }
+        logg ("!buildcld: close() failed for %s\n", newfile);
+        unlink (newfile);
+        return -1;
     }
 
     if (chdir (cwd) == -1)
@@ -1737,6 +1734,98 @@ static const char * dns_label(const char * ip)
 
 extern int sigchld_wait;
 
+/*
+ * The lines changed in daily.cvd by scripted updates are recorded in
+ * freshclam.delta, which lets clamd apply them to the engine it's running
+ * (RELOADDELTA) instead of loading all the databases again. Any other
+ * update invalidates the journal and asks clamd for a full reload.
+ */
+#define DELTA_MAXSIZE 1048576
+static int fullreload = 0;
+
+static void
+delta_discard (char **journal)
+{
+    if (*journal)
+    {
+        unlink (*journal);
+        free (*journal);
+        *journal = NULL;
+    }
+}
+
+static void
+delta_invalidate (void)
+{
+    if (!access (CLI_DELTA_JOURNAL, F_OK) && unlink (CLI_DELTA_JOURNAL))
+        logg ("^Can't unlink %s\n", CLI_DELTA_JOURNAL);
+    fullreload = 1;
+}
+
+static int
+delta_copy (FILE *src, FILE *dst)
+{
+    char buff[FILEBUFF];
+    size_t bytes;
+
+    while ((bytes = fread (buff, 1, sizeof (buff), src)) > 0)
+        if (fwrite (buff, 1, bytes, dst) != bytes)
+            return -1;
+
+    return ferror (src) ? -1 : 0;
+}
+
+/* appends the batch in journal to freshclam.delta, or starts a new one if
+ * the old one doesn't end at version from or has grown too big */
+static int
+delta_commit (const char *journal, unsigned int from, unsigned int to,
+              unsigned int stime)
+{
+    FILE *batch, *old, *new;
+    char line[64], tmpname[32];
+    unsigned int last = 0;
+    int ret = 0;
+    STATBUF sb;
+
+    if (!(batch = fopen (journal, "ab")))
+        return -1;
+    fprintf (batch, "END %u %u\n", to, stime);
+    if (fclose (batch) == EOF || !(batch = fopen (journal, "rb")))
+        return -1;
+
+    snprintf (tmpname, sizeof (tmpname), "%s.tmp", CLI_DELTA_JOURNAL);
+    if (!(new = fopen (tmpname, "wb")))
+    {
+        fclose (batch);
+        return -1;
+    }
+
+    if (!CLAMSTAT (CLI_DELTA_JOURNAL, &sb) && sb.st_size < DELTA_MAXSIZE
+        && (old = fopen (CLI_DELTA_JOURNAL, "rb")))
+    {
+        while (fgets (line, sizeof (line), old))
+            if (!strncmp (line, "END ", 4))
+                last = atoi (line + 4);
+        if (last == from)
+        {
+            rewind (old);
+            ret = delta_copy (old, new);
+        }
+        fclose (old);
+    }
+
+    if (!ret)
+        ret = delta_copy (batch, new);
+    fclose (batch);
+    if (fclose (new) == EOF || ret || rename (tmpname, CLI_DELTA_JOURNAL))
+    {
+        unlink (tmpname);
+        return -1;
+    }
+
+    return 0;
+}
+
 static int
 updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
           const struct optstruct *opts, const char *dnsreply, char *localip,
@@ -1759,6 +1848,8 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
     unsigned int w32 = 0;
 #endif
     int ctimeout, rtimeout;
+    char *journal = NULL;
+    FILE *journalfh = NULL;
 
 
     if (cli_strbcasestr (hostname, ".clamav.net"))
@@ -2058,6 +2149,15 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
 	    return FCE_MEM;
 	}    
 
+        if (!strcmp (dbname, "daily") && (journal = cli_gentemp (updtmpdir)))
+        {
+            if ((journalfh = fopen (journal, "wb")))
+                fprintf (journalfh, "BATCH %s %u %u\n", dbname, currver,
+                         newver);
+            else
+                delta_discard (&journal);
+        }
+
         maxattempts = optget (opts, "MaxAttempts")->numarg;
         for (i = currver + 1; i <= newver; i++)
         {
@@ -2070,7 +2170,7 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
                     getpatch (dbname, tmpdir, i, hostname, ip, localip, proxy,
                               port, user, pass, uas, ctimeout, rtimeout, mdat,
                               llogerr, can_whitelist, opts,
-                              attempt == 1 ? j : attempt);
+                              attempt == 1 ? j : attempt, journalfh);
                 if (ret == FCE_CONNECTION || ret == FCE_FAILEDGET)
                 {
 #ifdef HAVE_RESOLV_H
@@ -2094,6 +2194,9 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
                 break;
         }
 
+        if (journalfh && (fclose (journalfh) == EOF || ret))
+            delta_discard (&journal);
+
         if (ret)
         {
             cli_rmdirs (tmpdir);
@@ -2132,6 +2235,7 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
                 cli_rmdirs (tmpdir);
                 free (tmpdir);
                 free (newfile);
+                delta_discard (&journal);
                 return FCE_FAILEDUPDATE;
             }
             snprintf (newdb, sizeof (newdb), "%s.cld", dbname);
@@ -2145,6 +2249,7 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
         logg ("!Can't parse new database %s\n", newfile);
         unlink (newfile);
         free (newfile);
+        delta_discard (&journal);
         return FCE_FILE;
     }
 
@@ -2157,6 +2262,7 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
             unlink (newfile);
             free (newfile);
             cl_cvdfree(current);
+            delta_discard (&journal);
             return FCE_TESTFAIL;
         }
         newfile2[strlen (newfile2) - 4] = '.';
@@ -2171,6 +2277,7 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
             free (newfile);
             free (newfile2);
             cl_cvdfree(current);
+            delta_discard (&journal);
             return FCE_DBDIRACCESS;
         }
         free (newfile);
@@ -2183,6 +2290,7 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
             unlink (newfile);
             free (newfile);
             cl_cvdfree(current);
+            delta_discard (&journal);
             return FCE_TESTFAIL;
         }
         sigchld_wait = 1;
@@ -2195,6 +2303,7 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
         unlink (newfile);
         free (newfile);
         cl_cvdfree (current);
+        delta_discard (&journal);
         return FCE_EMPTYFILE;
     }
 #endif
@@ -2206,10 +2315,16 @@ updatedb (const char *dbname, const char *hostname, char *ip, int *signo,
         unlink (newfile);
         free (newfile);
         cl_cvdfree (current);
+        delta_discard (&journal);
         return FCE_DBDIRACCESS;
     }
     free (newfile);
 
+    if (!journal
+        || delta_commit (journal, currver, current->version, current->stime))
+        delta_invalidate ();
+    delta_discard (&journal);
+
     if (!nodb && !access (localname, R_OK) && strcmp (newdb, localname))
         if (unlink (localname))
             logg ("^Can't unlink the old database file %s. Please remove it manually.\n", localname);
@@ -2590,6 +2705,7 @@ downloadmanager (const struct optstruct *opts, const char *hostname,
         mirman_read ("mirrors.dat", &mdat, 1);
 
     memset (ipaddr, 0, sizeof (ipaddr));
+    fullreload = 0;
 
     /* custom dbs */
     if ((opt = optget (opts, "DatabaseCustomURL"))->enabled)
@@ -2599,7 +2715,10 @@ downloadmanager (const struct optstruct *opts, const char *hostname,
             if ((custret =
                  updatecustomdb (opt->strarg, &signo, opts, localip,
                                  logerr)) == 0)
+            {
                 updated = 1;
+                delta_invalidate ();
+            }
             opt = opt->nextarg;
         }
     }
@@ -2820,7 +2939,7 @@ downloadmanager (const struct optstruct *opts, const char *hostname,
 
 #ifdef BUILD_CLAMD
         if ((opt = optget (opts, "NotifyClamd"))->active)
-            notify (opt->strarg);
+            notify (opt->strarg, !fullreload);
 #endif
 
         if ((opt = optget (opts, "OnUpdateExecute"))->enabled)
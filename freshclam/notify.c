@@ -161,8 +161,8 @@ clamd_connect (const char *cfgfile, const char *option)
     return -1;
 }
 
-int
-notify (const char *cfgfile)
+static int
+notify_send (const char *cfgfile, const char *cmd)
 {
     char buff[20];
     int sockd, bread;
@@ -170,7 +170,7 @@ notify (const char *cfgfile)
     if ((sockd = clamd_connect (cfgfile, "NotifyClamd")) < 0)
         return 1;
 
-    if (sendln (sockd, "RELOAD", 7) < 0)
+    if (sendln (sockd, cmd, strlen (cmd) + 1) < 0)
     {
         logg ("!NotifyClamd: Could not write to clamd socket: %s\n", strerror(errno));
         closesocket (sockd);
@@ -178,12 +178,15 @@ notify (const char *cfgfile)
     }
 
     memset (buff, 0, sizeof (buff));
-    if ((bread = recv (sockd, buff, sizeof (buff), 0)) > 0)
+    if ((bread = recv (sockd, buff, sizeof (buff) - 1, 0)) > 0)
     {
         if (!strstr (buff, "RELOADING"))
         {
-            logg ("!NotifyClamd: Unknown answer from clamd: '%s'\n", buff);
             closesocket (sockd);
+            /* older clamd versions don't know RELOADDELTA */
+            if (strstr (buff, "UNKNOWN COMMAND"))
+                return 2;
+            logg ("!NotifyClamd: Unknown answer from clamd: '%s'\n", buff);
             return -1;
         }
     }
@@ -192,4 +195,22 @@ notify (const char *cfgfile)
     logg ("Clamd successfully notified about the update.\n");
     return 0;
 }
+
+/* with delta set clamd is asked to apply freshclam.delta to the loaded
+ * engine, it falls back to a full reload by itself if it can't */
+int
+notify (const char *cfgfile, int delta)
+{
+    int ret;
+
+    if (delta && (ret = notify_send (cfgfile, "RELOADDELTA")) != 2)
+        return ret;
+
+    if ((ret = notify_send (cfgfile, "RELOAD")) == 2)
+    {
+        logg ("!NotifyClamd: Unknown answer from clamd: 'UNKNOWN COMMAND'\n");
+        ret = -1;
+    }
+    return ret;
+}
 #endif
@@ -19,7 +19,7 @@
 #ifndef __NOTIFY_H
 #define __NOTIFY_H
 
-int notify (const char *cfgfile);
+int notify (const char *cfgfile, int delta);
 int clamd_connect (const char *cfgfile, const char *option);
 
 #endif
@@ -0,0 +1,275 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "clamav.h"
+#include "others.h"
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_ALIGNED(x) (((x) + (ARENA_ALIGN - 1)) & ~((size_t)ARENA_ALIGN - 1))
+/* max number of released chunks an arena keeps for reuse */
+#define ARENA_MAX_IDLE 16
+
+struct cli_arena_chunk {
+    struct cli_arena_chunk *prev;
+    size_t size;
+    size_t used;
+};
+
+#define CHUNK_HDR ARENA_ALIGNED(sizeof(struct cli_arena_chunk))
+#define CHUNK_DATA(c) ((unsigned char *)(c) + CHUNK_HDR)
+
+static struct cli_arena_chunk *chunk_get(cli_arena_t *arena, size_t size)
+{
+    struct cli_arena_chunk *chunk = NULL;
+
+    if (size <= CLI_ARENA_CHUNK_SIZE) {
+        size = CLI_ARENA_CHUNK_SIZE;
+        if ((chunk = arena->idle)) {
+            arena->idle = chunk->prev;
+            arena->nidle--;
+        }
+    }
+    if (!chunk) {
+        if (!(chunk = cli_malloc(CHUNK_HDR + size)))
+            return NULL;
+        chunk->size = size;
+    }
+    chunk->prev = NULL;
+    chunk->used = 0;
+    return chunk;
+}
+
+static void chunk_put(cli_arena_t *arena, struct cli_arena_chunk *chunk)
+{
+    if (chunk->size == CLI_ARENA_CHUNK_SIZE && arena->nidle < ARENA_MAX_IDLE) {
+        chunk->prev = arena->idle;
+        arena->idle = chunk;
+        arena->nidle++;
+        return;
+    }
+    free(chunk);
+}
+
+static inline unsigned int cli_arena_typeidx(cli_file_t type)
+{
+    if (type < CL_TYPENO || type > CL_TYPE_IGNORED)
+        return 0;
+    return type - CL_TYPENO + 1;
+}
+
+cli_arena_t *cli_arena_create(void)
+{
+    cli_arena_t *arena = cli_calloc(1, sizeof(*arena));
+
+    if (!arena) {
+        cli_errmsg("cli_arena_create: Can't allocate memory for arena\n");
+        return NULL;
+    }
+    arena->type = CL_TYPE_ANY;
+    return arena;
+}
+
+void cli_arena_destroy(cli_arena_t *arena)
+{
+    struct cli_arena_chunk *chunk;
+    unsigned int i;
+
+    if (!arena)
+        return;
+
+    if (cli_debug_flag) {
+        for (i = 0; i < CLI_ARENA_NTYPES; i++) {
+            if (!arena->allocs[i])
+                continue;
+            cli_dbgmsg("cli_arena: %s: %u allocations, %llu bytes\n",
+                       i ? cli_ftname(i + CL_TYPENO - 1) : "CL_TYPE_ANY",
+                       arena->allocs[i], (long long unsigned)arena->bytes[i]);
+        }
+    }
+
+    while ((chunk = arena->chunk)) {
+        arena->chunk = chunk->prev;
+        free(chunk);
+    }
+    while ((chunk = arena->idle)) {
+        arena->idle = chunk->prev;
+        free(chunk);
+    }
+    free(arena);
+}
+
+void *cli_arena_malloc(cli_arena_t *arena, size_t size)
+{
+    struct cli_arena_chunk *chunk;
+    unsigned int idx;
+    void *ret;
+
+    if (!arena || !size || size > CLI_MAX_ALLOCATION) {
+        cli_dbgmsg("cli_arena_malloc: attempt to allocate %lu bytes\n", (unsigned long)size);
+        return NULL;
+    }
+    size = ARENA_ALIGNED(size);
+
+    chunk = arena->chunk;
+    if (!chunk || chunk->size - chunk->used < size) {
+        if (!(chunk = chunk_get(arena, size))) {
+            cli_errmsg("cli_arena_malloc: Can't allocate memory (%lu bytes)\n", (unsigned long)size);
+            return NULL;
+        }
+        chunk->prev = arena->chunk;
+        arena->chunk = chunk;
+    }
+
+    ret = CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += size;
+
+    idx = cli_arena_typeidx(arena->type);
+    arena->allocs[idx]++;
+    arena->bytes[idx] += size;
+    return ret;
+}
+
+void *cli_arena_calloc(cli_arena_t *arena, size_t nmemb, size_t size)
+{
+    void *ret;
+
+    if (!nmemb || size > CLI_MAX_ALLOCATION / nmemb) {
+        cli_dbgmsg("cli_arena_calloc: attempt to allocate %lu units of %lu bytes\n", (unsigned long)nmemb, (unsigned long)size);
+        return NULL;
+    }
+    if ((ret = cli_arena_malloc(arena, nmemb * size)))
+        memset(ret, 0, nmemb * size);
+    return ret;
+}
+
+/*
+ * Grows (or shrinks) an allocation of oldsize bytes. The most recent
+ * allocation is extended in place when the chunk has room, which makes
+ * building a string up piecewise cheap; anything else is copied.
+ */
+void *cli_arena_realloc(cli_arena_t *arena, void *ptr, size_t oldsize, size_t size)
+{
+    struct cli_arena_chunk *chunk;
+    size_t oldaligned, newaligned;
+    unsigned int idx;
+    void *ret;
+
+    if (!ptr)
+        return cli_arena_malloc(arena, size);
+    if (!arena || !size || size > CLI_MAX_ALLOCATION) {
+        cli_dbgmsg("cli_arena_realloc: attempt to allocate %lu bytes\n", (unsigned long)size);
+        return NULL;
+    }
+
+    chunk = arena->chunk;
+    oldaligned = ARENA_ALIGNED(oldsize);
+    newaligned = ARENA_ALIGNED(size);
+    if (chunk && (unsigned char *)ptr + oldaligned == CHUNK_DATA(chunk) + chunk->used &&
+        chunk->used - oldaligned + newaligned <= chunk->size) {
+        chunk->used = chunk->used - oldaligned + newaligned;
+        if (newaligned > oldaligned) {
+            idx = cli_arena_typeidx(arena->type);
+            arena->bytes[idx] += newaligned - oldaligned;
+        }
+        return ptr;
+    }
+
+    if (size > oldsize && (!chunk || chunk->size - chunk->used < newaligned) &&
+        2 * oldaligned > CLI_ARENA_CHUNK_SIZE) {
+        /* a large block that keeps growing gets a chunk with room to spare,
+         * so that the next calls can extend it in place */
+        size_t reserve = 2 * oldaligned;
+
+        if (reserve < newaligned)
+            reserve = newaligned;
+        if (!(chunk = chunk_get(arena, reserve))) {
+            cli_errmsg("cli_arena_realloc: Can't allocate memory (%lu bytes)\n", (unsigned long)reserve);
+            return NULL;
+        }
+        chunk->prev = arena->chunk;
+        arena->chunk = chunk;
+        chunk->used = newaligned;
+        idx = cli_arena_typeidx(arena->type);
+        arena->allocs[idx]++;
+        arena->bytes[idx] += newaligned;
+        ret = CHUNK_DATA(chunk);
+        memcpy(ret, ptr, oldsize);
+        return ret;
+    }
+
+    if ((ret = cli_arena_malloc(arena, size)))
+        memcpy(ret, ptr, oldsize < size ? oldsize : size);
+    return ret;
+}
+
+char *cli_arena_strndup(cli_arena_t *arena, const char *s, size_t n)
+{
+    const char *end;
+    char *ret;
+
+    if (!s)
+        return NULL;
+    if ((end = memchr(s, '\0', n)))
+        n = end - s;
+    if (!(ret = cli_arena_malloc(arena, n + 1)))
+        return NULL;
+    memcpy(ret, s, n);
+    ret[n] = '\0';
+    return ret;
+}
+
+void cli_arena_mark(cli_arena_t *arena, cli_arena_mark_t *mark)
+{
+    if (!arena) {
+        memset(mark, 0, sizeof(*mark));
+        return;
+    }
+    mark->chunk = arena->chunk;
+    mark->used = arena->chunk ? arena->chunk->used : 0;
+    mark->type = arena->type;
+}
+
+void cli_arena_release(cli_arena_t *arena, const cli_arena_mark_t *mark)
+{
+    struct cli_arena_chunk *chunk;
+
+    if (!arena)
+        return;
+
+    while ((chunk = arena->chunk) && chunk != mark->chunk) {
+        arena->chunk = chunk->prev;
+        chunk_put(arena, chunk);
+    }
+    if (arena->chunk)
+        arena->chunk->used = mark->used;
+    arena->type = mark->type;
+}
+
+void cli_arena_settype(cli_arena_t *arena, cli_file_t type)
+{
+    if (arena)
+        arena->type = type;
+}
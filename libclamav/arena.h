@@ -0,0 +1,77 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <sys/types.h>
+
+#include "cltypes.h"
+#include "filetypes.h"
+
+/*
+ * Per-scan bump allocator for parser and extractor temporaries.
+ *
+ * Memory handed out by the arena is never freed individually: everything
+ * allocated after cli_arena_mark() is released in one shot by
+ * cli_arena_release(), and the whole arena goes away with
+ * cli_arena_destroy(). Released chunks stay with the arena and are reused
+ * by the next objects of the same scan, or the next file of a batch, so
+ * short-lived allocations don't keep going back to malloc and no lock is
+ * shared between scanning threads.
+ */
+
+#define CLI_ARENA_CHUNK_SIZE (64 * 1024)
+#define CLI_ARENA_NTYPES (CL_TYPE_IGNORED - CL_TYPENO + 2)
+
+struct cli_arena_chunk;
+
+typedef struct cli_arena_mark {
+    struct cli_arena_chunk *chunk;
+    size_t used;
+    cli_file_t type;
+} cli_arena_mark_t;
+
+typedef struct cli_arena {
+    struct cli_arena_chunk *chunk; /* current chunk, older ones linked below it */
+    struct cli_arena_chunk *idle;  /* released chunks kept for reuse */
+    unsigned int nidle;
+    cli_file_t type;               /* file type charged for new allocations */
+
+    /* allocation counters, indexed with cli_arena_typeidx() */
+    uint32_t allocs[CLI_ARENA_NTYPES];
+    uint64_t bytes[CLI_ARENA_NTYPES];
+} cli_arena_t;
+
+cli_arena_t *cli_arena_create(void);
+void cli_arena_destroy(cli_arena_t *arena);
+
+void *cli_arena_malloc(cli_arena_t *arena, size_t size);
+void *cli_arena_calloc(cli_arena_t *arena, size_t nmemb, size_t size);
+void *cli_arena_realloc(cli_arena_t *arena, void *ptr, size_t oldsize, size_t size);
+char *cli_arena_strndup(cli_arena_t *arena, const char *s, size_t n);
+
+void cli_arena_mark(cli_arena_t *arena, cli_arena_mark_t *mark);
+void cli_arena_release(cli_arena_t *arena, const cli_arena_mark_t *mark);
+void cli_arena_settype(cli_arena_t *arena, cli_file_t type);
+
+#endif
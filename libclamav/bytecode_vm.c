@@ -677,6 +677,11 @@ int cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const struct
                 stop = CL_ETIMEOUT;
                 break;
             }
+            if (cli_updatescanwork((cli_ctx*)ctx->ctx, 5000) != CL_SUCCESS) {
+                cli_dbgmsg("Bytecode run stopped in interpreter after %u opcodes: scan work budget exhausted\n", pc);
+                stop = CL_ETIMEOUT;
+                break;
+            }
         }
         switch (inst->interp_op) {
             DEFINE_BINOP(OP_BC_ADD, res = op0 + op1);
@@ -27,11 +27,15 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <assert.h>
+#include <time.h>
+
+#include <openssl/rand.h>
 
 #include "mpool.h"
 #include "clamav.h"
 #include "cache.h"
 #include "fmap.h"
+#include "matcher.h"
 
 #ifdef CL_THREAD_SAFE
 static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -738,6 +742,168 @@ struct CACHE {
 #endif
 };
 
+/* FAST CACHE KEY ------------------------------------------------------------------- */
+
+/* With CL_ENGINE_FAST_CACHE_KEY the cache is keyed by this 128-bit hash
+ * instead of the MD5, which is then only computed when a signature needs
+ * it. Four independent multiply-rotate lanes (as in xxHash) keep the
+ * multipliers busy and run several times faster than MD5.
+ * It isn't a cryptographic hash: the per-process random seed keeps
+ * attackers from precomputing a file that collides with a cached one. */
+
+#define FH_PRIME1 0x9E3779B185EBCA87ULL
+#define FH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define FH_PRIME3 0x165667B19E3779F9ULL
+#define FH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define FH_PRIME5 0x27D4EB2F165667C5ULL
+#define FH_STRIPE CLI_FASTHASH_STRIPE
+
+static uint64_t fasthash_seed[2];
+#ifdef CL_THREAD_SAFE
+static pthread_once_t fasthash_seed_once = PTHREAD_ONCE_INIT;
+#else
+static int fasthash_seeded = 0;
+#endif
+
+static inline uint64_t fh_rotl(uint64_t x, unsigned int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fh_read64(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return le64_to_host(v);
+}
+
+static inline uint64_t fh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * FH_PRIME2;
+    acc = fh_rotl(acc, 31);
+    return acc * FH_PRIME1;
+}
+
+static inline uint64_t fh_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= FH_PRIME2;
+    h ^= h >> 29;
+    h *= FH_PRIME3;
+    return h ^ (h >> 32);
+}
+
+static void fasthash_seed_alloc(void)
+{
+    if(RAND_bytes((unsigned char *)fasthash_seed, sizeof(fasthash_seed)) != 1) {
+	fasthash_seed[0] = ((uint64_t)cli_rndnum(0xffffffff) << 32) ^ cli_rndnum(0xffffffff) ^ (uint64_t)time(NULL);
+	fasthash_seed[1] = ((uint64_t)cli_rndnum(0xffffffff) << 32) ^ cli_rndnum(0xffffffff);
+    }
+}
+
+/* engines are created concurrently by some library users */
+static void fasthash_seed_init(void)
+{
+#ifdef CL_THREAD_SAFE
+    pthread_once(&fasthash_seed_once, fasthash_seed_alloc);
+#else
+    if(!fasthash_seeded) {
+	fasthash_seed_alloc();
+	fasthash_seeded = 1;
+    }
+#endif
+}
+
+void cli_fasthash_init(struct cli_fasthash *fh, const uint64_t seed[2])
+{
+    fh->acc[0] = seed[0] + FH_PRIME1 + FH_PRIME2;
+    fh->acc[1] = seed[1] + FH_PRIME2;
+    fh->acc[2] = seed[0];
+    fh->acc[3] = seed[1] - FH_PRIME1;
+    fh->buffered = 0;
+    fh->total = 0;
+}
+
+static inline void fasthash_stripe(uint64_t *acc, const unsigned char *p)
+{
+    acc[0] = fh_round(acc[0], fh_read64(p));
+    acc[1] = fh_round(acc[1], fh_read64(p + 8));
+    acc[2] = fh_round(acc[2], fh_read64(p + 16));
+    acc[3] = fh_round(acc[3], fh_read64(p + 24));
+}
+
+void cli_fasthash_update(struct cli_fasthash *fh, const unsigned char *data, size_t len)
+{
+    uint64_t acc[4];
+    size_t fill;
+
+    fh->total += len;
+    if(fh->buffered) {
+	fill = FH_STRIPE - fh->buffered;
+	if(len < fill) {
+	    memcpy(fh->buf + fh->buffered, data, len);
+	    fh->buffered += len;
+	    return;
+	}
+	memcpy(fh->buf + fh->buffered, data, fill);
+	fasthash_stripe(fh->acc, fh->buf);
+	data += fill;
+	len -= fill;
+	fh->buffered = 0;
+    }
+
+    memcpy(acc, fh->acc, sizeof(acc));
+    while(len >= FH_STRIPE) {
+	fasthash_stripe(acc, data);
+	data += FH_STRIPE;
+	len -= FH_STRIPE;
+    }
+    memcpy(fh->acc, acc, sizeof(acc));
+
+    if(len) {
+	memcpy(fh->buf, data, len);
+	fh->buffered = len;
+    }
+}
+
+void cli_fasthash_final(struct cli_fasthash *fh, unsigned char *digest)
+{
+    uint64_t h[2], *acc = fh->acc, k;
+    const unsigned char *p = fh->buf;
+    size_t len = fh->buffered;
+    unsigned int i;
+
+    h[0] = fh_rotl(acc[0], 1) + fh_rotl(acc[1], 7) + fh_rotl(acc[2], 12) + fh_rotl(acc[3], 18);
+    h[1] = fh_rotl(acc[0], 3) + fh_rotl(acc[1], 17) + fh_rotl(acc[2], 29) + fh_rotl(acc[3], 41);
+    for(i = 0; i < 4; i++) {
+	h[0] = (h[0] ^ fh_round(0, acc[i])) * FH_PRIME1 + FH_PRIME4;
+	h[1] = (h[1] ^ fh_round(0, acc[3 - i])) * FH_PRIME2 + FH_PRIME5;
+    }
+    h[0] += fh->total;
+    h[1] ^= fh->total * FH_PRIME3;
+
+    while(len >= 8) {
+	k = fh_round(0, fh_read64(p));
+	h[0] = fh_rotl(h[0] ^ k, 27) * FH_PRIME1 + FH_PRIME4;
+	h[1] = fh_rotl(h[1] ^ k, 31) * FH_PRIME2 + FH_PRIME3;
+	p += 8;
+	len -= 8;
+    }
+    while(len--) {
+	h[0] = fh_rotl(h[0] ^ (*p * FH_PRIME5), 11) * FH_PRIME1;
+	h[1] = fh_rotl(h[1] ^ (*p * FH_PRIME1), 13) * FH_PRIME2;
+	p++;
+    }
+
+    h[0] = fh_avalanche(h[0] ^ fh_rotl(h[1], 23));
+    h[1] = fh_avalanche(h[1] ^ h[0]);
+    /* same digest on any host, the unit tests check known answers */
+    h[0] = le64_to_host(h[0]);
+    h[1] = le64_to_host(h[1]);
+    memcpy(digest, h, 16);
+}
+
 /* Allocates the trees for the engine cache */
 int cli_cache_init(struct cl_engine *engine) {
     struct CACHE *cache;
@@ -748,6 +914,8 @@ int cli_cache_init(struct cl_engine *engine) {
 	return 1;
     }
 
+    fasthash_seed_init();
+
     if (engine->engine_options & ENGINE_OPTIONS_DISABLE_CACHE) {
         cli_dbgmsg("cli_cache_init: Caching disabled.\n");
         return 0;
@@ -896,12 +1064,42 @@ void cache_remove(unsigned char *md5, size_t size, const struct cl_engine *engin
     return;
 }
 
+static int cache_get_fastkey(unsigned char *hash, cli_ctx *ctx)
+{
+    fmap_t *map;
+    size_t todo, at = 0;
+    struct cli_fasthash fh;
+
+    map = *ctx->fmap;
+    todo = map->len;
+
+    cli_fasthash_init(&fh, fasthash_seed);
+    while(todo) {
+        const void *buf;
+        size_t readme = todo < FILEBUFF ? todo : FILEBUFF;
+
+        if(!(buf = fmap_need_off_once(map, at, readme)))
+            return CL_EREAD;
+
+        todo -= readme;
+        at += readme;
+        cli_fasthash_update(&fh, buf, readme);
+    }
+
+    cli_fasthash_final(&fh, hash);
+    return CL_CLEAN;
+}
+
 int cache_get_MD5(unsigned char *hash, cli_ctx *ctx)
 {
     fmap_t *map;
     size_t todo, at = 0;
     void *hashctx;
 
+    /* a streamed object was hashed as it arrived */
+    if(cli_scanstate_md5(ctx, hash))
+        return CL_CLEAN;
+
     map = *ctx->fmap;
     todo = map->len;
 
@@ -935,8 +1133,9 @@ int cache_get_MD5(unsigned char *hash, cli_ctx *ctx)
 
 /* Hashes a file onto the provided buffer and looks it up the cache.
    Returns CL_VIRUS if found, CL_CLEAN if not FIXME or a recoverable error,
-   and returns CL_EREAD if unrecoverable */
-int cache_check(unsigned char *hash, cli_ctx *ctx) {
+   and returns CL_EREAD if unrecoverable.
+   *md5 is set to hash if the cache key is the MD5 of the file */
+int cache_check(unsigned char *hash, cli_ctx *ctx, unsigned char **md5) {
     fmap_t *map;
     int ret;
 
@@ -948,10 +1147,16 @@ int cache_check(unsigned char *hash, cli_ctx *ctx) {
         return CL_VIRUS;
     }
 
-    ret = cache_get_MD5(hash, ctx);
+    if (ctx->engine->engine_options & ENGINE_OPTIONS_FAST_CACHE_KEY) {
+        ret = cache_get_fastkey(hash, ctx);
+    } else {
+        ret = cache_get_MD5(hash, ctx);
+        if (ret == CL_CLEAN)
+            *md5 = hash;
+    }
     if (ret != CL_CLEAN)
         return ret;
-        
+
     map = *ctx->fmap;
     ret = cache_lookup_hash(hash, map->len, ctx->engine->cache, ctx->recursion);
     cli_dbgmsg("cache_check: %02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x is %s\n", hash[0], hash[1], hash[2], hash[3], hash[4], hash[5], hash[6], hash[7], hash[8], hash[9], hash[10], hash[11], hash[12], hash[13], hash[14], hash[15], (ret == CL_VIRUS) ? "negative" : "positive");
@@ -28,7 +28,22 @@
 void cache_add(unsigned char *md5, size_t size, cli_ctx *ctx);
 /* Removes a hash from the cache */
 void cache_remove(unsigned char *md5, size_t size, const struct cl_engine *engine);
-int cache_check(unsigned char *hash, cli_ctx *ctx);
+int cache_check(unsigned char *hash, cli_ctx *ctx, unsigned char **md5);
+int cache_get_MD5(unsigned char *hash, cli_ctx *ctx);
 int cli_cache_init(struct cl_engine *engine);
 void cli_cache_destroy(struct cl_engine *engine);
+
+/* Fast cache key (CL_ENGINE_FAST_CACHE_KEY), seeded per process by the cache */
+#define CLI_FASTHASH_STRIPE 32
+struct cli_fasthash {
+    uint64_t acc[4];
+    unsigned char buf[CLI_FASTHASH_STRIPE];
+    size_t buffered;
+    uint64_t total;
+};
+
+void cli_fasthash_init(struct cli_fasthash *fh, const uint64_t seed[2]);
+void cli_fasthash_update(struct cli_fasthash *fh, const unsigned char *data, size_t len);
+/* writes a 16 byte digest */
+void cli_fasthash_final(struct cli_fasthash *fh, unsigned char *digest);
 #endif
@@ -188,6 +188,8 @@ typedef enum {
 #define ENGINE_OPTIONS_DISABLE_PE_STATS 0x4
 #define ENGINE_OPTIONS_DISABLE_PE_CERTS 0x8
 #define ENGINE_OPTIONS_PE_DUMPCERTS     0x10
+#define ENGINE_OPTIONS_DIRECT_MMAP      0x20
+#define ENGINE_OPTIONS_FAST_CACHE_KEY   0x40
 
 struct cl_engine;
 struct cl_settings;
@@ -246,7 +248,20 @@ enum cl_engine_field {
     CL_ENGINE_PCRE_RECMATCH_LIMIT,  /* uint64_t */
     CL_ENGINE_PCRE_MAX_FILESIZE,    /* uint64_t */
     CL_ENGINE_DISABLE_PE_CERTS,     /* uint32_t */
-    CL_ENGINE_PE_DUMPCERTS          /* uint32_t */
+    CL_ENGINE_PE_DUMPCERTS,         /* uint32_t */
+    CL_ENGINE_DIRECT_MMAP,          /* uint32_t */
+    CL_ENGINE_MAX_SCANWORK,         /* uint64_t */
+    CL_ENGINE_SCANWORK_ACTION,      /* uint32_t */
+    CL_ENGINE_SCANWORK_HITS,        /* uint64_t, read only */
+    CL_ENGINE_FAST_CACHE_KEY,       /* uint32_t */
+    CL_ENGINE_MAX_RATIO             /* uint32_t */
+};
+
+/* what to report when a scan runs out of CL_ENGINE_MAX_SCANWORK */
+enum scanwork_action {
+    CL_SCANWORK_ALERT=0, /* Heuristic.Limits.Exceeded.ScanWork (default) */
+    CL_SCANWORK_CLEAN,   /* report the result of the partial scan */
+    CL_SCANWORK_ERROR    /* fail the scan with CL_ETIMEOUT */
 };
 
 enum bytecode_security {
@@ -294,6 +309,14 @@ extern int cl_engine_addref(struct cl_engine *engine);
 
 extern int cl_engine_free(struct cl_engine *engine);
 
+/* Derives an engine from a compiled one with the updates recorded by
+ * freshclam in the delta journal at path (see freshclam.delta); returns NULL
+ * and sets *err to CL_EFORMAT if they can't be applied without a full reload.
+ * The engine passed in is left untouched and can be freed once the new one
+ * is in use.
+ */
+extern struct cl_engine *cl_engine_delta(struct cl_engine *engine, const char *path, unsigned int *signo, unsigned int dboptions, int *err);
+
 extern void cli_cache_disable(void);
 
 extern int cli_cache_enable(struct cl_engine *engine);
@@ -547,6 +570,44 @@ extern void cl_fmap_close(cl_fmap_t*);
 /* Scan custom data */
 extern int cl_scanmap_callback(cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context);
 
+/* Batch scanning, for many small objects.
+ * Each item is either a descriptor (desc >= 0) or a memory buffer (desc -1,
+ * data/len); result, virname and scanned are filled in as cl_scandesc()
+ * would return them. The allocations a scan context needs are shared by
+ * all the items. Returns CL_SUCCESS unless the batch couldn't be set up.
+ */
+struct cl_scan_item {
+    int desc;
+    const void *data;
+    size_t len;
+    void *context;		/* passed to the callbacks */
+    int result;
+    const char *virname;
+    unsigned long int scanned;
+};
+
+extern int cl_scan_batch(struct cl_scan_item *items, size_t count, const struct cl_engine *engine, unsigned int scanoptions);
+
+/* Streaming scans, for data that arrives piecewise.
+ * cl_scan_stream_feed() matches the data against the body signatures as it
+ * arrives, keeping the match state and hashes across calls, and returns
+ * CL_VIRUS as soon as one matches (unless CL_SCAN_ALLMATCHES is set, then
+ * all matches are reported by the final verdict); after that the rest of the
+ * object doesn't need to be fed. Data within reach of signatures anchored
+ * to the end of the object is matched once more data, or the end, arrives.
+ * cl_scan_stream_finish() returns the verdict cl_scandesc() would give for
+ * the whole object, continuing from the state the data was matched to, and
+ * releases the stream. An early CL_VIRUS doesn't take the size limits or
+ * the file hash whitelist into account. The engine must not be freed while
+ * streams are open.
+ */
+struct cl_scan_stream;
+typedef struct cl_scan_stream cl_scan_stream_t;
+
+extern cl_scan_stream_t *cl_scan_stream_open(const struct cl_engine *engine, unsigned int scanoptions, void *context);
+extern int cl_scan_stream_feed(cl_scan_stream_t *stream, const void *data, size_t len, const char **virname);
+extern int cl_scan_stream_finish(cl_scan_stream_t *stream, const char **virname, unsigned long int *scanned);
+
 /* Crypto/hashing functions */
 #define SHA1_HASH_SIZE 20
 #define SHA256_HASH_SIZE 32
@@ -35,6 +35,14 @@
 #include "zlib.h"
 #include <time.h>
 #include <errno.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+/* the pipelined loader needs pread() and sysconf() */
+#if defined(CL_THREAD_SAFE) && !defined(_WIN32)
+#define CVD_PIPELINE
+#endif
 
 #include "clamav.h"
 #include "others.h"
@@ -43,6 +51,7 @@
 #include "cvd.h"
 #include "readdb.h"
 #include "default.h"
+#include "inflate_iface.h"
 
 #define TAR_BLOCKSIZE 512
 
@@ -182,15 +191,493 @@ static int cli_untgz(int fd, const char *destdir)
     return 0;
 }
 
-static void cli_tgzload_cleanup(int comp, struct cli_dbio *dbio, int fdd)
+#ifdef CVD_PIPELINE
+/*
+ * Pipelined reader for the compressed part of a database: a reader thread
+ * pulls the file in while cli_tgzload() parses whatever has been inflated
+ * so far.
+ *
+ * sigtool and freshclam write the archive as a series of independent gzip
+ * members that carry their own size in a "BC" extra field (the BGZF
+ * layout), so the member boundaries can be found without inflating and
+ * the members are inflated by a pool of workers. Any other gzip stream is
+ * inflated by the reader thread itself.
+ */
+
+#define CVD_SLOTS	    32
+#define CVD_BLKSIZE	    65536	/* max size of a member and of its data */
+#define CVD_READSIZE	    (256 * 1024)
+#define CVD_MAXWORKERS	    8
+
+#define CVD_SLOT_FREE	    0
+#define CVD_SLOT_QUEUED	    1
+#define CVD_SLOT_BUSY	    2
+#define CVD_SLOT_READY	    3
+
+struct cvd_slot {
+    int state, err;
+    unsigned char *in, *out;
+    unsigned int inlen, outlen;
+};
+
+struct cvd_stream {
+    int fd;
+    off_t off;
+    int blocked;
+
+    /* reader thread only */
+    unsigned char *rbuf;
+    unsigned int rpos, rlen;
+    int reof, rerr;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t reader;
+    pthread_t workers[CVD_MAXWORKERS];
+    unsigned int nworkers;
+    struct cvd_slot slots[CVD_SLOTS];
+    unsigned long produced, dispatched, consumed;
+    int eof, err, done;
+
+    /* consumer only */
+    unsigned int outpos;
+};
+
+/* size of the BGZF member starting at h, 0 if it isn't one */
+static unsigned int cvd_blksize(const unsigned char *h, unsigned int len)
+{
+	unsigned int xlen, i, sublen;
+
+
+    if(len < 12 || h[0] != 0x1f || h[1] != 0x8b || h[2] != Z_DEFLATED || !(h[3] & 4))
+	return 0;
+    xlen = h[10] | (h[11] << 8);
+    if(12 + xlen > len)
+	return 0;
+    for(i = 12; i + 4 <= 12 + xlen; i += 4 + sublen) {
+	sublen = h[i + 2] | (h[i + 3] << 8);
+	if(h[i] == 'B' && h[i + 1] == 'C' && sublen == 2 && i + 6 <= 12 + xlen)
+	    return (h[i + 4] | (h[i + 5] << 8)) + 1;
+    }
+    return 0;
+}
+
+static void cvd_fail(struct cvd_stream *s)
+{
+    pthread_mutex_lock(&s->mutex);
+    s->err = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/* tops up the read buffer to hold need bytes (if the file has them) */
+static unsigned int cvd_fill(struct cvd_stream *s, unsigned int need)
+{
+	ssize_t n;
+
+
+    if(s->rlen - s->rpos >= need || s->reof)
+	return s->rlen - s->rpos;
+
+    memmove(s->rbuf, s->rbuf + s->rpos, s->rlen - s->rpos);
+    s->rlen -= s->rpos;
+    s->rpos = 0;
+    while(s->rlen < need && !s->reof) {
+	n = pread(s->fd, s->rbuf + s->rlen, CVD_READSIZE - s->rlen, s->off);
+	if(n < 0 && errno == EINTR)
+	    continue;
+	if(n <= 0) {
+	    if(n < 0)
+		s->rerr = 1;
+	    s->reof = 1;
+	    break;
+	}
+	s->off += n;
+	s->rlen += n;
+    }
+    return s->rlen - s->rpos;
+}
+
+static struct cvd_slot *cvd_getslot(struct cvd_stream *s)
+{
+	struct cvd_slot *slot = NULL;
+
+
+    pthread_mutex_lock(&s->mutex);
+    while(!s->done && s->produced - s->consumed == CVD_SLOTS)
+	pthread_cond_wait(&s->cond, &s->mutex);
+    if(!s->done)
+	slot = &s->slots[s->produced % CVD_SLOTS];
+    pthread_mutex_unlock(&s->mutex);
+    return slot;
+}
+
+static void cvd_putslot(struct cvd_stream *s, struct cvd_slot *slot, int state)
+{
+    pthread_mutex_lock(&s->mutex);
+    slot->state = state;
+    s->produced++;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static void cvd_read_serial(struct cvd_stream *s)
+{
+	struct cli_zstream z;
+	struct cvd_slot *slot;
+	unsigned int avail;
+	int zret = Z_OK;
+
+
+    memset(&z, 0, sizeof(z));
+    if(cli_inflate_init(&z, 16 + MAX_WBITS, NULL) != Z_OK) {
+	cvd_fail(s);
+	return;
+    }
+
+    while((slot = cvd_getslot(s))) {
+	z.next_out = slot->out;
+	z.avail_out = CVD_BLKSIZE;
+	slot->err = 0;
+	while(z.avail_out) {
+	    if(!(avail = cvd_fill(s, 1))) {
+		/* truncated, unless the last member was complete */
+		if(zret != Z_STREAM_END)
+		    slot->err = 1;
+		break;
+	    }
+	    z.next_in = s->rbuf + s->rpos;
+	    z.avail_in = avail;
+	    zret = cli_inflate(&z, Z_NO_FLUSH);
+	    s->rpos += avail - z.avail_in;
+	    if(zret == Z_STREAM_END) {
+		/* gzip members may be concatenated, anything else is junk */
+		if(cvd_fill(s, 2) < 2 || s->rbuf[s->rpos] != 0x1f || s->rbuf[s->rpos + 1] != 0x8b)
+		    break;
+		cli_inflate_reset(&z);
+	    } else if(zret != Z_OK) {
+		slot->err = 1;
+		break;
+	    }
+	}
+	slot->outlen = CVD_BLKSIZE - z.avail_out;
+	cvd_putslot(s, slot, CVD_SLOT_READY);
+	if(slot->err || slot->outlen < CVD_BLKSIZE)
+	    break;
+    }
+    cli_inflate_end(&z);
+}
+
+static void cvd_read_blocked(struct cvd_stream *s)
+{
+	struct cvd_slot *slot;
+	unsigned int avail, bsize;
+
+
+    while((avail = cvd_fill(s, 12))) {
+	if(avail >= 12)
+	    avail = cvd_fill(s, 12 + (s->rbuf[s->rpos + 10] | (s->rbuf[s->rpos + 11] << 8)));
+	if(!(bsize = cvd_blksize(s->rbuf + s->rpos, avail)) || cvd_fill(s, bsize) < bsize) {
+	    cli_errmsg("cvd_read_blocked: Broken or truncated block at offset %lu\n", (unsigned long int)(s->off - s->rlen + s->rpos));
+	    cvd_fail(s);
+	    return;
+	}
+	if(!(slot = cvd_getslot(s)))
+	    return;
+	memcpy(slot->in, s->rbuf + s->rpos, bsize);
+	slot->inlen = bsize;
+	s->rpos += bsize;
+	cvd_putslot(s, slot, CVD_SLOT_QUEUED);
+    }
+}
+
+static void *cvd_reader(void *arg)
+{
+	struct cvd_stream *s = (struct cvd_stream *)arg;
+
+
+    if(s->blocked)
+	cvd_read_blocked(s);
+    else
+	cvd_read_serial(s);
+
+    if(s->rerr) {
+	cli_errmsg("cvd_reader: Can't read database file\n");
+	cvd_fail(s);
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    s->eof = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+static int cvd_inflate_blk(struct cli_zstream *z, struct cvd_slot *slot)
+{
+	const unsigned char *h = slot->in;
+	unsigned int hlen = 12 + (h[10] | (h[11] << 8));
+
+
+    if(h[3] & 8) /* FNAME */
+	while(hlen < slot->inlen && h[hlen++]);
+    if(h[3] & 16) /* FCOMMENT */
+	while(hlen < slot->inlen && h[hlen++]);
+    if(h[3] & 2) /* FHCRC */
+	hlen += 2;
+    if(slot->inlen < hlen + 8 || (uint32_t)cli_readint32(h + slot->inlen - 4) > CVD_BLKSIZE)
+	return 1;
+
+    if(cli_inflate_reset(z) != Z_OK)
+	return 1;
+    z->next_in = (unsigned char *)h + hlen;
+    z->avail_in = slot->inlen - hlen - 8;
+    z->next_out = slot->out;
+    z->avail_out = CVD_BLKSIZE;
+    if(cli_inflate(z, Z_FINISH) != Z_STREAM_END)
+	return 1;
+    slot->outlen = CVD_BLKSIZE - z->avail_out;
+
+    if(slot->outlen != (uint32_t)cli_readint32(h + slot->inlen - 4) ||
+       crc32(0L, slot->out, slot->outlen) != (uint32_t)cli_readint32(h + slot->inlen - 8))
+	return 1;
+    return 0;
+}
+
+static void *cvd_worker(void *arg)
+{
+	struct cvd_stream *s = (struct cvd_stream *)arg;
+	struct cvd_slot *slot;
+	struct cli_zstream z;
+
+
+    memset(&z, 0, sizeof(z));
+    if(cli_inflate_init(&z, -MAX_WBITS, NULL) != Z_OK) {
+	cvd_fail(s);
+	return NULL;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    while(1) {
+	while(!s->done && !s->eof && s->dispatched == s->produced)
+	    pthread_cond_wait(&s->cond, &s->mutex);
+	if(s->done || s->dispatched == s->produced)
+	    break;
+	slot = &s->slots[s->dispatched++ % CVD_SLOTS];
+	slot->state = CVD_SLOT_BUSY;
+	pthread_mutex_unlock(&s->mutex);
+
+	slot->err = cvd_inflate_blk(&z, slot);
+
+	pthread_mutex_lock(&s->mutex);
+	slot->state = CVD_SLOT_READY;
+	pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    cli_inflate_end(&z);
+    return NULL;
+}
+
+/* reads (or with buff == NULL skips) up to len bytes, -1 on error */
+static int cvd_stream_read(struct cvd_stream *s, void *buff, unsigned int len)
+{
+	struct cvd_slot *slot;
+	unsigned int n, total = 0;
+	int ready, err;
+
+
+    while(len) {
+	slot = &s->slots[s->consumed % CVD_SLOTS];
+	pthread_mutex_lock(&s->mutex);
+	while(!(ready = s->consumed < s->produced && slot->state == CVD_SLOT_READY) &&
+	      !s->err && !(s->eof && s->consumed == s->produced))
+	    pthread_cond_wait(&s->cond, &s->mutex);
+	err = s->err;
+	pthread_mutex_unlock(&s->mutex);
+
+	if(err || (ready && slot->err))
+	    return -1;
+	if(!ready)
+	    break;
+
+	n = slot->outlen - s->outpos;
+	if(n > len)
+	    n = len;
+	if(buff) {
+	    memcpy(buff, slot->out + s->outpos, n);
+	    buff = (char *)buff + n;
+	}
+	s->outpos += n;
+	total += n;
+	len -= n;
+
+	if(s->outpos == slot->outlen) {
+	    s->outpos = 0;
+	    pthread_mutex_lock(&s->mutex);
+	    slot->state = CVD_SLOT_FREE;
+	    s->consumed++;
+	    pthread_cond_broadcast(&s->cond);
+	    pthread_mutex_unlock(&s->mutex);
+	}
+    }
+    return total;
+}
+
+static void cvd_stream_free(struct cvd_stream *s)
+{
+	unsigned int i;
+
+
+    for(i = 0; i < CVD_SLOTS; i++) {
+	free(s->slots[i].in);
+	free(s->slots[i].out);
+    }
+    free(s->rbuf);
+    free(s);
+}
+
+/*
+ * Starts inflating the gzip data at fd:off in the background. Returns NULL
+ * when it isn't gzip data or the threads can't be started, the caller
+ * then reads the file serially.
+ */
+static struct cvd_stream *cvd_stream_open(int fd, off_t off)
+{
+	struct cvd_stream *s;
+	unsigned char h[18];
+	unsigned int i;
+	long ncpu;
+
+
+    if(pread(fd, h, sizeof(h), off) != sizeof(h) || h[0] != 0x1f || h[1] != 0x8b)
+	return NULL;
+
+    if(!(s = cli_calloc(1, sizeof(*s))))
+	return NULL;
+    s->fd = fd;
+    s->off = off;
+    s->blocked = !!cvd_blksize(h, sizeof(h));
+    if(!(s->rbuf = cli_malloc(CVD_READSIZE))) {
+	cvd_stream_free(s);
+	return NULL;
+    }
+    for(i = 0; i < CVD_SLOTS; i++) {
+	if(!(s->slots[i].out = cli_malloc(CVD_BLKSIZE)) || (s->blocked && !(s->slots[i].in = cli_malloc(CVD_BLKSIZE)))) {
+	    cvd_stream_free(s);
+	    return NULL;
+	}
+    }
+
+    if(pthread_mutex_init(&s->mutex, NULL)) {
+	cvd_stream_free(s);
+	return NULL;
+    }
+    if(pthread_cond_init(&s->cond, NULL)) {
+	pthread_mutex_destroy(&s->mutex);
+	cvd_stream_free(s);
+	return NULL;
+    }
+
+    if(s->blocked) {
+	/* leave a core for the parser */
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if(ncpu < 1)
+	    ncpu = 1;
+	else if(ncpu > CVD_MAXWORKERS)
+	    ncpu = CVD_MAXWORKERS;
+	for(i = 0; i < (unsigned int) ncpu; i++) {
+	    if(pthread_create(&s->workers[i], NULL, cvd_worker, s))
+		break;
+	    s->nworkers++;
+	}
+	if(!s->nworkers)
+	    s->blocked = 0;
+    }
+
+    if(pthread_create(&s->reader, NULL, cvd_reader, s)) {
+	pthread_mutex_lock(&s->mutex);
+	s->done = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
+	for(i = 0; i < s->nworkers; i++)
+	    pthread_join(s->workers[i], NULL);
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->mutex);
+	cvd_stream_free(s);
+	return NULL;
+    }
+
+    cli_dbgmsg("cvd_stream_open: %s data, %u worker(s)\n", s->blocked ? "blocked" : "plain gzip", s->nworkers);
+    return s;
+}
+
+static void cvd_stream_close(struct cvd_stream *s)
+{
+	unsigned int i;
+
+
+    pthread_mutex_lock(&s->mutex);
+    s->done = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+
+    pthread_join(s->reader, NULL);
+    for(i = 0; i < s->nworkers; i++)
+	pthread_join(s->workers[i], NULL);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->mutex);
+    cvd_stream_free(s);
+}
+#endif /* CVD_PIPELINE */
+
+int cli_dbio_read(struct cli_dbio *dbio, void *buff, unsigned int len)
+{
+	int bread;
+
+
+#ifdef CVD_PIPELINE
+    if(dbio->stream)
+	return cvd_stream_read(dbio->stream, buff, len);
+#endif
+    if(dbio->mem) {
+	/* cli_dbgets() never asks for more than dbio->size */
+	memcpy(buff, dbio->mem, len);
+	dbio->mem += len;
+	return len;
+    }
+    if(dbio->gzs)
+	return gzread(dbio->gzs, buff, len);
+
+    bread = fread(buff, 1, len, dbio->fs);
+    if(!bread && ferror(dbio->fs))
+	return -1;
+    return bread;
+}
+
+static void cli_dbio_skip(struct cli_dbio *dbio, unsigned int len)
+{
+#ifdef CVD_PIPELINE
+    if(dbio->stream) {
+	cvd_stream_read(dbio->stream, NULL, len);
+	return;
+    }
+#endif
+    if(dbio->gzs)
+	gzseek(dbio->gzs, len, SEEK_CUR);
+    else
+	fseek(dbio->fs, len, SEEK_CUR);
+}
+
+static void cli_tgzload_cleanup(struct cli_dbio *dbio, int fdd)
 {
     UNUSEDPARAM(fdd);
     cli_dbgmsg("in cli_tgzload_cleanup()\n");
-    if(comp) {
+    if(dbio->gzs) {
         gzclose(dbio->gzs);
         dbio->gzs = NULL;
     }
-    else {
+    if(dbio->fs) {
         fclose(dbio->fs);
         dbio->fs = NULL;
     }
@@ -211,12 +698,18 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
 	char block[TAR_BLOCKSIZE];
 	int nread, fdd, ret;
 	unsigned int type, size, pad, compr = 1;
-	off_t off;
 	struct cli_dbinfo *db;
 	unsigned char hash[32];
 
     cli_dbgmsg("in cli_tgzload()\n");
 
+    fdd = -1;
+    if(dbio->stream) {
+	dbio->gzs = NULL;
+	dbio->fs = NULL;
+	goto loadbuf;
+    }
+
     if(lseek(fd, 512, SEEK_SET) < 0) {
         return CL_ESEEK;
     }
@@ -254,11 +747,12 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
 	dbio->gzs = NULL;
     }
 
+loadbuf:
     dbio->bufsize = CLI_DEFAULT_DBIO_BUFSIZE;
     dbio->buf = cli_malloc(dbio->bufsize);
     if(!dbio->buf) {
 	cli_errmsg("cli_tgzload: Can't allocate memory for dbio->buf\n");
-	cli_tgzload_cleanup(compr, dbio, fdd);
+	cli_tgzload_cleanup(dbio, fdd);
 	return CL_EMALFDB;
     }
     dbio->bufpt = NULL;
@@ -267,17 +761,14 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
 
     while(1) {
 
-	if(compr)
-	    nread = gzread(dbio->gzs, block, TAR_BLOCKSIZE);
-	else
-	    nread = fread(block, 1, TAR_BLOCKSIZE, dbio->fs);
+	nread = cli_dbio_read(dbio, block, TAR_BLOCKSIZE);
 
 	if(!nread)
 	    break;
 
 	if(nread != TAR_BLOCKSIZE) {
 	    cli_errmsg("cli_tgzload: Incomplete block read\n");
-	    cli_tgzload_cleanup(compr, dbio, fdd);
+	    cli_tgzload_cleanup(dbio, fdd);
 	    return CL_EMALFDB;
 	}
 
@@ -289,7 +780,7 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
 
 	if(strchr(name, '/')) {
 	    cli_errmsg("cli_tgzload: Slash separators are not allowed in CVD\n");
-	    cli_tgzload_cleanup(compr, dbio, fdd);
+	    cli_tgzload_cleanup(dbio, fdd);
 	    return CL_EMALFDB;
 	}
 
@@ -301,11 +792,11 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
 		break;
 	    case '5':
 		cli_errmsg("cli_tgzload: Directories are not supported in CVD\n");
-		cli_tgzload_cleanup(compr, dbio, fdd);
+		cli_tgzload_cleanup(dbio, fdd);
 		return CL_EMALFDB;
 	    default:
 		cli_errmsg("cli_tgzload: Unknown type flag '%c'\n", type);
-		cli_tgzload_cleanup(compr, dbio, fdd);
+		cli_tgzload_cleanup(dbio, fdd);
 		return CL_EMALFDB;
 	}
 
@@ -314,7 +805,7 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
 
 	if((sscanf(osize, "%o", &size)) == 0) {
 	    cli_errmsg("cli_tgzload: Invalid size in header\n");
-	    cli_tgzload_cleanup(compr, dbio, fdd);
+	    cli_tgzload_cleanup(dbio, fdd);
 	    return CL_EMALFDB;
 	}
 	dbio->size = size;
@@ -324,27 +815,22 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
     if (!(dbio->hashctx)) {
         dbio->hashctx = cl_hash_init("sha256");
         if (!(dbio->hashctx)) {
-            cli_tgzload_cleanup(compr, dbio, fdd);
+            cli_tgzload_cleanup(dbio, fdd);
             return CL_EMALFDB;
         }
     }
 	dbio->bread = 0;
 
 	/* cli_dbgmsg("cli_tgzload: Loading %s, size: %u\n", name, size); */
-	if(compr)
-	    off = (off_t) gzseek(dbio->gzs, 0, SEEK_CUR);
-	else
-	    off = ftell(dbio->fs);
-
 	if((!dbinfo && cli_strbcasestr(name, ".info")) || (dbinfo && (CLI_DBEXT(name) || cli_strbcasestr(name, ".ign") || cli_strbcasestr(name, ".ign2")))) {
 	    ret = cli_load(name, engine, signo, options, dbio);
 	    if(ret) {
 		cli_errmsg("cli_tgzload: Can't load %s\n", name);
-		cli_tgzload_cleanup(compr, dbio, fdd);
+		cli_tgzload_cleanup(dbio, fdd);
 		return CL_EMALFDB;
 	    }
 	    if(!dbinfo) {
-		cli_tgzload_cleanup(compr, dbio, fdd);
+		cli_tgzload_cleanup(dbio, fdd);
 		return CL_SUCCESS;
 	    } else {
 		db = dbinfo;
@@ -352,44 +838,36 @@ static int cli_tgzload(int fd, struct cl_engine *engine, unsigned int *signo, un
 		    db = db->next;
 		if(!db) {
 		    cli_errmsg("cli_tgzload: File %s not found in .info\n", name);
-		    cli_tgzload_cleanup(compr, dbio, fdd);
+		    cli_tgzload_cleanup(dbio, fdd);
 		    return CL_EMALFDB;
 		}
 		if(dbio->bread) {
 		    if(db->size != dbio->bread) {
 			cli_errmsg("cli_tgzload: File %s not correctly loaded\n", name);
-			cli_tgzload_cleanup(compr, dbio, fdd);
+			cli_tgzload_cleanup(dbio, fdd);
 			return CL_EMALFDB;
 		    }
             cl_finish_hash(dbio->hashctx, hash);
             dbio->hashctx = cl_hash_init("sha256");
             if (!(dbio->hashctx)) {
-                cli_tgzload_cleanup(compr, dbio, fdd);
+                cli_tgzload_cleanup(dbio, fdd);
                 return CL_EMALFDB;
             }
 		    if(memcmp(db->hash, hash, 32)) {
 			cli_errmsg("cli_tgzload: Invalid checksum for file %s\n", name);
-			cli_tgzload_cleanup(compr, dbio, fdd);
+			cli_tgzload_cleanup(dbio, fdd);
 			return CL_EMALFDB;
 		    }
 		}
 	    }
 	}
 	pad = size % TAR_BLOCKSIZE ? (TAR_BLOCKSIZE - (size % TAR_BLOCKSIZE)) : 0;
-	if(compr) {
-	    if(off == gzseek(dbio->gzs, 0, SEEK_CUR))
-		gzseek(dbio->gzs, size + pad, SEEK_CUR);
-	    else if(pad)
-		gzseek(dbio->gzs, pad, SEEK_CUR);
-	} else {
-	    if(off == ftell(dbio->fs))
-		fseek(dbio->fs, size + pad, SEEK_CUR);
-	    else if(pad)
-		fseek(dbio->fs, pad, SEEK_CUR);
-	}
+	/* dbio->size is whatever the loader left unread */
+	if(dbio->size + pad)
+	    cli_dbio_skip(dbio, dbio->size + pad);
     }
 
-    cli_tgzload_cleanup(compr, dbio, fdd);
+    cli_tgzload_cleanup(dbio, fdd);
     return CL_SUCCESS;
 }
 
@@ -613,6 +1091,8 @@ int cli_cvdload(FILE *fs, struct cl_engine *engine, unsigned int *signo, unsigne
 	char *dupname;
 
     dbio.hashctx = NULL;
+    dbio.stream = NULL;
+    dbio.mem = NULL;
 
     cli_dbgmsg("in cli_cvdload()\n");
 
@@ -698,8 +1178,18 @@ int cli_cvdload(FILE *fs, struct cl_engine *engine, unsigned int *signo, unsigne
     else
 	options |= CL_DB_SIGNED | CL_DB_OFFICIAL;
 
+#ifdef CVD_PIPELINE
+    dbio.stream = cvd_stream_open(cfd, 512);
+#endif
+
     ret = cli_tgzload(cfd, engine, signo, options, &dbio, dbinfo);
 
+#ifdef CVD_PIPELINE
+    if(dbio.stream) {
+	cvd_stream_close(dbio.stream);
+	dbio.stream = NULL;
+    }
+#endif
     while(engine->dbinfo) {
 	dbinfo = engine->dbinfo;
 	engine->dbinfo = dbinfo->next;
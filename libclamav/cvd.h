@@ -34,8 +34,11 @@ struct cli_dbio {
     unsigned int usebuf, bufsize, readsize;
     unsigned int chkonly;
     void *hashctx;
+    struct cvd_stream *stream;
+    const char *mem;
 };
 
+int cli_dbio_read(struct cli_dbio *dbio, void *buff, unsigned int len);
 int cli_cvdload(FILE *fs, struct cl_engine *engine, unsigned int *signo, unsigned int options, unsigned int dbtype, const char *filename, unsigned int chkonly);
 int cli_cvdunpack(const char *file, const char *dir);
 
@@ -120,6 +120,7 @@ static struct dconf_module modules[] = {
 
     { "MAIL",       "MBOX",     MAIL_CONF_MBOX,     1 },
     { "MAIL",       "TNEF",     MAIL_CONF_TNEF,     1 },
+    { "MAIL",       "STREAM",   MAIL_CONF_STREAM,   1 },
 
     { "OTHER",      "UUENCODED",    OTHER_CONF_UUENC,       1 },
     { "OTHER",      "SCRENC",       OTHER_CONF_SCRENC,      1 },
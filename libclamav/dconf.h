@@ -110,6 +110,7 @@ struct cli_dconf {
 /* Mail flags */
 #define MAIL_CONF_MBOX	    0x1
 #define MAIL_CONF_TNEF	    0x2
+#define MAIL_CONF_STREAM    0x4
 
 /* Other flags */
 #define OTHER_CONF_UUENC    0x1
@@ -0,0 +1,467 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "clamav.h"
+#include "others.h"
+#include "decoders.h"
+
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+/*
+ * The vector kernels need per function target attributes, so they are only
+ * built with compilers known to support them
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(_WIN32) && \
+    (defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define DECODERS_X86 1
+#include <immintrin.h>
+#endif
+
+#define B64_SKIP 64
+#define B64_PAD  65
+
+static const unsigned char base64_table[256] = {
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,62,64,64,64,63,
+    52,53,54,55,56,57,58,59,60,61,64,64,64,65,64,64,
+    64, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+    15,16,17,18,19,20,21,22,23,24,25,64,64,64,64,64,
+    64,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+    41,42,43,44,45,46,47,48,49,50,51,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+    64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64
+};
+
+/*
+ * A vector kernel decodes whole blocks of base64 from the start of in and
+ * stops at the first block containing anything but the 64 character
+ * alphabet. Returns the number of input bytes consumed
+ */
+typedef size_t (*base64_kernel_t)(const unsigned char *in, size_t len, unsigned char *out, size_t *outlen);
+
+static base64_kernel_t base64_kernel = NULL;
+static int simd_level = -1;
+static int simd_max = -1;
+#ifdef CL_THREAD_SAFE
+static pthread_once_t decoders_once = PTHREAD_ONCE_INIT;
+#else
+static int decoders_ready = 0;
+#endif
+
+#ifdef DECODERS_X86
+/*
+ * Classify with two nibble lookups, translate with a third, then merge the
+ * 6 bit values with multiply-adds; see Wojciech Mula and Daniel Lemire,
+ * "Faster Base64 Encoding and Decoding Using AVX2 Instructions"
+ */
+__attribute__((target("ssse3")))
+static size_t base64_ssse3(const unsigned char *in, size_t len, unsigned char *out, size_t *outlen)
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    unsigned char tmp[16];
+    size_t i = 0, o = 0;
+
+    while (len - i >= 16) {
+        __m128i str = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+        __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())))
+            break;
+
+        str = _mm_add_epi8(str, _mm_shuffle_epi8(lut_roll,
+                    _mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles)));
+        str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+        str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+        str = _mm_shuffle_epi8(str, pack);
+
+        _mm_storeu_si128((__m128i *)tmp, str);
+        memcpy(out + o, tmp, 12);
+        o += 12;
+        i += 16;
+    }
+    *outlen = o;
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t base64_avx2(const unsigned char *in, size_t len, unsigned char *out, size_t *outlen)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    unsigned char tmp[32];
+    size_t i = 0, o = 0;
+
+    while (len - i >= 32) {
+        __m256i str = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+
+        str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lut_roll,
+                    _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles)));
+        str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+        str = _mm256_shuffle_epi8(str, pack);
+        str = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+        _mm256_storeu_si256((__m256i *)tmp, str);
+        memcpy(out + o, tmp, 24);
+        o += 24;
+        i += 32;
+    }
+    *outlen = o;
+    return i;
+}
+#endif
+
+static int decoders_detect(void)
+{
+#ifdef DECODERS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return CLI_DECODERS_AVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return CLI_DECODERS_SSSE3;
+#endif
+    return CLI_DECODERS_SCALAR;
+}
+
+static int decoders_select(int level)
+{
+    if (level > simd_max)
+        level = simd_max;
+
+    switch (level) {
+#ifdef DECODERS_X86
+        case CLI_DECODERS_AVX2:
+            base64_kernel = base64_avx2;
+            break;
+        case CLI_DECODERS_SSSE3:
+            base64_kernel = base64_ssse3;
+            break;
+#endif
+        default:
+            level = CLI_DECODERS_SCALAR;
+            base64_kernel = NULL;
+    }
+    simd_level = level;
+
+    return level;
+}
+
+static void decoders_setup(void)
+{
+    simd_max = decoders_detect();
+    decoders_select(CLI_DECODERS_AVX2);
+    cli_dbgmsg("cli_decoders: using %s\n",
+               simd_level == CLI_DECODERS_AVX2 ? "AVX2" :
+               simd_level == CLI_DECODERS_SSSE3 ? "SSSE3" : "scalar code");
+}
+
+/* decoders run from many scanning threads at once, pick the kernel only once */
+static void decoders_init(void)
+{
+#ifdef CL_THREAD_SAFE
+    pthread_once(&decoders_once, decoders_setup);
+#else
+    if (!decoders_ready) {
+        decoders_setup();
+        decoders_ready = 1;
+    }
+#endif
+}
+
+/*
+ * Select the base64 kernel, capped to what the CPU supports. Returns the
+ * level actually in use. Not meant to be called while scanning
+ */
+int cli_decoders_set_simd(int level)
+{
+    decoders_init();
+    return decoders_select(level);
+}
+
+int cli_decoders_simd(void)
+{
+    decoders_init();
+    return simd_level;
+}
+
+void cli_base64_init(cli_base64_state_t *state)
+{
+    state->acc = 0;
+    state->n = 0;
+}
+
+/* padding, or the end of the data: write out what is left of the quantum */
+static size_t base64_flush(cli_base64_state_t *state, unsigned char *out)
+{
+    size_t ret = 0;
+
+    if (state->n == 2) {
+        out[ret++] = (unsigned char)(state->acc >> 4);
+    } else if (state->n == 3) {
+        out[ret++] = (unsigned char)(state->acc >> 10);
+        out[ret++] = (unsigned char)(state->acc >> 2);
+    }
+    state->acc = 0;
+    state->n = 0;
+
+    return ret;
+}
+
+/*
+ * Decode len bytes of base64, carrying incomplete quanta over to the next
+ * call in state. out must have room for CLI_BASE64_MAXLEN(len) bytes.
+ * Returns the number of bytes written
+ */
+size_t cli_base64_decode(cli_base64_state_t *state, const unsigned char *in, size_t len, unsigned char *out)
+{
+    base64_kernel_t kernel;
+    unsigned char *o = out;
+    unsigned int v;
+    size_t i = 0, done;
+
+    cli_decoders_simd();
+    kernel = base64_kernel;
+
+    while (i < len) {
+        if (kernel && !state->n) {
+            i += kernel(in + i, len - i, o, &done);
+            o += done;
+        }
+
+        /* one character at a time up to and including the next line break or junk */
+        for (; i < len; i++) {
+            v = base64_table[in[i]];
+            if (v < B64_SKIP) {
+                state->acc = (state->acc << 6) | v;
+                if (++state->n == 4) {
+                    *o++ = (unsigned char)(state->acc >> 16);
+                    *o++ = (unsigned char)(state->acc >> 8);
+                    *o++ = (unsigned char)state->acc;
+                    state->acc = 0;
+                    state->n = 0;
+                }
+                continue;
+            }
+            if (v == B64_PAD)
+                o += base64_flush(state, o);
+            i++;
+            break;
+        }
+    }
+
+    return (size_t)(o - out);
+}
+
+/* Flush a trailing quantum that wasn't padded. Writes at most 2 bytes */
+size_t cli_base64_finish(cli_base64_state_t *state, unsigned char *out)
+{
+    return base64_flush(state, out);
+}
+
+/* Decode a complete base64 buffer into newly allocated memory */
+unsigned char *cli_base64_decode_mem(const void *in, size_t len, size_t *outlen)
+{
+    cli_base64_state_t state;
+    unsigned char *out;
+    size_t n;
+
+    if (!(out = cli_malloc(CLI_BASE64_MAXLEN(len) + 1))) {
+        cli_errmsg("cli_base64_decode_mem: Can't allocate memory for decoded data\n");
+        return NULL;
+    }
+
+    cli_base64_init(&state);
+    n = cli_base64_decode(&state, in, len, out);
+    n += cli_base64_finish(&state, out + n);
+    out[n] = '\0';
+
+    *outlen = n;
+    return out;
+}
+
+static inline int hexval(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * Decode quoted-printable. Unless final is set, an escape sequence cut off
+ * at the end of in is left for the next call: *consumed tells how much of
+ * in was used. Malformed escapes are copied through. out needs len bytes
+ */
+size_t cli_qp_decode(const unsigned char *in, size_t len, unsigned char *out, size_t *consumed, int final)
+{
+    const unsigned char *eq;
+    unsigned char *o = out;
+    size_t i = 0, run;
+    int h, l;
+
+    while (i < len) {
+        /* literal text is copied up to the next escape in one go */
+        if (!(eq = memchr(in + i, '=', len - i))) {
+            memcpy(o, in + i, len - i);
+            o += len - i;
+            i = len;
+            break;
+        }
+        run = (size_t)(eq - (in + i));
+        memcpy(o, in + i, run);
+        o += run;
+        i += run;
+
+        if (!final && (i + 2 >= len))
+            break;
+
+        if ((i + 1 < len) && (in[i + 1] == '\n')) {
+            i += 2;
+        } else if ((i + 2 < len) && (in[i + 1] == '\r') && (in[i + 2] == '\n')) {
+            i += 3;
+        } else if ((i + 2 < len) && ((h = hexval(in[i + 1])) >= 0) && ((l = hexval(in[i + 2])) >= 0)) {
+            *o++ = (unsigned char)((h << 4) | l);
+            i += 3;
+        } else if ((i + 1 == len) || ((i + 2 == len) && (in[i + 1] == '\r'))) {
+            /* soft break at the very end */
+            i = len;
+        } else {
+            *o++ = in[i++];
+        }
+    }
+
+    if (consumed)
+        *consumed = i;
+    return (size_t)(o - out);
+}
+
+/*
+ * Decode one uuencoded line, length character included. Writes at most
+ * 63 bytes
+ */
+size_t cli_uudecode_line(const char *line, size_t len, unsigned char *out)
+{
+    size_t want, n = 0, i;
+    unsigned int b[4], k;
+
+    if (!len)
+        return 0;
+
+    want = (size_t)((line[0] - ' ') & 0x3f);
+    for (i = 1; (n < want) && (i < len); i += 4) {
+        for (k = 0; k < 4; k++)
+            b[k] = (i + k < len) ? (unsigned int)((line[i + k] - ' ') & 0x3f) : 0;
+
+        out[n++] = (unsigned char)((b[0] << 2) | (b[1] >> 4));
+        if (n < want)
+            out[n++] = (unsigned char)((b[1] << 4) | (b[2] >> 2));
+        if (n < want)
+            out[n++] = (unsigned char)((b[2] << 6) | b[3]);
+    }
+
+    return n;
+}
+
+/*
+ * Decode hex digits, skipping white space, up to the first character that
+ * is neither. A dangling digit is taken as the high nibble of a last byte.
+ * out needs len / 2 + 1 bytes
+ */
+size_t cli_hex_decode(const unsigned char *in, size_t len, unsigned char *out, size_t *consumed)
+{
+    unsigned char *o = out;
+    int v, hi = -1;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if ((v = hexval(in[i])) < 0) {
+            if (isspace(in[i]))
+                continue;
+            break;
+        }
+        if (hi < 0) {
+            hi = v;
+        } else {
+            *o++ = (unsigned char)((hi << 4) | v);
+            hi = -1;
+        }
+    }
+    if (hi >= 0)
+        *o++ = (unsigned char)(hi << 4);
+
+    if (consumed)
+        *consumed = i;
+    return (size_t)(o - out);
+}
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __DECODERS_H
+#define __DECODERS_H
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <sys/types.h>
+
+#include "cltypes.h"
+
+/*
+ * Transfer encoding decoders shared by the mail, PDF and XML parsers.
+ *
+ * All of them are tolerant in the same way: characters that can't be part
+ * of the encoding (white space, line breaks, junk inserted to upset
+ * scanners) are skipped rather than treated as errors, and they never write
+ * more than the documented maximum to the output buffer.
+ *
+ * Base64 is decoded with SSSE3 or AVX2 when the CPU has them, with the
+ * scalar code handling line breaks, padding and anything the vector code
+ * rejects.
+ */
+
+/* largest output from len bytes of base64 */
+#define CLI_BASE64_MAXLEN(len) (((len) / 4) * 3 + 3)
+
+typedef struct cli_base64_state {
+    uint32_t acc;
+    unsigned int n;
+} cli_base64_state_t;
+
+#define CLI_DECODERS_SCALAR 0
+#define CLI_DECODERS_SSSE3  1
+#define CLI_DECODERS_AVX2   2
+
+void cli_base64_init(cli_base64_state_t *state);
+size_t cli_base64_decode(cli_base64_state_t *state, const unsigned char *in, size_t len, unsigned char *out);
+size_t cli_base64_finish(cli_base64_state_t *state, unsigned char *out);
+unsigned char *cli_base64_decode_mem(const void *in, size_t len, size_t *outlen);
+
+size_t cli_qp_decode(const unsigned char *in, size_t len, unsigned char *out, size_t *consumed, int final);
+size_t cli_uudecode_line(const char *line, size_t len, unsigned char *out);
+size_t cli_hex_decode(const unsigned char *in, size_t len, unsigned char *out, size_t *consumed);
+
+int cli_decoders_simd(void);
+int cli_decoders_set_simd(int level);
+
+#endif
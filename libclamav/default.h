@@ -47,6 +47,7 @@
 #define CLI_DEFAULT_MAXRECHWP3          16
 
 #define CLI_DEFAULT_MAXPARTITIONS       50
+#define CLI_DEFAULT_MAXRATIO            1000
 
 /* TODO - set better defaults */
 #define CLI_DEFAULT_PCRE_MATCH_LIMIT     10000
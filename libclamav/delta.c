@@ -0,0 +1,688 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * Applying freshclam's delta journal to a compiled engine.
+ *
+ * When freshclam updates daily.cvd with .cdiff scripts it records every
+ * line the scripts added to or removed from the database files:
+ *
+ *	BATCH daily <from version> <to version>
+ *	+daily.hdb <added line>
+ *	-daily.ndb <removed line>
+ *	!daily.cfg		(a change that can't be described this way)
+ *	END <to version> <build time>
+ *
+ * cl_engine_delta() turns the batches newer than an engine into a new
+ * engine that shares all of its data with the old one, except for:
+ *   - hash signatures (.hdb .hsb .mdb .msb .fp .sfp .imp and the PUA
+ *     variants): additions go into small hash sets that are looked up
+ *     before the shared ones, removals into a set of dead hashes that hide
+ *     them in the shared ones;
+ *   - body and logical signatures (.db .ndb .ldb and the PUA variants):
+ *     additions are compiled into AC/BM roots of the new engine, scanned
+ *     after the shared ones;
+ *   - removed body, logical and container signatures and new .ign/.ign2
+ *     entries: matches of the shared signatures with these names are
+ *     skipped as if they didn't match. New .ign/.ign2 entries also apply
+ *     to the signatures the delta adds.
+ * Anything else (new container signatures, bytecode, configuration
+ * changes...) can only be applied by loading the databases again, the
+ * caller is told so with CL_EFORMAT.
+ *
+ * An engine made this way always points at the fully loaded engine it was
+ * derived from, and is rebuilt from it with all the batches since that
+ * engine's version, so repeated deltas don't stack up.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clamav.h"
+#include "others.h"
+#include "str.h"
+#include "cvd.h"
+#include "readdb.h"
+#include "default.h"
+#include "matcher.h"
+#include "matcher-ac.h"
+#include "matcher-bm.h"
+#include "matcher-pcre.h"
+#include "matcher-hash.h"
+#include "hashtab.h"
+#include "cache.h"
+#include "delta.h"
+
+#define DELTA_LINE_SIZE (CLI_DEFAULT_LSIG_BUFSIZE + 64)
+
+#define DELTA_HDB   0
+#define DELTA_MDB   1
+#define DELTA_IMP   2
+#define DELTA_FP    3
+#define DELTA_ROOTS 4
+
+/* lines added to one database file */
+struct delta_file {
+    char *name;
+    char *data;
+    size_t len, size;
+    struct delta_file *next;
+};
+
+struct delta_state {
+    struct cl_engine *engine;
+    struct delta_file *files;
+    struct cli_matcher *dead[DELTA_ROOTS];
+    unsigned int added, removed, body;
+};
+
+static const struct {
+    const char *ext;
+    unsigned int root;
+    unsigned int size_first;
+} delta_hashdbs[] = {
+    { "hdb", DELTA_HDB, 0 },
+    { "hsb", DELTA_HDB, 0 },
+    { "hdu", DELTA_HDB, 0 },
+    { "hsu", DELTA_HDB, 0 },
+    { "mdb", DELTA_MDB, 1 },
+    { "msb", DELTA_MDB, 1 },
+    { "mdu", DELTA_MDB, 1 },
+    { "msu", DELTA_MDB, 1 },
+    { "imp", DELTA_IMP, 0 },
+    { "fp",  DELTA_FP,  0 },
+    { "sfp", DELTA_FP,  0 },
+    { NULL, 0, 0 }
+};
+
+/* databases whose entries are removed by skipping matches by name, and
+ * whether additions go into the roots of the new engine */
+static const struct {
+    const char *ext;
+    unsigned int add;
+} delta_namedbs[] = {
+    { "db",  1 },
+    { "ndb", 1 },
+    { "ndu", 1 },
+    { "ldb", 1 },
+    { "ldu", 1 },
+    { "cdb", 0 },
+    { NULL, 0 }
+};
+
+static struct cli_matcher **delta_root(struct cl_engine *engine, unsigned int root)
+{
+    switch(root) {
+	case DELTA_HDB:
+	    return &engine->hm_hdb;
+	case DELTA_MDB:
+	    return &engine->hm_mdb;
+	case DELTA_IMP:
+	    return &engine->hm_imp;
+	default:
+	    return &engine->hm_fp;
+    }
+}
+
+static struct cli_matcher *delta_newroot(struct cl_engine *engine)
+{
+	struct cli_matcher *root;
+
+
+    if(!(root = mpool_calloc(engine->mempool, 1, sizeof(*root))))
+	return NULL;
+#ifdef USE_MPOOL
+    root->mempool = engine->mempool;
+#endif
+    return root;
+}
+
+static void delta_freeroot(struct cl_engine *engine, struct cli_matcher *root)
+{
+    if(!root)
+	return;
+    hm_free(root);
+    mpool_free(engine->mempool, root);
+}
+
+static int delta_killname(struct delta_state *st, const char *name, size_t len, int how)
+{
+	struct cl_engine *engine = st->engine;
+	const struct cli_element *el;
+
+
+    if(!len)
+	return CL_EMALFDB;
+
+    if(!engine->delta_dead) {
+	if(!(engine->delta_dead = cli_calloc(1, sizeof(struct cli_hashtable))))
+	    return CL_EMEM;
+	if(cli_hashtab_init(engine->delta_dead, 64)) {
+	    free(engine->delta_dead);
+	    engine->delta_dead = NULL;
+	    return CL_EMEM;
+	}
+    }
+    /* an ignored name stays ignored */
+    if((el = cli_hashtab_find(engine->delta_dead, name, len)) && el->data > how)
+	how = el->data;
+    if(!cli_hashtab_insert(engine->delta_dead, name, len, how))
+	return CL_EMEM;
+    st->removed++;
+    return CL_SUCCESS;
+}
+
+static struct delta_file *delta_getfile(struct delta_state *st, const char *name)
+{
+	struct delta_file *file;
+
+
+    for(file = st->files; file; file = file->next)
+	if(!strcmp(file->name, name))
+	    return file;
+
+    if(!(file = cli_calloc(1, sizeof(*file))))
+	return NULL;
+    if(!(file->name = cli_strdup(name))) {
+	free(file);
+	return NULL;
+    }
+    file->next = st->files;
+    st->files = file;
+    return file;
+}
+
+static int delta_addline(struct delta_file *file, const char *sig)
+{
+	size_t len = strlen(sig);
+	char *data;
+
+
+    if(file->len + len + 1 > file->size) {
+	if(!(data = cli_realloc(file->data, file->size + len + 1 + 4096)))
+	    return CL_EMEM;
+	file->data = data;
+	file->size += len + 1 + 4096;
+    }
+    memcpy(file->data + file->len, sig, len);
+    file->data[file->len + len] = '\n';
+    file->len += len + 1;
+    return CL_SUCCESS;
+}
+
+/* removes a line added by an earlier batch, returns 1 if there was one */
+static int delta_delline(struct delta_file *file, const char *sig)
+{
+	size_t len = strlen(sig);
+	char *pt = file->data, *end = file->data + file->len;
+
+
+    while(pt && pt + len < end) {
+	if(!memcmp(pt, sig, len) && pt[len] == '\n') {
+	    memmove(pt, pt + len + 1, end - pt - len - 1);
+	    file->len -= len + 1;
+	    return 1;
+	}
+	if((pt = memchr(pt, '\n', end - pt)))
+	    pt++;
+    }
+    return 0;
+}
+
+static int delta_killhash(struct delta_state *st, unsigned int root, unsigned int size_first, char *sig)
+{
+	const char *tokens[3], *pt;
+	unsigned long size = 0;
+	const char *hash, *sizestr;
+
+
+    if(cli_strtokenize(sig, ':', 3, tokens) < 2)
+	return CL_EMALFDB;
+    hash = tokens[size_first ? 1 : 0];
+    sizestr = tokens[size_first ? 0 : 1];
+    if(strcmp(sizestr, "*")) {
+	size = strtoul(sizestr, (char **)&pt, 10);
+	if(*pt || !size || size >= 0xffffffff)
+	    return CL_EMALFDB;
+    }
+
+    if(!st->dead[root] && !(st->dead[root] = delta_newroot(st->engine)))
+	return CL_EMEM;
+    if(hm_addhash_str(st->dead[root], hash, size, NULL))
+	return CL_EMALFDB;
+    st->removed++;
+    return CL_SUCCESS;
+}
+
+static int delta_line(struct delta_state *st, const char *db, char *line)
+{
+	char *sig, *ext;
+	struct delta_file *file;
+	unsigned int i;
+	int op = line[0];
+
+
+    if(op == '!') {
+	cli_dbgmsg("cl_engine_delta: %s changed in a way that needs a full reload\n", line + 1);
+	return CL_EFORMAT;
+    }
+
+    if(!(sig = strchr(line, ' ')))
+	return CL_EMALFDB;
+    *sig++ = 0;
+    line++;
+
+    if(strncmp(line, db, strlen(db)) || line[strlen(db)] != '.' || strchr(line, '/') || strchr(line, '\\'))
+	return CL_EMALFDB;
+    ext = line + strlen(db) + 1;
+
+    /* the .info file only describes the others */
+    if(!strcmp(ext, "info"))
+	return CL_SUCCESS;
+
+    for(i = 0; delta_hashdbs[i].ext; i++) {
+	if(strcmp(ext, delta_hashdbs[i].ext))
+	    continue;
+	if(!(file = delta_getfile(st, line)))
+	    return CL_EMEM;
+	if(op == '+') {
+	    st->added++;
+	    return delta_addline(file, sig);
+	}
+	if(delta_delline(file, sig)) {
+	    st->added--;
+	    return CL_SUCCESS;
+	}
+	return delta_killhash(st, delta_hashdbs[i].root, delta_hashdbs[i].size_first, sig);
+    }
+
+    if(op == '+' && (!strcmp(ext, "ign2") || !strcmp(ext, "ign"))) {
+	    const char *tokens[4];
+	    unsigned int count;
+
+	/* loaded before the added signatures, and hides the shared ones */
+	if(!(file = delta_getfile(st, line)) || delta_addline(file, sig))
+	    return CL_EMEM;
+	count = cli_strtokenize(sig, ':', 4, tokens);
+	if(count > 3)
+	    return CL_EMALFDB;
+	sig = (char *)tokens[count == 3 ? 2 : 0];
+	return delta_killname(st, sig, strlen(sig), CLI_DELTA_IGNORED);
+    }
+
+    for(i = 0; delta_namedbs[i].ext; i++) {
+	if(strcmp(ext, delta_namedbs[i].ext))
+	    continue;
+	if(op == '+' && !delta_namedbs[i].add)
+	    break;
+	if(!(file = delta_getfile(st, line)))
+	    return CL_EMEM;
+	if(op == '+') {
+	    st->added++;
+	    st->body++;
+	    return delta_addline(file, sig);
+	}
+	if(delta_delline(file, sig)) {
+	    st->added--;
+	    st->body--;
+	    return CL_SUCCESS;
+	}
+	return delta_killname(st, sig, strcspn(sig, !strcmp(ext, "db") ? "=" : (ext[0] == 'l' ? ";" : ":")), CLI_DELTA_REMOVED);
+    }
+
+    cli_dbgmsg("cl_engine_delta: %c%s can't be applied to a compiled engine\n", op, line);
+    return CL_EFORMAT;
+}
+
+static int delta_isign(const struct delta_file *file)
+{
+    return cli_strbcasestr(file->name, ".ign") || cli_strbcasestr(file->name, ".ign2");
+}
+
+static int delta_load(struct delta_state *st, unsigned int *signo, unsigned int dboptions)
+{
+	struct cl_engine *engine = st->engine, *base = engine->delta_base;
+	struct cli_matcher **own, *base_root;
+	struct delta_file *file;
+	struct cli_dbio dbio;
+	unsigned int i, pass;
+	int ret;
+
+
+    /* added body and logical signatures are loaded into new roots, which
+     * are then kept apart from the shared ones */
+    if(st->body) {
+	if(!(engine->delta_root = mpool_calloc(engine->mempool, CLI_MTARGETS, sizeof(*engine->delta_root))))
+	    return CL_EMEM;
+	engine->root = engine->delta_root;
+	if((ret = cli_initroots(engine, dboptions)))
+	    return ret;
+    }
+
+    /* the ignore lists first, so they apply to everything added */
+    for(pass = 0; pass < 2; pass++)
+    for(file = st->files; file; file = file->next) {
+	if(!file->len || delta_isign(file) == (int)pass)
+	    continue;
+
+	memset(&dbio, 0, sizeof(dbio));
+	dbio.mem = file->data;
+	dbio.size = file->len;
+	dbio.bufsize = CLI_DEFAULT_DBIO_BUFSIZE;
+	if(!(dbio.buf = cli_malloc(dbio.bufsize)))
+	    return CL_EMEM;
+	dbio.readpt = dbio.buf;
+	dbio.usebuf = 1;
+	dbio.readsize = dbio.size < dbio.bufsize ? dbio.size : dbio.bufsize - 1;
+
+	ret = cli_load(file->name, engine, signo, dboptions | CL_DB_OFFICIAL | CL_DB_SIGNED, &dbio);
+	free(dbio.buf);
+	if(ret)
+	    return ret;
+    }
+
+    if(engine->ignored) {
+	cli_bm_free(engine->ignored);
+	mpool_free(engine->mempool, engine->ignored);
+	engine->ignored = NULL;
+    }
+
+    if(engine->delta_root) {
+	engine->root = base->root;
+	for(i = 0; i < CLI_MTARGETS; i++) {
+	    if((ret = cli_ac_buildtrie(engine->delta_root[i])))
+		return ret;
+#if HAVE_PCRE
+	    if((ret = cli_pcre_build(engine->delta_root[i], engine->pcre_match_limit, engine->pcre_recmatch_limit, engine->dconf)))
+		return ret;
+#endif
+	}
+    }
+
+    for(i = 0; i < DELTA_ROOTS; i++) {
+	own = delta_root(engine, i);
+	base_root = *delta_root(base, i);
+	if(!*own && !st->dead[i] && (!engine->delta_dead || !base_root)) {
+	    *own = base_root;
+	    continue;
+	}
+	if(!*own && !(*own = delta_newroot(engine)))
+	    return CL_EMEM;
+	(*own)->hm_base = base_root;
+	(*own)->hm_dead = st->dead[i];
+	(*own)->hm_deadnames = engine->delta_dead;
+	st->dead[i] = NULL;
+	hm_flush(*own);
+	hm_flush((*own)->hm_dead);
+    }
+    return CL_SUCCESS;
+}
+
+void cli_delta_free(struct cl_engine *engine)
+{
+	struct cl_engine *base = engine->delta_base;
+	struct cli_matcher *root;
+	unsigned int i;
+
+
+    for(i = 0; i < DELTA_ROOTS; i++) {
+	root = *delta_root(engine, i);
+	if(root && root != *delta_root(base, i)) {
+	    delta_freeroot(engine, root->hm_dead);
+	    delta_freeroot(engine, root);
+	}
+    }
+
+    if(engine->delta_root) {
+	for(i = 0; i < CLI_MTARGETS; i++)
+	    cli_freeroot(engine, engine->delta_root[i]);
+	mpool_free(engine->mempool, engine->delta_root);
+	/* cached match state was sized for these roots */
+	cli_ac_dropcache();
+    }
+    if(engine->ignored) {
+	cli_bm_free(engine->ignored);
+	mpool_free(engine->mempool, engine->ignored);
+    }
+
+    if(engine->delta_dead) {
+	cli_hashtab_free(engine->delta_dead);
+	free(engine->delta_dead);
+    }
+
+    if(engine->cache)
+	cli_cache_destroy(engine);
+
+    if(engine->tmpdir != base->tmpdir)
+	mpool_free(engine->mempool, engine->tmpdir);
+    if(engine->pua_cats != base->pua_cats)
+	mpool_free(engine->mempool, engine->pua_cats);
+
+#ifdef USE_MPOOL
+    mpool_destroy(engine->mempool);
+#endif
+    free(engine);
+    cl_engine_free(base);
+}
+
+int cli_delta_isdead(const struct cl_engine *engine, const char *virname)
+{
+	const struct cli_element *el;
+
+
+    if(!engine->delta_dead || !virname || !(el = cli_hashtab_find(engine->delta_dead, virname, strlen(virname))))
+	return 0;
+    return el->data;
+}
+
+static struct cl_engine *delta_engine_new(struct cl_engine *base)
+{
+	struct cl_engine *new;
+
+
+    if(!(new = cli_malloc(sizeof(*new)))) {
+	cli_errmsg("cl_engine_delta: Can't allocate memory for cl_engine\n");
+	return NULL;
+    }
+    memcpy(new, base, sizeof(*new));
+    new->refcount = 1;
+    new->delta_base = base;
+    new->delta_dead = NULL;
+    new->delta_root = NULL;
+    new->ignored = NULL;
+    new->cache = NULL;
+    new->hm_hdb = new->hm_mdb = new->hm_imp = new->hm_fp = NULL;
+    new->scanwork_hits = 0;
+
+#ifdef USE_MPOOL
+    if(!(new->mempool = mpool_create())) {
+	cli_errmsg("cl_engine_delta: Can't allocate memory for memory pool\n");
+	free(new);
+	return NULL;
+    }
+#endif
+    cl_engine_addref(base);
+    return new;
+}
+
+struct cl_engine *cl_engine_delta(struct cl_engine *engine, const char *path, unsigned int *signo, unsigned int dboptions, int *err)
+{
+	struct cl_engine *base;
+	struct delta_state st;
+	struct delta_file *file;
+	char *line = NULL, *pt, db[32] = "";
+	const char *tokens[5];
+	unsigned int version, stime, to = 0, count, lineno = 0, i;
+	int ret = CL_SUCCESS, batch = 0;
+	FILE *fs = NULL;
+
+
+    memset(&st, 0, sizeof(st));
+
+    if(!engine || !path) {
+	ret = CL_ENULLARG;
+	goto done;
+    }
+    base = engine->delta_base ? engine->delta_base : engine;
+
+    if(!(base->dboptions & CL_DB_COMPILED)) {
+	cli_errmsg("cl_engine_delta: engine not compiled\n");
+	ret = CL_EARG;
+	goto done;
+    }
+    if(!(version = base->dbversion[0])) {
+	cli_dbgmsg("cl_engine_delta: daily.cvd not loaded\n");
+	ret = CL_EFORMAT;
+	goto done;
+    }
+    stime = base->dbversion[1];
+
+    if(!(fs = fopen(path, "rb"))) {
+	cli_dbgmsg("cl_engine_delta: Can't open %s\n", path);
+	ret = CL_EOPEN;
+	goto done;
+    }
+
+    if(!(line = cli_malloc(DELTA_LINE_SIZE)) || !(st.engine = delta_engine_new(base))) {
+	ret = CL_EMEM;
+	goto done;
+    }
+
+    /* batch: 0 - none open, 1 - already in the base engine, 2 - to apply */
+    while(fgets(line, DELTA_LINE_SIZE, fs)) {
+	lineno++;
+	if(!strchr(line, '\n') && !feof(fs)) {
+	    cli_errmsg("cl_engine_delta: Line %u of %s too long\n", lineno, path);
+	    ret = CL_EMALFDB;
+	    break;
+	}
+	cli_chomp(line);
+	if(!line[0] || line[0] == '#')
+	    continue;
+
+	if(!strncmp(line, "BATCH ", 6)) {
+	    count = cli_strtokenize(line, ' ', 5, tokens);
+	    if(batch || count != 4 || strlen(tokens[1]) >= sizeof(db)) {
+		ret = CL_EMALFDB;
+		break;
+	    }
+	    if(strcmp(tokens[1], "daily")) {
+		cli_dbgmsg("cl_engine_delta: Only daily.cvd updates can be applied\n");
+		ret = CL_EFORMAT;
+		break;
+	    }
+	    strcpy(db, tokens[1]);
+	    to = atoi(tokens[3]);
+	    if(to <= version) {
+		batch = 1;
+	    } else if((unsigned int) atoi(tokens[2]) != version) {
+		cli_dbgmsg("cl_engine_delta: %s doesn't continue from version %u\n", path, version);
+		ret = CL_EFORMAT;
+		break;
+	    } else {
+		batch = 2;
+	    }
+	} else if(!strncmp(line, "END ", 4)) {
+	    count = cli_strtokenize(line, ' ', 5, tokens);
+	    if(!batch || count != 3 || (unsigned int) atoi(tokens[1]) != to) {
+		ret = CL_EMALFDB;
+		break;
+	    }
+	    if(batch == 2) {
+		version = to;
+		stime = strtoul(tokens[2], &pt, 10);
+	    }
+	    batch = 0;
+	} else if(strchr("+-!", line[0])) {
+	    if(!batch) {
+		ret = CL_EMALFDB;
+		break;
+	    }
+	    if(batch == 2 && (ret = delta_line(&st, db, line)))
+		break;
+	} else {
+	    ret = CL_EMALFDB;
+	    break;
+	}
+    }
+    if(!ret && batch) {
+	cli_dbgmsg("cl_engine_delta: Incomplete batch at the end of %s\n", path);
+	ret = CL_EFORMAT;
+    }
+    if(ret) {
+	if(ret == CL_EMALFDB)
+	    cli_errmsg("cl_engine_delta: Malformed line %u in %s\n", lineno, path);
+	goto done;
+    }
+
+    if(version <= engine->dbversion[0]) {
+	if(version < engine->dbversion[0]) {
+	    cli_dbgmsg("cl_engine_delta: %s ends before version %u\n", path, engine->dbversion[0]);
+	    ret = CL_EFORMAT;
+	    goto done;
+	}
+	/* nothing new */
+	for(i = 0; i < DELTA_ROOTS; i++) {
+	    delta_freeroot(st.engine, st.dead[i]);
+	    st.dead[i] = NULL;
+	}
+	cl_engine_addref(engine);
+	cl_engine_free(st.engine);
+	st.engine = engine;
+	goto done;
+    }
+
+    if((ret = delta_load(&st, signo, dboptions)))
+	goto done;
+
+    if(cli_cache_init(st.engine)) {
+	ret = CL_EMEM;
+	goto done;
+    }
+
+    st.engine->dbversion[0] = version;
+    st.engine->dbversion[1] = stime;
+    cli_dbgmsg("cl_engine_delta: daily.cvd %u -> %u, %u signatures added, %u removed\n", base->dbversion[0], version, st.added, st.removed);
+
+done:
+    if(fs)
+	fclose(fs);
+    free(line);
+    while((file = st.files)) {
+	st.files = file->next;
+	free(file->name);
+	free(file->data);
+	free(file);
+    }
+    if(st.engine && st.engine != engine) {
+	for(i = 0; i < DELTA_ROOTS; i++)
+	    delta_freeroot(st.engine, st.dead[i]);
+	if(ret) {
+	    cl_engine_free(st.engine);
+	    st.engine = NULL;
+	}
+    }
+    if(err)
+	*err = ret;
+    return ret ? NULL : st.engine;
+}
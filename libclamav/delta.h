@@ -0,0 +1,42 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __DELTA_H
+#define __DELTA_H
+
+#include "clamav.h"
+
+/* name of the journal freshclam keeps in the database directory */
+#define CLI_DELTA_JOURNAL "freshclam.delta"
+
+/* how cl_engine_delta() killed a signature name */
+#define CLI_DELTA_REMOVED 1
+#define CLI_DELTA_IGNORED 2
+
+/* called by cl_engine_free() for engines made by cl_engine_delta() */
+void cli_delta_free(struct cl_engine *engine);
+
+/* 0 if virname is alive, CLI_DELTA_REMOVED or CLI_DELTA_IGNORED if not */
+int cli_delta_isdead(const struct cl_engine *engine, const char *virname);
+
+/* a match in root, one of the roots shared with the base engine, is of a
+ * signature the delta removed; the scan goes on as if it didn't match */
+#define cli_delta_dead(engine, root, virname) \
+    ((engine)->delta_dead && (root) == (engine)->root[(root)->type] && cli_delta_isdead((engine), (virname)))
+
+#endif
@@ -57,6 +57,7 @@
 #include "scanners.h"
 #include "sf_base64decode.h"
 #include "adc.h"
+#include "inflate_iface.h"
 
 /* #define DEBUG_DMG_PARSE */
 /* #define DEBUG_DMG_BZIP */
@@ -91,7 +92,7 @@ static int dmg_decode_mish(cli_ctx *, unsigned int *, xmlChar *, struct dmg_mish
 #endif
 static int cmp_mish_stripes(const void * stripe_a, const void * stripe_b);
 static int dmg_track_sectors(uint64_t *, uint8_t *, uint32_t, uint32_t, uint64_t);
-static int dmg_handle_mish(cli_ctx *, unsigned int, char *, uint64_t, struct dmg_mish_with_stripes *);
+static int dmg_handle_mish(cli_ctx *, unsigned int, uint64_t, struct dmg_mish_with_stripes *);
 
 int cli_scandmg(cli_ctx *ctx)
 {
@@ -158,25 +159,25 @@ int cli_scandmg(cli_ctx *ctx)
         return CL_EFORMAT;
     }
 
-    /* Create temp folder for contents */
-    if (!(dirname = cli_gentemp(ctx->engine->tmpdir))) {
-        return CL_ETMPDIR;
-    }
-    if (mkdir(dirname, 0700)) {
-        cli_errmsg("cli_scandmg: Cannot create temporary directory %s\n", dirname);
-        free(dirname);
-        return CL_ETMPDIR;
-    }
-    cli_dbgmsg("cli_scandmg: Extracting into %s\n", dirname);
-
     /* Dump XML to tempfile, if needed */
     if (ctx->engine->keeptmp && !(ctx->engine->engine_options & ENGINE_OPTIONS_FORCE_TO_DISK)) {
         int xret;
+
+        if (!(dirname = cli_gentemp(ctx->engine->tmpdir))) {
+            return CL_ETMPDIR;
+        }
+        if (mkdir(dirname, 0700)) {
+            cli_errmsg("cli_scandmg: Cannot create temporary directory %s\n", dirname);
+            free(dirname);
+            return CL_ETMPDIR;
+        }
+        cli_dbgmsg("cli_scandmg: Extracting into %s\n", dirname);
+
         xret = dmg_extract_xml(ctx, dirname, &hdr);
+        free(dirname);
 
         if (xret != CL_SUCCESS) {
             /* Printed err detail inside dmg_extract_xml */
-            free(dirname);
             return xret;
         }
     }
@@ -185,9 +186,6 @@ int cli_scandmg(cli_ctx *ctx)
     ret = cli_map_scan(*ctx->fmap, (off_t)hdr.xmlOffset, (size_t)hdr.xmlLength, ctx, CL_TYPE_ANY);
     if (ret != CL_CLEAN) {
         cli_dbgmsg("cli_scandmg: retcode from scanning TOC xml: %s\n", cl_strerror(ret));
-        if (!ctx->engine->keeptmp)
-            cli_rmdirs(dirname);
-        free(dirname);
         return ret;
     }
 
@@ -195,9 +193,6 @@ int cli_scandmg(cli_ctx *ctx)
     outdata = fmap_need_off_once_len(*ctx->fmap, hdr.xmlOffset, hdr.xmlLength, &nread);
     if (!outdata || (nread != hdr.xmlLength)) {
         cli_errmsg("cli_scandmg: Failed getting XML from map, len %d\n", (int)hdr.xmlLength);
-        if (!ctx->engine->keeptmp)
-            cli_rmdirs(dirname);
-        free(dirname);
         return CL_EMAP;
     }
 
@@ -215,9 +210,6 @@ int cli_scandmg(cli_ctx *ctx)
     reader = xmlReaderForMemory(outdata, (int)hdr.xmlLength, "toc.xml", NULL, DMG_XML_PARSE_OPTS);
     if (!reader) {
         cli_dbgmsg("cli_scandmg: Failed parsing XML!\n");
-        if (!ctx->engine->keeptmp)
-            cli_rmdirs(dirname);
-        free(dirname);
         return CL_EFORMAT;
     }
 
@@ -471,7 +463,7 @@ int cli_scandmg(cli_ctx *ctx)
     file = 0;
     while ((ret == CL_CLEAN) && (mish_list != NULL)) {
         /* Handle & scan mish block */
-        ret = dmg_handle_mish(ctx, file++, dirname, hdr.xmlOffset, mish_list);
+        ret = dmg_handle_mish(ctx, file++, hdr.xmlOffset, mish_list);
         free(mish_list->mish);
         mish_list_tail = mish_list;
         mish_list = mish_list->next;
@@ -486,9 +478,6 @@ int cli_scandmg(cli_ctx *ctx)
         mish_list = mish_list->next;
         free(mish_list_tail);
     }
-    if (!ctx->engine->keeptmp)
-        cli_rmdirs(dirname);
-    free(dirname);
     return ret;
 }
 
@@ -647,384 +636,234 @@ static int dmg_track_sectors(uint64_t *total, uint8_t *data_to_write,
 }
 
 /* Stripe handling: zero block (type 0x0 or 0x2) */
-static int dmg_stripe_zeroes(cli_ctx *ctx, int fd, uint32_t index, struct dmg_mish_with_stripes *mish_set)
+static int dmg_stripe_zeroes(fmap_extents_t *part, uint32_t index, struct dmg_mish_with_stripes *mish_set)
 {
-    int ret = CL_CLEAN;
     size_t len = mish_set->stripes[index].sectorCount * DMG_SECTOR_SIZE;
-    ssize_t written;
-    uint8_t obuf[BUFSIZ];
-
-    UNUSEDPARAM(ctx);
 
     cli_dbgmsg("dmg_stripe_zeroes: stripe " STDu32 "\n", index);
-    if (len == 0)
-        return CL_CLEAN;
-
-    memset(obuf, 0, sizeof(obuf));
-    while (len > sizeof(obuf)) {
-        written = cli_writen(fd, obuf, sizeof(obuf));
-        if ((size_t)written != sizeof(obuf)) {
-            ret = CL_EWRITE;
-            break;
-        }
-        len -= sizeof(obuf);
-    }
-
-    if ((ret == CL_CLEAN) && (len > 0)) {
-        written = cli_writen(fd, obuf, len);
-        if ((size_t)written != len) {
-            ret = CL_EWRITE;
-        }
-    }
-
-    if (ret != CL_CLEAN) {
-        cli_errmsg("dmg_stripe_zeroes: error writing bytes to file (out of disk space?)\n");
-        return CL_EWRITE;
-    }
-    return CL_CLEAN;
+    return fmap_extents_add_zero(part, len);
 }
 
 /* Stripe handling: stored block (type 0x1) */
-static int dmg_stripe_store(cli_ctx *ctx, int fd, uint32_t index, struct dmg_mish_with_stripes *mish_set)
+static int dmg_stripe_store(fmap_extents_t *part, uint32_t index, struct dmg_mish_with_stripes *mish_set)
 {
-    const void *obuf;
     size_t off = mish_set->stripes[index].dataOffset;
     size_t len = mish_set->stripes[index].dataLength;
-    ssize_t written;
 
     cli_dbgmsg("dmg_stripe_store: stripe " STDu32 "\n", index);
-    if (len == 0)
-        return CL_CLEAN;
-
-    obuf = (void *)fmap_need_off_once(*ctx->fmap, off, len);
-    if (!obuf) {
-        cli_warnmsg("dmg_stripe_store: fmap need failed on stripe " STDu32 "\n", index);
-        return CL_EMAP;
-    }
-    written = cli_writen(fd, obuf, len);
-    if (written < 0) {
-        cli_errmsg("dmg_stripe_store: error writing bytes to file (out of disk space?)\n");
-        return CL_EWRITE;
-    }
-    else if ((size_t)written != len) {
-        cli_errmsg("dmg_stripe_store: error writing bytes to file (out of disk space?)\n");
-        return CL_EWRITE;
-    }
-    return CL_CLEAN;
+    return fmap_extents_add(part, off, len);
 }
 
-/* Stripe handling: ADC block (type 0x80000004) */
-static int dmg_stripe_adc(cli_ctx *ctx, int fd, uint32_t index, struct dmg_mish_with_stripes *mish_set)
-{
-    int adcret;
-    adc_stream strm;
-    size_t off = mish_set->stripes[index].dataOffset;
-    size_t len = mish_set->stripes[index].dataLength;
-    uint64_t size_so_far = 0;
-    uint64_t expected_len = mish_set->stripes[index].sectorCount * DMG_SECTOR_SIZE;
-    uint8_t obuf[BUFSIZ];
-
-    cli_dbgmsg("dmg_stripe_adc: stripe " STDu32 " initial len " STDu64 " expected len " STDu64 "\n",
-            index, (uint64_t)len, (uint64_t)expected_len);
-    if (len == 0)
-        return CL_CLEAN;
+/*
+ * Stripe decoders, called for each window of a stripe when it is first
+ * read. The stream is kept between windows and picks up where the last
+ * one ended.
+ */
 
-    memset(&strm, 0, sizeof(strm));
-    strm.next_in = (uint8_t *)fmap_need_off_once(*ctx->fmap, off, len);
-    if (!strm.next_in) {
-        cli_warnmsg("dmg_stripe_adc: fmap need failed on stripe " STDu32 "\n", index);
-        return CL_EMAP;
-    }
-    strm.avail_in = len;
-    strm.next_out = obuf;
-    strm.avail_out = sizeof(obuf);
+/* ADC decoder */
+struct dmg_adc_state {
+    adc_stream strm;
+    size_t in;
+    int end;
+};
 
-    adcret = adc_decompressInit(&strm);
-    if(adcret != ADC_OK) {
-        cli_warnmsg("dmg_stripe_adc: adc_decompressInit failed\n");
-        return CL_EMEM;
+static ssize_t dmg_decode_adc(void **state, const void *src, size_t srclen, unsigned char *dst, size_t dstlen)
+{
+    struct dmg_adc_state *st = *state;
+    int adcret = ADC_OK;
+    size_t got = 0;
+
+    if (!dst) {
+        if (st) {
+            adc_decompressEnd(&st->strm);
+            free(st);
+            *state = NULL;
+        }
+        return 0;
     }
-
-    while(adcret == ADC_OK) {
-        int written;
-        if (size_so_far > expected_len) {
-            cli_warnmsg("dmg_stripe_adc: expected size exceeded!\n");
-            adc_decompressEnd(&strm);
-            return CL_EFORMAT;
+    if (!st) {
+        if (!(st = cli_calloc(1, sizeof(*st)))) {
+            cli_warnmsg("dmg_decode_adc: out of memory\n");
+            return -1;
         }
-        adcret = adc_decompress(&strm);
-        switch(adcret) {
-            case ADC_OK:
-                if(strm.avail_out == 0) {
-                    if ((written=cli_writen(fd, obuf, sizeof(obuf)))!=sizeof(obuf)) {
-                        cli_errmsg("dmg_stripe_adc: failed write to output file\n");
-                        adc_decompressEnd(&strm);
-                        return CL_EWRITE;
-                    }
-                    size_so_far += written;
-                    strm.next_out = obuf;
-                    strm.avail_out = sizeof(obuf);
-                }
-                continue;
-            case ADC_STREAM_END:
-            default:
-                written = sizeof(obuf) - strm.avail_out;
-                if (written) {
-                    if ((cli_writen(fd, obuf, written))!=written) {
-                        cli_errmsg("dmg_stripe_adc: failed write to output file\n");
-                        adc_decompressEnd(&strm);
-                        return CL_EWRITE;
-                    }
-                    size_so_far += written;
-                    strm.next_out = obuf;
-                    strm.avail_out = sizeof(obuf);
-                }
-                if (adcret == ADC_STREAM_END)
-                    break;
-                cli_dbgmsg("dmg_stripe_adc: after writing " STDu64 " bytes, "
-                           "got error %d decompressing stripe " STDu32 "\n",
-                           size_so_far, adcret, index);
-                adc_decompressEnd(&strm);
-                return CL_EFORMAT;
+        if (adc_decompressInit(&st->strm) != ADC_OK) {
+            cli_warnmsg("dmg_decode_adc: adc_decompressInit failed\n");
+            free(st);
+            return -1;
         }
-        break;
-    }
-
-    adc_decompressEnd(&strm);
-    cli_dbgmsg("dmg_stripe_adc: stripe " STDu32 " actual len " STDu64 " expected len " STDu64 "\n",
-            index, size_so_far, expected_len);
-    return CL_CLEAN;
+        *state = st;
+    }
+
+    st->strm.next_in = (uint8_t *)src + st->in;
+    st->strm.avail_in = srclen - st->in;
+    st->strm.next_out = dst;
+    st->strm.avail_out = dstlen;
+    while (!st->end && st->strm.avail_out) {
+        adcret = adc_decompress(&st->strm);
+        if (adcret != ADC_OK)
+            st->end = 1;
+    }
+    got = dstlen - st->strm.avail_out;
+    st->in = srclen - st->strm.avail_in;
+    if ((adcret != ADC_OK) && (adcret != ADC_STREAM_END))
+        cli_dbgmsg("dmg_decode_adc: after " STDu64 " bytes, got error %d\n",
+                   (uint64_t)st->strm.total_out, adcret);
+    return got;
 }
 
-/* Stripe handling: deflate block (type 0x80000005) */
-static int dmg_stripe_inflate(cli_ctx *ctx, int fd, uint32_t index, struct dmg_mish_with_stripes *mish_set)
-{
-    int zstat;
-    z_stream strm;
-    size_t off = mish_set->stripes[index].dataOffset;
-    size_t len = mish_set->stripes[index].dataLength;
-    uint64_t size_so_far = 0;
-    uint64_t expected_len = mish_set->stripes[index].sectorCount * DMG_SECTOR_SIZE;
-    uint8_t obuf[BUFSIZ];
-
-    cli_dbgmsg("dmg_stripe_inflate: stripe " STDu32 "\n", index);
-    if (len == 0)
-        return CL_CLEAN;
-
-    memset(&strm, 0, sizeof(strm));
-    strm.next_in = (void*)fmap_need_off_once(*ctx->fmap, off, len);
-    if (!strm.next_in) {
-        cli_warnmsg("dmg_stripe_inflate: fmap need failed on stripe " STDu32 "\n", index);
-        return CL_EMAP;
-    }
-    strm.avail_in = len;
-    strm.next_out = obuf;
-    strm.avail_out = sizeof(obuf);
+/* Deflate decoder */
+struct dmg_inflate_state {
+    struct cli_zstream strm;
+    size_t in;
+    int end;
+};
 
-    zstat = inflateInit(&strm);
-    if(zstat != Z_OK) {
-        cli_warnmsg("dmg_stripe_inflate: inflateInit failed\n");
-        return CL_EMEM;
+static ssize_t dmg_decode_inflate(void **state, const void *src, size_t srclen, unsigned char *dst, size_t dstlen)
+{
+    struct dmg_inflate_state *st = *state;
+    int zstat = Z_OK;
+    size_t want, used, got = 0;
+
+    if (!dst) {
+        if (st) {
+            if (!st->end)
+                cli_inflate_end(&st->strm);
+            free(st);
+            *state = NULL;
+        }
+        return 0;
     }
-
-    while(strm.avail_in) {
-        int written;
-        if (size_so_far > expected_len) {
-            cli_warnmsg("dmg_stripe_inflate: expected size exceeded!\n");
-            inflateEnd(&strm);
-            return CL_EFORMAT;
+    if (!st) {
+        if (!(st = cli_calloc(1, sizeof(*st)))) {
+            cli_warnmsg("dmg_decode_inflate: out of memory\n");
+            return -1;
         }
-        zstat = inflate(&strm, Z_NO_FLUSH);   /* zlib */
-        switch(zstat) {
-            case Z_OK:
-                if(strm.avail_out == 0) {
-                    if ((written=cli_writen(fd, obuf, sizeof(obuf)))!=sizeof(obuf)) {
-                        cli_errmsg("dmg_stripe_inflate: failed write to output file\n");
-                        inflateEnd(&strm);
-                        return CL_EWRITE;
-                    }
-                    size_so_far += written;
-                    strm.next_out = (Bytef *)obuf;
-                    strm.avail_out = sizeof(obuf);
-                }
-                continue;
-            case Z_STREAM_END:
-            default:
-                written = sizeof(obuf) - strm.avail_out;
-                if (written) {
-                    if ((cli_writen(fd, obuf, written))!=written) {
-                        cli_errmsg("dmg_stripe_inflate: failed write to output file\n");
-                        inflateEnd(&strm);
-                        return CL_EWRITE;
-                    }
-                    size_so_far += written;
-                    strm.next_out = (Bytef *)obuf;
-                    strm.avail_out = sizeof(obuf);
-                    if (zstat == Z_STREAM_END)
-                        break;
-                }
-                if(strm.msg)
-                    cli_dbgmsg("dmg_stripe_inflate: after writing " STDu64 " bytes, "
-                               "got error \"%s\" inflating stripe " STDu32 "\n",
-                               size_so_far, strm.msg, index);
-                else
-                    cli_dbgmsg("dmg_stripe_inflate: after writing " STDu64 " bytes, "
-                               "got error %d inflating stripe " STDu32 "\n",
-                               size_so_far, zstat, index);
-                inflateEnd(&strm);
-                return CL_EFORMAT;
+        *state = st;
+        /* a stripe that fits the window is decoded in one go */
+        used = srclen;
+        got = dstlen;
+        if (cli_inflate_buffer_native(src, &used, dst, &got, MAX_WBITS, NULL) == Z_OK) {
+            st->end = 1;
+            return got;
+        }
+        got = 0;
+        if ((zstat = cli_inflate_init(&st->strm, MAX_WBITS, NULL)) != Z_OK) {
+            st->end = 1;
+            return zstat == Z_MEM_ERROR ? -1 : 0;
         }
-        break;
     }
 
-    if(strm.avail_out != sizeof(obuf)) {
-        if(cli_writen(fd, obuf, sizeof(obuf) - strm.avail_out) < 0) {
-            cli_errmsg("dmg_stripe_inflate: failed write to output file\n");
-            inflateEnd(&strm);
-            return CL_EWRITE;
+    while (!st->end && got < dstlen) {
+        want = MIN(dstlen - got, UINT_MAX);
+        st->strm.next_in = (unsigned char *)src + st->in;
+        st->strm.avail_in = used = MIN(srclen - st->in, UINT_MAX);
+        st->strm.next_out = dst + got;
+        st->strm.avail_out = want;
+        zstat = cli_inflate(&st->strm, Z_NO_FLUSH);
+        st->in += used - st->strm.avail_in;
+        got += want - st->strm.avail_out;
+        if (zstat != Z_OK) {
+            cli_inflate_end(&st->strm);
+            st->end = 1;
         }
     }
-
-    inflateEnd(&strm);
-    return CL_CLEAN;
+    if (zstat == Z_MEM_ERROR) {
+        cli_warnmsg("dmg_decode_inflate: out of memory\n");
+        return -1;
+    }
+    /* Z_BUF_ERROR: input exhausted, keep what we have */
+    if ((zstat != Z_OK) && (zstat != Z_STREAM_END) && (zstat != Z_BUF_ERROR))
+        cli_dbgmsg("dmg_decode_inflate: after " STDu64 " bytes, got error %d\n",
+                   (uint64_t)st->strm.total_out, zstat);
+    return got;
 }
 
-/* Stripe handling: bzip block (type 0x80000006) */
-static int dmg_stripe_bzip(cli_ctx *ctx, int fd, uint32_t index, struct dmg_mish_with_stripes *mish_set)
-{
-    int ret = CL_CLEAN;
-    size_t off = mish_set->stripes[index].dataOffset;
-    size_t len = mish_set->stripes[index].dataLength;
-    uint64_t size_so_far = 0;
-    uint64_t expected_len = mish_set->stripes[index].sectorCount * DMG_SECTOR_SIZE;
 #if HAVE_BZLIB_H
-    int rc;
+/* bzip2 decoder */
+struct dmg_bzip_state {
     bz_stream strm;
-    uint8_t obuf[BUFSIZ];
-#endif
-
-    cli_dbgmsg("dmg_stripe_bzip: stripe " STDu32 " initial len " STDu64 " expected len " STDu64 "\n",
-            index, (uint64_t)len, (uint64_t)expected_len);
-
-#if HAVE_BZLIB_H
-    memset(&strm, 0, sizeof(strm));
-    strm.next_out = (char *)obuf;
-    strm.avail_out = sizeof(obuf);
-    if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) {
-        cli_dbgmsg("dmg_stripe_bzip: bzDecompressInit failed\n");
-        return CL_EOPEN;
-    }
-
-    do {
-        if (size_so_far > expected_len) {
-            cli_warnmsg("dmg_stripe_bzip: expected size exceeded!\n");
-            ret = CL_EFORMAT;
-            break;
-        }
-        if (strm.avail_in == 0) {
-            size_t next_len = (len > sizeof(obuf)) ? sizeof(obuf) : len;
-            dmg_bzipmsg("dmg_stripe_bzip: off %lu len %lu next_len %lu\n", off, len, next_len);
-            strm.next_in = (void*)fmap_need_off_once(*ctx->fmap, off, next_len);
-            if (strm.next_in == NULL) {
-                cli_dbgmsg("dmg_stripe_bzip: expected more stream\n");
-                ret = CL_EMAP;
-                break;
-            }
-            strm.avail_in = next_len;
-            len -= next_len;
-            off += next_len;
-        }
+    size_t in;
+    int end;
+};
 
-        dmg_bzipmsg("dmg_stripe_bzip: before = strm.avail_in %lu strm.avail_out: %lu\n", strm.avail_in, strm.avail_out);
-        rc = BZ2_bzDecompress(&strm);
-        if ((rc != BZ_OK) && (rc != BZ_STREAM_END)) {
-            cli_dbgmsg("dmg_stripe_bzip: decompress error: %d\n", rc);
-            ret = CL_EFORMAT;
-            break;
+static ssize_t dmg_decode_bzip(void **state, const void *src, size_t srclen, unsigned char *dst, size_t dstlen)
+{
+    struct dmg_bzip_state *st = *state;
+    int rc = BZ_OK;
+    size_t used, room;
+
+    if (!dst) {
+        if (st) {
+            BZ2_bzDecompressEnd(&st->strm);
+            free(st);
+            *state = NULL;
         }
-
-        dmg_bzipmsg("dmg_stripe_bzip: after = strm.avail_in %lu strm.avail_out: %lu rc: %d %d\n",
-                strm.avail_in, strm.avail_out, rc, BZ_STREAM_END);
-        /* Drain output buffer */
-        if (!strm.avail_out) {
-            size_t next_write = sizeof(obuf);
-            do {
-                size_so_far += next_write;
-                dmg_bzipmsg("dmg_stripe_bzip: size_so_far: " STDu64 " next_write: %lu\n", size_so_far, next_write);
-                if (size_so_far > expected_len) {
-                    cli_warnmsg("dmg_stripe_bzip: expected size exceeded!\n");
-                    ret = CL_EFORMAT;
-                    rc = BZ_DATA_ERROR; /* prevent stream end block */
-                    break;
-                }
-
-                ret = cli_checklimits("dmg_stripe_bzip", ctx, (unsigned long)(size_so_far + sizeof(obuf)), 0, 0);
-                if (ret != CL_CLEAN) {
-                    break;
-                }
-
-                if ((size_t)cli_writen(fd, obuf, next_write) != next_write) {
-                    cli_dbgmsg("dmg_stripe_bzip: error writing to tmpfile\n");
-                    ret = CL_EWRITE;
-                    break;
-                }
-
-                strm.next_out = (char *)obuf;
-                strm.avail_out = sizeof(obuf);
-
-                if (rc == BZ_OK)
-                    rc = BZ2_bzDecompress(&strm);
-                if ((rc != BZ_OK) && (rc != BZ_STREAM_END)) {
-                    cli_dbgmsg("dmg_stripe_bzip: decompress error: %d\n", rc);
-                    ret = CL_EFORMAT;
-                    break;
-                }
-            } while (!strm.avail_out);
+        return 0;
+    }
+    if (!st) {
+        if (!(st = cli_calloc(1, sizeof(*st)))) {
+            cli_warnmsg("dmg_decode_bzip: out of memory\n");
+            return -1;
         }
-        /* Stream end, so write data if any remains in buffer */
-        if (rc == BZ_STREAM_END) {
-            size_t next_write = sizeof(obuf) - strm.avail_out;
-            size_so_far += next_write;
-            dmg_bzipmsg("dmg_stripe_bzip: size_so_far: " STDu64 " next_write: %lu\n", size_so_far, next_write);
-
-            ret = cli_checklimits("dmg_stripe_bzip", ctx, (unsigned long)(size_so_far + sizeof(obuf)), 0, 0);
-            if (ret != CL_CLEAN) {
-                break;
-            }
-
-            if ((size_t)cli_writen(fd, obuf, next_write) != next_write) {
-                cli_dbgmsg("dmg_stripe_bzip: error writing to tmpfile\n");
-                ret = CL_EWRITE;
-                break;
-            }
-
-            strm.next_out = (char *)obuf;
-            strm.avail_out = sizeof(obuf);
+        if (BZ2_bzDecompressInit(&st->strm, 0, 0) != BZ_OK) {
+            cli_dbgmsg("dmg_decode_bzip: bzDecompressInit failed\n");
+            free(st);
+            return -1;
         }
-    } while ((rc == BZ_OK) && (len > 0));
-
-    BZ2_bzDecompressEnd(&strm);
+        *state = st;
+    }
+
+    st->strm.next_out = (char *)dst;
+    st->strm.avail_out = MIN(dstlen, UINT_MAX);
+    while (!st->end && st->strm.avail_out) {
+        st->strm.next_in = (char *)src + st->in;
+        st->strm.avail_in = used = MIN(srclen - st->in, UINT_MAX);
+        room = st->strm.avail_out;
+        dmg_bzipmsg("dmg_decode_bzip: before = strm.avail_in %lu strm.avail_out: %lu\n", st->strm.avail_in, st->strm.avail_out);
+        rc = BZ2_bzDecompress(&st->strm);
+        dmg_bzipmsg("dmg_decode_bzip: after = strm.avail_in %lu strm.avail_out: %lu rc: %d\n",
+                st->strm.avail_in, st->strm.avail_out, rc);
+        st->in += used - st->strm.avail_in;
+        /* out of input with nothing left to flush */
+        if (rc != BZ_OK || (used == st->strm.avail_in && room == st->strm.avail_out))
+            st->end = 1;
+    }
+    if ((rc != BZ_OK) && (rc != BZ_STREAM_END))
+        cli_dbgmsg("dmg_decode_bzip: decompress error: %d\n", rc);
+
+    return MIN(dstlen, UINT_MAX) - st->strm.avail_out;
+}
 #endif
 
-    if (ret == CL_CLEAN) {
-        if (size_so_far != expected_len) {
-            cli_dbgmsg("dmg_stripe_bzip: output does not match expected size!\n");
-        }
+/* Stripe handling: compressed block, decoded on first access */
+static int dmg_stripe_decoded(fmap_extents_t *part, uint32_t index, struct dmg_mish_with_stripes *mish_set,
+        fmap_extent_decoder decode)
+{
+    size_t off = mish_set->stripes[index].dataOffset;
+    size_t len = mish_set->stripes[index].dataLength;
+    size_t expected_len = mish_set->stripes[index].sectorCount * DMG_SECTOR_SIZE;
+
+    cli_dbgmsg("dmg_stripe_decoded: stripe " STDu32 " type " STDx32 " initial len " STDu64 " expected len " STDu64 "\n",
+            index, mish_set->stripes[index].type, (uint64_t)len, (uint64_t)expected_len);
+    if (len == 0) {
+        /* nothing to decode, the sectors still take up room in the partition */
+        return fmap_extents_add_zero(part, expected_len);
     }
-    return ret;
+    return fmap_extents_add_decoded(part, off, len, expected_len, decode);
 }
 
 /* Given mish data, reconstruct the partition details */
-static int dmg_handle_mish(cli_ctx *ctx, unsigned int mishblocknum, char *dir,
+static int dmg_handle_mish(cli_ctx *ctx, unsigned int mishblocknum,
         uint64_t xmlOffset, struct dmg_mish_with_stripes *mish_set)
 {
     struct dmg_block_data *blocklist = mish_set->stripes;
     uint64_t totalSectors = 0;
     uint32_t i;
     unsigned long projected_size;
-    int ret = CL_CLEAN, ofd;
+    int ret = CL_CLEAN;
     uint8_t sorted = 1, writeable_data = 0;
-    char outfile[NAME_MAX + 1];
+    fmap_extents_t *part;
+    fmap_t *map;
 
     /* First loop, fix endian-ness and check if already sorted */
     for (i = 0; i < mish_set->mish->blockDataCount; i++) {
@@ -1076,37 +915,32 @@ static int dmg_handle_mish(cli_ctx *ctx, unsigned int mishblocknum, char *dir,
         return ret;
     }
 
-    /* Prepare for file */
-    snprintf(outfile, sizeof(outfile)-1, "%s"PATHSEP"dmg%02u", dir, mishblocknum);
-    outfile[sizeof(outfile)-1] = '\0';
-    ofd = open(outfile, O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
-    if (ofd < 0) {
-        char err[128];
-        cli_errmsg("cli_scandmg: Can't create temporary file %s: %s\n", 
-            outfile, cli_strerror(errno, err, sizeof(err)));
-        return CL_ETMPFILE;
+    /* Assemble the partition in place, stripe by stripe */
+    if (!(part = fmap_extents_new(*ctx->fmap))) {
+        return CL_EMEM;
     }
-    cli_dbgmsg("dmg_handle_mish: extracting block %u to %s\n", mishblocknum, outfile);
+    cli_dbgmsg("dmg_handle_mish: mapping block %u\n", mishblocknum);
 
-    /* Push data, stripe by stripe */
     for(i=0; i < mish_set->mish->blockDataCount && ret == CL_CLEAN; i++) {
         switch (blocklist[i].type) {
             case DMG_STRIPE_EMPTY:
             case DMG_STRIPE_ZEROES:
-                ret = dmg_stripe_zeroes(ctx, ofd, i, mish_set);
+                ret = dmg_stripe_zeroes(part, i, mish_set);
                 break;
             case DMG_STRIPE_STORED:
-                ret = dmg_stripe_store(ctx, ofd, i, mish_set);
+                ret = dmg_stripe_store(part, i, mish_set);
                 break;
             case DMG_STRIPE_ADC:
-                ret = dmg_stripe_adc(ctx, ofd, i, mish_set);
+                ret = dmg_stripe_decoded(part, i, mish_set, dmg_decode_adc);
                 break;
             case DMG_STRIPE_DEFLATE:
-                ret = dmg_stripe_inflate(ctx, ofd, i, mish_set);
+                ret = dmg_stripe_decoded(part, i, mish_set, dmg_decode_inflate);
                 break;
+#if HAVE_BZLIB_H
             case DMG_STRIPE_BZ:
-                ret = dmg_stripe_bzip(ctx, ofd, i, mish_set);
+                ret = dmg_stripe_decoded(part, i, mish_set, dmg_decode_bzip);
                 break;
+#endif
             case DMG_STRIPE_SKIP:
             case DMG_STRIPE_END:
             default:
@@ -1116,14 +950,16 @@ static int dmg_handle_mish(cli_ctx *ctx, unsigned int mishblocknum, char *dir,
     }
 
     /* If okay so far, scan rebuilt partition */
-    if (ret == CL_CLEAN) {
-        ret = cli_partition_scandesc(ofd, ctx);
+    if (ret != CL_CLEAN) {
+        fmap_extents_free(part);
+        return ret;
     }
+    if (!(map = fmap_extents_map(part))) {
+        return CL_CLEAN;
+    }
+    ret = cli_map_scan(map, 0, map->len, ctx, CL_TYPE_PART_ANY);
+    funmap(map);
 
-    close(ofd);
-    if (!ctx->engine->keeptmp)
-        if (cli_unlink(outfile)) return CL_EUNLINK;
-    
     return ret;
 }
 
@@ -0,0 +1,324 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "clamav.h"
+#include "others.h"
+#include "scanners.h"
+#include "inflate_iface.h"
+#include "dsink.h"
+
+/* buffers of this size are kept around for reuse by later sinks */
+#define DSINK_IDLE_SIZE (1024 * 1024)
+#define DSINK_MAX_IDLE 16
+
+#ifdef CL_THREAD_SAFE
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+#else
+#define pthread_mutex_lock(x)
+#define pthread_mutex_unlock(x)
+#endif
+static unsigned char *idle_bufs[DSINK_MAX_IDLE];
+static unsigned int idle_count = 0;
+
+static unsigned char *buf_get(void)
+{
+    unsigned char *buf = NULL;
+
+    pthread_mutex_lock(&idle_mutex);
+    if (idle_count)
+        buf = idle_bufs[--idle_count];
+    pthread_mutex_unlock(&idle_mutex);
+
+    if (!buf)
+        buf = cli_malloc(DSINK_IDLE_SIZE);
+    return buf;
+}
+
+static void buf_put(unsigned char *buf, size_t size)
+{
+    if (buf && size == DSINK_IDLE_SIZE) {
+        pthread_mutex_lock(&idle_mutex);
+        if (idle_count < DSINK_MAX_IDLE) {
+            idle_bufs[idle_count++] = buf;
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&idle_mutex);
+    }
+    free(buf);
+}
+
+void cli_dsink_init(struct cli_dsink *sink, cli_ctx *ctx, const char *who, char *path)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->ctx = ctx;
+    sink->who = who;
+    sink->fd = -1;
+    sink->path = path;
+}
+
+/* move the output to a temporary file, the buffer becomes the write window */
+static int dsink_open(struct cli_dsink *sink)
+{
+    if (!sink->path) {
+        if (!(sink->path = cli_gentemp(sink->ctx->engine->tmpdir)))
+            return CL_EMEM;
+        sink->ownpath = 1;
+    }
+
+    if ((sink->fd = open(sink->path, O_RDWR|O_CREAT|O_TRUNC|O_BINARY, S_IRUSR|S_IWUSR)) == -1) {
+        cli_warnmsg("%s: failed to create temporary file %s\n", sink->who, sink->path);
+        return CL_ETMPFILE;
+    }
+
+    if (sink->len && cli_writen(sink->fd, sink->buf, sink->len) != (int)sink->len) {
+        cli_warnmsg("%s: failed to write %lu bytes to %s\n", sink->who, (unsigned long)sink->len, sink->path);
+        return CL_EWRITE;
+    }
+
+    return CL_SUCCESS;
+}
+
+unsigned char *cli_dsink_space(struct cli_dsink *sink, size_t *avail)
+{
+    if (!sink->buf) {
+        if (!(sink->buf = buf_get())) {
+            cli_errmsg("%s: can't allocate output buffer\n", sink->who);
+            return NULL;
+        }
+        sink->size = DSINK_IDLE_SIZE;
+    }
+
+    if (sink->fd >= 0) {
+        *avail = sink->size;
+        return sink->buf;
+    }
+
+    if (sink->size - sink->len < CLI_DSINK_WINDOW) {
+        if (sink->len + CLI_DSINK_WINDOW > CLI_DSINK_MEMMAX) {
+            cli_dbgmsg("%s: output larger than %u bytes, spilling to disk\n", sink->who, CLI_DSINK_MEMMAX);
+            if (dsink_open(sink) != CL_SUCCESS)
+                return NULL;
+
+            *avail = sink->size;
+            return sink->buf;
+        } else {
+            size_t size = sink->size * 2;
+            unsigned char *buf;
+
+            if (size > CLI_DSINK_MEMMAX)
+                size = CLI_DSINK_MEMMAX;
+
+            if (!(buf = cli_realloc(sink->buf, size))) {
+                cli_errmsg("%s: can't grow output buffer to %lu bytes\n", sink->who, (unsigned long)size);
+                return NULL;
+            }
+            sink->buf = buf;
+            sink->size = size;
+        }
+    }
+
+    *avail = sink->size - sink->len;
+    return sink->buf + sink->len;
+}
+
+/*
+ * Accounts for produced bytes written to the last cli_dsink_space() window
+ * and consumed input bytes. Returns CL_BREAK when a limit says to stop
+ * decompressing; the data committed so far should still be scanned.
+ * Returns CL_VIRUS when the output outgrows the input by more than the
+ * engine's MaxCompressionRatio.
+ */
+int cli_dsink_commit(struct cli_dsink *sink, size_t produced, size_t consumed)
+{
+    cli_ctx *ctx = sink->ctx;
+    uint64_t out;
+
+    sink->in += consumed;
+    if (!produced)
+        return CL_SUCCESS;
+
+    out = (uint64_t)sink->len + produced;
+    if (ctx->engine->maxratio && out > CLI_DSINK_RATIO_MINOUT &&
+        out / (sink->in ? sink->in : 1) > ctx->engine->maxratio) {
+        cli_dbgmsg("%s: %llu bytes out of %llu in, ratio above %u:1 (decompression bomb?)\n", sink->who,
+                   (long long unsigned)out, (long long unsigned)sink->in, ctx->engine->maxratio);
+        sink->limited = 1;
+        if (!ctx->limit_exceeded) {
+            cli_append_virus(ctx, "Heuristic.Limits.Exceeded.Ratio");
+            ctx->limit_exceeded = 1;
+        }
+        /* with --allmatch the output committed so far is still scanned */
+        return SCAN_ALL ? CL_BREAK : CL_VIRUS;
+    }
+
+    if (cli_checklimits(sink->who, ctx, out, 0, 0) != CL_CLEAN) {
+        /* keep the part of this window that still fits, the output is
+         * scanned up to the limit as it was before the sink */
+        uint64_t allowed = out;
+
+        if (ctx->engine->maxfilesize && allowed > ctx->engine->maxfilesize)
+            allowed = ctx->engine->maxfilesize;
+        if (ctx->engine->maxscansize && allowed > ctx->engine->maxscansize - MIN(ctx->scansize, ctx->engine->maxscansize))
+            allowed = ctx->engine->maxscansize - MIN(ctx->scansize, ctx->engine->maxscansize);
+        produced = allowed > sink->len ? allowed - sink->len : 0;
+        sink->limited = 1;
+    }
+
+    if (produced && cli_updatescanwork(ctx, produced) != CL_SUCCESS)
+        return CL_ETIMEOUT;
+
+    if (produced && sink->fd >= 0 && cli_writen(sink->fd, sink->buf, produced) != (int)produced) {
+        cli_warnmsg("%s: failed to write %lu bytes to %s\n", sink->who, (unsigned long)produced, sink->path);
+        return CL_EWRITE;
+    }
+
+    sink->len += produced;
+    return sink->limited ? CL_BREAK : CL_SUCCESS;
+}
+
+/* for producers that already have their output in a buffer (stored data) */
+int cli_dsink_write(struct cli_dsink *sink, const void *data, size_t len, size_t consumed)
+{
+    const unsigned char *src = data;
+    unsigned char *dst;
+    size_t avail;
+    int ret;
+
+    sink->in += consumed;
+    while (len) {
+        if (!(dst = cli_dsink_space(sink, &avail)))
+            return CL_EMEM;
+
+        if (avail > len)
+            avail = len;
+        memcpy(dst, src, avail);
+
+        if ((ret = cli_dsink_commit(sink, avail, 0)) != CL_SUCCESS)
+            return ret;
+
+        src += avail;
+        len -= avail;
+    }
+
+    return CL_SUCCESS;
+}
+
+/*
+ * Fast path for a deflate stream whose compressed and decompressed sizes
+ * are both known: the native decoder writes it straight into the empty
+ * sink. Returns CL_EUNPACK, with nothing committed, when the fast path
+ * does not apply or the stream doesn't decode to exactly usize bytes from
+ * exactly srclen; the caller then inflates it as a stream.
+ */
+int cli_dsink_inflate(struct cli_dsink *sink, const void *src, size_t srclen, size_t usize, int windowbits)
+{
+    const struct cl_engine *engine = sink->ctx->engine;
+    size_t used = srclen, produced = usize;
+
+    if (!cli_inflate_native() || sink->len || sink->fd >= 0 || !usize || usize > CLI_DSINK_MEMMAX)
+        return CL_EUNPACK;
+    /* output past a limit is trimmed by the stream path */
+    if ((engine->maxfilesize && usize > engine->maxfilesize) ||
+        (engine->maxscansize && usize > engine->maxscansize - MIN(sink->ctx->scansize, engine->maxscansize)))
+        return CL_EUNPACK;
+
+    if (!sink->buf || sink->size < usize) {
+        unsigned char *buf = usize <= DSINK_IDLE_SIZE ? buf_get() : cli_malloc(usize);
+
+        if (!buf)
+            return CL_EUNPACK;
+        buf_put(sink->buf, sink->size);
+        sink->buf = buf;
+        sink->size = MAX(usize, DSINK_IDLE_SIZE);
+    }
+
+    if (cli_inflate_buffer_native(src, &used, sink->buf, &produced, windowbits, sink->ctx) != Z_OK ||
+        used != srclen || produced != usize) {
+        cli_dbgmsg("%s: native inflate did not apply, inflating as a stream\n", sink->who);
+        return CL_EUNPACK;
+    }
+
+    return cli_dsink_commit(sink, produced, used);
+}
+
+fmap_t *cli_dsink_map(struct cli_dsink *sink)
+{
+    if (sink->fd >= 0)
+        return fmap(sink->fd, 0, 0);
+
+    return cl_fmap_open_memory(sink->buf, sink->len);
+}
+
+int cli_dsink_scan(struct cli_dsink *sink)
+{
+    fmap_t *map;
+    int ret;
+
+    cli_dbgmsg("%s: scanning %lu decompressed bytes%s\n", sink->who, (unsigned long)sink->len,
+               sink->fd >= 0 ? " from disk" : "");
+    if (!sink->len)
+        return CL_CLEAN;
+
+    if (!(map = cli_dsink_map(sink))) {
+        cli_errmsg("%s: can't map decompressed data\n", sink->who);
+        return CL_EMEM;
+    }
+
+    ret = cli_map_scan(map, 0, map->len, sink->ctx, CL_TYPE_ANY);
+    funmap(map);
+    return ret;
+}
+
+int cli_dsink_close(struct cli_dsink *sink)
+{
+    int ret = CL_SUCCESS;
+
+    /* with --leave-temps the output still ends up on disk */
+    if (sink->ctx->engine->keeptmp && sink->fd < 0 && sink->len)
+        dsink_open(sink);
+
+    if (sink->fd >= 0) {
+        close(sink->fd);
+        if (!sink->ctx->engine->keeptmp && cli_unlink(sink->path))
+            ret = CL_EUNLINK;
+    }
+
+    buf_put(sink->buf, sink->size);
+    if (sink->ownpath)
+        free(sink->path);
+
+    memset(sink, 0, sizeof(*sink));
+    sink->fd = -1;
+    return ret;
+}
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __DSINK_H
+#define __DSINK_H
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include "others.h"
+#include "fmap.h"
+
+/*
+ * Decompression output shared by the zip, gzip, bzip2 and xz unpackers.
+ *
+ * Decoders write straight into the sink: cli_dsink_space() returns the
+ * window to decompress into and cli_dsink_commit() accounts for what the
+ * decoder produced and consumed. The output stays in memory and is handed
+ * to the scanner as a memory fmap; only output larger than
+ * CLI_DSINK_MEMMAX goes to a temporary file.
+ *
+ * Every commit is checked against the compression ratio, the engine size
+ * limits and the scan work budget before it is kept. Output is only ever
+ * cut short silently by MaxFileSize/MaxScanSize; a stream that inflates
+ * past MaxCompressionRatio (once it has produced CLI_DSINK_RATIO_MINOUT
+ * bytes) is reported as Heuristic.Limits.Exceeded.Ratio.
+ */
+
+/* minimum window handed to a decoder */
+#define CLI_DSINK_WINDOW (256 * 1024)
+/* output kept in memory up to this size, spilled to a temporary file above */
+#define CLI_DSINK_MEMMAX (16 * 1024 * 1024)
+/* the ratio check only applies once this much output was produced */
+#define CLI_DSINK_RATIO_MINOUT (4 * 1024 * 1024)
+
+struct cli_dsink {
+    cli_ctx *ctx;
+    const char *who;
+    unsigned char *buf;
+    size_t size;
+    size_t len;         /* bytes produced so far */
+    uint64_t in;        /* bytes consumed so far */
+    int fd;
+    char *path;
+    int ownpath;
+    int limited;        /* output was cut short by a limit */
+};
+
+void cli_dsink_init(struct cli_dsink *sink, cli_ctx *ctx, const char *who, char *path);
+unsigned char *cli_dsink_space(struct cli_dsink *sink, size_t *avail);
+int cli_dsink_commit(struct cli_dsink *sink, size_t produced, size_t consumed);
+int cli_dsink_write(struct cli_dsink *sink, const void *data, size_t len, size_t consumed);
+int cli_dsink_inflate(struct cli_dsink *sink, const void *src, size_t srclen, size_t usize, int windowbits);
+fmap_t *cli_dsink_map(struct cli_dsink *sink);
+int cli_dsink_scan(struct cli_dsink *sink);
+int cli_dsink_close(struct cli_dsink *sink);
+
+#endif
@@ -117,6 +117,7 @@ enum perfev {
     PERFT_RAWTYPENO,
     PERFT_MAP,
     PERFT_BYTECODE,
+    PERFT_INFLATE,
     PERFT_KTIME,
     PERFT_UTIME,
     PERFT_LAST
@@ -31,12 +31,13 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
-#ifdef ANONYMOUS_MAP
+#if defined(ANONYMOUS_MAP) || defined(HAVE_MMAP)
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
 #endif
 #include <errno.h>
+#include <fcntl.h>
 
 #ifdef C_LINUX
 #include <pthread.h>
@@ -472,6 +473,45 @@ static int fmap_readpage(fmap_t *m, unsigned int first_page, unsigned int count,
 }
 
 
+/* vvvvv READAHEAD STUFF BELOW vvvvv */
+
+/* size of the window we ask the kernel to prefetch ahead of sequential reads */
+#define FMAP_READAHEAD (2*1024*1024)
+
+enum { FMAP_RA_NONE, FMAP_RA_WINDOW, FMAP_RA_RANDOM };
+
+/* Tracks the scanner's access pattern on file backed maps. While accesses
+ * keep moving forward, returns FMAP_RA_WINDOW with the next window (relative
+ * to the start of the map) that should be prefetched; the kernel reads it
+ * asynchronously so the disk latency overlaps with matching. Returns
+ * FMAP_RA_RANDOM once, when the scanner seeks well behind its furthest
+ * access, after which no more prefetching is done. */
+static int fmap_readahead(fmap_t *m, size_t at, size_t len, size_t *from, size_t *count)
+{
+    size_t end;
+
+    if(m->ra_random)
+	return FMAP_RA_NONE;
+
+    at += m->nested_offset;
+    end = at + len;
+    if(at + FMAP_READAHEAD < m->ra_last) {
+	m->ra_random = 1;
+	return FMAP_RA_RANDOM;
+    }
+    if(end > m->ra_last)
+	m->ra_last = end;
+    if(end + FMAP_READAHEAD / 2 <= m->ra_next || m->ra_next >= m->real_len)
+	return FMAP_RA_NONE;
+
+    *from = MAX(m->ra_next, end - end % m->pgsz);
+    m->ra_next = MIN(*from + FMAP_READAHEAD, m->real_len);
+    if(*from >= m->ra_next)
+	return FMAP_RA_NONE;
+    *count = m->ra_next - *from;
+    return FMAP_RA_WINDOW;
+}
+
 static const void *handle_need(fmap_t *m, size_t at, size_t len, int lock) {
     unsigned int first_page, last_page, lock_count;
     char *ret;
@@ -496,6 +536,15 @@ static const void *handle_need(fmap_t *m, size_t at, size_t len, int lock) {
     if(fmap_readpage(m, first_page, last_page-first_page+1, lock_count))
 	return NULL;
 
+#if defined(POSIX_FADV_WILLNEED) && !defined(_WIN32)
+    if(m->handle_is_fd) {
+	size_t from, count;
+
+	if(fmap_readahead(m, at - m->nested_offset, len, &from, &count) == FMAP_RA_WINDOW)
+	    posix_fadvise((int)(ssize_t)m->handle, m->offset + from, count, POSIX_FADV_WILLNEED);
+    }
+#endif
+
     ret = (char *)m;
     ret += at + m->hdrsz;
     return (void *)ret;
@@ -724,11 +773,397 @@ static const void *mem_gets(fmap_t *m, char *dst, size_t *at, size_t max_len) {
     return dst;
 }
 
+/* vvvvv DIRECT FILE MAPPING BELOW vvvvv */
+
+#if !defined(_WIN32) && defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+
+static const void *direct_need(fmap_t *m, size_t at, size_t len, int lock)
+{
+    const void *ret = mem_need(m, at, len, lock);
+    size_t from, count;
+
+    if(!ret)
+	return ret;
+#if HAVE_MADVISE
+    switch(fmap_readahead(m, at, len, &from, &count)) {
+    case FMAP_RA_WINDOW:
+	madvise((char *)m->data + from, count, MADV_WILLNEED);
+	break;
+    case FMAP_RA_RANDOM:
+	madvise((void *)m->data, m->real_len, MADV_RANDOM);
+	break;
+    }
+#endif
+    return ret;
+}
+
+static void unmap_direct(fmap_t *m)
+{
+    if(munmap((void *)m->data, m->real_len) == -1)
+	cli_warnmsg("funmap: unable to unmap file mapping at address: %p with length: %lu\n", m->data, (unsigned long)m->real_len);
+    free((void *)m);
+}
+
+fmap_t *fmap_direct(int fd, off_t offset, size_t len)
+{
+    STATBUF st;
+    fmap_t *m;
+    void *data;
+    int pgsz = cli_getpagesize();
+
+    if(FSTAT(fd, &st)) {
+	cli_warnmsg("fmap: fstat failed\n");
+	return NULL;
+    }
+    /* pipes, sockets and devices keep going through the pread path */
+    if(!S_ISREG(st.st_mode) || offset < 0 || offset != (off_t)fmap_align_to(offset, pgsz))
+	return fmap(fd, offset, len);
+
+    if(!len) len = st.st_size - offset;
+    if(!len || !CLI_ISCONTAINED(0, st.st_size, offset, len))
+	return fmap(fd, offset, len);
+
+    if((data = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, offset)) == MAP_FAILED) {
+	cli_dbgmsg("fmap_direct: mmap failed, falling back to pread\n");
+	return fmap(fd, offset, len);
+    }
+#if HAVE_MADVISE
+    madvise(data, len, MADV_SEQUENTIAL);
+#endif
+    if(!(m = cl_fmap_open_memory(data, len))) {
+	munmap(data, len);
+	return NULL;
+    }
+    m->handle = (void*)(ssize_t)fd;
+    m->handle_is_fd = 1;
+    m->offset = offset;
+    m->mtime = st.st_mtime;
+    m->need = direct_need;
+    m->unmap = unmap_direct;
+    return m;
+}
+
+#else
+
+fmap_t *fmap_direct(int fd, off_t offset, size_t len)
+{
+    return fmap(fd, offset, len);
+}
+
+#endif
+
 fmap_t *fmap(int fd, off_t offset, size_t len) {
     int unused;
     return fmap_check_empty(fd, offset, len, &unused);
 }
 
+/* vvvvv EXTENT LIST MAPPING BELOW vvvvv */
+
+/* decoded extents are kept in windows of at most this size, the least
+ * recently used of FMAP_EXTENT_WINDOWS windows is decoded over */
+#define FMAP_EXTENT_WINDOW (4 * 1024 * 1024)
+#define FMAP_EXTENT_WINDOWS 4
+
+struct fmap_extent {
+    size_t pos;		/* in the assembled object */
+    size_t len;		/* in the assembled object */
+    size_t offset;	/* in the parent map */
+    size_t srclen;	/* in the parent map, decoded extents only */
+    fmap_extent_decoder decode;
+    void *state;	/* decoder stream, kept between windows */
+    size_t out;		/* bytes the stream produced so far */
+    unsigned int zero;
+};
+
+struct fmap_extent_window {
+    unsigned char *data;
+    unsigned int extent;
+    size_t start;	/* in the decoded extent */
+    size_t len;
+    unsigned int used;
+};
+
+struct fmap_extents {
+    fmap_t *parent;
+    struct fmap_extent *extents;
+    unsigned int count;
+    unsigned int size;
+    size_t len;
+    struct fmap_extent_window windows[FMAP_EXTENT_WINDOWS];
+    unsigned int clock;
+    void (*unmap)(fmap_t *);
+};
+
+fmap_extents_t *fmap_extents_new(fmap_t *parent)
+{
+    fmap_extents_t *x = cli_calloc(1, sizeof(*x));
+
+    if(!x) {
+	cli_errmsg("fmap_extents_new: out of memory\n");
+	return NULL;
+    }
+    x->parent = parent;
+    return x;
+}
+
+static struct fmap_extent *extents_grow(fmap_extents_t *x, size_t len)
+{
+    struct fmap_extent *e;
+
+    if(x->len + len < x->len) {
+	cli_dbgmsg("fmap_extents: object size would wrap\n");
+	return NULL;
+    }
+    if(x->count == x->size) {
+	unsigned int size = x->size ? x->size * 2 : 16;
+	e = cli_realloc(x->extents, size * sizeof(*e));
+	if(!e) {
+	    cli_errmsg("fmap_extents: out of memory\n");
+	    return NULL;
+	}
+	x->extents = e;
+	x->size = size;
+    }
+    e = &x->extents[x->count++];
+    memset(e, 0, sizeof(*e));
+    e->pos = x->len;
+    e->len = len;
+    x->len += len;
+    return e;
+}
+
+int fmap_extents_add(fmap_extents_t *x, size_t offset, size_t len)
+{
+    struct fmap_extent *e;
+
+    if(!len)
+	return CL_SUCCESS;
+    if(x->count) {
+	e = &x->extents[x->count - 1];
+	if(!e->zero && !e->decode && e->offset + e->len == offset && x->len + len > x->len) {
+	    e->len += len;
+	    x->len += len;
+	    return CL_SUCCESS;
+	}
+    }
+    if(!(e = extents_grow(x, len)))
+	return CL_EMEM;
+    e->offset = offset;
+    return CL_SUCCESS;
+}
+
+int fmap_extents_add_zero(fmap_extents_t *x, size_t len)
+{
+    struct fmap_extent *e;
+
+    if(!len)
+	return CL_SUCCESS;
+    if(x->count) {
+	e = &x->extents[x->count - 1];
+	if(e->zero && x->len + len > x->len) {
+	    e->len += len;
+	    x->len += len;
+	    return CL_SUCCESS;
+	}
+    }
+    if(!(e = extents_grow(x, len)))
+	return CL_EMEM;
+    e->zero = 1;
+    return CL_SUCCESS;
+}
+
+int fmap_extents_add_decoded(fmap_extents_t *x, size_t offset, size_t srclen, size_t len, fmap_extent_decoder decode)
+{
+    struct fmap_extent *e;
+
+    if(!len)
+	return CL_SUCCESS;
+    if(!(e = extents_grow(x, len)))
+	return CL_EMEM;
+    e->offset = offset;
+    e->srclen = srclen;
+    e->decode = decode;
+    return CL_SUCCESS;
+}
+
+size_t fmap_extents_len(const fmap_extents_t *x)
+{
+    return x->len;
+}
+
+void fmap_extents_free(fmap_extents_t *x)
+{
+    unsigned int i;
+
+    if(!x)
+	return;
+    for(i = 0; i < x->count; i++)
+	if(x->extents[i].state)
+	    x->extents[i].decode(&x->extents[i].state, NULL, 0, NULL, 0);
+    free(x->extents);
+    for(i = 0; i < FMAP_EXTENT_WINDOWS; i++)
+	free(x->windows[i].data);
+    free(x);
+}
+
+/*
+ * Decodes len bytes of extent e from offset start into dst. The stream
+ * carries on from where the previous window ended, so reading an extent
+ * front to back decodes it once; only going back restarts it.
+ */
+static ssize_t extents_stream(struct fmap_extent *e, const void *src, size_t start, unsigned char *dst, size_t len)
+{
+    ssize_t got;
+
+    if(e->state && start < e->out) {
+	e->decode(&e->state, NULL, 0, NULL, 0);
+	e->state = NULL;
+    }
+    if(!e->state)
+	e->out = 0;
+
+    /* skip the output between the previous window and this one */
+    while(e->out < start) {
+	if((got = e->decode(&e->state, src, e->srclen, dst, MIN(len, start - e->out))) <= 0)
+	    return got;
+	e->out += got;
+    }
+    if((got = e->decode(&e->state, src, e->srclen, dst, len)) > 0)
+	e->out += got;
+    return got;
+}
+
+/*
+ * Returns the decoded data of extent i at offset skip, and in *avail how
+ * much of it is at hand. The window holding skip is decoded if it isn't
+ * cached; a short or failed decode reads as zeroes.
+ */
+static const unsigned char *extents_decode(fmap_extents_t *x, unsigned int i, size_t skip, size_t *avail)
+{
+    struct fmap_extent *e = &x->extents[i];
+    struct fmap_extent_window *w = NULL;
+    size_t start = skip - skip % FMAP_EXTENT_WINDOW;
+    const void *src = NULL;
+    ssize_t got = -1;
+    unsigned int j;
+
+    for(j = 0; j < FMAP_EXTENT_WINDOWS; j++) {
+	struct fmap_extent_window *c = &x->windows[j];
+
+	if(c->data && c->extent == i && c->start == start) {
+	    w = c;
+	    break;
+	}
+	if(!w || (w->data && (!c->data || c->used < w->used)))
+	    w = c;
+    }
+    w->used = ++x->clock;
+    if(j < FMAP_EXTENT_WINDOWS) {
+	*avail = w->start + w->len - skip;
+	return w->data + (skip - w->start);
+    }
+
+    free(w->data);
+    w->len = MIN(FMAP_EXTENT_WINDOW, e->len - start);
+    if(!(w->data = cli_malloc(w->len))) {
+	cli_errmsg("fmap_extents: can't allocate %lu bytes for a decoded extent\n", (unsigned long)w->len);
+	return NULL;
+    }
+    w->extent = i;
+    w->start = start;
+
+    if(e->srclen && CLI_ISCONTAINED(0, x->parent->len, e->offset, e->srclen))
+	src = fmap_need_off_once(x->parent, e->offset, e->srclen);
+    if(src)
+	got = extents_stream(e, src, start, w->data, w->len);
+    if(got < 0) {
+	cli_dbgmsg("fmap_extents: extent %u at %lu failed to decode\n", i, (unsigned long)e->offset);
+	got = 0;
+    } else if((size_t)got != w->len) {
+	cli_dbgmsg("fmap_extents: extent %u decoded to %lu bytes at %lu, expected %lu\n", i,
+		   (unsigned long)got, (unsigned long)start, (unsigned long)w->len);
+    }
+    if((size_t)got < w->len)
+	memset(w->data + got, 0, w->len - got);
+
+    *avail = w->start + w->len - skip;
+    return w->data + (skip - w->start);
+}
+
+static off_t extents_pread(void *handle, void *buf, size_t count, off_t offset)
+{
+    fmap_extents_t *x = (fmap_extents_t *)handle;
+    struct fmap_extent *e;
+    const unsigned char *src;
+    size_t done = 0, skip, todo, avail;
+    unsigned int lo = 0, hi = x->count, mid;
+
+    if(offset < 0)
+	return -1;
+    while(hi - lo > 1) {
+	mid = (lo + hi) / 2;
+	if(x->extents[mid].pos <= (size_t)offset)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    for(; done < count && lo < x->count; lo++) {
+	e = &x->extents[lo];
+	skip = offset + done - e->pos;
+	if(skip >= e->len)
+	    continue;
+	todo = MIN(count - done, e->len - skip);
+	if(e->zero) {
+	    memset((char *)buf + done, 0, todo);
+	} else if(e->decode) {
+	    size_t copied = 0;
+
+	    while(copied < todo) {
+		if(!(src = extents_decode(x, lo, skip + copied, &avail)))
+		    return done + copied ? (off_t)(done + copied) : -1;
+		avail = MIN(avail, todo - copied);
+		memcpy((char *)buf + done + copied, src, avail);
+		copied += avail;
+	    }
+	} else {
+	    /* ranges past the end of the parent read as zeroes */
+	    avail = 0;
+	    if(e->offset + skip < x->parent->len)
+		avail = MIN(todo, x->parent->len - e->offset - skip);
+	    if(avail) {
+		if(!(src = fmap_need_off_once(x->parent, e->offset + skip, avail)))
+		    return done ? (off_t)done : -1;
+		memcpy((char *)buf + done, src, avail);
+	    }
+	    if(avail < todo)
+		memset((char *)buf + done + avail, 0, todo - avail);
+	}
+	done += todo;
+    }
+    return done;
+}
+
+static void unmap_extents(fmap_t *m)
+{
+    fmap_extents_t *x = (fmap_extents_t *)m->handle;
+
+    x->unmap(m);
+    fmap_extents_free(x);
+}
+
+fmap_t *fmap_extents_map(fmap_extents_t *x)
+{
+    fmap_t *m;
+
+    if(!x->len || !(m = cl_fmap_open_handle(x, 0, x->len, extents_pread, 1))) {
+	fmap_extents_free(x);
+	return NULL;
+    }
+    x->unmap = m->unmap;
+    m->unmap = unmap_extents;
+    return m;
+}
+
 static inline unsigned int fmap_align_items(unsigned int sz, unsigned int al) {
     return sz / al + (sz % al != 0);
 }
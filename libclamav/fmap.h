@@ -76,6 +76,11 @@ struct cl_fmap {
     const void* (*need_offstr)(fmap_t*, size_t at, size_t len_hint);
     const void* (*gets)(fmap_t*, char *dst, size_t *at, size_t max_len);
     void        (*unneed_off)(fmap_t*, size_t at, size_t len);
+
+    /* readahead state for directly mapped files */
+    size_t ra_next;/* end of the last prefetched window */
+    size_t ra_last;/* end of the furthest access so far */
+    unsigned short ra_random;
 #ifdef _WIN32
     HANDLE fh;
     HANDLE mh;
@@ -85,6 +90,8 @@ struct cl_fmap {
 
 fmap_t *fmap(int fd, off_t offset, size_t len);
 fmap_t *fmap_check_empty(int fd, off_t offset, size_t len, int *empty);
+/* maps regular files straight from the page cache, others as fmap() does */
+fmap_t *fmap_direct(int fd, off_t offset, size_t len);
 
 static inline void funmap(fmap_t *m)
 {
@@ -180,6 +187,25 @@ static inline const void *fmap_need_ptr_once_len(fmap_t *m, const void *ptr, siz
 
 int fmap_dump_to_file(fmap_t *map, const char *tmpdir, char **outname, int *outfd);
 
+/* Extent list maps: a child object assembled from ranges of a parent map,
+ * runs of zeroes and lazily decoded ranges, read through without copying
+ * it out to a temporary file.  The parent must outlive the child map. */
+typedef struct fmap_extents fmap_extents_t;
+/* decodes srclen bytes of source as a stream, one window per call: each
+ * call writes at most dstlen bytes following those of the previous call
+ * and returns the number of bytes written or -1.  *state is NULL on the
+ * first call and is kept between calls; a call with dst NULL frees it. */
+typedef ssize_t (*fmap_extent_decoder)(void **state, const void *src, size_t srclen, unsigned char *dst, size_t dstlen);
+
+fmap_extents_t *fmap_extents_new(fmap_t *parent);
+int fmap_extents_add(fmap_extents_t *x, size_t offset, size_t len);
+int fmap_extents_add_zero(fmap_extents_t *x, size_t len);
+int fmap_extents_add_decoded(fmap_extents_t *x, size_t offset, size_t srclen, size_t len, fmap_extent_decoder decode);
+size_t fmap_extents_len(const fmap_extents_t *x);
+/* consumes x, also on failure */
+fmap_t *fmap_extents_map(fmap_extents_t *x);
+void fmap_extents_free(fmap_extents_t *x);
+
 /* deprecated */
 int fmap_fd(fmap_t *m);
 
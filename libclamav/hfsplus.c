@@ -40,12 +40,12 @@ static int hfsplus_volumeheader(cli_ctx *, hfsPlusVolumeHeader **);
 static int hfsplus_readheader(cli_ctx *, hfsPlusVolumeHeader *, hfsNodeDescriptor *,
     hfsHeaderRecord *, int, const char *);
 static int hfsplus_scanfile(cli_ctx *, hfsPlusVolumeHeader *, hfsHeaderRecord *,
-    hfsPlusForkData *, const char *);
+    hfsPlusForkData *);
 static int hfsplus_validate_catalog(cli_ctx *, hfsPlusVolumeHeader *, hfsHeaderRecord *);
 static int hfsplus_fetch_node (cli_ctx *, hfsPlusVolumeHeader *, hfsHeaderRecord *,
     hfsHeaderRecord *, uint32_t, uint8_t *);
 static int hfsplus_walk_catalog(cli_ctx *, hfsPlusVolumeHeader *, hfsHeaderRecord *,
-    hfsHeaderRecord *, const char *);
+    hfsHeaderRecord *);
 
 /* Header Record : fix endianness for useful fields */
 static void headerrecord_to_host(hfsHeaderRecord *hdr)
@@ -289,23 +289,22 @@ static int hfsplus_readheader(cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hfsN
     return CL_CLEAN;
 }
 
-/* Read and dump a file for scanning */
+/* Map a file from its fork extents and scan it in place */
 static int hfsplus_scanfile(cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hfsHeaderRecord *extHeader,
-    hfsPlusForkData *fork, const char *dirname)
+    hfsPlusForkData *fork)
 {
     hfsPlusExtentDescriptor *currExt;
-    const uint8_t *mPtr = NULL;
-    char *tmpname = NULL;
-    int ofd, ret = CL_CLEAN;
+    fmap_extents_t *file;
+    fmap_t *map;
+    int ret = CL_CLEAN;
     uint64_t targetSize;
-    uint32_t outputBlocks = 0;
     uint8_t ext;
 
     UNUSEDPARAM(extHeader);
 
     /* bad record checks */
     if (!fork || (fork->logicalSize == 0) || (fork->totalBlocks == 0)) {
-        cli_dbgmsg("hfsplus_dumpfile: Empty file.\n");
+        cli_dbgmsg("hfsplus_scanfile: Empty file.\n");
         return CL_CLEAN;
     }
 
@@ -313,7 +312,7 @@ static int hfsplus_scanfile(cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hfsHea
     targetSize = fork->logicalSize;
 #if SIZEOF_LONG < 8
     if (targetSize > ULONG_MAX) {
-        cli_dbgmsg("hfsplus_dumpfile: File too large for limit check.\n");
+        cli_dbgmsg("hfsplus_scanfile: File too large for limit check.\n");
         return CL_EFORMAT;
     }
 #endif
@@ -322,103 +321,71 @@ static int hfsplus_scanfile(cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hfsHea
         return ret;
     }
 
-    /* open file */
-    ret = cli_gentempfd(dirname, &tmpname, &ofd);
-    if (ret != CL_CLEAN) {
-        cli_dbgmsg("hfsplus_dumpfile: Cannot generate temporary file.\n");
-        return ret;
+    if (!(file = fmap_extents_new(*ctx->fmap))) {
+        return CL_EMEM;
     }
-    cli_dbgmsg("hfsplus_dumpfile: Extracting to %s\n", tmpname);
 
-    ext = 0;
-    /* Dump file, extent by extent */
-    do {
-        uint32_t currBlock, endBlock, outputSize = 0;
-        if (targetSize == 0) {
-            cli_dbgmsg("hfsplus_dumpfile: output complete\n");
-            break;
-        }
-        if (outputBlocks >= fork->totalBlocks) {
-            cli_dbgmsg("hfsplus_dumpfile: output all blocks, remaining size " STDu64 "\n", targetSize);
-            break;
-        }
+    /* Assemble the file, extent by extent */
+    for (ext = 0; targetSize > 0; ext++) {
+        uint64_t extSize, extOffset;
+
         /* Prepare extent */
         if (ext < 8) {
             currExt = &(fork->extents[ext]);
-            cli_dbgmsg("hfsplus_dumpfile: extent %u\n", ext);
+            cli_dbgmsg("hfsplus_scanfile: extent %u\n", ext);
         }
         else {
-            cli_dbgmsg("hfsplus_dumpfile: need next extent from ExtentOverflow\n");
+            cli_dbgmsg("hfsplus_scanfile: need next extent from ExtentOverflow\n");
             /* Not implemented yet */
             ret = CL_EFORMAT;
             break;
         }
         /* have extent, so validate and get block range */
         if ((currExt->startBlock == 0) || (currExt->blockCount == 0)) {
-            cli_dbgmsg("hfsplus_dumpfile: next extent empty, done\n");
+            cli_dbgmsg("hfsplus_scanfile: next extent empty, done\n");
             break;
         }
         if ((currExt->startBlock & 0x10000000) && (currExt->blockCount & 0x10000000)) {
-            cli_dbgmsg("hfsplus_dumpfile: next extent illegal!\n");
+            cli_dbgmsg("hfsplus_scanfile: next extent illegal!\n");
             ret = CL_EFORMAT;
             break;
         }
-        currBlock = currExt->startBlock;
-        endBlock = currExt->startBlock + currExt->blockCount - 1;
-        if ((currBlock > volHeader->totalBlocks) || (endBlock > volHeader->totalBlocks)
+        if ((currExt->startBlock > volHeader->totalBlocks)
+                || (currExt->startBlock + currExt->blockCount - 1 > volHeader->totalBlocks)
                 || (currExt->blockCount > volHeader->totalBlocks)) {
-            cli_dbgmsg("hfsplus_dumpfile: bad extent!\n");
+            cli_dbgmsg("hfsplus_scanfile: bad extent!\n");
             ret = CL_EFORMAT;
             break;
         }
-        /* Write the blocks, walking the map */
-        while (currBlock <= endBlock) {
-            size_t to_write = MIN(targetSize, volHeader->blockSize);
-            ssize_t written;
-            off_t offset = currBlock * volHeader->blockSize;
-            /* move map to next block */
-            mPtr = fmap_need_off_once(*ctx->fmap, offset, volHeader->blockSize);
-            if (!mPtr) {
-                cli_errmsg("hfsplus_dumpfile: map error\n");
-                ret = CL_EMAP;
-                break;
-            }
-            written = cli_writen(ofd, mPtr, to_write);
-            if ((size_t)written != to_write) {
-                cli_errmsg("hfsplus_dumpfile: write error\n");
-                ret = CL_EWRITE;
-                break;
-            }
-            targetSize -= to_write;
-            outputSize += to_write;
-            currBlock++;
-            if (targetSize == 0) {
-                cli_dbgmsg("hfsplus_dumpfile: all data written\n");
-                break;
-            }
-            if (outputBlocks >= fork->totalBlocks) {
-                cli_dbgmsg("hfsplus_dumpfile: output all blocks, remaining size " STDu64 "\n", targetSize);
-                break;
-            }
+        /* Blocks in use must be in the map, the last one is trimmed to size */
+        extOffset = (uint64_t)currExt->startBlock * volHeader->blockSize;
+        extSize = MIN((uint64_t)currExt->blockCount * volHeader->blockSize, targetSize);
+        if (!CLI_ISCONTAINED(0, (*ctx->fmap)->len, extOffset,
+                (extSize + volHeader->blockSize - 1) / volHeader->blockSize * volHeader->blockSize)) {
+            cli_errmsg("hfsplus_scanfile: map error\n");
+            ret = CL_EMAP;
+            break;
         }
-        /* Finished the extent, move to next */
-        ext++;
-    } while (ret == CL_CLEAN);
-
-    /* if successful so far, scan the output */
-    if (ret == CL_CLEAN) {
-        ret = cli_magic_scandesc(ofd, ctx);
+        ret = fmap_extents_add(file, (size_t)extOffset, (size_t)extSize);
+        if (ret != CL_CLEAN) {
+            break;
+        }
+        targetSize -= extSize;
+    }
+    if (ret == CL_CLEAN && targetSize == 0) {
+        cli_dbgmsg("hfsplus_scanfile: all data mapped\n");
     }
 
-    if (ofd >= 0) {
-        close(ofd);
+    /* if successful so far, scan the file */
+    if (ret != CL_CLEAN) {
+        fmap_extents_free(file);
+        return ret;
     }
-    if (!ctx->engine->keeptmp) {
-        if (cli_unlink(tmpname)) {
-            ret = CL_EUNLINK;
-        }
+    if (!(map = fmap_extents_map(file))) {
+        return CL_CLEAN;
     }
-    free(tmpname);
+    ret = cli_map_scan(map, 0, map->len, ctx, CL_TYPE_ANY);
+    funmap(map);
 
     return ret;
 }
@@ -543,7 +510,7 @@ static int hfsplus_fetch_node (cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hfs
 
 /* Given the catalog and other details, scan all the volume contents */
 static int hfsplus_walk_catalog(cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hfsHeaderRecord *catHeader,
-    hfsHeaderRecord *extHeader, const char *dirname)
+    hfsHeaderRecord *extHeader)
 {
     int ret = CL_CLEAN;
     unsigned int has_alerts = 0;
@@ -657,7 +624,7 @@ static int hfsplus_walk_catalog(cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hf
                 forkdata_to_host(&(fileRec.dataFork));
                 forkdata_print("data fork:", &(fileRec.dataFork));
                 if (fileRec.dataFork.logicalSize) {
-                    ret = hfsplus_scanfile(ctx, volHeader, extHeader, &(fileRec.dataFork), dirname);
+                    ret = hfsplus_scanfile(ctx, volHeader, extHeader, &(fileRec.dataFork));
                 }
                 /* Check return code */
                 if (ret == CL_VIRUS) {
@@ -676,7 +643,7 @@ static int hfsplus_walk_catalog(cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hf
                 forkdata_to_host(&(fileRec.resourceFork));
                 forkdata_print("resource fork:", &(fileRec.resourceFork));
                 if (fileRec.resourceFork.logicalSize) {
-                    ret = hfsplus_scanfile(ctx, volHeader, extHeader, &(fileRec.resourceFork), dirname);
+                    ret = hfsplus_scanfile(ctx, volHeader, extHeader, &(fileRec.resourceFork));
                 }
                 /* Check return code */
                 if (ret == CL_VIRUS) {
@@ -723,7 +690,6 @@ static int hfsplus_walk_catalog(cli_ctx *ctx, hfsPlusVolumeHeader *volHeader, hf
 /* Base scan function for scanning HFS+ or HFSX partitions */
 int cli_scanhfsplus(cli_ctx *ctx)
 {
-    char *targetdir = NULL;
     int ret = CL_CLEAN;
     hfsPlusVolumeHeader *volHeader = NULL;
     hfsNodeDescriptor catFileDesc;
@@ -764,21 +730,8 @@ cli_dbgmsg("sizeof(hfsNodeDescriptor) is %lu\n", sizeof(hfsNodeDescriptor));
         goto freeHeader;
     }
 
-    /* Create temp folder for contents */
-    if (!(targetdir = cli_gentemp(ctx->engine->tmpdir))) {
-        cli_errmsg("cli_scandmg: cli_gentemp failed\n");
-        ret = CL_ETMPDIR;
-        goto freeHeader;
-    }
-    if (mkdir(targetdir, 0700)) {
-        cli_errmsg("cli_scandmg: Cannot create temporary directory %s\n", targetdir);
-        ret = CL_ETMPDIR;
-        goto freeDirname;
-    }
-    cli_dbgmsg("cli_scandmg: Extracting into %s\n", targetdir);
-
     /* Can build and scan catalog file if we want ***
-    ret = hfsplus_scanfile(ctx, volHeader, &extentFileHeader, &(volHeader->catalogFile), targetdir);
+    ret = hfsplus_scanfile(ctx, volHeader, &extentFileHeader, &(volHeader->catalogFile));
      */
     if (ret == CL_CLEAN) {
         ret = hfsplus_validate_catalog(ctx, volHeader, &catFileHeader);
@@ -792,17 +745,10 @@ cli_dbgmsg("sizeof(hfsNodeDescriptor) is %lu\n", sizeof(hfsNodeDescriptor));
 
     /* Walk through catalog to identify files to scan */
     if (ret == CL_CLEAN) {
-        ret = hfsplus_walk_catalog(ctx, volHeader, &catFileHeader, &extentFileHeader, targetdir);
+        ret = hfsplus_walk_catalog(ctx, volHeader, &catFileHeader, &extentFileHeader);
         cli_dbgmsg("cli_scandmg: walk catalog finished\n");
     }
 
-    /* Clean up extracted content, if needed */
-    if (!ctx->engine->keeptmp) {
-        cli_rmdirs(targetdir);
-    }
-
-freeDirname:
-    free(targetdir);
 freeHeader:
     free(volHeader);
     return ret;
@@ -91,8 +91,10 @@ typedef enum {
 
 typedef struct file_buff_tag {
 	int fd;
+	html_norm_buf_t *mem; /* if set, collect the output here instead of fd */
 	unsigned char buffer[HTML_FILE_BUFF_LEN];
 	int length;
+	int error; /* some of the output was lost */
 } file_buff_t;
 
 struct tag_contents {
@@ -299,14 +301,57 @@ static unsigned char *cli_readchunk(FILE *stream, m_area_t *m_area, unsigned int
 	return chunk;
 }
 
+static void html_output_write(file_buff_t *fbuff, const unsigned char *data, size_t len)
+{
+	html_norm_buf_t *mem = fbuff->mem;
+	unsigned char *newdata;
+	size_t newsize;
+
+	if (fbuff->error)
+		return;
+	if (!mem) {
+		if (cli_writen(fbuff->fd, data, len) != (int)len)
+			fbuff->error = 1;
+		return;
+	}
+	if (mem->len + len > mem->size) {
+		newsize = mem->size ? mem->size : 4 * HTML_FILE_BUFF_LEN;
+		while (newsize < mem->len + len)
+			newsize *= 2;
+		newdata = cli_realloc(mem->data, newsize);
+		if (!newdata) {
+			cli_errmsg("html_output_write: Unable to grow output buffer to %lu bytes\n", (unsigned long)newsize);
+			fbuff->error = 1;
+			return;
+		}
+		mem->data = newdata;
+		mem->size = newsize;
+	}
+	memcpy(mem->data + mem->len, data, len);
+	mem->len += len;
+}
+
 static void html_output_flush(file_buff_t *fbuff)
 {
 	if (fbuff && (fbuff->length > 0)) {
-		cli_writen(fbuff->fd, fbuff->buffer, fbuff->length);
+		html_output_write(fbuff, fbuff->buffer, fbuff->length);
 		fbuff->length = 0;
 	}
 }
 
+/* flushes and frees fbuff, returns nonzero if any of its output was lost */
+static int html_output_close(file_buff_t *fbuff)
+{
+	int error;
+
+	html_output_flush(fbuff);
+	if (fbuff->fd != -1)
+		close(fbuff->fd);
+	error = fbuff->error;
+	free(fbuff);
+	return error;
+}
+
 static inline void html_output_c(file_buff_t *fbuff1, unsigned char c)
 {
 	if (fbuff1) {
@@ -325,7 +370,7 @@ static void html_output_str(file_buff_t *fbuff, const unsigned char *str, size_t
 		}
 		if (len >= HTML_FILE_BUFF_LEN) {
 			html_output_flush(fbuff);
-			cli_writen(fbuff->fd, str, len);
+			html_output_write(fbuff, str, len);
 		} else {
 			memcpy(fbuff->buffer + fbuff->length, str, len);
 			fbuff->length += len;
@@ -624,8 +669,16 @@ static void screnc_decode(unsigned char *ptr, struct screnc_state *s)
 	}
 }
 
+static void js_output(struct parser_state *js_state, const char *dirname, html_norm_output_t *memout)
+{
+	if (memout)
+		cli_js_output_mem(js_state, &memout->javascript.data, &memout->javascript.len);
+	else
+		cli_js_output(js_state, dirname);
+}
+
 static void js_process(struct parser_state *js_state, const unsigned char *js_begin, const unsigned char *js_end,
-		const unsigned char *line, const unsigned char *ptr, int in_script, const char *dirname)
+		const unsigned char *line, const unsigned char *ptr, int in_script, const char *dirname, html_norm_output_t *memout)
 {
 	if(!js_begin)
 		js_begin = line;
@@ -639,15 +692,16 @@ static void js_process(struct parser_state *js_state, const unsigned char *js_be
 	if(!in_script) {
 		/*  we found a /script, normalize script now */
 		cli_js_parse_done(js_state);
-		cli_js_output(js_state, dirname);
+		js_output(js_state, dirname, memout);
 		cli_js_destroy(js_state);
 	}
 }
 
-static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag_arguments_t *hrefs,const struct cli_dconf* dconf)
+static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, html_norm_output_t *memout, tag_arguments_t *hrefs,const struct cli_dconf* dconf)
 {
 	int fd_tmp, tag_length = 0, tag_arg_length = 0, binary;
 	int retval=FALSE, escape=FALSE, value = 0, hex=FALSE, tag_val_length=0;
+	int output_error = 0;
 	int look_for_screnc=FALSE, in_screnc=FALSE,in_script=FALSE, text_space_written=FALSE;
 	FILE *stream_in = NULL;
 	html_state state=HTML_NORM, next_state=HTML_BAD_STATE, saved_next_state=HTML_BAD_STATE;
@@ -669,7 +723,7 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 	unsigned char entity_val[HTML_STR_LENGTH+1];
 	size_t entity_val_length = 0;
 	const int dconf_entconv = dconf ? dconf->phishing&PHISHING_CONF_ENTCONV : 1;
-	const int dconf_js = dirname && (dconf ? dconf->doc&DOC_CONF_JSNORM : 1); /* TODO */
+	const int dconf_js = (dirname || memout) && (dconf ? dconf->doc&DOC_CONF_JSNORM : 1); /* TODO */
 	/* dconf for phishing engine sets scanContents, so no need for a flag here */
 	struct parser_state *js_state = NULL;
 	const unsigned char *js_begin = NULL, *js_end = NULL;
@@ -743,8 +797,30 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 			file_buff_o2 = file_buff_text = NULL;
 			goto abort;
 		}
+		file_buff_o2->mem = NULL;
 		file_buff_o2->length = 0;
+		file_buff_o2->error = 0;
+		file_buff_text->mem = NULL;
 		file_buff_text->length = 0;
+		file_buff_text->error = 0;
+	} else if (memout) {
+		file_buff_o2 = (file_buff_t *) cli_malloc(sizeof(file_buff_t));
+		file_buff_text = (file_buff_t *) cli_malloc(sizeof(file_buff_t));
+		if (!file_buff_o2 || !file_buff_text) {
+			cli_errmsg("cli_html_normalise: Unable to allocate memory for output buffers\n");
+			free(file_buff_o2);
+			free(file_buff_text);
+			file_buff_o2 = file_buff_text = NULL;
+			goto abort;
+		}
+		file_buff_o2->fd = -1;
+		file_buff_o2->mem = &memout->nocomment;
+		file_buff_o2->length = 0;
+		file_buff_o2->error = 0;
+		file_buff_text->fd = -1;
+		file_buff_text->mem = &memout->notags;
+		file_buff_text->length = 0;
+		file_buff_text->error = 0;
 	} else {
 		file_buff_o2 = NULL;
 		file_buff_text = NULL;
@@ -1169,7 +1245,7 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 						in_script = FALSE;
 						if(js_state) {
 							js_end = ptr;
-							js_process(js_state, js_begin, js_end, line, ptr, in_script, dirname);
+							js_process(js_state, js_begin, js_end, line, ptr, in_script, dirname, memout);
 							js_state = NULL;
 							js_begin = js_end = NULL;
 						}
@@ -1602,25 +1678,41 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 				}
 				break;
 			case HTML_RFC2397_INIT:
-				if (dirname) {
+				if (dirname || memout) {
 					file_tmp_o1 = (file_buff_t *) cli_malloc(sizeof(file_buff_t));
 					if (!file_tmp_o1) {
                         cli_errmsg("cli_html_normalise: Unable to allocate memory for file_tmp_o1\n");
 						goto abort;
 					}
-					snprintf(filename, 1024, "%s"PATHSEP"rfc2397", dirname);
-					tmp_file = cli_gentemp(filename);
-					if(!tmp_file) {
-						goto abort;
-					}
-					cli_dbgmsg("RFC2397 data file: %s\n", tmp_file);
-					file_tmp_o1->fd = open(tmp_file, O_WRONLY|O_CREAT|O_TRUNC, S_IWUSR|S_IRUSR);
-					free(tmp_file);
-					if (file_tmp_o1->fd < 0) {
-						cli_dbgmsg("open failed: %s\n", filename);
-						goto abort;
-					}
+					file_tmp_o1->fd = -1;
+					file_tmp_o1->mem = NULL;
 					file_tmp_o1->length = 0;
+					file_tmp_o1->error = 0;
+					if (memout) {
+						html_norm_buf_t *rfc2397;
+
+						rfc2397 = cli_realloc(memout->rfc2397, (memout->rfc2397_cnt + 1) * sizeof(html_norm_buf_t));
+						if (!rfc2397) {
+							cli_errmsg("cli_html_normalise: Unable to allocate memory for rfc2397 buffer\n");
+							goto abort;
+						}
+						memout->rfc2397 = rfc2397;
+						file_tmp_o1->mem = &rfc2397[memout->rfc2397_cnt++];
+						memset(file_tmp_o1->mem, 0, sizeof(html_norm_buf_t));
+					} else {
+						snprintf(filename, 1024, "%s"PATHSEP"rfc2397", dirname);
+						tmp_file = cli_gentemp(filename);
+						if(!tmp_file) {
+							goto abort;
+						}
+						cli_dbgmsg("RFC2397 data file: %s\n", tmp_file);
+						file_tmp_o1->fd = open(tmp_file, O_WRONLY|O_CREAT|O_TRUNC, S_IWUSR|S_IRUSR);
+						free(tmp_file);
+						if (file_tmp_o1->fd < 0) {
+							cli_dbgmsg("open failed: %s\n", filename);
+							goto abort;
+						}
+					}
 
 					html_output_str(file_tmp_o1, (const unsigned char*)"From html-normalise\n", 20);
 					html_output_str(file_tmp_o1, (const unsigned char*)"Content-type: ", 14);
@@ -1686,9 +1778,7 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 				break;
 			case HTML_RFC2397_FINISH:
 				if(file_tmp_o1) {
-					html_output_flush(file_tmp_o1);
-					close(file_tmp_o1->fd);
-					free(file_tmp_o1);
+					output_error |= html_output_close(file_tmp_o1);
 					file_tmp_o1 = NULL;
 				}
 				state = HTML_SKIP_WS;
@@ -1733,7 +1823,7 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 		ptrend = NULL;
 
 		if(js_state) {
-			js_process(js_state, js_begin, js_end, line, ptr, in_script, dirname);
+			js_process(js_state, js_begin, js_end, line, ptr, in_script, dirname, memout);
 			js_begin = js_end = NULL;
 			if(!in_script) {
 				js_state = NULL;
@@ -1795,7 +1885,7 @@ abort:
 	if(js_state) {
 		/*  output script so far */
 		cli_js_parse_done(js_state);
-		cli_js_output(js_state, dirname);
+		js_output(js_state, dirname, memout);
 		cli_js_destroy(js_state);
 		js_state = NULL;
 	}
@@ -1803,24 +1893,18 @@ abort:
 	if (!m_area) {
 		fclose(stream_in);
 	}
-	if (file_buff_o2) {
-		html_output_flush(file_buff_o2);
-		if(file_buff_o2->fd != -1)
-			close(file_buff_o2->fd);
-		free(file_buff_o2);
-	}
-	if(file_buff_text) {
-		html_output_flush(file_buff_text);
-		if(file_buff_text->fd != -1)
-			close(file_buff_text->fd);
-		free(file_buff_text);
-        file_buff_text=NULL;
-	}
-	if(file_tmp_o1) {
-		html_output_flush(file_tmp_o1);
-		if(file_buff_text && file_buff_text->fd != -1)
-			close(file_tmp_o1->fd);
-		free(file_tmp_o1);
+	if (file_buff_o2)
+		output_error |= html_output_close(file_buff_o2);
+	if (file_buff_text)
+		output_error |= html_output_close(file_buff_text);
+	if (file_tmp_o1)
+		output_error |= html_output_close(file_tmp_o1);
+	if (output_error) {
+		/* the normalised forms are incomplete, don't let them pass for the document */
+		cli_dbgmsg("cli_html_normalise: output lost, failing\n");
+		if (memout)
+			memout->error = CL_EMEM;
+		retval = FALSE;
 	}
 	return retval;
 }
@@ -1834,7 +1918,7 @@ int html_normalise_mem(unsigned char *in_buff, off_t in_size, const char *dirnam
 	m_area.offset = 0;
 	m_area.map = NULL;
 
-	return cli_html_normalise(-1, &m_area, dirname, hrefs, dconf);
+	return cli_html_normalise(-1, &m_area, dirname, NULL, hrefs, dconf);
 }
 
 int html_normalise_map(fmap_t *map, const char *dirname, tag_arguments_t *hrefs,const struct cli_dconf* dconf)
@@ -1845,10 +1929,34 @@ int html_normalise_map(fmap_t *map, const char *dirname, tag_arguments_t *hrefs,
 	m_area.length = map->len;
 	m_area.offset = 0;
 	m_area.map = map;
-	retval = cli_html_normalise(-1, &m_area, dirname, hrefs, dconf);
+	retval = cli_html_normalise(-1, &m_area, dirname, NULL, hrefs, dconf);
 	return retval;
 }
 
+int html_normalise_map_mem(fmap_t *map, html_norm_output_t *out, const struct cli_dconf* dconf)
+{
+	m_area_t m_area;
+
+	memset(out, 0, sizeof(*out));
+	m_area.length = map->len;
+	m_area.offset = 0;
+	m_area.map = map;
+	return cli_html_normalise(-1, &m_area, NULL, out, NULL, dconf);
+}
+
+void html_norm_output_free(html_norm_output_t *out)
+{
+	unsigned int i;
+
+	free(out->nocomment.data);
+	free(out->notags.data);
+	free(out->javascript.data);
+	for (i = 0; i < out->rfc2397_cnt; i++)
+		free(out->rfc2397[i].data);
+	free(out->rfc2397);
+	memset(out, 0, sizeof(*out));
+}
+
 int html_screnc_decode(fmap_t *map, const char *dirname)
 {
 	int count, retval=FALSE;
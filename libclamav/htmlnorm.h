@@ -38,8 +38,29 @@ typedef struct m_area_tag {
 	fmap_t *map;
 } m_area_t;
 
+/* documents up to this size are normalised in memory by cli_scanhtml() */
+#define HTML_NORM_MEM_MAX (1024 * 1024)
+
+typedef struct html_norm_buf {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+} html_norm_buf_t;
+
+/* the in-memory equivalent of the files html_normalise_map() creates */
+typedef struct html_norm_output {
+	html_norm_buf_t nocomment;
+	html_norm_buf_t notags;
+	html_norm_buf_t javascript;
+	html_norm_buf_t *rfc2397;
+	unsigned int rfc2397_cnt;
+	int error; /* CL_EMEM if some of the output had to be dropped */
+} html_norm_output_t;
+
 int html_normalise_mem(unsigned char *in_buff, off_t in_size, const char *dirname, tag_arguments_t *hrefs,const struct cli_dconf* dconf);
 int html_normalise_map(fmap_t *map, const char *dirname, tag_arguments_t *hrefs, const struct cli_dconf* dconf);
+int html_normalise_map_mem(fmap_t *map, html_norm_output_t *out, const struct cli_dconf* dconf);
+void html_norm_output_free(html_norm_output_t *out);
 void html_tag_arg_free(tag_arguments_t *tags);
 int html_screnc_decode(fmap_t *map, const char *dirname);
 void html_tag_arg_add(tag_arguments_t *tags, const char *tag, char *value);
@@ -53,6 +53,7 @@
 #include "msxml.h"
 #include "json_api.h"
 #include "hwp.h"
+#include "inflate_iface.h"
 #if HAVE_JSON
 #include "msdoc.h"
 #endif
@@ -83,7 +84,7 @@ static int decompress_and_callback(cli_ctx *ctx, fmap_t *input, off_t at, size_t
     int zret, ofd, in, ret = CL_SUCCESS;
     off_t off_in = at;
     size_t count, remain = 1, outsize = 0;
-    z_stream zstrm;
+    struct cli_zstream zstrm;
     char *tmpname;
     unsigned char inbuf[FILEBUFF], outbuf[FILEBUFF];
 
@@ -101,15 +102,12 @@ static int decompress_and_callback(cli_ctx *ctx, fmap_t *input, off_t at, size_t
 
     /* initialize zlib inflation stream */
     memset(&zstrm, 0, sizeof(zstrm));
-    zstrm.zalloc = Z_NULL;
-    zstrm.zfree = Z_NULL;
-    zstrm.opaque = Z_NULL;
     zstrm.next_in = inbuf;
     zstrm.next_out = outbuf;
     zstrm.avail_in = 0;
     zstrm.avail_out = FILEBUFF;
 
-    zret = inflateInit2(&zstrm, -15);
+    zret = cli_inflate_init(&zstrm, -15, ctx);
     if (zret != Z_OK) {
         cli_errmsg("%s: Can't initialize zlib inflation stream\n", parent);
         ret = CL_EUNPACK;
@@ -137,7 +135,7 @@ static int decompress_and_callback(cli_ctx *ctx, fmap_t *input, off_t at, size_t
             zstrm.avail_in = in;
             off_in += in;
         }
-        zret = inflate(&zstrm, Z_SYNC_FLUSH);
+        zret = cli_inflate(&zstrm, Z_SYNC_FLUSH);
         count = FILEBUFF - zstrm.avail_out;
         if (count) {
             if ((ret = cli_checklimits("HWP", ctx, outsize + count, 0, 0)) != CL_SUCCESS)
@@ -181,7 +179,7 @@ static int decompress_and_callback(cli_ctx *ctx, fmap_t *input, off_t at, size_t
 
     /* clean-up */
  dc_end:
-    zret = inflateEnd(&zstrm);
+    zret = cli_inflate_end(&zstrm);
     if (zret != Z_OK) {
         cli_errmsg("%s: Error closing zlib inflation stream\n", parent);
         if (ret == CL_SUCCESS)
@@ -379,12 +377,12 @@ static int hwp5_cb(void *cbdata, int fd, cli_ctx *ctx)
     return cli_magic_scandesc(fd, ctx);
 }
 
-int cli_scanhwp5_stream(cli_ctx *ctx, hwp5_header_t *hwp5, char *name, int fd)
+int cli_scanhwp5_stream(cli_ctx *ctx, hwp5_header_t *hwp5, char *name, fmap_t *map)
 {
     hwp5_debug("HWP5.x: NAME: %s\n", name ? name : "(NULL)");
 
-    if (fd < 0) {
-        cli_errmsg("HWP5.x: Invalid file descriptor argument\n");
+    if (!map) {
+        cli_errmsg("HWP5.x: Invalid map argument\n");
         return CL_ENULLARG;
     }
 
@@ -396,31 +394,13 @@ int cli_scanhwp5_stream(cli_ctx *ctx, hwp5_header_t *hwp5, char *name, int fd)
 
             if (hwp5->flags & HWP5_PASSWORD) {
                 cli_dbgmsg("HWP5.x: Password encrypted stream, scanning as-is\n");
-                return cli_magic_scandesc(fd, ctx);
+                return cli_map_scan(map, 0, map->len, ctx, CL_TYPE_ANY);
             }
 
             if (hwp5->flags & HWP5_COMPRESSED) {
                 /* DocInfo JSON Handling */
-                STATBUF statbuf;
-                fmap_t *input;
-                int ret;
-
                 hwp5_debug("HWP5.x: Sending %s for decompress and scan\n", name);
-
-                /* fmap the input file for easier manipulation */
-                if (FSTAT(fd, &statbuf) == -1) {
-                    cli_errmsg("HWP5.x: Can't stat file descriptor\n");
-                    return CL_ESTAT;
-                }
-
-                input = fmap(fd, 0, statbuf.st_size);
-                if (!input) {
-                    cli_errmsg("HWP5.x: Failed to get fmap for input stream\n");
-                    return CL_EMAP;
-                }
-                ret = decompress_and_callback(ctx, input, 0, 0, "HWP5.x", hwp5_cb, NULL);
-                funmap(input);
-                return ret;
+                return decompress_and_callback(ctx, map, 0, 0, "HWP5.x", hwp5_cb, NULL);
             }
         }
 
@@ -430,7 +410,7 @@ int cli_scanhwp5_stream(cli_ctx *ctx, hwp5_header_t *hwp5, char *name, int fd)
             if (name && !strncmp(name, "_5_hwpsummaryinformation", 24)) {
                 cli_dbgmsg("HWP5.x: Detected a '_5_hwpsummaryinformation' stream\n");
                 /* JSONOLE2 - what to do if something breaks? */
-                if (cli_ole2_summary_json(ctx, fd, 2) == CL_ETIMEOUT)
+                if (cli_ole2_summary_json(ctx, map, 2) == CL_ETIMEOUT)
                     return CL_ETIMEOUT;
             }
         }
@@ -439,7 +419,7 @@ int cli_scanhwp5_stream(cli_ctx *ctx, hwp5_header_t *hwp5, char *name, int fd)
     }
 
     /* normal streams */
-    return cli_magic_scandesc(fd, ctx);
+    return cli_map_scan(map, 0, map->len, ctx, CL_TYPE_ANY);
 }
 
 /*** HWP3 ***/
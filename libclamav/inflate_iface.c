@@ -0,0 +1,337 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <string.h>
+#include <limits.h>
+
+#include "clamav.h"
+#include "others.h"
+#include "events.h"
+#include "ltdl.h"
+#include "inflate_iface.h"
+
+struct cli_inflate_backend {
+    const char *name;
+    int (*init)(struct cli_zstream *strm);
+    int (*inflate)(struct cli_zstream *strm, int flush);
+    int (*end)(struct cli_zstream *strm);
+};
+
+/* zlib */
+
+static int zlib_init(struct cli_zstream *strm)
+{
+    return inflateInit2(&strm->s.z, strm->windowbits);
+}
+
+static int zlib_inflate(struct cli_zstream *strm, int flush)
+{
+    z_stream *z = &strm->s.z;
+    int ret;
+
+    z->next_in = strm->next_in;
+    z->avail_in = strm->avail_in;
+    z->next_out = strm->next_out;
+    z->avail_out = strm->avail_out;
+
+    ret = inflate(z, flush);
+
+    strm->next_in = z->next_in;
+    strm->avail_in = z->avail_in;
+    strm->total_in = z->total_in;
+    strm->next_out = z->next_out;
+    strm->avail_out = z->avail_out;
+    strm->total_out = z->total_out;
+    strm->msg = z->msg;
+    return ret;
+}
+
+static int zlib_end(struct cli_zstream *strm)
+{
+    return inflateEnd(&strm->s.z);
+}
+
+static const struct cli_inflate_backend zlib_backend = {
+    "zlib", zlib_init, zlib_inflate, zlib_end
+};
+
+/* deflate64 */
+
+static int inflate64_init(struct cli_zstream *strm)
+{
+    return inflate64Init2(&strm->s.z64, strm->windowbits);
+}
+
+static int inflate64_inflate(struct cli_zstream *strm, int flush)
+{
+    z_stream64 *z = &strm->s.z64;
+    int ret;
+
+    z->next_in = strm->next_in;
+    z->avail_in = strm->avail_in;
+    z->next_out = strm->next_out;
+    z->avail_out = strm->avail_out;
+
+    ret = inflate64(z, flush);
+
+    strm->next_in = z->next_in;
+    strm->avail_in = z->avail_in;
+    strm->total_in = z->total_in;
+    strm->next_out = z->next_out;
+    strm->avail_out = z->avail_out;
+    strm->total_out = z->total_out;
+    return ret;
+}
+
+static int inflate64_end(struct cli_zstream *strm)
+{
+    return inflate64End(&strm->s.z64);
+}
+
+static const struct cli_inflate_backend inflate64_backend = {
+    "inflate64", inflate64_init, inflate64_inflate, inflate64_end
+};
+
+static int inflate_start(struct cli_zstream *strm, const struct cli_inflate_backend *backend, int windowbits, cli_ctx *ctx)
+{
+    int ret;
+
+    memset(&strm->s, 0, sizeof(strm->s));
+    strm->total_in = strm->total_out = 0;
+    strm->msg = NULL;
+    strm->backend = backend;
+    strm->windowbits = windowbits;
+    strm->perf = ctx ? ctx->perf : NULL;
+
+    if ((ret = backend->init(strm)) != Z_OK) {
+        cli_dbgmsg("cli_inflate: %s init failed: %d\n", backend->name, ret);
+        strm->backend = NULL;
+    }
+    return ret;
+}
+
+int cli_inflate_init(struct cli_zstream *strm, int windowbits, cli_ctx *ctx)
+{
+    return inflate_start(strm, &zlib_backend, windowbits, ctx);
+}
+
+int cli_inflate64_init(struct cli_zstream *strm, cli_ctx *ctx)
+{
+    return inflate_start(strm, &inflate64_backend, -MAX_WBITS64, ctx);
+}
+
+int cli_inflate(struct cli_zstream *strm, int flush)
+{
+    int ret;
+
+    if (!strm->backend)
+        return Z_STREAM_ERROR;
+
+    if (!strm->perf)
+        return strm->backend->inflate(strm, flush);
+
+    cli_event_time_start(strm->perf, PERFT_INFLATE);
+    ret = strm->backend->inflate(strm, flush);
+    cli_event_time_stop(strm->perf, PERFT_INFLATE);
+    return ret;
+}
+
+int cli_inflate_reset(struct cli_zstream *strm)
+{
+    if (!strm->backend)
+        return Z_STREAM_ERROR;
+
+    strm->total_in = strm->total_out = 0;
+    strm->msg = NULL;
+    if (strm->backend == &zlib_backend)
+        return inflateReset(&strm->s.z);
+
+    /* inflate64 has no reset */
+    strm->backend->end(strm);
+    memset(&strm->s, 0, sizeof(strm->s));
+    return strm->backend->init(strm);
+}
+
+int cli_inflate_end(struct cli_zstream *strm)
+{
+    int ret;
+
+    if (!strm->backend)
+        return Z_STREAM_ERROR;
+
+    ret = strm->backend->end(strm);
+    strm->backend = NULL;
+    return ret;
+}
+
+/* native whole-buffer decoder, libdeflate's decompression API */
+
+struct native_decompressor;
+typedef struct native_decompressor *(*native_alloc_t)(void);
+typedef int (*native_decompress_t)(struct native_decompressor *d, const void *in, size_t in_nbytes,
+                                   void *out, size_t out_nbytes_avail,
+                                   size_t *actual_in_nbytes_ret, size_t *actual_out_nbytes_ret);
+typedef void (*native_free_t)(struct native_decompressor *d);
+
+/* enum libdeflate_result */
+#define NATIVE_SUCCESS 0
+#define NATIVE_INSUFFICIENT_SPACE 3
+
+static struct {
+    const char *name;
+    native_alloc_t alloc;
+    native_decompress_t deflate;
+    native_decompress_t zlib;
+    native_decompress_t gzip;
+    native_free_t free;
+} native;
+static int native_loaded = 0;
+static int native_use = 0;
+
+void cli_inflate_load(void)
+{
+    static const char *names[] = {
+        "libdeflate"LT_MODULE_EXT".0",
+        "libdeflate"LT_MODULE_EXT
+    };
+    lt_dlhandle handle = NULL;
+    unsigned int i;
+
+    if (native_loaded)
+        return;
+    native_loaded = 1;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]) && !handle; i++)
+        handle = lt_dlopen(names[i]);
+    if (!handle) {
+        cli_dbgmsg("cli_inflate: libdeflate not found, inflating with zlib\n");
+        return;
+    }
+
+    if (!(native.alloc = (native_alloc_t)lt_dlsym(handle, "libdeflate_alloc_decompressor")) ||
+        !(native.deflate = (native_decompress_t)lt_dlsym(handle, "libdeflate_deflate_decompress_ex")) ||
+        !(native.zlib = (native_decompress_t)lt_dlsym(handle, "libdeflate_zlib_decompress_ex")) ||
+        !(native.gzip = (native_decompress_t)lt_dlsym(handle, "libdeflate_gzip_decompress_ex")) ||
+        !(native.free = (native_free_t)lt_dlsym(handle, "libdeflate_free_decompressor"))) {
+        cli_dbgmsg("cli_inflate: can't resolve libdeflate (too old?), inflating with zlib\n");
+        memset(&native, 0, sizeof(native));
+        lt_dlclose(handle);
+        return;
+    }
+
+    native.name = "libdeflate";
+    native_use = 1;
+    cli_dbgmsg("cli_inflate: using libdeflate for whole buffers\n");
+}
+
+const char *cli_inflate_native(void)
+{
+    return native_use ? native.name : NULL;
+}
+
+const char *cli_inflate_set_native(int use)
+{
+    native_use = use && native.name;
+    return cli_inflate_native();
+}
+
+int cli_inflate_buffer_native(const void *src, size_t *srclen, void *dst, size_t *dstlen, int windowbits, cli_ctx *ctx)
+{
+    const unsigned char *in = src;
+    native_decompress_t decompress;
+    struct native_decompressor *d;
+    size_t used = 0, produced = 0;
+    int ret;
+
+    if (!native_use)
+        return Z_STREAM_ERROR;
+
+    if (windowbits < 0)
+        decompress = native.deflate;
+    else if (windowbits >= 32)
+        decompress = (*srclen >= 2 && in[0] == 0x1f && in[1] == 0x8b) ? native.gzip : native.zlib;
+    else if (windowbits >= 16)
+        decompress = native.gzip;
+    else
+        decompress = native.zlib;
+
+    if (!(d = native.alloc()))
+        return Z_MEM_ERROR;
+
+    if (ctx && ctx->perf)
+        cli_event_time_start(ctx->perf, PERFT_INFLATE);
+    ret = decompress(d, src, *srclen, dst, *dstlen, &used, &produced);
+    if (ctx && ctx->perf)
+        cli_event_time_stop(ctx->perf, PERFT_INFLATE);
+    native.free(d);
+
+    switch (ret) {
+    case NATIVE_SUCCESS:
+        *srclen = used;
+        *dstlen = produced;
+        return Z_OK;
+    case NATIVE_INSUFFICIENT_SPACE:
+        return Z_BUF_ERROR;
+    default:
+        return Z_DATA_ERROR;
+    }
+}
+
+int cli_inflate_buffer(const void *src, size_t srclen, void *dst, size_t *dstlen, int windowbits, cli_ctx *ctx)
+{
+    struct cli_zstream strm;
+    size_t used = srclen, produced = *dstlen;
+    int ret;
+
+    if (cli_inflate_buffer_native(src, &used, dst, &produced, windowbits, ctx) == Z_OK) {
+        *dstlen = produced;
+        return Z_OK;
+    }
+
+    memset(&strm, 0, sizeof(strm));
+    strm.next_in = (unsigned char *)src;
+    strm.avail_in = MIN(srclen, UINT_MAX);
+    strm.next_out = (unsigned char *)dst;
+    strm.avail_out = MIN(*dstlen, UINT_MAX);
+
+    if ((ret = cli_inflate_init(&strm, windowbits, ctx)) != Z_OK) {
+        *dstlen = 0;
+        return ret;
+    }
+
+    /* a single Z_FINISH call lets zlib decode straight into dst without
+     * maintaining its sliding window */
+    ret = cli_inflate(&strm, Z_FINISH);
+    *dstlen = strm.next_out - (unsigned char *)dst;
+    cli_inflate_end(&strm);
+
+    switch (ret) {
+    case Z_STREAM_END:
+        return Z_OK;
+    case Z_OK:
+        return Z_BUF_ERROR;
+    case Z_NEED_DICT:
+        return Z_DATA_ERROR;
+    default:
+        return ret;
+    }
+}
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __INFLATE_IFACE_H
+#define __INFLATE_IFACE_H
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <zlib.h>
+#include "others.h"
+#include "events.h"
+#include "inflate64.h"
+
+/*
+ * Common entry point for every deflate consumer in libclamav.
+ *
+ * The stream fields have the same meaning as in zlib's z_stream and the
+ * functions return zlib status codes, so callers only swap the names.
+ * The decoder behind the stream is picked when it is initialised: the
+ * zlib libclamav was linked against (stock zlib or a compatible build
+ * such as zlib-ng, chosen with --with-zlib) for deflate, the bundled
+ * inflate64 for deflate64. Time spent decoding is reported as "inflate"
+ * by --dev-performance.
+ *
+ * Whole buffers of known size can also go to a native decoder, libdeflate,
+ * when cl_init() finds it at run time. It is several times faster than
+ * zlib but cannot decode a stream in pieces, so it is only ever a fast
+ * path: anything it refuses is decoded again with zlib.
+ */
+
+struct cli_inflate_backend;
+
+struct cli_zstream {
+    unsigned char *next_in;
+    unsigned int avail_in;
+    unsigned long total_in;
+
+    unsigned char *next_out;
+    unsigned int avail_out;
+    unsigned long total_out;
+
+    const char *msg;
+
+    /* private */
+    const struct cli_inflate_backend *backend;
+    cli_events_t *perf;
+    int windowbits;
+    union {
+        z_stream z;
+        z_stream64 z64;
+    } s;
+};
+
+/* windowbits as for inflateInit2(): negative for raw, +16 gzip, +32 auto */
+int cli_inflate_init(struct cli_zstream *strm, int windowbits, cli_ctx *ctx);
+/* raw deflate64 (zip method 9) */
+int cli_inflate64_init(struct cli_zstream *strm, cli_ctx *ctx);
+int cli_inflate(struct cli_zstream *strm, int flush);
+int cli_inflate_reset(struct cli_zstream *strm);
+int cli_inflate_end(struct cli_zstream *strm);
+
+/*
+ * Decompresses a whole buffer in one call, like zlib's uncompress().
+ * On return *dstlen holds the number of bytes produced. Returns Z_OK once
+ * the end of the stream was reached, Z_BUF_ERROR when the input or the
+ * output ran out first, or another zlib error code.
+ */
+int cli_inflate_buffer(const void *src, size_t srclen, void *dst, size_t *dstlen, int windowbits, cli_ctx *ctx);
+
+/*
+ * Decodes a whole deflate, zlib or gzip stream (windowbits as above) with
+ * the native decoder only. Returns Z_OK when the stream ended within dst,
+ * with *srclen and *dstlen set to the bytes consumed and produced; any
+ * other code means the stream has to be decoded with zlib.
+ */
+int cli_inflate_buffer_native(const void *src, size_t *srclen, void *dst, size_t *dstlen, int windowbits, cli_ctx *ctx);
+
+/* looks for the native decoder, called by cl_init() */
+void cli_inflate_load(void);
+/* name of the native decoder in use, NULL if none */
+const char *cli_inflate_native(void);
+/* turns the native decoder on or off, returns the name of the one in use */
+const char *cli_inflate_set_native(int use);
+
+#endif /* __INFLATE_IFACE_H */
@@ -49,6 +49,7 @@
 #include "others.h"
 #include "fmap.h"
 #include "ishield.h"
+#include "inflate_iface.h"
 
 #ifndef LONG_MAX
 #define LONG_MAX ((-1UL)>>1)
@@ -219,7 +220,7 @@ int cli_scanishield_msi(cli_ctx *ctx, off_t off) {
 	unsigned int i, lameidx=0, keylen;
 	int ofd;
 	uint64_t csize;
-	z_stream z;
+	struct cli_zstream z;
 
 	if(fmap_readn(map, &fb, off, sizeof(fb)) != sizeof(fb)) {
 	    cli_dbgmsg("ishield-msi: short read for fileblock\n");
@@ -252,7 +253,7 @@ int cli_scanishield_msi(cli_ctx *ctx, off_t off) {
 	for(i=0; i<keylen; i++)
 	    key[i] ^= skey[i & 3];
 	memset(&z, 0, sizeof(z));
-	inflateInit(&z);
+	cli_inflate_init(&z, MAX_WBITS, ctx);
 	ret = CL_SUCCESS;
 	while(csize) {
 	    uint8_t buf2[BUFSIZ];
@@ -274,7 +275,7 @@ int cli_scanishield_msi(cli_ctx *ctx, off_t off) {
 		int inf;
 		z.avail_out = sizeof(obuf);
 		z.next_out = obuf;
-		inf = inflate(&z, 0);
+		inf = cli_inflate(&z, 0);
 		if(inf != Z_OK && inf != Z_STREAM_END && inf != Z_BUF_ERROR) {
 		    cli_dbgmsg("ishield-msi: bad stream\n");
 		    csize = 0;
@@ -295,7 +296,7 @@ int cli_scanishield_msi(cli_ctx *ctx, off_t off) {
 	    } while (!z.avail_out);
 	}
 
-	inflateEnd(&z);
+	cli_inflate_end(&z);
 
 	if (ret == CL_SUCCESS) {
 	    cli_dbgmsg("ishield-msi: extracted to %s\n", tempfile);
@@ -697,7 +698,7 @@ static int is_extract_cab(cli_ctx *ctx, uint64_t off, uint64_t size, uint64_t cs
     uint8_t *outbuf;
     char *tempfile;
     int ofd, ret = CL_CLEAN;
-    z_stream z;
+    struct cli_zstream z;
     uint64_t outsz = 0;
     int success = 0;
     fmap_t *map = *ctx->fmap;
@@ -747,14 +748,14 @@ static int is_extract_cab(cli_ctx *ctx, uint64_t off, uint64_t size, uint64_t cs
 	}
 	off += chunksz;
 	memset(&z, 0, sizeof(z));
-	inflateInit2(&z, -MAX_WBITS);
+	cli_inflate_init(&z, -MAX_WBITS, ctx);
 	z.next_in = (uint8_t *)inbuf;
 	z.avail_in = chunksz;
 	while(1) {
 	    int zret;
 	    z.next_out = outbuf;
 	    z.avail_out = IS_CABBUFSZ;
-	    zret = inflate(&z, 0);
+	    zret = cli_inflate(&z, 0);
 	    if(zret == Z_OK || zret == Z_STREAM_END || zret == Z_BUF_ERROR) {
 		unsigned int umpd = IS_CABBUFSZ - z.avail_out;
 		if(cli_writen(ofd, outbuf, umpd) < (ssize_t)umpd)
@@ -775,7 +776,7 @@ static int is_extract_cab(cli_ctx *ctx, uint64_t off, uint64_t size, uint64_t cs
 	    cli_dbgmsg("is_extract_cab: file decompression failed with %d\n", zret);
 	    break;
 	}
-	inflateEnd(&z);
+	cli_inflate_end(&z);
 	if(!success) break;
     }
     free(outbuf);
@@ -55,42 +55,39 @@ static const void *needblock(const iso9660_t *iso, unsigned int block, int temp)
 
 
 static int iso_scan_file(const iso9660_t *iso, unsigned int block, unsigned int len) {
-    char *tmpf;
-    int fd, ret = CL_SUCCESS;
+    fmap_extents_t *file;
+    fmap_t *map = *iso->ctx->fmap;
+    unsigned int blocks_per_sect = (2048 / iso->blocksz);
+    size_t loff;
+    int ret;
 
-    if(cli_gentempfd(iso->ctx->engine->tmpdir, &tmpf, &fd) != CL_SUCCESS)
-        return CL_ETMPFILE;
+    if(!(file = fmap_extents_new(map)))
+        return CL_EMEM;
 
-    cli_dbgmsg("iso_scan_file: dumping to %s\n", tmpf);
+    /* the file is read in place, block by block; with 2048 byte sectors
+     * the blocks coalesce into a single extent */
     while(len) {
-        const void *buf = needblock(iso, block, 1);
         unsigned int todo = MIN(len, iso->blocksz);
-        if(!buf) {
+        if(block > ((map->len - iso->base_offset) / iso->sectsz) * blocks_per_sect) {
             /* Block outside file */
-            cli_dbgmsg("iso_scan_file: cannot dump block outside file, ISO may be truncated\n");
-            ret = CL_EFORMAT;
-            break;
+            cli_dbgmsg("iso_scan_file: cannot map block outside file, ISO may be truncated\n");
+            fmap_extents_free(file);
+            return CL_EFORMAT;
         }
-        if((unsigned int)cli_writen(fd, buf, todo) != todo) {
-            cli_warnmsg("iso_scan_file: Can't write to file %s\n", tmpf);
-            ret = CL_EWRITE;
-            break;
+        loff = (block / blocks_per_sect) * iso->sectsz;
+        loff += (block % blocks_per_sect) * iso->blocksz;
+        if((ret = fmap_extents_add(file, iso->base_offset + loff, todo)) != CL_SUCCESS) {
+            fmap_extents_free(file);
+            return ret;
         }
         len -= todo;
         block++;
     }
 
-    if (!len)
-        ret = cli_magic_scandesc(fd, iso->ctx);
-
-    close(fd);
-    if(!iso->ctx->engine->keeptmp) {
-	if(cli_unlink(tmpf)) {
-	    ret = CL_EUNLINK;
-	}
-    }
-
-    free(tmpf);
+    if(!(map = fmap_extents_map(file)))
+        return CL_SUCCESS;
+    ret = cli_map_scan(map, 0, map->len, iso->ctx, CL_TYPE_ANY);
+    funmap(map);
     return ret;
 }
 
@@ -38,7 +38,7 @@
 #include "clamav.h"
 #include "cltypes.h"
 #include "jsparse/lexglobal.h"
-#include "hashtab.h"
+#include "arena.h"
 #include "others.h"
 #include "str.h"
 #include "js-norm.h"
@@ -90,10 +90,17 @@ enum fsm_state {
 	InsideFunctionDecl
 };
 
+/* identifier -> uniq id map of a scope, keyed by interned identifier */
+struct scope_ids {
+	const char **keys;
+	long *ids;
+	size_t capacity;
+	size_t used;
+};
+
 struct scope {
-	struct cli_hashtable id_map;
+	struct scope_ids ids;
 	struct scope *parent;/* hierarchy */
-	struct scope *nxt;/* all scopes kept in a list so we can easily free all of them */
 	enum fsm_state fsm_state;
 	int  last_token;
 	unsigned int brackets;
@@ -106,44 +113,153 @@ struct tokens {
 	size_t   capacity;
 };
 
+/* every distinct identifier of a file is stored once, so identifiers can be
+ * compared by pointer */
+struct idents {
+	const char **keys;
+	size_t capacity;
+	size_t used;
+};
+
 /* state for the current JS file being parsed */
 struct parser_state {
 	unsigned long     var_uniq;
 	unsigned long     syntax_errors;
 	struct scope *global;
 	struct scope *current;
-	struct scope *list;
 	yyscan_t scanner;
 	struct tokens tokens;
 	unsigned int      rec;
+	/* scopes, identifiers and token strings live here until cli_js_destroy */
+	cli_arena_t *arena;
+	struct idents idents;
+	/* result of the last string concatenation, to avoid strlen on long
+	 * "a"+"b"+... chains */
+	const char *fold_str;
+	size_t fold_len;
 };
 
 static struct scope* scope_new(struct parser_state *state)
 {
 	struct scope *parent = state->current;
-	struct scope *s = cli_calloc(1, sizeof(*s));
+	struct scope *s = cli_arena_calloc(state->arena, 1, sizeof(*s));
 	if(!s)
 		return NULL;
-	if(cli_hashtab_init(&s->id_map, 10) < 0) {
-		free(s);
-		return NULL;
-	}
 	s->parent = parent;
 	s->fsm_state = Base;
-	s->nxt = state->list;
-	state->list = s;
 	state->current = s;
 	return s;
 }
 
-static struct scope* scope_done(struct scope *s)
+static char *js_strndup(struct parser_state *state, const char *s, size_t n)
+{
+	if(!s)
+		return NULL;
+	return cli_arena_strndup(state->arena, s, n);
+}
+
+static uint32_t ident_hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+	while(len--)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static const char *ident_intern(struct parser_state *state, const char *token, size_t len)
+{
+	struct idents *idents = &state->idents;
+	const char *key;
+	size_t i;
+
+	if(2*(idents->used + 1) > idents->capacity) {
+		size_t capacity = idents->capacity ? idents->capacity * 2 : 256;
+		const char **keys = cli_calloc(capacity, sizeof(*keys));
+		if(!keys)
+			return NULL;
+		for(i = 0; i < idents->capacity; i++) {
+			size_t j;
+			key = idents->keys[i];
+			if(!key)
+				continue;
+			j = ident_hash(key, strlen(key)) & (capacity - 1);
+			while(keys[j])
+				j = (j + 1) & (capacity - 1);
+			keys[j] = key;
+		}
+		free(idents->keys);
+		idents->keys = keys;
+		idents->capacity = capacity;
+	}
+	i = ident_hash(token, len) & (idents->capacity - 1);
+	while((key = idents->keys[i])) {
+		if(!strncmp(key, token, len) && !key[len])
+			return key;
+		i = (i + 1) & (idents->capacity - 1);
+	}
+	key = cli_arena_strndup(state->arena, token, len);
+	if(!key)
+		return NULL;
+	idents->keys[i] = key;
+	idents->used++;
+	return key;
+}
+
+#define SCOPE_HASH(key, capacity) \
+	((size_t)(((uintptr_t)(key) >> 3) * 2654435761u) & ((capacity) - 1))
+
+static long *scope_ids_find(struct scope_ids *ids, const char *key)
 {
-	struct scope* parent = s->parent;
-	/* TODO: have a hashtab_destroy */
-	cli_hashtab_clear(&s->id_map);
-	free(s->id_map.htable);
-	free(s);
-	return parent;
+	size_t i;
+
+	if(!ids->capacity)
+		return NULL;
+	i = SCOPE_HASH(key, ids->capacity);
+	while(ids->keys[i]) {
+		if(ids->keys[i] == key)
+			return &ids->ids[i];
+		i = (i + 1) & (ids->capacity - 1);
+	}
+	return NULL;
+}
+
+static long *scope_ids_insert(struct parser_state *state, struct scope_ids *ids, const char *key, long id)
+{
+	size_t i;
+	long *found = scope_ids_find(ids, key);
+
+	if(found) {
+		*found = id;
+		return found;
+	}
+	if(2*(ids->used + 1) > ids->capacity) {
+		/* the old table is left to the arena */
+		struct scope_ids grown;
+		grown.capacity = ids->capacity ? ids->capacity * 2 : 16;
+		grown.used = ids->used;
+		grown.keys = cli_arena_calloc(state->arena, grown.capacity, sizeof(*grown.keys));
+		grown.ids = cli_arena_malloc(state->arena, grown.capacity * sizeof(*grown.ids));
+		if(!grown.keys || !grown.ids)
+			return NULL;
+		for(i = 0; i < ids->capacity; i++) {
+			size_t j;
+			if(!ids->keys[i])
+				continue;
+			j = SCOPE_HASH(ids->keys[i], grown.capacity);
+			while(grown.keys[j])
+				j = (j + 1) & (grown.capacity - 1);
+			grown.keys[j] = ids->keys[i];
+			grown.ids[j] = ids->ids[i];
+		}
+		*ids = grown;
+	}
+	i = SCOPE_HASH(key, ids->capacity);
+	while(ids->keys[i])
+		i = (i + 1) & (ids->capacity - 1);
+	ids->keys[i] = key;
+	ids->ids[i] = id;
+	ids->used++;
+	return &ids->ids[i];
 }
 
 /* transitions:
@@ -252,34 +368,41 @@ static struct scope* scope_done(struct scope *s)
 
 static const char* scope_declare(struct scope *s, const char *token, const size_t len, struct parser_state *state)
 {
-	const struct cli_element *el = cli_hashtab_insert(&s->id_map, token, len, state->var_uniq++);
-	/* cli_hashtab_insert either finds an already existing entry, or allocates a
-	 * new one, we return the allocated string */
-	return el ? el->key : NULL;
+	const char *key = ident_intern(state, token, len);
+	long id = state->var_uniq++;
+
+	if(!key || !scope_ids_insert(state, &s->ids, key, id))
+		return NULL;
+	return key;
 }
 
-static const char* scope_use(struct scope *s, const char *token, const size_t len)
+static const char* scope_use(struct scope *s, const char *token, const size_t len, struct parser_state *state)
 {
-	const struct cli_element *el = cli_hashtab_find(&s->id_map, token, len);
-	if(el) {
+	const char *key = ident_intern(state, token, len);
+
+	if(!key)
+		return NULL;
+	if(scope_ids_find(&s->ids, key)) {
 		/* identifier already found in current scope,
 		 * return here to avoid overwriting uniq id */
-		return el->key;
+		return key;
 	}
-	/* identifier not yet in current scope's hashtab, add with ID -1.
+	/* identifier not yet in current scope, add with ID -1.
 	 * Later if we find a declaration it will automatically assign a uniq ID
 	 * to it. If not, we'll know that we have to push ID == -1 tokens to an
 	 * outer scope.*/
-	el = cli_hashtab_insert(&s->id_map, token, len, -1);
-	return el ? el->key : NULL;
+	if(!scope_ids_insert(state, &s->ids, key, -1))
+		return NULL;
+	return key;
 }
 
-static long scope_lookup(struct scope *s, const char *token, const size_t len)
+/* token must be an interned identifier */
+static long scope_lookup(struct scope *s, const char *token)
 {
 	while(s) {
-		const struct cli_element *el = cli_hashtab_find(&s->id_map, token, len);
-		if(el && el->data != -1) {
-			return el->data;
+		const long *id = scope_ids_find(&s->ids, token);
+		if(id && *id != -1) {
+			return *id;
 		}
 		/* not found in current scope, try in outer scope */
 		s = s->parent;
@@ -291,7 +414,7 @@ static int tokens_ensure_capacity(struct tokens *tokens, size_t cap)
 {
 	if(tokens->capacity < cap) {
 	        yystype *data;
-		cap += 1024;
+		cap = MAX(cap + 1024, tokens->capacity * 2);
 		/* Keep old data if OOM */
 		data = cli_realloc(tokens->data, cap * sizeof(*tokens->data));
 		if(!data)
@@ -313,13 +436,34 @@ static int add_token(struct parser_state *state, const yystype *token)
 struct buf {
 	size_t pos;
 	int outfd;
+	/* when set, output is appended to *mem instead of written to outfd */
+	unsigned char **mem;
+	size_t *memlen;
 	char buf[65536];
 };
 
+static int buf_write(struct buf *buf, const char *data, size_t len)
+{
+	unsigned char *mem;
+
+	if(buf->mem) {
+		mem = cli_realloc(*buf->mem, *buf->memlen + len);
+		if(!mem)
+			return CL_EMEM;
+		memcpy(mem + *buf->memlen, data, len);
+		*buf->mem = mem;
+		*buf->memlen += len;
+		return CL_SUCCESS;
+	}
+	if(write(buf->outfd, data, len) != (ssize_t)len)
+		return CL_EWRITE;
+	return CL_SUCCESS;
+}
+
 static inline int buf_outc(char c, struct buf *buf)
 {
 	if(buf->pos >= sizeof(buf->buf)) {
-		if(write(buf->outfd, buf->buf, sizeof(buf->buf)) != sizeof(buf->buf))
+		if(buf_write(buf, buf->buf, sizeof(buf->buf)) != CL_SUCCESS)
 			return CL_EWRITE;
 		buf->pos = 0;
 	}
@@ -342,7 +486,7 @@ static inline int buf_outs(const char *s, struct buf *buf)
 			++s;
 		}
 		if(i == buf_len) {
-			if(write(buf->outfd, buf->buf, buf_len) < 0)
+			if(buf_write(buf, buf->buf, buf_len) != CL_SUCCESS)
 				return CL_EWRITE;
 		       i = 0;
 		}
@@ -386,7 +530,7 @@ static char output_token(const yystype *token, struct scope *scope, struct buf *
 		case TOK_IDENTIFIER_NAME:
 			output_space(lastchar,'a', out);
 			if(s) {
-				long id = scope_lookup(scope, s, strlen(s));
+				long id = scope_lookup(scope, s);
 				if(id == -1) {
 					/* identifier not normalized */
 					buf_outs(s, out);
@@ -418,10 +562,10 @@ static char output_token(const yystype *token, struct scope *scope, struct buf *
  * If we would normalize all the identifiers, and output when a scope is closed,
  * then it would be impossible to normalize calls to other functions.
  *
- * So we need to keep all scopes in memory, to do this instead of scope_done, we
- * simply just set current = current->parent when a scope is closed.
- * We keep a list of all scopes created in parser_state-> When we parsed
- * everything, we output everything, and then delete all scopes.
+ * So we need to keep all scopes in memory, to do this we simply just set
+ * current = current->parent when a scope is closed.
+ * All scopes are allocated from the parser_state's arena. When we parsed
+ * everything, we output everything, and then the arena is destroyed.
  *
  * We also need to know where to switch scopes on the second pass, so for
  * TOK_FUNCTION types we will use another pointer, that points to the scope
@@ -465,16 +609,6 @@ static char output_token(const yystype *token, struct scope *scope, struct buf *
  * function ... (.
  */
 
-static void scope_free_all(struct scope *p)
-{
-	struct scope *nxt;
-	do {
-		nxt = p->nxt;
-		scope_done(p);
-		p = nxt;
-	} while(p);
-}
-
 size_t cli_strtokenize(char *buffer, const char delim, const size_t token_count, const char **tokens);
 static int match_parameters(const yystype *tokens, const char ** param_names, size_t count)
 {
@@ -500,39 +634,15 @@ static int match_parameters(const yystype *tokens, const char ** param_names, si
 static const char *de_packer_3[] = {"p","a","c","k","e","r"};
 static const char *de_packer_2[] = {"p","a","c","k","e","d"};
 
-static inline char *textbuffer_done(yyscan_t scanner)
-{
-       char *str = cli_realloc(scanner->buf.data, scanner->buf.pos);
-       if(!str) {
-               str = scanner->buf.data;
-       }
-       scanner->yytext = str;
-       scanner->yylen = scanner->buf.pos - 1;
-       memset(&scanner->buf, 0, sizeof(scanner->buf));
-       return str;
-}
-
 #define MODULE "JS-Norm: "
 
-static void free_token(yystype *token)
-{
-	if(token->vtype == vtype_string) {
-		free(token->val.string);
-		token->val.string = NULL;
-	}
-}
-
 static int replace_token_range(struct tokens *dst, size_t start, size_t end, const struct tokens *with)
 {
 	const size_t len = with ? with->cnt : 0;
-	size_t i;
 	cli_dbgmsg(MODULE "Replacing tokens %lu - %lu with %lu tokens\n", (unsigned long)start,
                    (unsigned long)end, (unsigned long)len);
 	if(start >= dst->cnt || end > dst->cnt)
 		return -1;
-	for(i=start;i<end;i++) {
-		free_token(&dst->data[i]);
-	}
 	if(tokens_ensure_capacity(dst, dst->cnt - (end-start) + len))
 		return CL_EMEM;
 	memmove(&dst->data[start+len], &dst->data[end], (dst->cnt - end) * sizeof(dst->data[0]));
@@ -613,6 +723,7 @@ struct decode_result {
 	size_t pos_end;
         unsigned append:1; /* 0: tokens are replaced with new token(s),
                             1: old tokens are deleted, new ones appended at the end */
+        unsigned borrowed:1; /* txtbuf.data belongs to a token, don't free it */
 };
 
 static void handle_de(yystype *tokens, size_t start, const size_t cnt, const char *name, struct decode_result *res)
@@ -685,25 +796,6 @@ static void handle_de(yystype *tokens, size_t start, const size_t cnt, const cha
 	}
 }
 
-static int handle_unescape(struct tokens *tokens, size_t start)
-{
-	if(tokens->data[start].type == TOK_StringLiteral) {
-		char *R;
-		struct tokens new_tokens;
-		yystype tok;
-
-		R = cli_unescape(TOKEN_GET(&tokens->data[start], cstring));
-		tok.type = TOK_StringLiteral;
-		TOKEN_SET(&tok, string, R);
-		new_tokens.capacity = new_tokens.cnt = 1;
-		new_tokens.data = &tok;
-		if(replace_token_range(tokens, start-2, start+2, &new_tokens) < 0)
-			return CL_EMEM;
-	}
-	return CL_SUCCESS;
-}
-
-
 /* scriptasylum dot com's JS encoder */
 static void handle_df(const yystype *tokens, size_t start, struct decode_result *res)
 {
@@ -743,26 +835,40 @@ static void handle_eval(struct tokens *tokens, size_t start, struct decode_resul
 {
 	res->txtbuf.data = TOKEN_GET(&tokens->data[start], string);
 	if(res->txtbuf.data && tokens->data[start+1].type == TOK_PAR_CLOSE) {
-		TOKEN_SET(&tokens->data[start], string, NULL);
 		res->txtbuf.pos = strlen(res->txtbuf.data);
 		res->pos_begin = start-2;
 		res->pos_end = start+2;
+		res->borrowed = 1;
 	}
 }
 
-static void run_folders(struct tokens *tokens)
+/* folds unescape("...") into a string literal, compacting the token array in
+ * the same pass */
+static void run_folders(struct parser_state *state)
 {
-  size_t i;
+  struct tokens *tokens = &state->tokens;
+  size_t i, j;
 
-  for(i = 0; i < tokens->cnt; i++) {
+  for(i = 0, j = 0; i < tokens->cnt; j++) {
 	  const char *cstring = TOKEN_GET(&tokens->data[i], cstring);
-	  if(i+2 < tokens->cnt && tokens->data[i].type == TOK_IDENTIFIER_NAME &&
+	  if(i+3 < tokens->cnt && tokens->data[i].type == TOK_IDENTIFIER_NAME &&
 		    cstring &&
-		    !strcmp("unescape", cstring) && tokens->data[i+1].type == TOK_PAR_OPEN) {
-
-		  handle_unescape(tokens, i+2);
+		    !strcmp("unescape", cstring) && tokens->data[i+1].type == TOK_PAR_OPEN &&
+		    tokens->data[i+2].type == TOK_StringLiteral) {
+		  char *R = cli_unescape(TOKEN_GET(&tokens->data[i+2], cstring));
+
+		  tokens->data[j].type = TOK_StringLiteral;
+		  TOKEN_SET(&tokens->data[j], string, js_strndup(state, R, R ? strlen(R) : 0));
+		  free(R);
+		  /* unescape ( "..." ) */
+		  i += 4;
+		  continue;
 	  }
+	  if(i != j)
+		  tokens->data[j] = tokens->data[i];
+	  i++;
   }
+  tokens->cnt = j;
 }
 
 static inline int state_update_scope(struct parser_state *state, const yystype *token)
@@ -794,6 +900,7 @@ static void run_decoders(struct parser_state *state)
 	  struct decode_result res;
 	  res.pos_begin = res.pos_end = 0;
 	  res.append = 0;
+	  res.borrowed = 0;
 	  if(tokens->data[i].type == TOK_FUNCTION && i+13 < tokens->cnt) {
 		  name = NULL;
 		  ++i;
@@ -832,7 +939,8 @@ static void run_decoders(struct parser_state *state)
 			cli_js_process_buffer(state, res.txtbuf.data, res.txtbuf.pos);
 			--state->rec;
 		}
-		free(res.txtbuf.data);
+		if(!res.borrowed)
+			free(res.txtbuf.data);
 		/* state->tokens still refers to the embedded/nested context
 		 * here */
 		if(!res.append) {
@@ -889,7 +997,8 @@ void cli_js_parse_done(struct parser_state* state)
 
 	/* we had to close unfinished strings, paranthesis,
 	 * so that the folders/decoders can run properly */
-	run_folders(&state->tokens);
+	state->fold_str = NULL;
+	run_folders(state);
 	run_decoders(state);
 
 	yylex_destroy(state->scanner);
@@ -897,16 +1006,35 @@ void cli_js_parse_done(struct parser_state* state)
 }
 
 
-void cli_js_output(struct parser_state *state, const char *tempdir)
+static void js_output(struct parser_state *state, struct buf *buf)
 {
 	unsigned i;
-	struct buf buf;
 	char lastchar = '\0';
+
+	buf_outs("<script>", buf);
+	state->current = state->global;
+	for(i = 0; i < state->tokens.cnt; i++) {
+		if(state_update_scope(state, &state->tokens.data[i]))
+			lastchar = output_token(&state->tokens.data[i], state->current, buf, lastchar);
+	}
+	/* add /script if not already there */
+	if(buf->pos < 9 || memcmp(buf->buf + buf->pos - 9, "</script>", 9))
+		buf_outs("</script>", buf);
+	if(buf_write(buf, buf->buf, buf->pos) != CL_SUCCESS) {
+		cli_dbgmsg(MODULE "I/O error\n");
+	}
+}
+
+void cli_js_output(struct parser_state *state, const char *tempdir)
+{
+	struct buf buf;
 	char filename[1024];
 
 	snprintf(filename, 1024, "%s"PATHSEP"javascript", tempdir);
 
 	buf.pos = 0;
+	buf.mem = NULL;
+	buf.memlen = NULL;
 	buf.outfd = open(filename, O_CREAT | O_WRONLY, 0600);
 	if(buf.outfd < 0) {
 		cli_errmsg(MODULE "cannot open output file for writing: %s\n", filename);
@@ -917,35 +1045,37 @@ void cli_js_output(struct parser_state *state, const char *tempdir)
 		/* separate multiple scripts with \n */
 		buf_outc('\n', &buf);
 	}
-	buf_outs("<script>", &buf);
-	state->current = state->global;
-	for(i = 0; i < state->tokens.cnt; i++) {
-		if(state_update_scope(state, &state->tokens.data[i]))
-			lastchar = output_token(&state->tokens.data[i], state->current, &buf, lastchar);
-	}
-	/* add /script if not already there */
-	if(buf.pos < 9 || memcmp(buf.buf + buf.pos - 9, "</script>", 9))
-		buf_outs("</script>", &buf);
-	if(write(buf.outfd, buf.buf, buf.pos) < 0) {
-		cli_dbgmsg(MODULE "I/O error\n");
-	}
+	js_output(state, &buf);
 	close(buf.outfd);
 	cli_dbgmsg(MODULE "dumped/appended normalized script to: %s\n",filename);
 }
 
+void cli_js_output_mem(struct parser_state *state, unsigned char **out, size_t *outlen)
+{
+	struct buf buf;
+
+	buf.pos = 0;
+	buf.outfd = -1;
+	buf.mem = out;
+	buf.memlen = outlen;
+	if(*outlen) {
+		/* separate multiple scripts with \n */
+		buf_outc('\n', &buf);
+	}
+	js_output(state, &buf);
+	cli_dbgmsg(MODULE "appended normalized script to memory (%lu bytes)\n", (unsigned long)*outlen);
+}
+
 void cli_js_destroy(struct parser_state *state)
 {
-	size_t i;
 	if(!state)
 		return;
-	scope_free_all(state->list);
-	for(i=0;i<state->tokens.cnt;i++) {
-		free_token(&state->tokens.data[i]);
-	}
 	free(state->tokens.data);
-	/* detect use after free */
+	free(state->idents.keys);
 	if(state->scanner)
 		yylex_destroy(state->scanner);
+	cli_arena_destroy(state->arena);
+	/* detect use after free */
 	memset(state, 0x55, sizeof(*state));
 	free(state);
 	cli_dbgmsg(MODULE "cli_js_destroy() done\n");
@@ -961,6 +1091,7 @@ void cli_js_process_buffer(struct parser_state *state, const char *buf, size_t n
 {
 	struct scope* current = state->current;
 	YYSTYPE val;
+	char *str;
 	int yv;
 	YY_BUFFER_STATE yyb;
 
@@ -990,7 +1121,7 @@ void cli_js_process_buffer(struct parser_state *state, const char *buf, size_t n
 				if(current->last_token == TOK_DOT) {
 					/* this is a member name, don't normalize
 					*/
-					TOKEN_SET(&val, string, cli_strdup(text));
+					TOKEN_SET(&val, cstring, ident_intern(state, text, leng));
 					val.type = TOK_UNNORM_IDENTIFIER;
 				} else {
 					switch(current->fsm_state) {
@@ -999,7 +1130,7 @@ void cli_js_process_buffer(struct parser_state *state, const char *buf, size_t n
 							/* fall through */
 						case Base:
 						case InsideInitializer:
-							TOKEN_SET(&val, cstring, scope_use(current, text, leng));
+							TOKEN_SET(&val, cstring, scope_use(current, text, leng, state));
 							break;
 						case InsideVar:
 						case InsideFunctionDecl:
@@ -1114,32 +1245,39 @@ void cli_js_process_buffer(struct parser_state *state, const char *buf, size_t n
 				TOKEN_SET(&val, scope, state->current);
 				break;
 			case TOK_StringLiteral:
+				/* the text is still in the scanner's buffer */
+				text = yyget_text(state->scanner);
+				leng = yyget_leng(state->scanner);
 				if(state->tokens.cnt > 1 && state->tokens.data[state->tokens.cnt-1].type == TOK_PLUS) {
 					/* see if can fold */
 					yystype *prev_string = &state->tokens.data[state->tokens.cnt-2];
-					if(prev_string->type == TOK_StringLiteral) {
-						char *str = TOKEN_GET(prev_string, string);
-						size_t str_len = strlen(str);
-
-						text = yyget_text(state->scanner);
-						leng = yyget_leng(state->scanner);
-
-
-						/* delete TOK_PLUS */
-						free_token(&state->tokens.data[--state->tokens.cnt]);
-
-						str = cli_realloc(str, str_len + leng + 1);
-						if (!str)
-						    break;
-						strncpy(str+str_len, text, leng);
-						str[str_len + leng] = '\0';
-						TOKEN_SET(prev_string, string, str);
-						free(val.val.string);
-						memset(&val, 0, sizeof(val));
-						val.vtype = vtype_undefined;
-						continue;
+					char *str = TOKEN_GET(prev_string, string);
+					if(prev_string->type == TOK_StringLiteral && str) {
+						size_t str_len = str == state->fold_str ? state->fold_len : strlen(str);
+
+						/* grows in place while str is the
+						 * last allocation in the arena */
+						str = cli_arena_realloc(state->arena, str, str_len + 1, str_len + leng + 1);
+						if (str) {
+							strncpy(str+str_len, text, leng);
+							str[str_len + leng] = '\0';
+							TOKEN_SET(prev_string, string, str);
+							state->fold_str = str;
+							state->fold_len = str_len + strlen(str + str_len);
+							/* delete TOK_PLUS */
+							state->tokens.cnt--;
+							memset(&val, 0, sizeof(val));
+							val.vtype = vtype_undefined;
+							continue;
+						}
 					}
 				}
+				str = js_strndup(state, text, leng);
+				if(str) {
+					TOKEN_SET(&val, string, str);
+				} else {
+					TOKEN_SET(&val, cstring, "");
+				}
 				break;
 		}
 		if(val.vtype == vtype_undefined) {
@@ -1159,14 +1297,20 @@ struct parser_state *cli_js_init(void)
 	struct parser_state *state = cli_calloc(1, sizeof(*state));
 	if(!state)
 		return NULL;
+	state->arena = cli_arena_create();
+	if(!state->arena) {
+		free(state);
+		return NULL;
+	}
 	if(!scope_new(state)) {
+		cli_arena_destroy(state->arena);
 		free(state);
 		return NULL;
 	}
 	state->global = state->current;
 
 	if(yylex_init(&state->scanner)) {
-		scope_done(state->global);
+		cli_arena_destroy(state->arena);
 		free(state);
 		return NULL;
 	}
@@ -1287,18 +1431,15 @@ static inline int parseString(YYSTYPE *lvalp, yyscan_t scanner, const char q,
 		len = scanner->insize - scanner->pos;
 	cli_textbuffer_append_normalize(&scanner->buf, start, len);
 	if(end) {
-	        char *str;
 		/* skip over end quote */
 		scanner->pos += len + 1;
 		textbuffer_putc(&scanner->buf, '\0');
-		str = textbuffer_done(scanner);
-		if (str) {
-		    TOKEN_SET(lvalp, string, str);
-		} else {
-		    TOKEN_SET(lvalp, cstring, "");
-		}
+		/* the parser copies the text out of the buffer, or appends it
+		 * to the previous string literal */
+		scanner->yytext = scanner->buf.data ? scanner->buf.data : "";
+		scanner->yylen = scanner->buf.data ? scanner->buf.pos - 1 : 0;
+		TOKEN_SET(lvalp, cstring, scanner->yytext);
 		scanner->state = Initial;
-		assert(lvalp->val.string);
 		return TOK_StringLiteral;
 	} else {
 		scanner->pos += len;
@@ -10,7 +10,7 @@ static inline int textbuffer_ensure_capacity(struct text_buffer *txtbuf, size_t
 {
 	if (txtbuf->pos + len > txtbuf->capacity) {
 		char *d;
-		unsigned capacity = MAX(txtbuf->pos + len, txtbuf->capacity + 4096);
+		size_t capacity = MAX(txtbuf->pos + len, txtbuf->capacity ? 2 * txtbuf->capacity : 4096);
 		d = cli_realloc(txtbuf->data, capacity);
 		if(!d)
 			return -1;
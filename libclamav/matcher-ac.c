@@ -44,9 +44,14 @@
 #include "readdb.h"
 #include "default.h"
 #include "filtering.h"
+#include "delta.h"
 
 #include "mpool.h"
 
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
+
 #define AC_SPECIAL_ALT_CHAR             1
 #define AC_SPECIAL_ALT_STR_FIXED        2
 #define AC_SPECIAL_ALT_STR              3
@@ -480,11 +485,63 @@ static int ac_maketrans(struct cli_matcher *root)
     return CL_SUCCESS;
 }
 
+/*
+ * Logical signatures only need evaluating once one of their subsignatures
+ * was hit, except for the ones whose expression holds with all counts at
+ * zero (and YARA rules, whose conditions can depend on anything); collect
+ * those so cli_exp_eval() can check them unconditionally.
+ */
+static int ac_lsig_nomatch_build(struct cli_matcher *root)
+{
+    struct cli_ac_lsig *ac_lsig;
+    uint32_t i, lsigcnt[64];
+    unsigned int evalcnt;
+    uint64_t evalids;
+
+    if(root->ac_lsig_nomatch) {
+        mpool_free(root->mempool, root->ac_lsig_nomatch);
+        root->ac_lsig_nomatch = NULL;
+    }
+    root->ac_lsig_nomatch_num = 0;
+    if(!root->ac_lsigs)
+        return CL_SUCCESS;
+
+    root->ac_lsig_nomatch = (uint32_t *) mpool_malloc(root->mempool, root->ac_lsigs * sizeof(uint32_t));
+    if(!root->ac_lsig_nomatch) {
+        cli_errmsg("cli_ac_buildtrie: Can't allocate memory for ac_lsig_nomatch\n");
+        return CL_EMEM;
+    }
+
+    memset(lsigcnt, 0, sizeof(lsigcnt));
+    for(i = 0; i < root->ac_lsigs; i++) {
+        ac_lsig = root->ac_lsigtable[i];
+        if(ac_lsig->type == CLI_LSIG_NORMAL) {
+            evalcnt = 0;
+            evalids = 0;
+            if(cli_ac_chklsig(ac_lsig->u.logic, ac_lsig->u.logic + strlen(ac_lsig->u.logic), lsigcnt, &evalcnt, &evalids, 0) != 1)
+                continue;
+        }
+        root->ac_lsig_nomatch[root->ac_lsig_nomatch_num++] = i;
+    }
+    cli_dbgmsg("cli_ac_buildtrie: %u of %u logical signatures evaluated unconditionally\n", root->ac_lsig_nomatch_num, root->ac_lsigs);
+
+    return CL_SUCCESS;
+}
+
+static void ac_data_cache_fit(const struct cli_matcher *root);
+
 int cli_ac_buildtrie(struct cli_matcher *root)
 {
+    int ret;
+
     if(!root)
         return CL_EMALFDB;
 
+    if((ret = ac_lsig_nomatch_build(root)))
+        return ret;
+
+    ac_data_cache_fit(root);
+
     if(!(root->ac_root)) {
         cli_dbgmsg("cli_ac_buildtrie: AC pattern matcher is not initialised\n");
         return CL_SUCCESS;
@@ -590,6 +647,9 @@ void cli_ac_free(struct cli_matcher *root)
     if(root->ac_reloff)
         mpool_free(root->mempool, root->ac_reloff);
 
+    if(root->ac_lsig_nomatch)
+        mpool_free(root->mempool, root->ac_lsig_nomatch);
+
     /* Freeing trans nodes must be done before freeing table nodes! */
     for(i = 0; i < root->ac_nodes; i++) {
         if(!IS_LEAF(root->ac_nodetable[i]) &&
@@ -1250,17 +1310,237 @@ inline static int ac_findmatch(const unsigned char *buffer, uint32_t offset, uin
     return 0;
 }
 
-int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen)
+/*
+ * Setting up a cli_ac_data means allocating and initialising a 64 entry
+ * row per logical signature, for every root of every scanned object; with
+ * large databases that's megabytes of memory to clear each time. Instead
+ * of being freed, released match state is reset, touching only the rows
+ * that were written during the scan, and kept in a small per thread cache
+ * to be picked up by the next cli_ac_initdata() with the same dimensions.
+ *
+ * The cache is bounded both in entries and in bytes, and it only lives as
+ * long as the engines it was sized for: freeing an engine starts a new
+ * generation, and a thread drops the entries of older generations the
+ * next time it touches its cache (threads that exit free theirs).
+ * The byte bound is AC_DATA_CACHE_MAXBYTES on top of the state of the
+ * largest root compiled so far, so that root is always cached.
+ */
+#define AC_DATA_CACHE_SIZE 4
+#define AC_DATA_CACHE_MAXBYTES (8 * 1024 * 1024)
+
+struct ac_data_cache {
+    struct cli_ac_data data[AC_DATA_CACHE_SIZE];
+    size_t bytes[AC_DATA_CACHE_SIZE];
+    size_t total;
+    unsigned int cnt;
+    unsigned int generation;
+};
+
+static volatile unsigned int ac_data_generation = 0;
+static volatile size_t ac_data_cache_maxbytes = AC_DATA_CACHE_MAXBYTES;
+
+/* memory held by the state ac_data_alloc() sets up */
+static size_t ac_data_size(uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs)
 {
-    unsigned int i, j;
+    return (size_t)lsigs * (64 * 3 * sizeof(uint32_t) + 3 * sizeof(uint32_t *) +
+                            sizeof(struct cli_lsig_matches *) + sizeof(uint32_t) + 2 * sizeof(uint8_t)) +
+        (size_t)partsigs * (sizeof(int32_t **) + sizeof(uint32_t)) +
+        (size_t)reloffsigs * 2 * sizeof(uint32_t);
+}
 
-    UNUSEDPARAM(tracklen);
+static void ac_data_free(struct cli_ac_data *data)
+{
+    uint32_t i, j;
 
-    if(!data) {
-        cli_errmsg("cli_ac_init: data == NULL\n");
-        return CL_ENULLARG;
+    if(data->offmatrix) {
+        for(i = 0; i < data->partsigs; i++) {
+            if(data->offmatrix[i]) {
+                free(data->offmatrix[i][0]);
+                free(data->offmatrix[i]);
+            }
+        }
+        free(data->offmatrix);
     }
-    memset((void *)data, 0, sizeof(struct cli_ac_data));
+
+    if(data->lsig_matches) {
+        for(i = 0; i < data->lsigs; i++) {
+            struct cli_lsig_matches *ls_matches;
+
+            if((ls_matches = data->lsig_matches[i])) {
+                for(j = 0; j < ls_matches->subsigs; j++)
+                    free(ls_matches->matches[j]);
+                free(ls_matches);
+            }
+        }
+        free(data->lsig_matches);
+    }
+    free(data->yr_matches);
+    if(data->lsigcnt)
+        free(data->lsigcnt[0]);
+    free(data->lsigcnt);
+    if(data->lsigsuboff_last)
+        free(data->lsigsuboff_last[0]);
+    free(data->lsigsuboff_last);
+    if(data->lsigsuboff_first)
+        free(data->lsigsuboff_first[0]);
+    free(data->lsigsuboff_first);
+    free(data->lsig_dirty);
+    free(data->lsig_touched);
+    free(data->partsig_dirty);
+    free(data->offset);
+
+    memset(data, 0, sizeof(*data));
+}
+
+static void ac_data_cache_clear(struct ac_data_cache *cache)
+{
+    while(cache->cnt)
+        ac_data_free(&cache->data[--cache->cnt]);
+    cache->total = 0;
+}
+
+static void ac_data_cache_destroy(void *ptr)
+{
+    struct ac_data_cache *cache = ptr;
+
+    if(cache) {
+        ac_data_cache_clear(cache);
+        free(cache);
+    }
+}
+
+#ifdef CL_THREAD_SAFE
+static pthread_mutex_t ac_data_generation_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ac_data_cache_key;
+static pthread_once_t ac_data_cache_key_once = PTHREAD_ONCE_INIT;
+
+static void ac_data_cache_cleanup_main(void)
+{
+    struct ac_data_cache *cache = pthread_getspecific(ac_data_cache_key);
+
+    if(cache) {
+        ac_data_cache_destroy(cache);
+        pthread_setspecific(ac_data_cache_key, NULL);
+    }
+    pthread_key_delete(ac_data_cache_key);
+}
+
+static void ac_data_cache_key_alloc(void)
+{
+    pthread_key_create(&ac_data_cache_key, ac_data_cache_destroy);
+    if(atexit(ac_data_cache_cleanup_main))
+        cli_dbgmsg("cli_ac_initdata: failed to register atexit\n");
+}
+
+static struct ac_data_cache *ac_data_cache_find(void)
+{
+    struct ac_data_cache *cache;
+
+    pthread_once(&ac_data_cache_key_once, ac_data_cache_key_alloc);
+    if(!(cache = pthread_getspecific(ac_data_cache_key))) {
+        if(!(cache = cli_calloc(1, sizeof(*cache))))
+            return NULL;
+        cache->generation = ac_data_generation;
+        pthread_setspecific(ac_data_cache_key, cache);
+    }
+    return cache;
+}
+#else
+#define pthread_mutex_lock(x)
+#define pthread_mutex_unlock(x)
+
+static struct ac_data_cache *global_ac_data_cache = NULL;
+
+static void ac_data_cache_cleanup_main(void)
+{
+    ac_data_cache_destroy(global_ac_data_cache);
+    global_ac_data_cache = NULL;
+}
+
+static struct ac_data_cache *ac_data_cache_find(void)
+{
+    if(!global_ac_data_cache) {
+        if(!(global_ac_data_cache = cli_calloc(1, sizeof(*global_ac_data_cache))))
+            return NULL;
+        global_ac_data_cache->generation = ac_data_generation;
+        atexit(ac_data_cache_cleanup_main);
+    }
+    return global_ac_data_cache;
+}
+#endif
+
+static struct ac_data_cache *ac_data_cache_get(void)
+{
+    struct ac_data_cache *cache;
+
+    if((cache = ac_data_cache_find()) && cache->generation != ac_data_generation) {
+        ac_data_cache_clear(cache);
+        cache->generation = ac_data_generation;
+    }
+    return cache;
+}
+
+/*
+ * Called when an engine is freed, the cached match state may be sized for
+ * its roots: this thread's cache is emptied now, the others' on their next
+ * scan.
+ */
+void cli_ac_dropcache(void)
+{
+    pthread_mutex_lock(&ac_data_generation_mutex);
+    ac_data_generation++;
+    pthread_mutex_unlock(&ac_data_generation_mutex);
+    ac_data_cache_get();
+}
+
+/* make room in the cache for the match state of a newly compiled root */
+static void ac_data_cache_fit(const struct cli_matcher *root)
+{
+    size_t bytes = ac_data_size(root->ac_partsigs, root->ac_lsigs, root->ac_reloff_num);
+
+    pthread_mutex_lock(&ac_data_generation_mutex);
+    if(bytes + AC_DATA_CACHE_MAXBYTES > ac_data_cache_maxbytes)
+        ac_data_cache_maxbytes = bytes + AC_DATA_CACHE_MAXBYTES;
+    pthread_mutex_unlock(&ac_data_generation_mutex);
+}
+
+/* undo what the last scan did, leaving the state as cli_ac_initdata() would */
+static void ac_data_reset(struct cli_ac_data *data)
+{
+    uint32_t i, j, id;
+
+    for(i = 0; i < data->lsig_ndirty; i++) {
+        struct cli_lsig_matches *ls_matches;
+
+        id = data->lsig_dirty[i];
+        memset(data->lsigcnt[id], 0, 64 * sizeof(uint32_t));
+        for(j = 0; j < 64; j++) {
+            data->lsigsuboff_last[id][j] = CLI_OFF_NONE;
+            data->lsigsuboff_first[id][j] = CLI_OFF_NONE;
+        }
+        if((ls_matches = data->lsig_matches[id])) {
+            for(j = 0; j < ls_matches->subsigs; j++)
+                free(ls_matches->matches[j]);
+            free(ls_matches);
+            data->lsig_matches[id] = NULL;
+        }
+        data->yr_matches[id] = 0;
+        data->lsig_touched[id] = 0;
+    }
+    data->lsig_ndirty = 0;
+
+    for(i = 0; i < data->partsig_ndirty; i++) {
+        id = data->partsig_dirty[i];
+        free(data->offmatrix[id][0]);
+        free(data->offmatrix[id]);
+        data->offmatrix[id] = NULL;
+    }
+    data->partsig_ndirty = 0;
+}
+
+static int ac_data_alloc(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs)
+{
+    unsigned int i, j;
 
     data->reloffsigs = reloffsigs;
     if(reloffsigs) {
@@ -1269,131 +1549,97 @@ int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs,
             cli_errmsg("cli_ac_init: Can't allocate memory for data->offset\n");
             return CL_EMEM;
         }
-        for(i = 0; i < reloffsigs * 2; i += 2)
-            data->offset[i] = CLI_OFF_NONE;
     }
 
     data->partsigs = partsigs;
     if(partsigs) {
         data->offmatrix = (int32_t ***) cli_calloc(partsigs, sizeof(int32_t **));
-        if(!data->offmatrix) {
+        data->partsig_dirty = (uint32_t *) cli_malloc(partsigs * sizeof(uint32_t));
+        if(!data->offmatrix || !data->partsig_dirty) {
             cli_errmsg("cli_ac_init: Can't allocate memory for data->offmatrix\n");
-
-            if(reloffsigs)
-                free(data->offset);
-
             return CL_EMEM;
         }
     }
- 
+
     data->lsigs = lsigs;
     if(lsigs) {
-        data->lsigcnt = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
-        if(!data->lsigcnt) {
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
-
+        data->lsigcnt = (uint32_t **) cli_calloc(lsigs, sizeof(uint32_t *));
+        data->lsigsuboff_last = (uint32_t **) cli_calloc(lsigs, sizeof(uint32_t *));
+        data->lsigsuboff_first = (uint32_t **) cli_calloc(lsigs, sizeof(uint32_t *));
+        if(!data->lsigcnt || !data->lsigsuboff_last || !data->lsigsuboff_first) {
             cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigcnt\n");
             return CL_EMEM;
         }
         data->lsigcnt[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-        if(!data->lsigcnt[0]) {
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigcnt[0]\n");
+        data->lsigsuboff_last[0] = (uint32_t *) cli_malloc(lsigs * 64 * sizeof(uint32_t));
+        data->lsigsuboff_first[0] = (uint32_t *) cli_malloc(lsigs * 64 * sizeof(uint32_t));
+        if(!data->lsigcnt[0] || !data->lsigsuboff_last[0] || !data->lsigsuboff_first[0]) {
+            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)[0]\n");
             return CL_EMEM;
         }
-        for(i = 1; i < lsigs; i++)
+        for(i = 0; i < lsigs; i++) {
             data->lsigcnt[i] = data->lsigcnt[0] + 64 * i;
-        data->yr_matches = (uint8_t *) cli_calloc(lsigs, sizeof(uint8_t));
-        if (data->yr_matches == NULL) {
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-            
-            if(reloffsigs)
-                free(data->offset);
-            return CL_EMEM;
+            data->lsigsuboff_last[i] = data->lsigsuboff_last[0] + 64 * i;
+            data->lsigsuboff_first[i] = data->lsigsuboff_first[0] + 64 * i;
+            for(j = 0; j < 64; j++) {
+                data->lsigsuboff_last[i][j] = CLI_OFF_NONE;
+                data->lsigsuboff_first[i][j] = CLI_OFF_NONE;
+            }
         }
 
+        data->yr_matches = (uint8_t *) cli_calloc(lsigs, sizeof(uint8_t));
         /* subsig offsets */
         data->lsig_matches = (struct cli_lsig_matches **) cli_calloc(lsigs, sizeof(struct cli_lsig_matches *));
-        if(!data->lsig_matches) {
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
-
+        data->lsig_dirty = (uint32_t *) cli_malloc(lsigs * sizeof(uint32_t));
+        data->lsig_touched = (uint8_t *) cli_calloc(lsigs, sizeof(uint8_t));
+        if(!data->yr_matches || !data->lsig_matches || !data->lsig_dirty || !data->lsig_touched) {
             cli_errmsg("cli_ac_init: Can't allocate memory for data->lsig_matches\n");
             return CL_EMEM;
         }
-        data->lsigsuboff_last = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
-        data->lsigsuboff_first = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
-        if(!data->lsigsuboff_last || !data->lsigsuboff_first) {
-            free(data->lsig_matches);
-            free(data->lsigsuboff_last);
-            free(data->lsigsuboff_first);
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)\n");
-            return CL_EMEM;
-        }
-        data->lsigsuboff_last[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-        data->lsigsuboff_first[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-        if(!data->lsigsuboff_last[0] || !data->lsigsuboff_first[0]) {
-            free(data->lsig_matches);
-            free(data->lsigsuboff_last[0]);
-            free(data->lsigsuboff_first[0]);
-            free(data->lsigsuboff_last);
-            free(data->lsigsuboff_first);
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
+    }
 
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)[0]\n");
-            return CL_EMEM;
-        }
-        for(j = 0; j < 64; j++) {
-            data->lsigsuboff_last[0][j] = CLI_OFF_NONE;
-            data->lsigsuboff_first[0][j] = CLI_OFF_NONE;
-        }
-        for(i = 1; i < lsigs; i++) {
-            data->lsigsuboff_last[i] = data->lsigsuboff_last[0] + 64 * i;
-            data->lsigsuboff_first[i] = data->lsigsuboff_first[0] + 64 * i;
-            for(j = 0; j < 64; j++) {
-                data->lsigsuboff_last[i][j] = CLI_OFF_NONE;
-                data->lsigsuboff_first[i][j] = CLI_OFF_NONE;
+    return CL_SUCCESS;
+}
+
+int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen)
+{
+    struct ac_data_cache *cache;
+    unsigned int i;
+    int ret;
+
+    UNUSEDPARAM(tracklen);
+
+    if(!data) {
+        cli_errmsg("cli_ac_init: data == NULL\n");
+        return CL_ENULLARG;
+    }
+    memset((void *)data, 0, sizeof(struct cli_ac_data));
+
+    if((partsigs || lsigs || reloffsigs) && (cache = ac_data_cache_get())) {
+        for(i = 0; i < cache->cnt; i++) {
+            if(cache->data[i].partsigs == partsigs && cache->data[i].lsigs == lsigs && cache->data[i].reloffsigs == reloffsigs) {
+                *data = cache->data[i];
+                cache->total -= cache->bytes[i];
+                cache->data[i] = cache->data[--cache->cnt];
+                cache->bytes[i] = cache->bytes[cache->cnt];
+                break;
             }
         }
     }
+
+    if(!data->lsigs && !data->partsigs && !data->reloffsigs) {
+        if((ret = ac_data_alloc(data, partsigs, lsigs, reloffsigs)) != CL_SUCCESS) {
+            ac_data_free(data);
+            return ret;
+        }
+    }
+
+    for(i = 0; i < reloffsigs * 2; i += 2)
+        data->offset[i] = CLI_OFF_NONE;
     for (i=0;i<32;i++)
         data->macro_lastmatch[i] = CLI_OFF_NONE;
 
+    data->vinfo = NULL;
     data->min_partno = 1;
 
     return CL_SUCCESS;
@@ -1425,56 +1671,34 @@ int cli_ac_caloff(const struct cli_matcher *root, struct cli_ac_data *data, cons
 
 void cli_ac_freedata(struct cli_ac_data *data)
 {
-    uint32_t i;
+    struct ac_data_cache *cache;
+    size_t bytes, maxbytes;
 
     if (!data)
         return;
 
-    if(data->partsigs) {
-        for(i = 0; i < data->partsigs; i++) {
-            if(data->offmatrix[i]) {
-                free(data->offmatrix[i][0]);
-                free(data->offmatrix[i]);
-            }
-        }
-        free(data->offmatrix);
-        data->offmatrix = NULL;
-        data->partsigs = 0;
-    }
-
-    if(data->lsigs) {
-        if (data->lsig_matches) {
-            for (i = 0; i < data->lsigs; i++) {
-                struct cli_lsig_matches * ls_matches;
-                if ((ls_matches = data->lsig_matches[i])) {
-                    uint32_t j;
-                    for (j = 0; j < ls_matches->subsigs; j++) {
-                        if (ls_matches->matches[j]) {
-                            free(ls_matches->matches[j]);
-                            ls_matches->matches[j] = 0;
-                        }
-                    }
-                    free(data->lsig_matches[i]);
-                    data->lsig_matches[i] = 0;
-                }
-            }
-            free(data->lsig_matches);
-            data->lsig_matches = 0;
-        }
-        free(data->yr_matches);
-        free(data->lsigcnt[0]);
-        free(data->lsigcnt);
-        free(data->lsigsuboff_last[0]);
-        free(data->lsigsuboff_last);
-        free(data->lsigsuboff_first[0]);
-        free(data->lsigsuboff_first);
-        data->lsigs = 0;
-    }
+    if(!data->partsigs && !data->lsigs && !data->reloffsigs)
+        return;
 
-    if(data->reloffsigs) {
-        free(data->offset);
-        data->reloffsigs = 0;
+    bytes = ac_data_size(data->partsigs, data->lsigs, data->reloffsigs);
+    maxbytes = ac_data_cache_maxbytes;
+    if(bytes > maxbytes || !(cache = ac_data_cache_get())) {
+        ac_data_free(data);
+        return;
     }
+    ac_data_reset(data);
+    while(cache->cnt == AC_DATA_CACHE_SIZE || cache->total + bytes > maxbytes) {
+        /* make room, dropping the oldest */
+        ac_data_free(&cache->data[0]);
+        cache->total -= cache->bytes[0];
+        cache->cnt--;
+        memmove(&cache->data[0], &cache->data[1], cache->cnt * sizeof(struct cli_ac_data));
+        memmove(&cache->bytes[0], &cache->bytes[1], cache->cnt * sizeof(size_t));
+    }
+    cache->data[cache->cnt] = *data;
+    cache->bytes[cache->cnt++] = bytes;
+    cache->total += bytes;
+    memset(data, 0, sizeof(*data));
 }
 
 /* returns only CL_SUCCESS or CL_EMEM */
@@ -1517,6 +1741,8 @@ int lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata,
     const struct cli_lsig_tdb *tdb = &ac_lsig->tdb;
 
     if(realoff != CLI_OFF_NONE) {
+        cli_ac_lsig_touch(mdata, lsigid1);
+
         if(mdata->lsigsuboff_first[lsigid1][lsigid2] == CLI_OFF_NONE)
             mdata->lsigsuboff_first[lsigid1][lsigid2] = realoff;
 
@@ -1754,6 +1980,7 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
                                     mdata->offmatrix[pt->sigid - 1][j] = mdata->offmatrix[pt->sigid - 1][0] + j * (CLI_DEFAULT_AC_TRACKLEN + 2);
                                     mdata->offmatrix[pt->sigid - 1][j][0] = 0;
                                 }
+                                mdata->partsig_dirty[mdata->partsig_ndirty++] = pt->sigid - 1;
                             }
                             offmatrix = mdata->offmatrix[pt->sigid - 1];
 
@@ -1829,6 +2056,11 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
                                         continue;
                                     }
 
+                                    if(ctx && cli_delta_dead(ctx->engine, root, pt->virname)) {
+                                        ptN = ptN->next_same;
+                                        continue;
+                                    }
+
                                     if(res) {
                                         newres = (struct cli_ac_result *) malloc(sizeof(struct cli_ac_result));
                                         if(!newres) {
@@ -1884,6 +2116,11 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
                                     continue;
                                 }
 
+                                if(ctx && cli_delta_dead(ctx->engine, root, pt->virname)) {
+                                    ptN = ptN->next_same;
+                                    continue;
+                                }
+
                                 if(res) {
                                     newres = (struct cli_ac_result *) malloc(sizeof(struct cli_ac_result));
                                     if(!newres) {
@@ -2839,6 +3076,10 @@ int cli_ac_addsig(struct cli_matcher *root, const char *virname, const char *hex
         new->offset_min = root->ac_reloff_num * 2;
         new->offset_max = new->offset_min + 1;
         root->ac_reloff_num++;
+        if(new->offdata[0] == CLI_OFF_EOF_MINUS)
+            root->reloff_eof = MAX(root->reloff_eof, new->offdata[1]);
+        else
+            root->reloff_other++;
     }
 
     return CL_SUCCESS;
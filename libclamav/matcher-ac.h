@@ -68,8 +68,21 @@ struct cli_ac_data {
     /** Hashset for versioninfo matching */
     const struct cli_hashset *vinfo;
     uint32_t min_partno;
+    /* rows written since cli_ac_initdata(), so that the state can be reset
+     * and reused without touching the rest */
+    uint32_t *lsig_dirty, lsig_ndirty;
+    uint8_t *lsig_touched;
+    uint32_t *partsig_dirty, partsig_ndirty;
 };
 
+static inline void cli_ac_lsig_touch(struct cli_ac_data *data, uint32_t lsigid)
+{
+    if(!data->lsig_touched[lsigid]) {
+        data->lsig_touched[lsigid] = 1;
+        data->lsig_dirty[data->lsig_ndirty++] = lsigid;
+    }
+}
+
 struct cli_alt_node {
     uint16_t *str;
     uint16_t len;
@@ -134,6 +147,7 @@ int lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata,
 int cli_ac_chkmacro(struct cli_matcher *root, struct cli_ac_data *data, unsigned lsigid1);
 int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids, unsigned int parse_only);
 void cli_ac_freedata(struct cli_ac_data *data);
+void cli_ac_dropcache(void);
 int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **virname, void **customdata, struct cli_ac_result **res, const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t offset, cli_file_t ftype, struct cli_matched_type **ftoffset, unsigned int mode, cli_ctx *ctx);
 int cli_ac_buildtrie(struct cli_matcher *root);
 int cli_ac_init(struct cli_matcher *root, uint8_t mindepth, uint8_t maxdepth, uint8_t dconf_prefiltering);
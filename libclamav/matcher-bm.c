@@ -34,6 +34,7 @@
 #include "matcher-bm.h"
 #include "filetypes.h"
 #include "filtering.h"
+#include "delta.h"
 
 #include "mpool.h"
 
@@ -63,6 +64,10 @@ int cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern, const
 	    root->bm_absoff_num++;
 	else
 	    root->bm_reloff_num++;
+	if(pattern->offdata[0] == CLI_OFF_EOF_MINUS)
+	    root->reloff_eof = MAX(root->reloff_eof, pattern->offdata[1]);
+	else if(pattern->offdata[0] != CLI_OFF_ABSOLUTE)
+	    root->reloff_other++;
     }
 
     /* bm_offmode doesn't use the prefilter for BM signatures anyway, so
@@ -379,6 +384,10 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 			    continue;
 			}
 		    }
+		    if(ctx && cli_delta_dead(ctx->engine, root, p->virname)) {
+			p = p->next;
+			continue;
+		    }
 		    if(virname) {
 			*virname = p->virname;
 			if(ctx != NULL && SCAN_ALL) {
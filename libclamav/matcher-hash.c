@@ -25,6 +25,7 @@
 #include "matcher.h"
 #include "others.h"
 #include "str.h"
+#include "hashtab.h"
 
 
 int hm_addhash_str(struct cli_matcher *root, const char *strhash, uint32_t size, const char *virusname) {
@@ -225,15 +226,19 @@ void hm_flush(struct cli_matcher *root) {
 
 
 int cli_hm_have_size(const struct cli_matcher *root, enum CLI_HASH_TYPE type, uint32_t size) {
-    return (size && size != 0xffffffff && root && root->hm.sizehashes[type].capacity && cli_htu32_find(&root->hm.sizehashes[type], size));
+    if(!size || size == 0xffffffff || !root)
+	return 0;
+    if(root->hm.sizehashes[type].capacity && cli_htu32_find(&root->hm.sizehashes[type], size))
+	return 1;
+    return cli_hm_have_size(root->hm_base, type, size);
 }
 
 int cli_hm_have_wild(const struct cli_matcher *root, enum CLI_HASH_TYPE type) {
-    return (root && root->hwild.hashes[type].items);
+    return (root && (root->hwild.hashes[type].items || cli_hm_have_wild(root->hm_base, type)));
 }
 
 int cli_hm_have_any(const struct cli_matcher *root, enum CLI_HASH_TYPE type) {
-    return (root && (root->hwild.hashes[type].items || root->hm.sizehashes[type].capacity));
+    return (root && (root->hwild.hashes[type].items || root->hm.sizehashes[type].capacity || cli_hm_have_any(root->hm_base, type)));
 }
 
 /* cli_hm_scan will scan only size-specific hashes, if any */
@@ -267,29 +272,61 @@ static int hm_scan(const unsigned char *digest, const char **virname, const stru
     return CL_CLEAN;
 }
 
-/* cli_hm_scan will scan only size-specific hashes, if any */
-int cli_hm_scan(const unsigned char *digest, uint32_t size, const char **virname, const struct cli_matcher *root, enum CLI_HASH_TYPE type) {
+static int hm_scan_size(const unsigned char *digest, uint32_t size, const char **virname, const struct cli_matcher *root, enum CLI_HASH_TYPE type) {
     const struct cli_htu32_element *item;
-    struct cli_sz_hash *szh;
 
-    if(!digest || !size || size == 0xffffffff || !root || !root->hm.sizehashes[type].capacity)
+    if(!root || !root->hm.sizehashes[type].capacity)
 	return CL_CLEAN;
 
     item = cli_htu32_find(&root->hm.sizehashes[type], size);
     if(!item)
 	return CL_CLEAN;
 
-    szh = (struct cli_sz_hash *)item->data.as_ptr;
+    return hm_scan(digest, virname, (struct cli_sz_hash *)item->data.as_ptr, type);
+}
+
+/* a signature of the base engine that a delta removed by name */
+static int hm_deadname(const struct cli_matcher *root, const char *name) {
+    return root->hm_deadnames && name && cli_hashtab_find(root->hm_deadnames, name, strlen(name));
+}
+
+/* cli_hm_scan will scan only size-specific hashes, if any */
+int cli_hm_scan(const unsigned char *digest, uint32_t size, const char **virname, const struct cli_matcher *root, enum CLI_HASH_TYPE type) {
+    const char *name;
+
+    if(!digest || !size || size == 0xffffffff || !root)
+	return CL_CLEAN;
+
+    if(hm_scan_size(digest, size, virname, root, type) == CL_VIRUS)
+	return CL_VIRUS;
 
-    return hm_scan(digest, virname, szh, type);
+    if(root->hm_base && cli_hm_scan(digest, size, &name, root->hm_base, type) == CL_VIRUS &&
+       hm_scan_size(digest, size, NULL, root->hm_dead, type) != CL_VIRUS && !hm_deadname(root, name)) {
+	if(virname)
+	    *virname = name;
+	return CL_VIRUS;
+    }
+    return CL_CLEAN;
 }
 
 /* cli_hm_scan_wild will scan only size-agnostic hashes, if any */
 int cli_hm_scan_wild(const unsigned char *digest, const char **virname, const struct cli_matcher *root, enum CLI_HASH_TYPE type) {
-    if(!digest || !root || !root->hwild.hashes[type].items)
+    const char *name;
+
+    if(!digest || !root)
 	return CL_CLEAN;
 
-    return hm_scan(digest, virname, &root->hwild.hashes[type], type);
+    if(hm_scan(digest, virname, &root->hwild.hashes[type], type) == CL_VIRUS)
+	return CL_VIRUS;
+
+    if(root->hm_base && cli_hm_scan_wild(digest, &name, root->hm_base, type) == CL_VIRUS &&
+       (!root->hm_dead || hm_scan(digest, NULL, &root->hm_dead->hwild.hashes[type], type) != CL_VIRUS) &&
+       !hm_deadname(root, name)) {
+	if(virname)
+	    *virname = name;
+	return CL_VIRUS;
+    }
+    return CL_CLEAN;
 }
 
 /* free both size-specific and agnostic hash sets */
@@ -687,6 +687,10 @@ int cli_pcre_scanbuf(const unsigned char *buffer, uint32_t length, const char **
 
         /* if the global flag is set, loop through the scanning */
         do {
+            /* every (global) run costs the rest of the buffer at worst */
+            if ((ret = cli_updatescanwork(ctx, adjlength - offset)) != CL_SUCCESS)
+                break;
+
             /* reset the match results */
             if ((ret = cli_pcre_results_reset(&p_res, pd)) != CL_SUCCESS)
                 break;
@@ -55,6 +55,7 @@
 #include "perflogging.h"
 #include "bytecode_priv.h"
 #include "bytecode_api_impl.h"
+#include "delta.h"
 #ifdef HAVE_YARA
 #include "yara_clam.h"
 #include "yara_exec.h"
@@ -250,6 +251,10 @@ int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset,
 	return CL_ENULLARG;
     }
 
+    /* charged once, however many roots match the buffer */
+    if((ret = cli_updatescanwork(ctx, length)) != CL_SUCCESS)
+	return ret;
+
     groot = engine->root[0]; /* generic signatures */
 
     if(ftype) {
@@ -294,6 +299,23 @@ int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset,
     if(!acdata)
 	cli_ac_freedata(&mdata);
 
+    /* body signatures added by cl_engine_delta(), the callers evaluate the
+     * logical signatures of the shared roots only */
+    for(j = 0; engine->delta_root && j < 2; j++) {
+	struct cli_matcher *droot = j ? engine->delta_root[0] : (troot ? engine->delta_root[i] : NULL);
+
+	if(ret == CL_VIRUS)
+	    viruses_found = 1;
+	if(!droot || !(droot->ac_patterns || droot->bm_patterns) || (ret != CL_CLEAN && ret != CL_VIRUS) || (viruses_found && !SCAN_ALL))
+	    continue;
+
+	virname = NULL;
+	if((ret = cli_ac_initdata(&mdata, droot->ac_partsigs, droot->ac_lsigs, droot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)))
+	    return ret;
+	ret = matcher_run(droot, buffer, length, &virname, &mdata, offset, NULL, ftype, NULL, AC_SCAN_VIR, PCRE_SCAN_BUFF, NULL, *ctx->fmap, NULL, NULL, ctx);
+	cli_ac_freedata(&mdata);
+    }
+
     if(viruses_found)
 	return CL_VIRUS;
     return ret;
@@ -508,19 +530,28 @@ int cli_checkfp(unsigned char *digest, size_t size, cli_ctx *ctx)
     const char *ptr;
     uint8_t shash1[SHA1_HASH_SIZE*2+1];
     uint8_t shash256[SHA256_HASH_SIZE*2+1];
+    unsigned char md5digest[16];
     int have_sha1, have_sha256, do_dsig_check = 1;
     stats_section_t sections;
 
-    if(cli_hm_scan(digest, size, &virname, ctx->engine->hm_fp, CLI_HASH_MD5) == CL_VIRUS) {
+    /* no MD5 from the cache (CL_ENGINE_FAST_CACHE_KEY), compute it if
+     * anything is going to look at it */
+    if(!digest && (cli_hm_have_size(ctx->engine->hm_fp, CLI_HASH_MD5, size) || cli_hm_have_wild(ctx->engine->hm_fp, CLI_HASH_MD5)
+                   || cli_debug_flag || ctx->engine->cb_hash || ctx->engine->cb_stats_add_sample)) {
+        if((ptr = fmap_need_off_once(*ctx->fmap, 0, size)) && cl_hash_data("md5", ptr, size, md5digest, NULL))
+            digest = md5digest;
+    }
+
+    if(digest && cli_hm_scan(digest, size, &virname, ctx->engine->hm_fp, CLI_HASH_MD5) == CL_VIRUS) {
         cli_dbgmsg("cli_checkfp(md5): Found false positive detection (fp sig: %s), size: %d\n", virname, (int)size);
         return CL_CLEAN;
     }
-    else if(cli_hm_scan_wild(digest, &virname, ctx->engine->hm_fp, CLI_HASH_MD5) == CL_VIRUS) {
+    else if(digest && cli_hm_scan_wild(digest, &virname, ctx->engine->hm_fp, CLI_HASH_MD5) == CL_VIRUS) {
         cli_dbgmsg("cli_checkfp(md5): Found false positive detection (fp sig: %s), size: *\n", virname);
         return CL_CLEAN;
     }
 
-    if(cli_debug_flag || ctx->engine->cb_hash) {
+    if(digest && (cli_debug_flag || ctx->engine->cb_hash)) {
         for(i = 0; i < 16; i++)
             sprintf(md5 + i * 2, "%02x", digest[i]);
         md5[32] = 0;
@@ -613,10 +644,10 @@ int cli_checkfp(unsigned char *digest, size_t size, cli_ctx *ctx)
         }
     }
 
-    if (ctx->engine->cb_hash)
+    if (ctx->engine->cb_hash && digest)
         ctx->engine->cb_hash(fmap_fd(*ctx->fmap), size, (const unsigned char *)md5, cli_get_last_virus(ctx), ctx->cb_ctx);
 
-    if (ctx->engine->cb_stats_add_sample)
+    if (ctx->engine->cb_stats_add_sample && digest)
         ctx->engine->cb_stats_add_sample(cli_get_last_virus(ctx), digest, size, &sections, ctx->engine->stats_data);
 
     if (sections.sections)
@@ -703,6 +734,26 @@ int cli_scandesc(int desc, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struc
     return ret;
 }
 
+/* like cli_scandesc(), for data that was produced in memory */
+int cli_scandesc_mem(const void *buffer, size_t length, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres)
+{
+    int ret;
+    fmap_t *map = *ctx->fmap;
+
+    if(!length)
+	return CL_CLEAN;
+
+    if(!(*ctx->fmap = cl_fmap_open_memory(buffer, length))) {
+	*ctx->fmap = map;
+	return CL_EMAP;
+    }
+    ret = cli_fmap_scandesc(ctx, ftype, ftonly, ftoffset, acmode, acres, NULL);
+    map->dont_cache_flag = (*ctx->fmap)->dont_cache_flag;
+    cl_fmap_close(*ctx->fmap);
+    *ctx->fmap = map;
+    return ret;
+}
+
 static int lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acdata, struct cli_target_info *target_info, const char *hash, uint32_t lsid)
 {
     unsigned evalcnt = 0;
@@ -717,6 +768,8 @@ static int lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data
     if (rc != CL_SUCCESS)
         return rc;
     if (cli_ac_chklsig(exp, exp_end, acdata->lsigcnt[lsid], &evalcnt, &evalids, 0) == 1) {
+        if(cli_delta_dead(ctx->engine, root, ac_lsig->virname))
+            return CL_CLEAN;
         if(ac_lsig->tdb.container && ac_lsig->tdb.container[0] != ctx->container_type)
             return CL_CLEAN;
         if(ac_lsig->tdb.filesize && (ac_lsig->tdb.filesize[0] > map->len || ac_lsig->tdb.filesize[1] < map->len))
@@ -786,7 +839,7 @@ static int yara_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data
     rc = yr_execute_code(ac_lsig, acdata, &context, 0, 0);
 
     if (rc == CL_VIRUS) {
-        if (ac_lsig->flag & CLI_LSIG_FLAG_PRIVATE) {
+        if (ac_lsig->flag & CLI_LSIG_FLAG_PRIVATE || cli_delta_dead(ctx->engine, root, ac_lsig->virname)) {
             rc = CL_CLEAN;
         } else {
             cli_append_virus(ctx, ac_lsig->virname);
@@ -796,18 +849,44 @@ static int yara_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data
 }
 #endif
 
+static int lsig_id_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
 int cli_exp_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acdata, struct cli_target_info *target_info, const char *hash)
 {
     uint8_t viruses_found = 0;
-    uint32_t i;
+    uint32_t i, j, n, lsid;
     int32_t rc = CL_SUCCESS;
 
-    for(i = 0; i < root->ac_lsigs; i++) {
-        if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL)
-            rc = lsig_eval(ctx, root, acdata, target_info, hash, i);
+    /*
+     * Only the logical signatures touched by this scan and those that can
+     * match with no subsignature hits need checking; walk both lists in
+     * signature order so the first detection reported doesn't change.
+     * yara_eval() may append to lsig_dirty, so work on a snapshot.
+     */
+    n = acdata->lsig_ndirty;
+    if(n > 1)
+        cli_qsort(acdata->lsig_dirty, n, sizeof(uint32_t), lsig_id_cmp);
+
+    i = j = 0;
+    while(i < n || j < root->ac_lsig_nomatch_num) {
+        if(j == root->ac_lsig_nomatch_num || (i < n && acdata->lsig_dirty[i] <= root->ac_lsig_nomatch[j])) {
+            lsid = acdata->lsig_dirty[i++];
+            if(j < root->ac_lsig_nomatch_num && root->ac_lsig_nomatch[j] == lsid)
+                j++;
+        } else {
+            lsid = root->ac_lsig_nomatch[j++];
+        }
+
+        if (root->ac_lsigtable[lsid]->type == CLI_LSIG_NORMAL)
+            rc = lsig_eval(ctx, root, acdata, target_info, hash, lsid);
 #ifdef HAVE_YARA
-        else if (root->ac_lsigtable[i]->type == CLI_YARA_NORMAL || root->ac_lsigtable[i]->type == CLI_YARA_OFFSET)
-            rc = yara_eval(ctx, root, acdata, target_info, hash, i);
+        else if (root->ac_lsigtable[lsid]->type == CLI_YARA_NORMAL || root->ac_lsigtable[lsid]->type == CLI_YARA_OFFSET)
+            rc = yara_eval(ctx, root, acdata, target_info, hash, lsid);
 #endif
         if (rc == CL_VIRUS) {
             viruses_found = 1;
@@ -821,6 +900,255 @@ int cli_exp_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acd
     return CL_CLEAN;
 }
 
+/*
+ * Streamed objects
+ */
+
+int cli_scanstate_init(struct cli_scanstate *st, const struct cl_engine *engine, int fd)
+{
+    memset(st, 0, sizeof(*st));
+    st->fd = fd;
+    st->feeding = 1;
+
+    /* MD5 is also the cache key, the others only if something can match */
+    if(!(st->hashctx[CLI_HASH_MD5] = cl_hash_init("md5")))
+        return CL_EMEM;
+    if((cli_hm_have_any(engine->hm_hdb, CLI_HASH_SHA1) || cli_hm_have_any(engine->hm_fp, CLI_HASH_SHA1)) &&
+       !(st->hashctx[CLI_HASH_SHA1] = cl_hash_init("sha1")))
+        return CL_EMEM;
+    if((cli_hm_have_any(engine->hm_hdb, CLI_HASH_SHA256) || cli_hm_have_any(engine->hm_fp, CLI_HASH_SHA256)) &&
+       !(st->hashctx[CLI_HASH_SHA256] = cl_hash_init("sha256")))
+        return CL_EMEM;
+
+    return CL_SUCCESS;
+}
+
+void cli_scanstate_hash(struct cli_scanstate *st, const void *data, size_t len)
+{
+    unsigned int i;
+
+    for(i = 0; i < CLI_HASH_AVAIL_TYPES; i++)
+        if(st->hashctx[i])
+            cl_update_hash(st->hashctx[i], (void *)data, len);
+    st->len += len;
+}
+
+/*
+ * Sets up the matching of the windows for the type cli_scanraw() will scan
+ * the object as. Roots with offsets relative to anything but the end of the
+ * object are left to the final scan; so is the target root if the type may
+ * still change (usetroot == 0), the match data doesn't depend on it.
+ */
+int cli_scanstate_settype(struct cli_scanstate *st, const struct cl_engine *engine, cli_file_t ftype, unsigned int acmode, int usetroot)
+{
+    struct cli_matcher *groot = engine->root[0], *troot = NULL;
+    unsigned int i, j;
+    int ret;
+
+    if(ftype) {
+        for(i = 1; i < CLI_MTARGETS && !troot; i++) {
+            for(j = 0; j < cli_mtargets[i].target_count; j++) {
+                if(cli_mtargets[i].target[j] == ftype) {
+                    troot = engine->root[i];
+                    break;
+                }
+            }
+        }
+    }
+
+    st->ftype = ftype;
+    st->acmode = acmode;
+    st->maxpatlen = troot ? MAX(troot->maxpatlen, groot->maxpatlen) : groot->maxpatlen;
+
+    if(!groot->reloff_other) {
+        if((ret = cli_ac_initdata(&st->gdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)) ||
+           (ret = cli_ac_caloff(groot, &st->gdata, NULL)))
+            return ret;
+        st->groot = groot;
+        st->lag = groot->reloff_eof;
+    }
+    if(troot && usetroot && !troot->reloff_other && !troot->bm_offmode) {
+        if((ret = cli_ac_initdata(&st->tdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)) ||
+           (ret = cli_ac_caloff(troot, &st->tdata, NULL)))
+            return ret;
+        st->troot = troot;
+        st->lag = MAX(st->lag, troot->reloff_eof);
+    }
+
+    if(st->groot || st->troot)
+        st->ready = 1;
+    return CL_SUCCESS;
+}
+
+/*
+ * Matches the next window, which must be SCANBUFF bytes at st->offset
+ * followed by at least st->lag more bytes of the object. The work is
+ * accounted for when the state is taken over.
+ */
+int cli_scanstate_window(cli_ctx *ctx, const unsigned char *buff, uint32_t bytes)
+{
+    struct cli_scanstate *st = ctx->scanstate;
+    const char *virname;
+    int ret;
+
+    st->work += bytes;
+    if(st->troot) {
+        virname = NULL;
+        ret = matcher_run(st->troot, buff, bytes, &virname, &st->tdata, st->offset, NULL, st->ftype, &st->ftoffset, st->acmode, PCRE_SCAN_NONE, NULL, NULL, NULL, NULL, ctx);
+        if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM || ret == CL_ETIMEOUT)
+            return ret;
+    }
+
+    if(st->groot) {
+        virname = NULL;
+        ret = matcher_run(st->groot, buff, bytes, &virname, &st->gdata, st->offset, NULL, st->ftype, &st->ftoffset, st->acmode, PCRE_SCAN_NONE, NULL, NULL, NULL, NULL, ctx);
+        if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM || ret == CL_ETIMEOUT)
+            return ret;
+        else if((st->acmode & AC_SCAN_FT) && ret >= CL_TYPENO && ret > st->type)
+            st->type = ret;
+    }
+
+    st->scanned += bytes / CL_COUNT_PRECISION;
+    st->offset += bytes - st->maxpatlen;
+    return CL_CLEAN;
+}
+
+/* if the name can't be kept, the final scan will have to find it again */
+void cli_scanstate_addvirus(struct cli_scanstate *st, const char *virname)
+{
+    const char **virnames;
+
+    if(!(virnames = cli_realloc(st->virnames, (st->nvirnames + 1) * sizeof(*virnames)))) {
+        st->ready = 0;
+        return;
+    }
+    virnames[st->nvirnames++] = virname;
+    st->virnames = virnames;
+}
+
+/* gives up on the matching, the final scan does it all */
+void cli_scanstate_drop(struct cli_scanstate *st)
+{
+    struct cli_matched_type *node;
+
+    cli_ac_freedata(&st->tdata);
+    cli_ac_freedata(&st->gdata);
+    memset(&st->tdata, 0, sizeof(st->tdata));
+    memset(&st->gdata, 0, sizeof(st->gdata));
+    while((node = st->ftoffset)) {
+        st->ftoffset = node->next;
+        free(node);
+    }
+    free(st->virnames);
+    st->virnames = NULL;
+    st->nvirnames = 0;
+    st->troot = st->groot = NULL;
+    st->ready = 0;
+}
+
+/* the object is complete */
+void cli_scanstate_final(struct cli_scanstate *st)
+{
+    unsigned int i;
+
+    for(i = 0; i < CLI_HASH_AVAIL_TYPES; i++) {
+        if(st->hashctx[i]) {
+            cl_finish_hash(st->hashctx[i], st->digest[i]);
+            st->hashctx[i] = NULL;
+        }
+    }
+    st->feeding = 0;
+}
+
+/* the state belongs to the object being scanned at the top level */
+static struct cli_scanstate *scanstate_get(cli_ctx *ctx, fmap_t *map)
+{
+    struct cli_scanstate *st = ctx->scanstate;
+
+    if(!st || st->feeding || ctx->recursion || !map->handle_is_fd || (int)(ssize_t)map->handle != st->fd ||
+       map->nested_offset || map->len != st->len)
+        return NULL;
+    return st;
+}
+
+int cli_scanstate_md5(cli_ctx *ctx, unsigned char *digest)
+{
+    if(!scanstate_get(ctx, *ctx->fmap))
+        return 0;
+    memcpy(digest, ctx->scanstate->digest[CLI_HASH_MD5], 16);
+    return 1;
+}
+
+void cli_scanstate_free(struct cli_scanstate *st)
+{
+    unsigned int i;
+
+    cli_scanstate_drop(st);
+    for(i = 0; i < CLI_HASH_AVAIL_TYPES; i++) {
+        cl_hash_destroy(st->hashctx[i]);
+        st->hashctx[i] = NULL;
+    }
+}
+
+/* the match data of a root that was matched while the object was streamed,
+ * or a fresh one */
+static int scanstate_initdata(struct cli_matcher *root, struct cli_ac_data *data, struct cli_matcher *sroot, struct cli_ac_data *sdata)
+{
+    if(sroot == root) {
+        *data = *sdata;
+        memset(sdata, 0, sizeof(*sdata));
+        return CL_SUCCESS;
+    }
+    return cli_ac_initdata(data, root->ac_partsigs, root->ac_lsigs, root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN);
+}
+
+/* the signatures cl_engine_delta() added to root, which isn't shared with
+ * the base engine, matched over the whole map */
+static int delta_scanroot(cli_ctx *ctx, struct cli_matcher *root, cli_file_t ftype, struct cli_target_info *info, const char *refhash)
+{
+    const unsigned char *buff;
+    const char *virname;
+    struct cli_ac_data data;
+    struct cli_pcre_off poff;
+    fmap_t *map = *ctx->fmap;
+    uint32_t offset = 0, bytes;
+    int ret, viruses_found = 0;
+
+    if(!root->ac_patterns && !root->bm_patterns && !root->ac_lsigs)
+        return CL_CLEAN;
+
+    if((ret = cli_ac_initdata(&data, root->ac_partsigs, root->ac_lsigs, root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)))
+        return ret;
+    if((ret = cli_ac_caloff(root, &data, info)) || (ret = cli_pcre_recaloff(root, &poff, info, ctx))) {
+        cli_ac_freedata(&data);
+        return ret;
+    }
+
+    while(offset < map->len) {
+        bytes = MIN(map->len - offset, SCANBUFF);
+        if(!(buff = fmap_need_off_once(map, offset, bytes)))
+            break;
+
+        virname = NULL;
+        ret = matcher_run(root, buff, bytes, &virname, &data, offset, info, ftype, NULL, AC_SCAN_VIR, PCRE_SCAN_FMAP, NULL, map, NULL, &poff, ctx);
+        if(virname)
+            viruses_found = 1;
+        if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM || ret == CL_ETIMEOUT)
+            break;
+
+        if(bytes < SCANBUFF)
+            break;
+        offset += bytes - root->maxpatlen;
+    }
+
+    if(ret != CL_EMEM && ret != CL_ETIMEOUT && (ret != CL_VIRUS || SCAN_ALL))
+        ret = cli_exp_eval(ctx, root, &data, info, refhash);
+
+    cli_ac_freedata(&data);
+    cli_pcre_freeoff(&poff);
+    return viruses_found ? CL_VIRUS : ret;
+}
+
 int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres, unsigned char *refhash)
 {
     const unsigned char *buff;
@@ -837,30 +1165,15 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
     struct cli_matcher *hdb, *fp;
     const char *virname = NULL;
     uint32_t viruses_found = 0;
-    void *md5ctx, *sha1ctx, *sha256ctx;
+    void *md5ctx = NULL, *sha1ctx = NULL, *sha256ctx = NULL;
+    struct cli_scanstate *st;
+    uint32_t resume = 0, tresume = 0, gresume = 0, n;
 
     if(!ctx->engine) {
         cli_errmsg("cli_scandesc: engine == NULL\n");
         return CL_ENULLARG;
     }
 
-    md5ctx = cl_hash_init("md5");
-    if (!(md5ctx))
-        return CL_EMEM;
-
-    sha1ctx = cl_hash_init("sha1");
-    if (!(sha1ctx)) {
-        cl_hash_destroy(md5ctx);
-        return CL_EMEM;
-    }
-
-    sha256ctx = cl_hash_init("sha256");
-    if (!(sha256ctx)) {
-        cl_hash_destroy(md5ctx);
-        cl_hash_destroy(sha1ctx);
-        return CL_EMEM;
-    }
-
     if(!ftonly)
         groot = ctx->engine->root[0]; /* generic signatures */
 
@@ -892,10 +1205,38 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
             maxpatlen = groot->maxpatlen;
     }
 
+    /* the windows of a streamed object were matched as the data arrived,
+     * pick up from where that stopped */
+    if((st = scanstate_get(ctx, map)) && st->ready && !ftonly && !acres && (!ftoffset || !*ftoffset) &&
+       st->ftype == ftype && st->acmode == acmode && st->maxpatlen == maxpatlen) {
+        cli_dbgmsg("cli_scandesc: streamed object matched up to offset %u\n", st->offset);
+        st->ready = 0;
+        if(ctx->scanned)
+            *ctx->scanned += st->scanned;
+        if((ret = cli_updatescanwork(ctx, st->work)) != CL_SUCCESS)
+            return ret;
+        for(n = 0; n < st->nvirnames; n++) {
+            cli_append_virus(ctx, st->virnames[n]);
+            viruses_found = 1;
+        }
+        if(ftoffset) {
+            *ftoffset = st->ftoffset;
+            st->ftoffset = NULL;
+        }
+        type = st->type;
+        resume = st->offset;
+        if(!troot || st->troot == troot)
+            tresume = resume;
+        if(st->groot == groot)
+            gresume = resume;
+    } else {
+        st = NULL;
+    }
+
     cli_targetinfo(&info, i, map);
 
     if(!ftonly) {
-        if((ret = cli_ac_initdata(&gdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)) || (ret = cli_ac_caloff(groot, &gdata, &info))) {
+        if((ret = scanstate_initdata(groot, &gdata, st ? st->groot : NULL, st ? &st->gdata : NULL)) || (ret = cli_ac_caloff(groot, &gdata, &info))) {
             if(info.exeinfo.section)
                 free(info.exeinfo.section);
 
@@ -920,7 +1261,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
     }
 
     if(troot) {
-        if((ret = cli_ac_initdata(&tdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)) || (ret = cli_ac_caloff(troot, &tdata, &info))) {
+        if((ret = scanstate_initdata(troot, &tdata, st ? st->troot : NULL, st ? &st->tdata : NULL)) || (ret = cli_ac_caloff(troot, &tdata, &info))) {
             if(!ftonly) {
                 cli_ac_freedata(&gdata);
                 cli_pcre_freeoff(&gpoff);
@@ -1004,16 +1345,67 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
         } else {
             compute_hash[CLI_HASH_SHA256] = 0;
         }
+
+        /* only set up the digests that can match something */
+        if(!st && ((compute_hash[CLI_HASH_MD5] && !(md5ctx = cl_hash_init("md5"))) ||
+           (compute_hash[CLI_HASH_SHA1] && !(sha1ctx = cl_hash_init("sha1"))) ||
+           (compute_hash[CLI_HASH_SHA256] && !(sha256ctx = cl_hash_init("sha256"))))) {
+            cli_ac_freedata(&gdata);
+            cli_pcre_freeoff(&gpoff);
+            if(troot) {
+                cli_ac_freedata(&tdata);
+                if(bm_offmode)
+                    cli_bm_freeoff(&toff);
+                cli_pcre_freeoff(&tpoff);
+            }
+
+            if(info.exeinfo.section)
+                free(info.exeinfo.section);
+
+            cli_hashset_destroy(&info.exeinfo.vinfo);
+            cl_hash_destroy(md5ctx);
+            cl_hash_destroy(sha1ctx);
+            cl_hash_destroy(sha256ctx);
+            return CL_EMEM;
+        }
     }
 
     while(offset < map->len) {
         bytes = MIN(map->len - offset, SCANBUFF);
+        if(offset < tresume && offset < gresume) {
+            /* both roots were matched while the object was streamed */
+            offset += bytes - maxpatlen;
+            continue;
+        }
         if(!(buff = fmap_need_off_once(map, offset, bytes)))
             break;
-        if(ctx->scanned)
+        if(ctx->scanned && offset >= resume)
             *ctx->scanned += bytes / CL_COUNT_PRECISION;
 
-        if(troot) {
+        /* charged once per window, however many roots match it */
+        if((ret = cli_updatescanwork(ctx, bytes)) != CL_SUCCESS) {
+            if(!ftonly) {
+                cli_ac_freedata(&gdata);
+                cli_pcre_freeoff(&gpoff);
+            }
+            if(troot) {
+                cli_ac_freedata(&tdata);
+                if(bm_offmode)
+                    cli_bm_freeoff(&toff);
+                cli_pcre_freeoff(&tpoff);
+            }
+
+            if(info.exeinfo.section)
+                free(info.exeinfo.section);
+
+            cli_hashset_destroy(&info.exeinfo.vinfo);
+            cl_hash_destroy(md5ctx);
+            cl_hash_destroy(sha1ctx);
+            cl_hash_destroy(sha256ctx);
+            return ret;
+        }
+
+        if(troot && offset >= tresume) {
                 virname = NULL;
                 ret = matcher_run(troot, buff, bytes, &virname, &tdata, offset, &info, ftype, ftoffset, acmode, PCRE_SCAN_FMAP, acres, map, bm_offmode ? &toff : NULL, &tpoff, ctx);
 
@@ -1021,7 +1413,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
                 /* virname already appended by matcher_run */
                 viruses_found = 1;
             }
-            if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM) {
+            if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM || ret == CL_ETIMEOUT) {
                 if(!ftonly) {
                     cli_ac_freedata(&gdata);
                     cli_pcre_freeoff(&gpoff);
@@ -1043,7 +1435,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
             }
         }
 
-        if(!ftonly) {
+        if(!ftonly && offset >= gresume) {
             virname = NULL;
             ret = matcher_run(groot, buff, bytes, &virname, &gdata, offset, &info, ftype, ftoffset, acmode, PCRE_SCAN_FMAP, acres, map, NULL, &gpoff, ctx);
 
@@ -1051,7 +1443,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
                 /* virname already appended by matcher_run */
                 viruses_found = 1;
             }
-            if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM) {
+            if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM || ret == CL_ETIMEOUT) {
                 cli_ac_freedata(&gdata);
                 cli_pcre_freeoff(&gpoff);
                 if(troot) {
@@ -1076,7 +1468,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 
             /* if (bytes <= (maxpatlen * (offset!=0))), it means the last window finished the file hashing *
              *   since the last window is responsible for adding intersection between windows (maxpatlen)  */
-            if(hdb && (bytes > (maxpatlen * (offset!=0)))) {
+            if(hdb && !st && (bytes > (maxpatlen * (offset!=0)))) {
                 const void *data = buff + maxpatlen * (offset!=0);
                 uint32_t data_len = bytes - maxpatlen * (offset!=0);
 
@@ -1098,20 +1490,27 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
     if(!ftonly && hdb) {
         enum CLI_HASH_TYPE hashtype, hashtype2;
 
-        if(compute_hash[CLI_HASH_MD5]) {
-            cl_finish_hash(md5ctx, digest[CLI_HASH_MD5]);
-            md5ctx = NULL;
+        if(st) {
+            /* hashed as the object was streamed */
+            for(hashtype = CLI_HASH_MD5; hashtype < CLI_HASH_AVAIL_TYPES; hashtype++)
+                if(compute_hash[hashtype])
+                    memcpy(digest[hashtype], st->digest[hashtype], sizeof(digest[hashtype]));
+        } else {
+            if(compute_hash[CLI_HASH_MD5]) {
+                cl_finish_hash(md5ctx, digest[CLI_HASH_MD5]);
+                md5ctx = NULL;
+            }
+            if(compute_hash[CLI_HASH_SHA1]) {
+                cl_finish_hash(sha1ctx, digest[CLI_HASH_SHA1]);
+                sha1ctx = NULL;
+            }
+            if(compute_hash[CLI_HASH_SHA256]) {
+                cl_finish_hash(sha256ctx, digest[CLI_HASH_SHA256]);
+                sha256ctx = NULL;
+            }
         }
         if(refhash)
             compute_hash[CLI_HASH_MD5] = 1;
-        if(compute_hash[CLI_HASH_SHA1]) {
-            cl_finish_hash(sha1ctx, digest[CLI_HASH_SHA1]);
-            sha1ctx = NULL;
-        }
-        if(compute_hash[CLI_HASH_SHA256]) {
-            cl_finish_hash(sha256ctx, digest[CLI_HASH_SHA256]);
-            sha256ctx = NULL;
-        }
 
         virname = NULL;
         for(hashtype = CLI_HASH_MD5; hashtype < CLI_HASH_AVAIL_TYPES; hashtype++) {
@@ -1191,6 +1590,22 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
         cli_pcre_freeoff(&gpoff);
     }
 
+    if(ctx->engine->delta_root && (ret != CL_VIRUS || SCAN_ALL)) {
+        if(ret == CL_VIRUS)
+            viruses_found++;
+        if(troot && (ret = delta_scanroot(ctx, ctx->engine->delta_root[i], ftype, &info, (const char *)refhash)) == CL_VIRUS)
+            viruses_found++;
+        if(!ftonly && (ret != CL_VIRUS || SCAN_ALL) && ret != CL_EMEM && ret != CL_ETIMEOUT)
+            ret = delta_scanroot(ctx, ctx->engine->delta_root[0], ftype, &info, (const char *)refhash);
+        if(ret == CL_EMEM || ret == CL_ETIMEOUT) {
+            if(info.exeinfo.section)
+                free(info.exeinfo.section);
+
+            cli_hashset_destroy(&info.exeinfo.vinfo);
+            return ret;
+        }
+    }
+
     if(info.exeinfo.section)
         free(info.exeinfo.section);
 
@@ -1253,6 +1668,9 @@ int cli_matchmeta(cli_ctx *ctx, const char *fname, size_t fsizec, size_t fsizer,
 	if(cdb->name.re_magic && (!fname || cli_regexec(&cdb->name, fname, 0, NULL, 0) == REG_NOMATCH))
 	    continue;
 
+	if(ctx->engine->delta_dead && cli_delta_isdead(ctx->engine, cdb->virname))
+	    continue;
+
 	cli_append_virus(ctx, cdb->virname);
 	viruses_found++;
 	if(!SCAN_ALL)
@@ -109,10 +109,17 @@ struct cli_matcher {
     /* HASH */
     struct cli_hash_patt hm;
     struct cli_hash_wild hwild;
+    /* for engines made by cl_engine_delta(): the hashes here are checked
+     * before those of hm_base, which don't match if listed in hm_dead or
+     * if their name is in hm_deadnames */
+    const struct cli_matcher *hm_base;
+    struct cli_matcher *hm_dead;
+    const struct cli_hashtable *hm_deadnames;
 
     /* Extended Aho-Corasick */
     uint32_t ac_partsigs, ac_nodes, ac_lists, ac_patterns, ac_lsigs;
     struct cli_ac_lsig **ac_lsigtable;
+    uint32_t *ac_lsig_nomatch, ac_lsig_nomatch_num; /* lsigs that may match without any subsig hits */
     struct cli_ac_node *ac_root, **ac_nodetable;
     struct cli_ac_list **ac_listtable;
     struct cli_ac_patt **ac_pattable;
@@ -124,6 +131,10 @@ struct cli_matcher {
     uint16_t maxpatlen;
     uint8_t ac_only;
 
+    /* relative offsets of the AC and BM patterns: how far back from the end
+     * the EOF-n ones reach, and how many depend on more than the size */
+    uint32_t reloff_eof, reloff_other;
+
     /* Perl-Compiled Regular Expressions */
 #if HAVE_PCRE
     uint32_t pcre_metas;
@@ -198,9 +209,53 @@ static const struct cli_mtarget cli_mtargets[CLI_MTARGETS] =  {
 #define CLI_OFF_MACRO       8
 #define CLI_OFF_SE	    9
 
+/*
+ * Raw matching of an object that arrives in pieces (cl_scan_stream_feed()).
+ * The windows cli_fmap_scandesc() would scan are matched as soon as the data
+ * behind them is known not to be within reach of an EOF relative offset, and
+ * the match data, file type hits and digests are carried over until the
+ * object is complete. cli_fmap_scandesc() then takes over the state when it
+ * scans the object at the top level and only matches what's left.
+ */
+struct cli_scanstate {
+    int fd;                     /* the spooled object */
+    uint64_t len;
+    void *hashctx[CLI_HASH_AVAIL_TYPES];
+    unsigned char digest[CLI_HASH_AVAIL_TYPES][32];
+    uint8_t feeding;
+
+    /* set up once the file type is known */
+    uint8_t ready;
+    cli_file_t ftype;
+    unsigned int acmode;
+    uint32_t maxpatlen;
+    uint32_t lag;               /* farthest EOF relative offset */
+    struct cli_matcher *troot, *groot; /* the roots matched so far */
+    struct cli_ac_data tdata, gdata;
+    struct cli_matched_type *ftoffset;
+    int type;
+    uint32_t offset;            /* next window */
+    unsigned long int scanned;
+    uint64_t work;
+    /* CL_SCAN_ALLMATCHES: reported when the state is taken over */
+    const char **virnames;
+    unsigned int nvirnames;
+};
+
+int cli_scanstate_init(struct cli_scanstate *st, const struct cl_engine *engine, int fd);
+void cli_scanstate_hash(struct cli_scanstate *st, const void *data, size_t len);
+int cli_scanstate_settype(struct cli_scanstate *st, const struct cl_engine *engine, cli_file_t ftype, unsigned int acmode, int usetroot);
+int cli_scanstate_window(cli_ctx *ctx, const unsigned char *buff, uint32_t bytes);
+void cli_scanstate_addvirus(struct cli_scanstate *st, const char *virname);
+void cli_scanstate_drop(struct cli_scanstate *st);
+void cli_scanstate_final(struct cli_scanstate *st);
+int cli_scanstate_md5(cli_ctx *ctx, unsigned char *digest);
+void cli_scanstate_free(struct cli_scanstate *st);
+
 int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset, cli_ctx *ctx, cli_file_t ftype, struct cli_ac_data **acdata);
 
 int cli_scandesc(int desc, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres);
+int cli_scandesc_mem(const void *buffer, size_t length, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres);
 int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres, unsigned char *refhash);
 int cli_exp_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acdata, struct cli_target_info *target_info, const char *hash);
 int cli_caloff(const char *offstr, const struct cli_target_info *info, unsigned int target, uint32_t *offdata, uint32_t *offset_min, uint32_t *offset_max);
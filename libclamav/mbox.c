@@ -72,6 +72,8 @@
 #include "fmap.h"
 #include "json_api.h"
 #include "msxml_parser.h"
+#include "scanners.h"
+#include "decoders.h"
 
 #if HAVE_LIBXML2
 #ifdef _WIN32
@@ -229,6 +231,7 @@ static	int	count_quotes(const char *buf);
 static	bool	next_is_folded_header(const text *t);
 static	bool	newline_in_header(const char *line);
 
+static	int	getHrefsMem(unsigned char *mem, size_t len, tag_arguments_t *hrefs, const struct cli_dconf *dconf);
 static	blob	*getHrefs(message *m, tag_arguments_t *hrefs);
 static	void	hrefs_done(blob *b, tag_arguments_t *hrefs);
 static	void	checkURLs(message *m, mbox_ctx *mctx, mbox_status *rc, int is_html);
@@ -236,6 +239,10 @@ static	void	checkURLs(message *m, mbox_ctx *mctx, mbox_status *rc, int is_html);
 /* Maximum line length according to RFC2821 */
 #define	RFC2821LENGTH	1000
 
+/* text bigger than this isn't searched for URLs, by either the parser or
+ * the streaming path */
+#define	HREFS_MAXLEN	(100 * 1024)
+
 /* Hashcodes for our hash tables */
 #define	CONTENT_TYPE			1
 #define	CONTENT_TRANSFER_ENCODING	2
@@ -456,6 +463,12 @@ cli_parse_mbox(const char *dir, cli_ctx *ctx)
 		messageSetCTX(m, ctx);
 
 		do {
+			if(cli_updatescanwork(ctx, strlen(buffer)) != CL_SUCCESS) {
+				/* body is m (or NULL) here, m is freed below */
+				retcode = CL_ETIMEOUT;
+				body = NULL;
+				break;
+			}
 			cli_chomp(buffer);
 			/*if(lastLineWasEmpty && (strncmp(buffer, "From ", 5) == 0) && isalnum(buffer[5])) {*/
 			if(lastLineWasEmpty && (strncmp(buffer, "From ", 5) == 0)) {
@@ -544,6 +557,8 @@ cli_parse_mbox(const char *dir, cli_ctx *ctx)
 		buffer[sizeof(buffer) - 1] = '\0';
 
 		body = parseEmailFile(map, &at, rfc821, buffer, dir);
+		if(cli_updatescanwork(ctx, at) != CL_SUCCESS)
+			retcode = CL_ETIMEOUT;
 	}
 
 	if(body) {
@@ -1353,6 +1368,11 @@ parseEmailBody(message *messageIn, text *textIn, mbox_ctx *mctx, unsigned int re
 		cli_dbgmsg("parseEmailBody: number of files exceeded %u\n", engine->maxfiles);
 		return MAXFILES;
 	}
+	if(cli_updatescanwork(mctx->ctx, 0) != CL_SUCCESS) {
+		/* unwind like a recursion limit, nothing more gets scanned */
+		cli_dbgmsg("parseEmailBody: scan work budget exhausted\n");
+		return MAXREC;
+	}
 
 	rc = OK;
 
@@ -3443,10 +3463,34 @@ static void extract_text_urls(const unsigned char *mem, size_t len, tag_argument
  * too, and phishingScan might be used in situations where checkURLs is
  * disabled (see ifdef)
  */
+static int
+getHrefsMem(unsigned char *mem, size_t len, tag_arguments_t *hrefs, const struct cli_dconf *dconf)
+{
+	hrefs->count = 0;
+	hrefs->tag = hrefs->value = NULL;
+	hrefs->contents = NULL;
+
+	/* TODO: make this size customisable */
+	if(len > HREFS_MAXLEN) {
+		cli_dbgmsg("Viruses pointed to by URLs not scanned in large message\n");
+		return 0;
+	}
+
+	cli_dbgmsg("getHrefs: calling html_normalise_mem\n");
+	if(!html_normalise_mem(mem, (off_t)len, NULL, hrefs, dconf))
+		return 0;
+	cli_dbgmsg("getHrefs: html_normalise_mem returned\n");
+	if (!hrefs->count && hrefs->scanContents) {
+	    extract_text_urls(mem, len, hrefs);
+	}
+
+	/* TODO: Do we need to call remove_html_comments? */
+	return 1;
+}
+
 static blob *
 getHrefs(message *m, tag_arguments_t *hrefs)
 {
-	unsigned char *mem;
 	blob *b = messageToBlob(m, 0);
 	size_t len;
 
@@ -3455,34 +3499,10 @@ getHrefs(message *m, tag_arguments_t *hrefs)
 
 	len = blobGetDataSize(b);
 
-	if(len == 0) {
-		blobDestroy(b);
-		return NULL;
-	}
-
-	/* TODO: make this size customisable */
-	if(len > 100*1024) {
-		cli_dbgmsg("Viruses pointed to by URLs not scanned in large message\n");
-		blobDestroy(b);
-		return NULL;
-	}
-
-	hrefs->count = 0;
-	hrefs->tag = hrefs->value = NULL;
-	hrefs->contents = NULL;
-
-	cli_dbgmsg("getHrefs: calling html_normalise_mem\n");
-	mem = blobGetData(b);
-	if(!html_normalise_mem(mem, (off_t)len, NULL, hrefs,m->ctx->dconf)) {
+	if((len == 0) || !getHrefsMem(blobGetData(b), len, hrefs, m->ctx->dconf)) {
 		blobDestroy(b);
 		return NULL;
 	}
-	cli_dbgmsg("getHrefs: html_normalise_mem returned\n");
-	if (!hrefs->count && hrefs->scanContents) {
-	    extract_text_urls(mem, len, hrefs);
-	}
-
-	/* TODO: Do we need to call remove_html_comments? */
 	return b;
 }
 
@@ -3532,6 +3552,574 @@ checkURLs(message *mainMessage, mbox_ctx *mctx, mbox_status *rc, int is_html)
 	hrefs_done(b,&hrefs);
 }
 
+/*
+ * Streaming fast path
+ *
+ * Most mail is a plain MIME tree of base64, quoted-printable or unencoded
+ * parts. For those there's no need to build the message/text/blob objects
+ * and write every part out to a temporary directory: the message is walked
+ * in place in the fmap, each leaf is recorded as an (offset, length,
+ * encoding) extent, and the leaves are then decoded straight into a scan
+ * buffer, or scanned directly out of the map when they aren't encoded.
+ *
+ * Anything outside that subset - mailboxes, message/rfc822 parts, uuencode,
+ * binhex, yEnc or bounces in the text, RFC2231 parameters, unterminated
+ * multiparts - is found while walking, before anything has been scanned,
+ * and makes cli_mbox_stream() return CL_BREAK so that the caller can fall
+ * back to the full parser.
+ */
+#define	MIME_STREAM_MAXDEPTH	16
+#define	MIME_STREAM_MAXLINE	(8 * RFC2821LENGTH)
+#define	MIME_STREAM_CHUNK	(64 * 1024)
+
+typedef	struct	mime_part {
+	size_t	off;
+	size_t	len;
+	encoding_type	enc;
+	int	checkurls;	/* inline text, look for phish */
+} mime_part_t;
+
+typedef	struct	mime_hdr {
+	char	type[32];
+	char	subtype[64];
+	char	boundary[RFC2821LENGTH + 1];
+	encoding_type	enc;
+	int	attachment;
+	int	have_type, have_enc, have_disp;
+} mime_hdr_t;
+
+typedef	struct	mime_stream {
+	mbox_ctx	*mctx;
+	fmap_t	*map;
+	size_t	at;
+	mime_part_t	*parts;
+	unsigned	int	nparts;
+	unsigned	int	maxparts;
+	const	char	*boundaries[MIME_STREAM_MAXDEPTH];
+	unsigned	int	depth;
+	char	line[RFC2821LENGTH + 1];
+} mime_stream_t;
+
+/* line that ended a body: level -1 is the end of the map */
+typedef	struct	mime_term {
+	int	level;
+	int	end;
+} mime_term_t;
+
+/*
+ * Return the next line of the map without copying it. *len doesn't include
+ * the line terminator
+ */
+static const char *
+mime_stream_getline(mime_stream_t *ms, size_t *start, size_t *len)
+{
+	const char *p, *nl;
+	size_t avail;
+
+	p = fmap_need_off_once_len(ms->map, ms->at, MIME_STREAM_MAXLINE, &avail);
+	if((p == NULL) || (avail == 0))
+		return NULL;
+
+	*start = ms->at;
+	if((nl = memchr(p, '\n', avail)) != NULL) {
+		*len = (size_t)(nl - p);
+		ms->at += *len + 1;
+	} else {
+		*len = avail;
+		ms->at += avail;
+	}
+	if(*len && (p[*len - 1] == '\r'))
+		(*len)--;
+
+	return p;
+}
+
+/* NUL terminated copy of a line, for the helpers shared with the parser */
+static const char *
+mime_stream_cstr(mime_stream_t *ms, const char *p, size_t len)
+{
+	if(len > RFC2821LENGTH)
+		len = RFC2821LENGTH;
+	memcpy(ms->line, p, len);
+	ms->line[len] = '\0';
+
+	return ms->line;
+}
+
+/*
+ * Does this line of text need one of the decoders that only the full
+ * parser has?
+ */
+static int
+mime_stream_needparser(mime_stream_t *ms, const char *p, size_t len)
+{
+	if(len < 6)
+		return 0;
+	if(((p[0] == 'b') || (p[0] == 'B')) &&
+	   isuuencodebegin(mime_stream_cstr(ms, p, len)))
+		return 1;
+	if((len > 7) && (memcmp(p, "=ybegin", 7) == 0))
+		return 1;
+	if((len < 100) && cli_memstr(p, len, "BinHex", 6))
+		return 1;
+	if((len < 72) && isBounceStart(ms->mctx, mime_stream_cstr(ms, p, len)))
+		return 1;
+
+	return 0;
+}
+
+static int
+mime_stream_param(mime_hdr_t *hdr, const char *name, size_t namelen, const char *value, size_t valuelen)
+{
+	if(memchr(name, '*', namelen))
+		/* RFC2231 */
+		return 0;
+	if((namelen != 8) || (strncasecmp(name, "boundary", 8) != 0))
+		return 1;
+	if(hdr->boundary[0] || (valuelen == 0) || (valuelen >= sizeof(hdr->boundary)))
+		return 0;
+
+	memcpy(hdr->boundary, value, valuelen);
+	hdr->boundary[valuelen] = '\0';
+
+	return 1;
+}
+
+/*
+ * Handle one of the headers that determine the MIME structure. Returns 0
+ * for anything that isn't simple enough for the fast path, including
+ * repeated headers, which the parser resolves in its own way
+ */
+static int
+mime_stream_header(mime_hdr_t *hdr, int which, const char *value)
+{
+	const char *p, *name, *v;
+	size_t len, namelen;
+
+	while(isblank(*value))
+		value++;
+
+	switch(which) {
+		case CONTENT_TYPE:
+			if(hdr->have_type++ || strchr(value, '('))
+				return 0;
+			len = strcspn(value, "/; \t");
+			if((len == 0) || (len >= sizeof(hdr->type)) || (value[len] != '/'))
+				return 0;
+			memcpy(hdr->type, value, len);
+			hdr->type[len] = '\0';
+			value += len + 1;
+			len = strcspn(value, "; \t");
+			if((len == 0) || (len >= sizeof(hdr->subtype)))
+				return 0;
+			memcpy(hdr->subtype, value, len);
+			hdr->subtype[len] = '\0';
+
+			p = value + len;
+			for(;;) {
+				while((*p == ';') || isblank(*p))
+					p++;
+				if(*p == '\0')
+					break;
+				name = p;
+				namelen = strcspn(p, "=; \t");
+				p += namelen;
+				while(isblank(*p))
+					p++;
+				if((namelen == 0) || (*p++ != '='))
+					return 0;
+				while(isblank(*p))
+					p++;
+				if(*p == '"') {
+					v = ++p;
+					if((p = strchr(v, '"')) == NULL)
+						return 0;
+					len = (size_t)(p++ - v);
+					if(memchr(v, '\\', len))
+						return 0;
+				} else {
+					v = p;
+					len = strcspn(v, "; \t");
+					p += len;
+				}
+				if(!mime_stream_param(hdr, name, namelen, v, len))
+					return 0;
+			}
+			return 1;
+		case CONTENT_TRANSFER_ENCODING:
+			if(hdr->have_enc++)
+				return 0;
+			len = strcspn(value, " \t;");
+			if((len == 0) ||
+			   ((len == 4) && ((strncasecmp(value, "7bit", 4) == 0) ||
+					   (strncasecmp(value, "8bit", 4) == 0))))
+				hdr->enc = NOENCODING;
+			else if((len == 6) && (strncasecmp(value, "binary", 6) == 0))
+				hdr->enc = BINARY;
+			else if((len == 6) && (strncasecmp(value, "base64", 6) == 0))
+				hdr->enc = BASE64;
+			else if((len == 16) && (strncasecmp(value, "quoted-printable", 16) == 0))
+				hdr->enc = QUOTEDPRINTABLE;
+			else
+				return 0;
+			return 1;
+		case CONTENT_DISPOSITION:
+			if(hdr->have_disp++)
+				return 0;
+			hdr->attachment = (strncasecmp(value, "attachment", 10) == 0);
+			return 1;
+	}
+	return 1;
+}
+
+/*
+ * Read a header block, keeping only the headers that describe the MIME
+ * structure. On return ms->at is at the start of the body
+ */
+static int
+mime_stream_headers(mime_stream_t *ms, mime_hdr_t *hdr)
+{
+	char buf[RFC2821LENGTH + 1];
+	size_t start, len, buflen = 0, namelen;
+	const char *p, *colon;
+	int which = 0, nheaders = 0;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->enc = NOENCODING;
+
+	for(;;) {
+		p = mime_stream_getline(ms, &start, &len);
+
+		if((p != NULL) && len && isblank(p[0])) {
+			/* folded header */
+			if(nheaders == 0)
+				return 0;
+			if(which) {
+				while(len && isblank(*p)) {
+					p++;
+					len--;
+				}
+				if(buflen + len + 1 >= sizeof(buf))
+					return 0;
+				buf[buflen++] = ' ';
+				memcpy(&buf[buflen], p, len);
+				buflen += len;
+			}
+			continue;
+		}
+
+		if(which) {
+			buf[buflen] = '\0';
+			if(!mime_stream_header(hdr, which, buf))
+				return 0;
+			which = 0;
+		}
+		if((p == NULL) || (len == 0))
+			break;
+
+		if(((colon = memchr(p, ':', len)) == NULL) || (colon == p))
+			return 0;
+		namelen = (size_t)(colon - p);
+		if(memchr(p, ' ', namelen) || memchr(p, '\t', namelen))
+			return 0;
+		nheaders++;
+
+		if((namelen == 12) && (strncasecmp(p, "Content-Type", 12) == 0))
+			which = CONTENT_TYPE;
+		else if((namelen == 25) && (strncasecmp(p, "Content-Transfer-Encoding", 25) == 0))
+			which = CONTENT_TRANSFER_ENCODING;
+		else if((namelen == 19) && (strncasecmp(p, "Content-Disposition", 19) == 0))
+			which = CONTENT_DISPOSITION;
+		else
+			continue;
+
+		buflen = len - namelen - 1;
+		if(buflen >= sizeof(buf))
+			return 0;
+		memcpy(buf, colon + 1, buflen);
+	}
+	return 1;
+}
+
+/*
+ * Walk body text up to the next boundary of any of the enclosing
+ * multiparts. *last is set to the end of the last line before that
+ * boundary, less its line terminator
+ */
+static int
+mime_stream_walk(mime_stream_t *ms, int check, size_t *last, mime_term_t *term)
+{
+	size_t start, len;
+	const char *p, *line;
+	int level;
+
+	term->level = -1;
+	term->end = 0;
+	*last = ms->at;
+
+	while((p = mime_stream_getline(ms, &start, &len)) != NULL) {
+		if(ms->depth && len && ((p[0] == '-') || (p[0] == '('))) {
+			line = mime_stream_cstr(ms, p, len);
+			for(level = (int)ms->depth - 1; level >= 0; level--) {
+				if(boundaryEnd(line, ms->boundaries[level])) {
+					term->level = level;
+					term->end = 1;
+					return 1;
+				}
+				if(boundaryStart(line, ms->boundaries[level])) {
+					term->level = level;
+					return 1;
+				}
+			}
+		}
+		if(check && mime_stream_needparser(ms, p, len))
+			return 0;
+		*last = start + len;
+	}
+	return 1;
+}
+
+static int
+mime_stream_addpart(mime_stream_t *ms, const mime_hdr_t *hdr, size_t off, size_t len)
+{
+	cli_ctx *ctx = ms->mctx->ctx;
+	mime_part_t *part;
+
+	if(len == 0)
+		return 1;
+	if(ctx->engine->maxfiles && (ms->nparts >= ctx->engine->maxfiles))
+		/* let the parser report it */
+		return 0;
+
+	if(ms->nparts == ms->maxparts) {
+		unsigned int n = ms->maxparts ? ms->maxparts * 2 : 16;
+
+		if((part = cli_realloc(ms->parts, n * sizeof(*part))) == NULL)
+			return 0;
+		ms->parts = part;
+		ms->maxparts = n;
+	}
+	part = &ms->parts[ms->nparts++];
+	part->off = off;
+	part->len = len;
+	part->enc = hdr->enc;
+	part->checkurls = !hdr->attachment &&
+		((hdr->type[0] == '\0') ||
+		 ((strcasecmp(hdr->type, "text") == 0) &&
+		  ((strcasecmp(hdr->subtype, "plain") == 0) ||
+		   (strcasecmp(hdr->subtype, "html") == 0))));
+
+	return 1;
+}
+
+/*
+ * Walk the body of an entity whose headers have just been read, recording
+ * its leaves
+ */
+static int
+mime_stream_entity(mime_stream_t *ms, const mime_hdr_t *hdr, mime_term_t *term)
+{
+	mime_hdr_t part;
+	size_t off, last;
+	int level;
+
+	if(strcasecmp(hdr->type, "message") == 0)
+		return 0;
+
+	if(strcasecmp(hdr->type, "multipart") != 0) {
+		off = ms->at;
+		if(!mime_stream_walk(ms, hdr->enc != BASE64, &last, term))
+			return 0;
+		return mime_stream_addpart(ms, hdr, off, last - off);
+	}
+
+	if((hdr->boundary[0] == '\0') || (hdr->enc == BASE64) ||
+	   (hdr->enc == QUOTEDPRINTABLE) ||
+	   (strcasecmp(hdr->subtype, "digest") == 0) ||
+	   (ms->depth == MIME_STREAM_MAXDEPTH))
+		return 0;
+
+	level = (int)ms->depth;
+	ms->boundaries[ms->depth++] = hdr->boundary;
+
+	/* preamble */
+	if(!mime_stream_walk(ms, 1, &last, term))
+		return 0;
+	while((term->level == level) && !term->end) {
+		if(!mime_stream_headers(ms, &part))
+			return 0;
+		if(!mime_stream_entity(ms, &part, term))
+			return 0;
+	}
+	if((term->level != level) || !term->end)
+		/* not terminated by our own boundary */
+		return 0;
+
+	/* epilogue */
+	ms->depth--;
+	return mime_stream_walk(ms, 1, &last, term);
+}
+
+static size_t
+mime_stream_decode(mime_stream_t *ms, const mime_part_t *part, unsigned char *out)
+{
+	const unsigned char *in;
+	unsigned char *o = out;
+	cli_base64_state_t state;
+	size_t off = 0, len, used;
+
+	cli_base64_init(&state);
+	while(off < part->len) {
+		len = MIN(part->len - off, MIME_STREAM_CHUNK);
+		if((in = fmap_need_off_once(ms->map, part->off + off, len)) == NULL)
+			break;
+		if(part->enc == BASE64) {
+			o += cli_base64_decode(&state, in, len, o);
+			off += len;
+		} else {
+			o += cli_qp_decode(in, len, o, &used, off + len == part->len);
+			off += used;
+		}
+	}
+	if(part->enc == BASE64)
+		o += cli_base64_finish(&state, o);
+
+	return (size_t)(o - out);
+}
+
+static int
+mime_stream_checkurls(mime_stream_t *ms, unsigned char *mem, size_t len)
+{
+	mbox_ctx *mctx = ms->mctx;
+	tag_arguments_t hrefs;
+	int ret = CL_CLEAN;
+
+	hrefs.scanContents = 1;
+	if(getHrefsMem(mem, len, &hrefs, mctx->ctx->dconf) &&
+	   (phishingScan(mctx->ctx, &hrefs) == CL_VIRUS)) {
+		cli_dbgmsg("PH:Phishing found\n");
+		ret = CL_VIRUS;
+	}
+	html_tag_arg_free(&hrefs);
+
+	return ret;
+}
+
+static int
+mime_stream_scanpart(mime_stream_t *ms, const mime_part_t *part)
+{
+	mbox_ctx *mctx = ms->mctx;
+	cli_ctx *ctx = mctx->ctx;
+	unsigned char *buf = NULL;
+	size_t len = part->len;
+	int ret;
+
+	cli_dbgmsg("cli_mbox_stream: part at %lu, %lu bytes, %s\n",
+		(unsigned long)part->off, (unsigned long)part->len,
+		getEncTypeStr(part->enc));
+
+	if((part->enc == BASE64) || (part->enc == QUOTEDPRINTABLE)) {
+		if(cli_checklimits("cli_mbox_stream", ctx, part->len, 0, 0) != CL_CLEAN)
+			return CL_CLEAN;
+		if((buf = cli_malloc(part->len + 3)) == NULL)
+			return CL_EMEM;
+		len = mime_stream_decode(ms, part, buf);
+		ret = len ? cli_mem_scandesc(buf, len, ctx) : CL_CLEAN;
+	} else
+		ret = cli_map_scan(ms->map, part->off, part->len, ctx, CL_TYPE_ANY);
+
+	if((ret == CL_CLEAN) && part->checkurls && len &&
+	   (ctx->engine->dboptions & CL_DB_PHISHING_URLS) &&
+	   (DCONF_PHISHING & PHISHING_CONF_ENGINE)) {
+		if(buf == NULL) {
+			const void *p;
+
+			/* the map may be read only, html_normalise_mem wants a
+			 * copy; getHrefsMem() skips anything bigger anyway */
+			if((len <= HREFS_MAXLEN) &&
+			   ((p = fmap_need_off_once(ms->map, part->off, len)) != NULL) &&
+			   ((buf = cli_malloc(len)) != NULL))
+				memcpy(buf, p, len);
+		}
+		if(buf)
+			ret = mime_stream_checkurls(ms, buf, len);
+	}
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Scan a MIME message without going through the temporary directory.
+ * Returns CL_BREAK, having scanned nothing, if the message needs the full
+ * parser
+ */
+int
+cli_mbox_stream(cli_ctx *ctx)
+{
+	mime_stream_t ms;
+	mbox_ctx mctx;
+	mime_hdr_t hdr;
+	mime_term_t term;
+	size_t start, len;
+	const char *p;
+	unsigned int i, viruses_found = 0;
+	int ret = CL_CLEAN;
+
+	if(ctx->options & CL_SCAN_FILE_PROPERTIES)
+		return CL_BREAK;
+
+	memset(&mctx, 0, sizeof(mctx));
+	mctx.ctx = ctx;
+	memset(&ms, 0, sizeof(ms));
+	ms.mctx = &mctx;
+	ms.map = *ctx->fmap;
+
+	/* ignore any blank lines at the top of the message */
+	while(((p = mime_stream_getline(&ms, &start, &len)) != NULL) && (len == 0))
+		;
+	if(p == NULL)
+		return CL_CLEAN;
+	if(((len >= 5) && (memcmp(p, "From ", 5) == 0)) ||
+	   ((len >= 4) && (memcmp(p, "P I ", 4) == 0)))
+		/* mailbox, or CommuniGate Pro */
+		return CL_BREAK;
+	ms.at = start;
+
+	if(!mime_stream_headers(&ms, &hdr) ||
+	   !mime_stream_entity(&ms, &hdr, &term) ||
+	   (term.level != -1)) {
+		cli_dbgmsg("cli_mbox_stream: handing over to the parser\n");
+		free(ms.parts);
+		return CL_BREAK;
+	}
+
+	cli_dbgmsg("cli_mbox_stream: %u parts\n", ms.nparts);
+	for(i = 0; i < ms.nparts; i++) {
+		ret = mime_stream_scanpart(&ms, &ms.parts[i]);
+		if(ret == CL_VIRUS) {
+			if(!SCAN_ALL)
+				break;
+			viruses_found++;
+			ret = CL_CLEAN;
+		} else if(ret != CL_CLEAN)
+			break;
+	}
+	free(ms.parts);
+
+	if(viruses_found)
+		ret = CL_VIRUS;
+	if((ret == CL_CLEAN) && ctx->found_possibly_unwanted &&
+	   (*ctx->virname == NULL || SCAN_ALL)) {
+		cli_append_virus(ctx, "Heuristics.Phishing.Email");
+		ctx->found_possibly_unwanted = 0;
+		ret = CL_VIRUS;
+	}
+	cli_dbgmsg("cli_mbox_stream returning %d\n", ret);
+
+	return ret;
+}
+
 #ifdef HAVE_BACKTRACE
 static void
 sigsegv(int sig)
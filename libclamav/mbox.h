@@ -52,5 +52,6 @@ typedef enum {
 
 size_t	strstrip(char *s);	/* remove trailing white space */
 int	cli_mbox(const char *dir, cli_ctx *ctx);
+int	cli_mbox_stream(cli_ctx *ctx);
 
 #endif /* __MBOX_H */
@@ -49,6 +49,7 @@
 
 #include "others.h"
 #include "str.h"
+#include "decoders.h"
 #include "filetypes.h"
 
 #include "mbox.h"
@@ -1889,10 +1890,17 @@ decodeLine(message *m, encoding_type et, const char *line, unsigned char *buf, s
 
 			sanitiseBase64(copy);
 
-			/*
-			 * Klez doesn't always put "=" on the last line
-			 */
-			buf = decode(m, copy, buf, base64, (p2 == NULL) && ((strlen(copy) & 3) == 0));
+			if((m->base64chars == 0) && (p2 == NULL) && ((strlen(copy) & 3) == 0)) {
+				/* whole quanta and nothing carried over */
+				cli_base64_state_t state;
+
+				cli_base64_init(&state);
+				buf += cli_base64_decode(&state, (const unsigned char *)copy, strlen(copy), buf);
+			} else
+				/*
+				 * Klez doesn't always put "=" on the last line
+				 */
+				buf = decode(m, copy, buf, base64, FALSE);
 
 			if(copy != base64buf)
 				free(copy);
@@ -1929,10 +1937,8 @@ decodeLine(message *m, encoding_type et, const char *line, unsigned char *buf, s
 				 * 62 characters
 				 */
 				cli_dbgmsg("uudecode: buffer overflow stopped, attempting to ignore but decoding may fail\n");
-			else {
-				(void)decode(m, line, buf, uudecode, (len & 3) == 0);
-				buf = &buf[reallen];
-			}
+			else
+				buf += cli_uudecode_line(line - 1, len + 1, buf);
 			m->base64chars = 0;	/* this happens with broken uuencoded files */
 			break;
 		case YENCODE:
@@ -810,10 +810,6 @@ static int cli_ole2_summary_json_cleanup(summary_ctx_t *sctx, int retcode)
 
     cli_dbgmsg("in cli_ole2_summary_json_cleanup: %d[%x]\n", retcode, sctx->flags);
 
-    if (sctx->sfmap) {
-        funmap(sctx->sfmap);
-    }
-
     if (sctx->flags) {
         jarr = cli_jsonarray(sctx->summary, "ParseErrors");
 
@@ -870,10 +866,9 @@ static int cli_ole2_summary_json_cleanup(summary_ctx_t *sctx, int retcode)
     return retcode;
 }
 
-int cli_ole2_summary_json(cli_ctx *ctx, int fd, int mode)
+int cli_ole2_summary_json(cli_ctx *ctx, fmap_t *sfmap, int mode)
 {
     summary_ctx_t sctx;
-    STATBUF statbuf;
     off_t foff = 0;
     unsigned char *databuf;
     summary_stub_t sumstub;
@@ -887,8 +882,8 @@ int cli_ole2_summary_json(cli_ctx *ctx, int fd, int mode)
         return CL_ENULLARG;
     }
 
-    if (fd < 0) {
-        cli_dbgmsg("ole2_summary_json: invalid file descriptor\n");
+    if (sfmap == NULL) {
+        cli_dbgmsg("ole2_summary_json: invalid map\n");
         return CL_ENULLARG; /* placeholder */
     }
 
@@ -902,16 +897,7 @@ int cli_ole2_summary_json(cli_ctx *ctx, int fd, int mode)
     sctx.ctx = ctx;
     sctx.mode = mode;
 
-    if (FSTAT(fd, &statbuf) == -1) {
-        cli_dbgmsg("ole2_summary_json: cannot stat file descriptor\n");
-        return CL_ESTAT;
-    }
-
-    sctx.sfmap = fmap(fd, 0, statbuf.st_size);
-    if (!sctx.sfmap) {
-        cli_dbgmsg("ole2_summary_json: failed to get fmap\n");
-        return CL_EMAP;
-    }
+    sctx.sfmap = sfmap;
     sctx.maplen = sctx.sfmap->len;
     cli_dbgmsg("ole2_summary_json: streamsize: %u\n", sctx.maplen);
 
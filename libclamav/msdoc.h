@@ -331,7 +331,7 @@ static const struct codepage_entry codepage_entries[] = {
     { 65001, "UTF-8" }        /* Unicode (UTF-8) */
 };
 
-int cli_ole2_summary_json(cli_ctx *ctx, int fd, int mode);
+int cli_ole2_summary_json(cli_ctx *ctx, fmap_t *sfmap, int mode);
 #endif /* HAVE_JSON */
 
 #endif /* __MSDOC_H_ */
@@ -30,7 +30,7 @@
 
 #include "clamav.h"
 #include "others.h"
-#include "conv.h"
+#include "decoders.h"
 #include "scanners.h"
 #include "json_api.h"
 #include "msxml_parser.h"
@@ -444,7 +444,7 @@ static int msxml_parse_element(struct msxml_ctx *mxctx, xmlTextReaderPtr reader,
 
                     cli_msxmlmsg("BINARY DATA!\n");
 
-                    decoded = (char *)cl_base64_decode((char *)node_value, strlen((const char *)node_value), NULL, &decodedlen, 0);
+                    decoded = (char *)cli_base64_decode_mem(node_value, strlen((const char *)node_value), &decodedlen);
                     if (!decoded) {
                         cli_warnmsg("msxml_parse_element: failed to decode base64-encoded binary data\n");
                         state = xmlTextReaderRead(reader);
@@ -43,6 +43,7 @@
 #include "others.h"
 #include "hwp.h"
 #include "ole2_extract.h"
+#include "inflate_iface.h"
 #include "scanners.h"
 #include "fmap.h"
 #include "json_api.h"
@@ -106,10 +107,19 @@ typedef struct ole2_header_tag {
     uint32_t        max_block_no;
     off_t           m_length;
     bitset_t       *bitset;
-    struct uniq    *U;
     fmap_t         *map;
     int             has_vba;
     hwp5_header_t  *is_hwp;
+
+    /* block chains, resolved once instead of re-read for every link */
+    int32_t        *bat;
+    uint32_t        bat_size;
+    int32_t        *sbat;
+    uint32_t        sbat_size;
+    int32_t        *sbat_root;  /* big blocks holding the small block data */
+    uint32_t        sbat_root_size;
+    int             sbat_read;
+    struct ole2_vfs *vfs;
 }               ole2_header_t;
 
 typedef struct property_tag {
@@ -145,9 +155,11 @@ typedef struct ole2_list
 {
   uint32_t Size;
   ole2_list_node_t *Head;
+  ole2_list_node_t *Free;  /* popped nodes, reused by later pushes */
+  cli_arena_t *Arena;      /* optional; nodes are then released with the scan */
 } ole2_list_t;
 
-int ole2_list_init(ole2_list_t * list);
+int ole2_list_init(ole2_list_t * list, cli_arena_t * arena);
 int ole2_list_is_empty(ole2_list_t * list);
 uint32_t ole2_list_size(ole2_list_t * list);
 int ole2_list_push(ole2_list_t * list, uint32_t val);
@@ -155,9 +167,11 @@ uint32_t ole2_list_pop(ole2_list_t * list);
 int ole2_list_delete(ole2_list_t * list);
 
 int
-ole2_list_init(ole2_list_t * list)
+ole2_list_init(ole2_list_t * list, cli_arena_t * arena)
 {
     list->Head = NULL;
+    list->Free = NULL;
+    list->Arena = arena;
     list->Size = 0;
     return CL_SUCCESS;
 }
@@ -177,10 +191,14 @@ ole2_list_size(ole2_list_t * list)
 int
 ole2_list_push(ole2_list_t * list, uint32_t val)
 {
-    //check the cli - malloc ?
     ole2_list_node_t * new_node;
 
-    new_node = (ole2_list_node_t *) cli_malloc(sizeof(ole2_list_node_t));
+    if ((new_node = list->Free))
+        list->Free = new_node->Next;
+    else if (list->Arena)
+        new_node = (ole2_list_node_t *) cli_arena_malloc(list->Arena, sizeof(ole2_list_node_t));
+    else
+        new_node = (ole2_list_node_t *) cli_malloc(sizeof(ole2_list_node_t));
     if (!new_node) {
         cli_dbgmsg("OLE2: could not allocate new node for worklist!\n");
         return CL_EMEM;
@@ -206,7 +224,8 @@ ole2_list_pop(ole2_list_t * list)
     val = list->Head->Val;
     next = list->Head->Next;
 
-    free(list->Head);
+    list->Head->Next = list->Free;
+    list->Free = list->Head;
     list->Head = next;
 
     (list->Size)--;
@@ -216,8 +235,18 @@ ole2_list_pop(ole2_list_t * list)
 int
 ole2_list_delete(ole2_list_t * list)
 {
+    ole2_list_node_t *next;
+
     while (!ole2_list_is_empty(list))
         ole2_list_pop(list);
+    if (!list->Arena) {
+        while (list->Free) {
+            next = list->Free->Next;
+            free(list->Free);
+            list->Free = next;
+        }
+    }
+    list->Free = NULL;
     return CL_SUCCESS;
 }
 
@@ -229,6 +258,23 @@ ole2_list_delete(ole2_list_t * list)
 #pragma pack
 #endif
 
+/* A stream recorded for the VBA scanners */
+typedef struct ole2_vfs_entry {
+    char           *name;       /* NULL if the property name is unusable */
+    uint32_t        storage;    /* 0 is the root storage */
+    uint32_t        index;      /* order of discovery */
+    int32_t         start_block;
+    uint32_t        size;
+} ole2_vfs_entry_t;
+
+struct ole2_vfs {
+    ole2_header_t   hdr;
+    ole2_vfs_entry_t *entries;
+    uint32_t        count;
+    uint32_t        size;
+    uint32_t        storages;
+};
+
 static unsigned char magic_id[] = {0xd0, 0xcf, 0x11, 0xe0, 0xa1, 0xb1, 0x1a, 0xe1};
 
 
@@ -416,135 +462,193 @@ ole2_read_block(ole2_header_t * hdr, void *buff, unsigned int size, int32_t bloc
     return TRUE;
 }
 
-static          int32_t
-ole2_get_next_bat_block(ole2_header_t * hdr, int32_t current_block)
+/*
+ * Read the whole BAT, following the XBAT chain, into hdr->bat. Entries
+ * are looked up 128 to a BAT block, as the format has them for 512 byte
+ * blocks; unreadable BAT blocks leave their entries at -1.
+ */
+static int
+ole2_read_bat(ole2_header_t * hdr)
 {
-    int32_t         bat_array_index;
-    uint32_t        bat[128];
+    uint32_t        nblocks, nbat, i, j, xbat_index;
+    int32_t         bat_blockno;
+    uint32_t        xbat[128], bat[128];
+    off_t           hdr_len;
 
-    if (current_block < 0) {
-        return -1;
+    hdr_len = MAX(512, 1 << hdr->log2_big_block_size);
+    if (hdr->m_length <= hdr_len) {
+        hdr->bat_size = 0;
+        return TRUE;
     }
-    bat_array_index = current_block / 128;
-    if (bat_array_index > hdr->bat_count) {
-        cli_dbgmsg("bat_array index error\n");
-        return -10;
+    nblocks = ((hdr->m_length - hdr_len - 1) >> hdr->log2_big_block_size) + 1;
+    nbat = (nblocks + 127) / 128;
+
+    hdr->bat = (int32_t *)cli_malloc(nbat * 128 * sizeof(int32_t));
+    if (!hdr->bat) {
+        cli_errmsg("OLE2 [ole2_read_bat]: Unable to allocate memory for %u BAT entries\n", nbat * 128);
+        return FALSE;
     }
-    if (!ole2_read_block(hdr, &bat, 512,
-                 ole2_endian_convert_32(hdr->bat_array[bat_array_index]))) {
-        return -1;
+    memset(hdr->bat, 0xff, nbat * 128 * sizeof(int32_t));
+    hdr->bat_size = nbat * 128;
+
+    xbat_index = 0;
+    for (i = 0; i < nbat; i++) {
+        if (i < 109) {
+            if ((int32_t) i > hdr->bat_count) {
+                cli_dbgmsg("bat_array index error\n");
+                break;
+            }
+            bat_blockno = ole2_endian_convert_32(hdr->bat_array[i]);
+        } else {
+            /*
+             * NB:	The last entry in each XBAT points to the next XBAT block.
+             * This reduces the number of entries in each block by 1.
+             */
+            if (i == 109) {
+                if (!ole2_read_block(hdr, &xbat, 512, hdr->xbat_start))
+                    break;
+            } else if (xbat_index == 127) {
+                if (!ole2_read_block(hdr, &xbat, 512, ole2_endian_convert_32(xbat[127])))
+                    break;
+                xbat_index = 0;
+            }
+            bat_blockno = ole2_endian_convert_32(xbat[xbat_index++]);
+        }
+        if (!ole2_read_block(hdr, &bat, 512, bat_blockno))
+            continue;
+        for (j = 0; j < 128; j++)
+            hdr->bat[i * 128 + j] = ole2_endian_convert_32(bat[j]);
     }
-    return ole2_endian_convert_32(bat[current_block - (bat_array_index * 128)]);
+    return TRUE;
 }
 
 static          int32_t
-ole2_get_next_xbat_block(ole2_header_t * hdr, int32_t current_block)
+ole2_get_next_block_number(ole2_header_t * hdr, int32_t current_block)
 {
-    int32_t         xbat_index, xbat_block_index, bat_index, bat_blockno;
-    uint32_t        xbat[128], bat[128];
-
-    if (current_block < 0) {
+    if ((current_block < 0) || ((uint32_t) current_block >= hdr->bat_size)) {
         return -1;
     }
-    xbat_index = current_block / 128;
-
-    /*
-     * NB:	The last entry in each XBAT points to the next XBAT block.
-     * This reduces the number of entries in each block by 1.
-     */
-    xbat_block_index = (xbat_index - 109) / 127;
-    bat_blockno = (xbat_index - 109) % 127;
+    return hdr->bat[current_block];
+}
 
-    bat_index = current_block % 128;
+/* Collect the big blocks of a chain, stopping at its end or at a loop */
+static int32_t *
+ole2_read_chain(ole2_header_t * hdr, int32_t start_block, uint32_t * count)
+{
+    int32_t        *chain = NULL, *newchain, current_block;
+    uint32_t        size = 0;
+    bitset_t       *blk_bitset;
 
-    if (!ole2_read_block(hdr, &xbat, 512, hdr->xbat_start)) {
-        return -1;
+    *count = 0;
+    if (!(blk_bitset = cli_bitset_init()))
+        return NULL;
+    current_block = start_block;
+    while ((current_block >= 0) && ((uint32_t) current_block < hdr->bat_size)) {
+        /* Check we aren't in a loop */
+        if (cli_bitset_test(blk_bitset, (unsigned long)current_block)) {
+            cli_dbgmsg("OLE2: Block list loop detected\n");
+            break;
+        }
+        if (!cli_bitset_set(blk_bitset, (unsigned long)current_block)) {
+            break;
+        }
+        if (*count == size) {
+            size = size ? size * 2 : 16;
+            newchain = (int32_t *)cli_realloc(chain, size * sizeof(int32_t));
+            if (!newchain) {
+                free(chain);
+                chain = NULL;
+                *count = 0;
+                break;
+            }
+            chain = newchain;
+        }
+        chain[(*count)++] = current_block;
+        current_block = ole2_get_next_block_number(hdr, current_block);
     }
-    /* Follow the chain of XBAT blocks */
-    while (xbat_block_index > 0) {
-        if (!ole2_read_block(hdr, &xbat, 512,
-                             ole2_endian_convert_32(xbat[127]))) {
-            return -1;
+    cli_bitset_free(blk_bitset);
+    return chain;
+}
+
+/* Resolve the SBAT and the small block data chain on first use */
+static void
+ole2_read_sbat(ole2_header_t * hdr)
+{
+    int32_t        *chain;
+    uint32_t        count, i, j, sbat[128];
+
+    if (hdr->sbat_read)
+        return;
+    hdr->sbat_read = 1;
+
+    if ((chain = ole2_read_chain(hdr, hdr->sbat_start, &count))) {
+        hdr->sbat = (int32_t *)cli_malloc(count * 128 * sizeof(int32_t));
+        if (hdr->sbat) {
+            memset(hdr->sbat, 0xff, count * 128 * sizeof(int32_t));
+            hdr->sbat_size = count * 128;
+            for (i = 0; i < count; i++) {
+                if (!ole2_read_block(hdr, &sbat, 512, chain[i]))
+                    break;
+                for (j = 0; j < 128; j++)
+                    hdr->sbat[i * 128 + j] = ole2_endian_convert_32(sbat[j]);
+            }
         }
-        xbat_block_index--;
+        free(chain);
     }
 
-    if (!ole2_read_block(hdr, &bat, 512, ole2_endian_convert_32(xbat[bat_blockno]))) {
-        return -1;
+    if (hdr->sbat_root_start < 0) {
+        cli_dbgmsg("No root start block\n");
+        return;
     }
-    return ole2_endian_convert_32(bat[bat_index]);
+    hdr->sbat_root = ole2_read_chain(hdr, hdr->sbat_root_start, &hdr->sbat_root_size);
 }
 
 static          int32_t
-ole2_get_next_block_number(ole2_header_t * hdr, int32_t current_block)
+ole2_get_next_sbat_block(ole2_header_t * hdr, int32_t current_block)
 {
     if (current_block < 0) {
         return -1;
     }
-    if ((current_block / 128) > 108) {
-        return ole2_get_next_xbat_block(hdr, current_block);
-    } else {
-        return ole2_get_next_bat_block(hdr, current_block);
+    ole2_read_sbat(hdr);
+    if ((uint32_t) current_block >= hdr->sbat_size) {
+        return -1;
     }
+    return hdr->sbat[current_block];
 }
 
+/* Retrieve the big block number holding the given small block */
 static          int32_t
-ole2_get_next_sbat_block(ole2_header_t * hdr, int32_t current_block)
+ole2_get_sbat_data_blockno(ole2_header_t * hdr, int32_t sbat_index)
 {
-    int32_t         iter, current_bat_block;
-    uint32_t        sbat[128];
+    uint32_t        block_count;
 
-    if (current_block < 0) {
+    if (sbat_index < 0) {
         return -1;
     }
-    current_bat_block = hdr->sbat_start;
-    iter = current_block / 128;
-    while (iter > 0) {
-        current_bat_block = ole2_get_next_block_number(hdr, current_bat_block);
-        iter--;
-    }
-    if (!ole2_read_block(hdr, &sbat, 512, current_bat_block)) {
+    ole2_read_sbat(hdr);
+    block_count = sbat_index / (1 << (hdr->log2_big_block_size - hdr->log2_small_block_size));
+    if (block_count >= hdr->sbat_root_size) {
         return -1;
     }
-    return ole2_endian_convert_32(sbat[current_block % 128]);
+    return hdr->sbat_root[block_count];
 }
 
 /* Retrieve the block containing the data for the given sbat index */
 static          int32_t
 ole2_get_sbat_data_block(ole2_header_t * hdr, void *buff, int32_t sbat_index)
 {
-    int32_t         block_count, current_block;
-
-    if (sbat_index < 0) {
-        return FALSE;
-    }
-    if (hdr->sbat_root_start < 0) {
-        cli_dbgmsg("No root start block\n");
-        return FALSE;
-    }
-    block_count = sbat_index / (1 << (hdr->log2_big_block_size - hdr->log2_small_block_size));
-    current_block = hdr->sbat_root_start;
-    while (block_count > 0) {
-        current_block = ole2_get_next_block_number(hdr, current_block);
-        block_count--;
-    }
-
-    /*
-     * current_block now contains the block number of the sbat array
-     * containing the entry for the required small block
-     */
-
-    return (ole2_read_block(hdr, buff, 1 << hdr->log2_big_block_size, current_block));
+    return (ole2_read_block(hdr, buff, 1 << hdr->log2_big_block_size,
+                            ole2_get_sbat_data_blockno(hdr, sbat_index)));
 }
 
 static int
-ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index,
-                        int (*handler) (ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx * ctx),
+ole2_walk_property_tree(ole2_header_t * hdr, uint32_t storage, int32_t prop_index,
+                        int (*handler) (ole2_header_t * hdr, property_t * prop, uint32_t storage, cli_ctx * ctx),
                         unsigned int rec_level, unsigned int *file_count, cli_ctx * ctx, unsigned long *scansize)
 {
     property_t      prop_block[4];
     int32_t         idx, current_block, i, curindex;
-    char            *dirname;
+    uint32_t        substorage;
     ole2_list_t     node_list;
     int             ret, func_ret;
 #if HAVE_JSON
@@ -554,7 +658,7 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
 
     ole2_listmsg("ole2_walk_property_tree() called\n");
     func_ret = CL_SUCCESS;
-    ole2_list_init(&node_list);
+    ole2_list_init(&node_list, ctx ? ctx->arena : NULL);
 
     ole2_listmsg("rec_level: %d\n", rec_level);
     ole2_listmsg("file_count: %d\n", *file_count);
@@ -619,7 +723,7 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
         prop_block[idx].size = ole2_endian_convert_32(prop_block[idx].size);
 
         ole2_listmsg("printing ole2 property\n");
-        if (dir)
+        if (hdr->vfs)
             print_ole2_property(&prop_block[idx]);
 
         ole2_listmsg("checking bitset\n");
@@ -648,7 +752,7 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
             }
             hdr->sbat_root_start = prop_block[idx].start_block;
             if ((int)(prop_block[idx].child) != -1) {
-                ret = ole2_walk_property_tree(hdr, dir, prop_block[idx].child, handler, rec_level + 1, file_count, ctx, scansize);
+                ret = ole2_walk_property_tree(hdr, storage, prop_block[idx].child, handler, rec_level + 1, file_count, ctx, scansize);
                 if (ret != CL_SUCCESS) {
                     if ((ctx->options & CL_SCAN_ALLMATCHES) && (ret == CL_VIRUS)) {
                         func_ret = ret;
@@ -683,7 +787,7 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
                 (*file_count)++;
                 *scansize -= prop_block[idx].size;
                 ole2_listmsg("running file handler\n");
-                ret = handler(hdr, &prop_block[idx], dir, ctx);
+                ret = handler(hdr, &prop_block[idx], storage, ctx);
                 if (ret != CL_SUCCESS) {
                     if ((ctx->options & CL_SCAN_ALLMATCHES) && (ret == CL_VIRUS)) {
                         func_ret = ret;
@@ -698,7 +802,7 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
                 cli_dbgmsg("OLE2: filesize exceeded\n");
             }
             if ((int)(prop_block[idx].child) != -1) {
-                ret = ole2_walk_property_tree(hdr, dir, prop_block[idx].child, handler, rec_level, file_count, ctx, scansize);
+                ret = ole2_walk_property_tree(hdr, storage, prop_block[idx].child, handler, rec_level, file_count, ctx, scansize);
                 if (ret != CL_SUCCESS) {
                     if ((ctx->options & CL_SCAN_ALLMATCHES) && (ret == CL_VIRUS)) {
                         func_ret = ret;
@@ -724,7 +828,8 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
             break;
         case 1:                /* Directory */
             ole2_listmsg("directory node\n");
-            if (dir) {
+            substorage = storage;
+            if (hdr->vfs) {
 #if HAVE_JSON
                 if ((ctx->options & CL_SCAN_FILE_PROPERTIES) && (ctx->wrkproperty != NULL)) {
                     if (!json_object_object_get_ex(ctx->wrkproperty, "DigitalSignatures", NULL)) {
@@ -738,24 +843,11 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
                     }
                 }
 #endif
-                dirname = (char *)cli_malloc(strlen(dir) + 8);
-                if (!dirname) {
-		    ole2_listmsg("OLE2: malloc failed for dirname\n");
-                    ole2_list_delete(&node_list);
-                    return CL_EMEM;
-                }
-                snprintf(dirname, strlen(dir) + 8, "%s" PATHSEP "%.6d", dir, curindex);
-                if (mkdir(dirname, 0700) != 0) {
-		    ole2_listmsg("OLE2: mkdir failed for directory %s\n", dirname);
-                    free(dirname);
-                    ole2_list_delete(&node_list);
-                    return CL_BREAK;
-                }
-                cli_dbgmsg("OLE2 dir entry: %s\n", dirname);
-            } else
-                dirname = NULL;
+                substorage = hdr->vfs->storages++;
+                cli_dbgmsg("OLE2 dir entry: storage %u (%d)\n", substorage, curindex);
+            }
             if ((int)(prop_block[idx].child) != -1) {
-                ret = ole2_walk_property_tree(hdr, dirname, prop_block[idx].child, handler, rec_level + 1, file_count, ctx, scansize);
+                ret = ole2_walk_property_tree(hdr, substorage, prop_block[idx].child, handler, rec_level + 1, file_count, ctx, scansize);
                 if (ret != CL_SUCCESS) {
                     if ((ctx->options & CL_SCAN_ALLMATCHES) && (ret == CL_VIRUS)) {
                         func_ret = ret;
@@ -778,8 +870,6 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
 		    return ret;
 		}
             }
-            if (dirname)
-                free(dirname);
             break;
         default:
             cli_dbgmsg("ERROR: unknown OLE2 entry type: %d\n", prop_block[idx].type);
@@ -791,130 +881,147 @@ ole2_walk_property_tree(ole2_header_t * hdr, const char *dir, int32_t prop_index
     return func_ret;
 }
 
-/* Write file Handler - write the contents of the entry to a file */
-static int
-handler_writefile(ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx * ctx)
+/*
+ * Map the stream starting at the given block; NULL if it has no data.
+ * The block chain is resolved into runs of the compound file and the stream
+ * is read in place through an extent list over them.
+ */
+static fmap_t  *
+ole2_stream_map(ole2_header_t * hdr, int32_t start_block, uint32_t size)
 {
-    unsigned char  *buff;
-    int32_t         current_block, ofd, len, offset;
-    char           *name, newname[1024];
+    fmap_extents_t *stream;
+    fmap_t         *map;
     bitset_t       *blk_bitset;
-    char           *hash;
-    uint32_t        cnt;
-
-    UNUSEDPARAM(ctx);
-
-    if (prop->type != 2) {
-        /* Not a file */
-        return CL_SUCCESS;
-    }
-    if (prop->name_size > 64) {
-        cli_dbgmsg("OLE2 [handler_writefile]: property name too long: %d\n", prop->name_size);
-        return CL_SUCCESS;
-    }
-    name = get_property_name2(prop->name, prop->name_size);
-    if (name)
-        cnt = uniq_add(hdr->U, name, strlen(name), &hash);
-    else
-        cnt = uniq_add(hdr->U, NULL, 0, &hash);
-    snprintf(newname, sizeof(newname), "%s" PATHSEP "%s_%u", dir, hash, cnt);
-    newname[sizeof(newname) - 1] = '\0';
-    cli_dbgmsg("OLE2 [handler_writefile]: Dumping '%s' to '%s'\n", name ? name : "<empty>", newname);
-    if (name)
-        free(name);
-
-    ofd = open(newname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, S_IRWXU);
-    if (ofd < 0) {
-        cli_errmsg("OLE2 [handler_writefile]: failed to create file: %s\n", newname);
-        return CL_SUCCESS;
-    }
-    current_block = prop->start_block;
-    len = prop->size;
+    int32_t         current_block, blockno;
+    uint32_t        len, block_len;
+    off_t           offset, hdr_len;
+    int             small;
 
-    buff = (unsigned char *)cli_malloc(1 << hdr->log2_big_block_size);
-    if (!buff) {
-        cli_errmsg("OLE2 [handler_writefile]: Unable to allocate memory for buff: %u\n", 1 << hdr->log2_big_block_size);
-        close(ofd);
-        return CL_BREAK;
+    stream = fmap_extents_new(hdr->map);
+    if (!stream) {
+        return NULL;
     }
     blk_bitset = cli_bitset_init();
     if (!blk_bitset) {
-        cli_errmsg("OLE2 [handler_writefile]: init bitset failed\n");
-        close(ofd);
-        free(buff);
-        return CL_BREAK;
+        cli_errmsg("OLE2 [ole2_stream_map]: init bitset failed\n");
+        fmap_extents_free(stream);
+        return NULL;
     }
+
+    hdr_len = MAX(512, 1 << hdr->log2_big_block_size);
+    small = size < (int64_t) hdr->sbat_cutoff;
+    block_len = 1 << (small ? hdr->log2_small_block_size : hdr->log2_big_block_size);
+    current_block = start_block;
+    len = size;
     while ((current_block >= 0) && (len > 0)) {
         if (current_block > (int32_t) hdr->max_block_no) {
-            cli_dbgmsg("OLE2 [handler_writefile]: Max block number for file size exceeded: %d\n", current_block);
-            close(ofd);
-            free(buff);
-            cli_bitset_free(blk_bitset);
-            return CL_SUCCESS;
+            cli_dbgmsg("OLE2 [ole2_stream_map]: Max block number for file size exceeded: %d\n", current_block);
+            break;
         }
         /* Check we aren't in a loop */
         if (cli_bitset_test(blk_bitset, (unsigned long)current_block)) {
             /* Loop in block list */
-            cli_dbgmsg("OLE2 [handler_writefile]: Block list loop detected\n");
-            close(ofd);
-            free(buff);
-            cli_bitset_free(blk_bitset);
-            return CL_BREAK;
+            cli_dbgmsg("OLE2 [ole2_stream_map]: Block list loop detected\n");
+            break;
         }
         if (!cli_bitset_set(blk_bitset, (unsigned long)current_block)) {
-            close(ofd);
-            free(buff);
-            cli_bitset_free(blk_bitset);
-            return CL_BREAK;
+            break;
         }
-        if (prop->size < (int64_t) hdr->sbat_cutoff) {
+        if (small) {
             /* Small block file */
-            if (!ole2_get_sbat_data_block(hdr, buff, current_block)) {
-                cli_dbgmsg("OLE2 [handler_writefile]: ole2_get_sbat_data_block failed\n");
-                close(ofd);
-                free(buff);
-                cli_bitset_free(blk_bitset);
-                return CL_SUCCESS;
+            if ((blockno = ole2_get_sbat_data_blockno(hdr, current_block)) < 0) {
+                cli_dbgmsg("OLE2 [ole2_stream_map]: ole2_get_sbat_data_blockno failed\n");
+                break;
             }
-            /* buff now contains the block with N small blocks in it */
-            offset = (1 << hdr->log2_small_block_size) * (current_block % (1 << (hdr->log2_big_block_size - hdr->log2_small_block_size)));
-
-            if (cli_writen(ofd, &buff[offset], MIN(len, 1 << hdr->log2_small_block_size)) != MIN(len, 1 << hdr->log2_small_block_size)) {
-                close(ofd);
-                free(buff);
-                cli_bitset_free(blk_bitset);
-                return CL_BREAK;
+            offset = ((off_t)blockno << hdr->log2_big_block_size) + hdr_len;
+            if (offset >= hdr->m_length) {
+                break;
             }
-            len -= MIN(len, 1 << hdr->log2_small_block_size);
+            offset += (off_t)block_len * (current_block % (1 << (hdr->log2_big_block_size - hdr->log2_small_block_size)));
             current_block = ole2_get_next_sbat_block(hdr, current_block);
         } else {
             /* Big block file */
-            if (!ole2_read_block(hdr, buff, 1 << hdr->log2_big_block_size, current_block)) {
-                close(ofd);
-                free(buff);
-                cli_bitset_free(blk_bitset);
-                return CL_SUCCESS;
-            }
-            if (cli_writen(ofd, buff, MIN(len, (1 << hdr->log2_big_block_size))) !=
-                    MIN(len, (1 << hdr->log2_big_block_size))) {
-                close(ofd);
-                free(buff);
-                cli_bitset_free(blk_bitset);
-                return CL_BREAK;
+            offset = ((off_t)current_block << hdr->log2_big_block_size) + hdr_len;
+            if (offset >= hdr->m_length) {
+                break;
             }
             current_block = ole2_get_next_block_number(hdr, current_block);
-            len -= MIN(len, (1 << hdr->log2_big_block_size));
         }
+        if (fmap_extents_add(stream, offset, MIN(len, block_len)) != CL_SUCCESS) {
+            fmap_extents_free(stream);
+            cli_bitset_free(blk_bitset);
+            return NULL;
+        }
+        len -= MIN(len, block_len);
     }
-    close(ofd);
-    free(buff);
     cli_bitset_free(blk_bitset);
+
+    if (!(map = fmap_extents_map(stream))) {
+        return NULL;
+    }
+    cli_dbgmsg("OLE2 [ole2_stream_map]: mapped %lu bytes\n", (unsigned long)map->len);
+    return map;
+}
+
+/* VFS Handler - record the entry so the VBA scanners can map it by name */
+static int
+handler_vfs(ole2_header_t * hdr, property_t * prop, uint32_t storage, cli_ctx * ctx)
+{
+    struct ole2_vfs *vfs = hdr->vfs;
+    ole2_vfs_entry_t *entry;
+
+    UNUSEDPARAM(ctx);
+
+    if (prop->type != 2) {
+        /* Not a file */
+        return CL_SUCCESS;
+    }
+    if (prop->name_size > 64) {
+        cli_dbgmsg("OLE2 [handler_vfs]: property name too long: %d\n", prop->name_size);
+        return CL_SUCCESS;
+    }
+    if (vfs->count == vfs->size) {
+        uint32_t        size = vfs->size ? vfs->size * 2 : 16;
+
+        entry = (ole2_vfs_entry_t *)cli_realloc(vfs->entries, size * sizeof(ole2_vfs_entry_t));
+        if (!entry) {
+            cli_errmsg("OLE2 [handler_vfs]: Unable to allocate memory for entries\n");
+            return CL_EMEM;
+        }
+        vfs->entries = entry;
+        vfs->size = size;
+    }
+    entry = &vfs->entries[vfs->count];
+    entry->name = get_property_name2(prop->name, prop->name_size);
+    entry->storage = storage;
+    entry->index = vfs->count++;
+    entry->start_block = prop->start_block;
+    entry->size = prop->size;
+    cli_dbgmsg("OLE2 [handler_vfs]: '%s' in storage %u\n", entry->name ? entry->name : "<empty>", storage);
     return CL_SUCCESS;
 }
 
+static int
+ole2_vfs_cmp(const void *a, const void *b)
+{
+    const ole2_vfs_entry_t *x = (const ole2_vfs_entry_t *)a;
+    const ole2_vfs_entry_t *y = (const ole2_vfs_entry_t *)b;
+    int             cmp;
+
+    if (x->storage != y->storage)
+        return x->storage < y->storage ? -1 : 1;
+    if (!x->name || !y->name)
+        cmp = (x->name != NULL) - (y->name != NULL);
+    else
+        cmp = strcmp(x->name, y->name);
+    if (cmp)
+        return cmp;
+    return x->index < y->index ? -1 : (x->index > y->index);
+}
+
 /* enum file Handler - checks for VBA presence */
 static int
-handler_enum(ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx * ctx)
+handler_enum(ole2_header_t * hdr, property_t * prop, uint32_t storage, cli_ctx * ctx)
 {
     char           *name = NULL;
     unsigned char  *hwp_check;
@@ -950,7 +1057,7 @@ handler_enum(ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx *
 #else
     UNUSEDPARAM(ctx);
 #endif
-    UNUSEDPARAM(dir);
+    UNUSEDPARAM(storage);
 
     if (!hdr->has_vba) {
         if (!name)
@@ -1036,26 +1143,16 @@ handler_enum(ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx *
 }
 
 static int
-likely_mso_stream(int fd)
+likely_mso_stream(fmap_t *map)
 {
-    off_t fsize;
-    unsigned char check[2];
-
-    fsize = lseek(fd, 0, SEEK_END);
-    if (fsize == -1) {
-        cli_dbgmsg("likely_mso_stream: call to lseek() failed\n");
-        return 0;
-    } else if (fsize < 6) {
-        return 0;
-    }
+    const unsigned char *check;
 
-    if (lseek(fd, 4, SEEK_SET) == -1) {
-        cli_dbgmsg("likely_mso_stream: call to lseek() failed\n");
+    if (map->len < 6) {
         return 0;
     }
 
-    if (cli_readn(fd, check, 2) != 2) {
-        cli_dbgmsg("likely_mso_stream: reading from fd failed\n");
+    if (!(check = fmap_need_off_once(map, 4, 2))) {
+        cli_dbgmsg("likely_mso_stream: reading from map failed\n");
         return 0;
     }
 
@@ -1066,54 +1163,30 @@ likely_mso_stream(int fd)
 }
 
 static int
-scan_mso_stream(int fd, cli_ctx *ctx)
+scan_mso_stream(fmap_t *input, cli_ctx *ctx)
 {
     int zret, ofd, ret = CL_SUCCESS;
-    fmap_t *input;
     off_t off_in = 0;
     size_t count, outsize = 0;
-    z_stream zstrm;
+    struct cli_zstream zstrm;
     char *tmpname;
     uint32_t prefix;
     unsigned char inbuf[FILEBUFF], outbuf[FILEBUFF];
 
-    /* fmap the input file for easier manipulation */
-    if (fd < 0) {
-        cli_dbgmsg("scan_mso_stream: Invalid file descriptor argument\n");
-        return CL_ENULLARG;
-    } else {
-        STATBUF statbuf;
-
-        if (FSTAT(fd, &statbuf) == -1) {
-            cli_dbgmsg("scan_mso_stream: Can't stat file descriptor\n");
-            return CL_ESTAT;
-        }
-
-        input = fmap(fd, 0, statbuf.st_size);
-        if (!input) {
-            cli_dbgmsg("scan_mso_stream: Failed to get fmap for input stream\n");
-            return CL_EMAP;
-        }
-    }
-
     /* reserve tempfile for output and scanning */
     if ((ret = cli_gentempfd(ctx->engine->tmpdir, &tmpname, &ofd)) != CL_SUCCESS) {
         cli_errmsg("scan_mso_stream: Can't generate temporary file\n");
-        funmap(input);
         return ret;
     }
 
     /* initialize zlib inflation stream */
     memset(&zstrm, 0, sizeof(zstrm));
-    zstrm.zalloc = Z_NULL;
-    zstrm.zfree = Z_NULL;
-    zstrm.opaque = Z_NULL;
     zstrm.next_in = inbuf;
     zstrm.next_out = outbuf;
     zstrm.avail_in = 0;
     zstrm.avail_out = FILEBUFF;
 
-    zret = inflateInit(&zstrm);
+    zret = cli_inflate_init(&zstrm, MAX_WBITS, ctx);
     if (zret != Z_OK) {
         cli_dbgmsg("scan_mso_stream: Can't initialize zlib inflation stream\n");
         ret = CL_EUNPACK;
@@ -1149,7 +1222,7 @@ scan_mso_stream(int fd, cli_ctx *ctx)
             zstrm.avail_in = ret;
             off_in += ret;
         }
-        zret = inflate(&zstrm, Z_SYNC_FLUSH);
+        zret = cli_inflate(&zstrm, Z_SYNC_FLUSH);
         count = FILEBUFF - zstrm.avail_out;
         if (count) {
             if (cli_checklimits("MSO", ctx, outsize + count, 0, 0) != CL_SUCCESS)
@@ -1190,7 +1263,7 @@ scan_mso_stream(int fd, cli_ctx *ctx)
 
     /* clean-up */
  mso_end:
-    zret = inflateEnd(&zstrm);
+    zret = cli_inflate_end(&zstrm);
     if (zret != Z_OK)
         ret = CL_EUNPACK;
     close(ofd);
@@ -1198,20 +1271,17 @@ scan_mso_stream(int fd, cli_ctx *ctx)
         if (cli_unlink(tmpname))
             ret = CL_EUNLINK;
     free(tmpname);
-    funmap(input);
     return ret;
 }
 
 static int
-handler_otf(ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx * ctx)
+handler_otf(ole2_header_t * hdr, property_t * prop, uint32_t storage, cli_ctx * ctx)
 {
-    char           *tempfile, *name = NULL;
-    unsigned char  *buff;
-    int32_t         current_block, len, offset;
-    int             ofd, is_mso, ret;
-    bitset_t       *blk_bitset;
+    char           *name = NULL;
+    fmap_t         *map;
+    int             ret;
 
-    UNUSEDPARAM(dir);
+    UNUSEDPARAM(storage);
 
     if (prop->type != 2) {
         /* Not a file */
@@ -1219,122 +1289,14 @@ handler_otf(ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx * c
     }
     print_ole2_property(prop);
 
-    if (!(tempfile = cli_gentemp(ctx ? ctx->engine->tmpdir : NULL)))
-        return CL_EMEM;
-
-    if ((ofd = open(tempfile, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, S_IRWXU)) < 0) {
-        cli_dbgmsg("OLE2: Can't create file %s\n", tempfile);
-        free(tempfile);
-        return CL_ECREAT;
+    if (!(map = ole2_stream_map(hdr, prop->start_block, prop->size))) {
+        return CL_SUCCESS;
     }
-    current_block = prop->start_block;
-    len = prop->size;
 
     if (cli_debug_flag) {
         if (!name)
             name = get_property_name2(prop->name, prop->name_size);
-        cli_dbgmsg("OLE2 [handler_otf]: Dumping '%s' to '%s'\n", name, tempfile);
-    }
-
-    buff = (unsigned char *)cli_malloc(1 << hdr->log2_big_block_size);
-    if (!buff) {
-        close(ofd);
-        if (name)
-            free(name);
-        cli_unlink(tempfile);
-        free(tempfile);
-        return CL_EMEM;
-    }
-    blk_bitset = cli_bitset_init();
-
-    if (!blk_bitset) {
-        cli_errmsg("OLE2: OTF handler init bitset failed\n");
-        free(buff);
-        close(ofd);
-        if (name)
-            free(name);
-        if (cli_unlink(tempfile)) {
-            free(tempfile);
-            return CL_EUNLINK;
-        }
-        free(tempfile);
-        return CL_BREAK;
-    }
-    while ((current_block >= 0) && (len > 0)) {
-        if (current_block > (int32_t) hdr->max_block_no) {
-            cli_dbgmsg("OLE2: Max block number for file size exceeded: %d\n", current_block);
-            break;
-        }
-        /* Check we aren't in a loop */
-        if (cli_bitset_test(blk_bitset, (unsigned long)current_block)) {
-            /* Loop in block list */
-            cli_dbgmsg("OLE2: Block list loop detected\n");
-            break;
-        }
-        if (!cli_bitset_set(blk_bitset, (unsigned long)current_block)) {
-            break;
-        }
-        if (prop->size < (int64_t) hdr->sbat_cutoff) {
-            /* Small block file */
-            if (!ole2_get_sbat_data_block(hdr, buff, current_block)) {
-                cli_dbgmsg("ole2_get_sbat_data_block failed\n");
-                break;
-            }
-            /* buff now contains the block with N small blocks in it */
-            offset = (1 << hdr->log2_small_block_size) * (current_block % (1 << (hdr->log2_big_block_size - hdr->log2_small_block_size)));
-            if (cli_writen(ofd, &buff[offset], MIN(len, 1 << hdr->log2_small_block_size)) != MIN(len, 1 << hdr->log2_small_block_size)) {
-                close(ofd);
-                if (name)
-                    free(name);
-                free(buff);
-                cli_bitset_free(blk_bitset);
-                if (cli_unlink(tempfile)) {
-                    free(tempfile);
-                    return CL_EUNLINK;
-                }
-                free(tempfile);
-                return CL_BREAK;
-            }
-            len -= MIN(len, 1 << hdr->log2_small_block_size);
-            current_block = ole2_get_next_sbat_block(hdr, current_block);
-        } else {
-            /* Big block file */
-            if (!ole2_read_block(hdr, buff, 1 << hdr->log2_big_block_size, current_block)) {
-                break;
-            }
-            if (cli_writen(ofd, buff, MIN(len, (1 << hdr->log2_big_block_size))) !=
-                    MIN(len, (1 << hdr->log2_big_block_size))) {
-                close(ofd);
-                if (name)
-                    free(name);
-                free(buff);
-                cli_bitset_free(blk_bitset);
-                if (cli_unlink(tempfile)) {
-                    free(tempfile);
-                    return CL_EUNLINK;
-                }
-                free(tempfile);
-                return CL_EWRITE;
-            }
-            current_block = ole2_get_next_block_number(hdr, current_block);
-            len -= MIN(len, (1 << hdr->log2_big_block_size));
-        }
-    }
-
-    /* defragmenting of ole2 stream complete */
-
-    is_mso = likely_mso_stream(ofd);
-    if (lseek(ofd, 0, SEEK_SET) == -1) {
-        close(ofd);
-        if (name)
-            free(name);
-        if (ctx && !(ctx->engine->keeptmp))
-            cli_unlink(tempfile);
-
-        free(tempfile);
-        free(buff);
-        cli_bitset_free(blk_bitset);
-        return CL_ESEEK;
+        cli_dbgmsg("OLE2 [handler_otf]: Scanning '%s' in place\n", name);
     }
 
 #if HAVE_JSON
@@ -1346,30 +1308,18 @@ handler_otf(ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx * c
             if (!strncmp(name, "_5_summaryinformation", 21)) {
                 cli_dbgmsg("OLE2: detected a '_5_summaryinformation' stream\n");
                 /* JSONOLE2 - what to do if something breaks? */
-                if (cli_ole2_summary_json(ctx, ofd, 0) == CL_ETIMEOUT) {
+                if (cli_ole2_summary_json(ctx, map, 0) == CL_ETIMEOUT) {
                     free(name);
-                    close(ofd);
-                    if (ctx && !(ctx->engine->keeptmp))
-                        cli_unlink(tempfile);
-
-                    free(tempfile);
-                    free(buff);
-                    cli_bitset_free(blk_bitset);
+                    funmap(map);
                     return CL_ETIMEOUT;
                 }
             }
             if (!strncmp(name, "_5_documentsummaryinformation", 29)) {
                 cli_dbgmsg("OLE2: detected a '_5_documentsummaryinformation' stream\n");
                 /* JSONOLE2 - what to do if something breaks? */
-                if (cli_ole2_summary_json(ctx, ofd, 1) == CL_ETIMEOUT) {
+                if (cli_ole2_summary_json(ctx, map, 1) == CL_ETIMEOUT) {
                     free(name);
-                    close(ofd);
-                    if (ctx && !(ctx->engine->keeptmp))
-                        cli_unlink(tempfile);
-
-                    free(tempfile);
-                    free(buff);
-                    cli_bitset_free(blk_bitset);
+                    funmap(map);
                     return CL_ETIMEOUT;
                 }
             }
@@ -1380,28 +1330,17 @@ handler_otf(ole2_header_t * hdr, property_t * prop, const char *dir, cli_ctx * c
     if (hdr->is_hwp) {
         if (!name)
             name = get_property_name2(prop->name, prop->name_size);
-        ret = cli_scanhwp5_stream(ctx, hdr->is_hwp, name, ofd);
-    } else if (is_mso < 0) {
-        ret = CL_ESEEK;
-    } else if (is_mso) {
+        ret = cli_scanhwp5_stream(ctx, hdr->is_hwp, name, map);
+    } else if (likely_mso_stream(map)) {
         /* MSO Stream Scan */
-        ret = scan_mso_stream(ofd, ctx);
+        ret = scan_mso_stream(map, ctx);
     } else {
         /* Normal File Scan */
-        ret = cli_magic_scandesc(ofd, ctx);
+        ret = cli_map_scan(map, 0, map->len, ctx, CL_TYPE_ANY);
     }
     if (name)
         free(name);
-    close(ofd);
-    free(buff);
-    cli_bitset_free(blk_bitset);
-    if (ctx && !ctx->engine->keeptmp) {
-        if (cli_unlink(tempfile)) {
-            free(tempfile);
-            return CL_EUNLINK;
-        }
-    }
-    free(tempfile);
+    funmap(map);
     return ret == CL_VIRUS ? CL_VIRUS : CL_SUCCESS;
 
 }
@@ -1470,9 +1409,10 @@ ole2_read_header(int fd, ole2_header_t * hdr)
 #endif
 
 int
-cli_ole2_extract(const char *dirname, cli_ctx * ctx, struct uniq **vba)
+cli_ole2_extract(cli_ctx * ctx, struct ole2_vfs **vba)
 {
     ole2_header_t   hdr;
+    struct ole2_vfs *vfs;
     int             ret = CL_CLEAN;
     size_t hdr_size;
     unsigned int    file_count = 0;
@@ -1483,8 +1423,7 @@ cli_ole2_extract(const char *dirname, cli_ctx * ctx, struct uniq **vba)
     if (!ctx)
         return CL_ENULLARG;
 
-    hdr.is_hwp = NULL;
-    hdr.bitset = NULL;
+    memset(&hdr, 0, sizeof(hdr));
     if (ctx->engine->maxscansize) {
         if (ctx->engine->maxscansize > ctx->scansize)
             scansize = ctx->engine->maxscansize - ctx->scansize;
@@ -1496,9 +1435,7 @@ cli_ole2_extract(const char *dirname, cli_ctx * ctx, struct uniq **vba)
     scansize2 = scansize;
 
     /* size of header - size of other values in struct */
-    hdr_size = sizeof(struct ole2_header_tag) - sizeof(int32_t) - sizeof(uint32_t) -
-        sizeof(off_t) - sizeof(bitset_t *) -
-        sizeof(struct uniq *) - sizeof(fmap_t *) - sizeof(int) - sizeof(hwp5_header_t *);
+    hdr_size = offsetof(struct ole2_header_tag, sbat_root_start);
 
     if ((size_t)((*ctx->fmap)->len) < (size_t)(hdr_size)) {
         return CL_CLEAN;
@@ -1561,9 +1498,14 @@ cli_ole2_extract(const char *dirname, cli_ctx * ctx, struct uniq **vba)
     print_ole2_header(&hdr);
     cli_dbgmsg("Max block number: %lu\n", (unsigned long int)hdr.max_block_no);
 
+    if (!ole2_read_bat(&hdr)) {
+        ret = CL_EMEM;
+        goto abort;
+    }
+
     /* PASS 1 : Count files and check for VBA */
     hdr.has_vba = 0;
-    ret = ole2_walk_property_tree(&hdr, NULL, 0, handler_enum, 0, &file_count, ctx, &scansize);
+    ret = ole2_walk_property_tree(&hdr, 0, 0, handler_enum, 0, &file_count, ctx, &scansize);
     cli_bitset_free(hdr.bitset);
     hdr.bitset = NULL;
     if (!file_count || !(hdr.bitset = cli_bitset_init()))
@@ -1584,20 +1526,31 @@ cli_ole2_extract(const char *dirname, cli_ctx * ctx, struct uniq **vba)
     if (hdr.has_vba) {
         /* PASS 2/A : VBA scan */
         cli_dbgmsg("OLE2: VBA project found\n");
-        if (!(hdr.U = uniq_init(file_count))) {
-            cli_dbgmsg("OLE2: uniq_init() failed\n");
+        if (!(vfs = cli_calloc(1, sizeof(struct ole2_vfs)))) {
+            cli_dbgmsg("OLE2: Unable to allocate memory for VFS\n");
             ret = CL_EMEM;
             goto abort;
         }
+        /* the VFS takes over the block tables and the map */
+        vfs->hdr = hdr;
+        vfs->hdr.vfs = vfs;
+        vfs->hdr.is_hwp = NULL;
+        vfs->storages = 1;
+        hdr.bitset = NULL;
+        hdr.bat = hdr.sbat = hdr.sbat_root = NULL;
         file_count = 0;
-        ole2_walk_property_tree(&hdr, dirname, 0, handler_writefile, 0, &file_count, ctx, &scansize2);
+        ole2_walk_property_tree(&vfs->hdr, 0, 0, handler_vfs, 0, &file_count, ctx, &scansize2);
+        cli_bitset_free(vfs->hdr.bitset);
+        vfs->hdr.bitset = NULL;
+        if (vfs->count)
+            cli_qsort(vfs->entries, vfs->count, sizeof(ole2_vfs_entry_t), ole2_vfs_cmp);
         ret = CL_CLEAN;
-        *vba = hdr.U;
+        *vba = vfs;
     } else {
         cli_dbgmsg("OLE2: no VBA projects found\n");
         /* PASS 2/B : OTF scan */
         file_count = 0;
-        ret = ole2_walk_property_tree(&hdr, NULL, 0, handler_otf, 0, &file_count, ctx, &scansize2);
+        ret = ole2_walk_property_tree(&hdr, 0, 0, handler_otf, 0, &file_count, ctx, &scansize2);
     }
 
 abort:
@@ -1607,5 +1560,103 @@ abort:
     if (hdr.is_hwp)
         free(hdr.is_hwp);
 
+    free(hdr.bat);
+    free(hdr.sbat);
+    free(hdr.sbat_root);
+
     return ret == CL_BREAK ? CL_CLEAN : ret;
 }
+
+/* First entry named name in storage, entries are sorted by storage then name */
+static ole2_vfs_entry_t *
+ole2_vfs_find(struct ole2_vfs *vfs, uint32_t storage, const char *name)
+{
+    ole2_vfs_entry_t key, *entry;
+    uint32_t        lo = 0, hi = vfs->count, mid;
+
+    key.storage = storage;
+    key.name = (char *)name;
+    key.index = 0;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (ole2_vfs_cmp(&vfs->entries[mid], &key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == vfs->count)
+        return NULL;
+    entry = &vfs->entries[lo];
+    if (entry->storage != storage || !entry->name || strcmp(entry->name, name))
+        return NULL;
+    return entry;
+}
+
+uint32_t
+cli_ole2_vfs_storages(struct ole2_vfs *vfs)
+{
+    return vfs ? vfs->storages : 0;
+}
+
+uint32_t
+cli_ole2_vfs_count(struct ole2_vfs *vfs, uint32_t storage, const char *name)
+{
+    ole2_vfs_entry_t *entry, *end;
+
+    if (!vfs || !name || !(entry = ole2_vfs_find(vfs, storage, name)))
+        return 0;
+    end = entry;
+    while (end < &vfs->entries[vfs->count] && end->storage == storage &&
+           end->name && !strcmp(end->name, name))
+        end++;
+    return end - entry;
+}
+
+fmap_t *
+cli_ole2_vfs_map(struct ole2_vfs *vfs, uint32_t storage, const char *name, uint32_t which)
+{
+    ole2_vfs_entry_t *entry;
+
+    if (which >= cli_ole2_vfs_count(vfs, storage, name))
+        return NULL;
+    entry = ole2_vfs_find(vfs, storage, name) + which;
+    return ole2_stream_map(&vfs->hdr, entry->start_block, entry->size);
+}
+
+int
+cli_ole2_vfs_scan(struct ole2_vfs *vfs, cli_ctx * ctx)
+{
+    fmap_t         *map;
+    uint32_t        i;
+    unsigned int    viruses_found = 0;
+
+    for (i = 0; i < vfs->count; i++) {
+        if (!(map = ole2_stream_map(&vfs->hdr, vfs->entries[i].start_block, vfs->entries[i].size)))
+            continue;
+        if (cli_map_scan(map, 0, map->len, ctx, CL_TYPE_ANY) == CL_VIRUS) {
+            funmap(map);
+            if (!(ctx->options & CL_SCAN_ALLMATCHES))
+                return CL_VIRUS;
+            viruses_found++;
+            continue;
+        }
+        funmap(map);
+    }
+    return viruses_found ? CL_VIRUS : CL_CLEAN;
+}
+
+void
+cli_ole2_vfs_free(struct ole2_vfs *vfs)
+{
+    uint32_t        i;
+
+    if (!vfs)
+        return;
+    for (i = 0; i < vfs->count; i++)
+        free(vfs->entries[i].name);
+    free(vfs->entries);
+    free(vfs->hdr.bat);
+    free(vfs->hdr.sbat);
+    free(vfs->hdr.sbat_root);
+    free(vfs);
+}
@@ -25,8 +25,21 @@
 #define __OLE2_EXTRACT_H
 
 #include "others.h"
-#include "uniq.h"
+#include "fmap.h"
 
-int cli_ole2_extract(const char *dirname, cli_ctx *ctx, struct uniq **);
+/*
+ * Streams of a document holding macros, handed to the VBA scanners. They
+ * are read in place from the document; storages are numbered from 0 (the
+ * root) and streams are looked up by name within their storage.
+ */
+struct ole2_vfs;
+
+int cli_ole2_extract(cli_ctx *ctx, struct ole2_vfs **vba);
+
+uint32_t cli_ole2_vfs_storages(struct ole2_vfs *vfs);
+uint32_t cli_ole2_vfs_count(struct ole2_vfs *vfs, uint32_t storage, const char *name);
+fmap_t *cli_ole2_vfs_map(struct ole2_vfs *vfs, uint32_t storage, const char *name, uint32_t which);
+int cli_ole2_vfs_scan(struct ole2_vfs *vfs, cli_ctx *ctx);
+void cli_ole2_vfs_free(struct ole2_vfs *vfs);
 
 #endif
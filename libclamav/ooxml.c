@@ -99,18 +99,23 @@ static const struct key_entry ooxml_keys[] = {
 };
 static size_t num_ooxml_keys = sizeof(ooxml_keys) / sizeof(struct key_entry);
 
-static int ooxml_updatelimits(int fd, cli_ctx *ctx)
+static int ooxml_updatelimits(fmap_t *map, cli_ctx *ctx)
 {
-    STATBUF sb;
-    if (FSTAT(fd, &sb) == -1) {
-        cli_errmsg("ooxml_updatelimits: Can't fstat descriptor %d\n", fd);
-        return CL_ESTAT;
-    }
+    return cli_updatelimits(ctx, map->len);
+}
+
+/* the zip entry is handed over decompressed in memory */
+static xmlTextReaderPtr ooxml_reader(fmap_t *map, const char *url)
+{
+    const char *buf;
+
+    if (!map->len || !(buf = fmap_need_off_once(map, 0, map->len)))
+        return NULL;
 
-    return cli_updatelimits(ctx, sb.st_size);
+    return xmlReaderForMemory(buf, map->len, url, NULL, CLAMAV_MIN_XMLREADER_FLAGS);
 }
 
-static int ooxml_parse_document(int fd, cli_ctx *ctx)
+static int ooxml_parse_document(fmap_t *map, cli_ctx *ctx)
 {
     int ret = CL_SUCCESS;
     xmlTextReaderPtr reader = NULL;
@@ -118,13 +123,13 @@ static int ooxml_parse_document(int fd, cli_ctx *ctx)
     cli_dbgmsg("in ooxml_parse_document\n");
 
     /* perform engine limit checks in temporary tracking session */
-    ret = ooxml_updatelimits(fd, ctx);
+    ret = ooxml_updatelimits(map, ctx);
     if (ret != CL_CLEAN)
         return ret;
 
-    reader = xmlReaderForFd(fd, "properties.xml", NULL, CLAMAV_MIN_XMLREADER_FLAGS);
+    reader = ooxml_reader(map, "properties.xml");
     if (reader == NULL) {
-        cli_dbgmsg("ooxml_parse_document: xmlReaderForFd error\n");
+        cli_dbgmsg("ooxml_parse_document: xmlReaderForMemory error\n");
         return CL_SUCCESS; // internal error from libxml2
     }
 
@@ -138,12 +143,12 @@ static int ooxml_parse_document(int fd, cli_ctx *ctx)
     return ret;
 }
 
-static int ooxml_core_cb(int fd, cli_ctx *ctx)
+static int ooxml_core_cb(fmap_t *map, cli_ctx *ctx)
 {
     int ret;
 
     cli_dbgmsg("in ooxml_core_cb\n");
-    ret = ooxml_parse_document(fd, ctx);
+    ret = ooxml_parse_document(map, ctx);
     if (ret == CL_EPARSE)
         cli_json_parse_error(ctx->wrkproperty, "OOXML_ERROR_CORE_XMLPARSER");
     else if (ret == CL_EFORMAT)
@@ -152,12 +157,12 @@ static int ooxml_core_cb(int fd, cli_ctx *ctx)
     return ret;
 }
 
-static int ooxml_extn_cb(int fd, cli_ctx *ctx)
+static int ooxml_extn_cb(fmap_t *map, cli_ctx *ctx)
 {
     int ret;
 
     cli_dbgmsg("in ooxml_extn_cb\n");
-    ret = ooxml_parse_document(fd, ctx);
+    ret = ooxml_parse_document(map, ctx);
     if (ret == CL_EPARSE)
         cli_json_parse_error(ctx->wrkproperty, "OOXML_ERROR_EXTN_XMLPARSER");
     else if (ret == CL_EFORMAT)
@@ -166,7 +171,7 @@ static int ooxml_extn_cb(int fd, cli_ctx *ctx)
     return ret;
 }
 
-static int ooxml_content_cb(int fd, cli_ctx *ctx)
+static int ooxml_content_cb(fmap_t *map, cli_ctx *ctx)
 {
     int ret = CL_SUCCESS, tmp, toval = 0, state;
     int core=0, extn=0, cust=0, dsig=0;
@@ -181,14 +186,14 @@ static int ooxml_content_cb(int fd, cli_ctx *ctx)
     cli_dbgmsg("in ooxml_content_cb\n");
 
     /* perform engine limit checks in temporary tracking session */
-    ret = ooxml_updatelimits(fd, ctx);
+    ret = ooxml_updatelimits(map, ctx);
     if (ret != CL_CLEAN)
         return ret;
 
     /* apply a reader to the document */
-    reader = xmlReaderForFd(fd, "[Content_Types].xml", NULL, CLAMAV_MIN_XMLREADER_FLAGS);
+    reader = ooxml_reader(map, "[Content_Types].xml");
     if (reader == NULL) {
-        cli_dbgmsg("ooxml_content_cb: xmlReaderForFd error for ""[Content_Types].xml""\n");
+        cli_dbgmsg("ooxml_content_cb: xmlReaderForMemory error for ""[Content_Types].xml""\n");
         cli_json_parse_error(ctx->wrkproperty, "OOXML_ERROR_XML_READER_FD");
 
         ctx->scansize = sav_scansize;
@@ -357,7 +362,7 @@ static const struct key_entry ooxml_hwp_keys[] = {
 };
 static size_t num_ooxml_hwp_keys = sizeof(ooxml_hwp_keys) / sizeof(struct key_entry);
 
-static int ooxml_hwp_cb(int fd, cli_ctx *ctx)
+static int ooxml_hwp_cb(fmap_t *map, cli_ctx *ctx)
 {
     int ret = CL_SUCCESS;
     xmlTextReaderPtr reader = NULL;
@@ -365,13 +370,13 @@ static int ooxml_hwp_cb(int fd, cli_ctx *ctx)
     cli_dbgmsg("in ooxml_hwp_cb\n");
 
     /* perform engine limit checks in temporary tracking session */
-    ret = ooxml_updatelimits(fd, ctx);
+    ret = ooxml_updatelimits(map, ctx);
     if (ret != CL_CLEAN)
         return ret;
 
-    reader = xmlReaderForFd(fd, "ooxml_hwp.xml", NULL, CLAMAV_MIN_XMLREADER_FLAGS);
+    reader = ooxml_reader(map, "ooxml_hwp.xml");
     if (reader == NULL) {
-        cli_dbgmsg("ooxml_hwp_cb: xmlReaderForFd error\n");
+        cli_dbgmsg("ooxml_hwp_cb: xmlReaderForMemory error\n");
         return CL_SUCCESS; // internal error from libxml2
     }
 
@@ -73,6 +73,7 @@
 #include "ltdl.h"
 #include "matcher-ac.h"
 #include "matcher-pcre.h"
+#include "matcher.h"
 #include "default.h"
 #include "scanners.h"
 #include "bytecode.h"
@@ -80,6 +81,9 @@
 #include "cache.h"
 #include "readdb.h"
 #include "stats.h"
+#include "decoders.h"
+#include "inflate_iface.h"
+#include "delta.h"
 
 int (*cli_unrar_open)(int fd, const char *dirname, unrar_state_t *state);
 int (*cli_unrar_extract_next_prepare)(unrar_state_t *state, const char *dirname);
@@ -304,12 +308,14 @@ int cl_init(unsigned int initoptions)
     /* put dlopen() stuff here, etc. */
     if (lt_init() == 0) {
 	cli_rarload();
+	cli_inflate_load();
     }
     gettimeofday(&tv, (struct timezone *) 0);
     srand(pid + tv.tv_usec*(pid+1) + clock());
     rc = bytecode_init();
     if (rc)
 	return rc;
+    cli_decoders_simd();
 #ifdef HAVE_LIBXML2
     xmlInitParser();
 #endif
@@ -445,6 +451,7 @@ struct cl_engine *cl_engine_new(void)
     /* Engine max settings */
     new->maxiconspe = CLI_DEFAULT_MAXICONSPE;
     new->maxrechwp3 = CLI_DEFAULT_MAXRECHWP3;
+    new->maxratio = CLI_DEFAULT_MAXRATIO;
 
     /* PCRE matching limitations */
 #if HAVE_PCRE
@@ -545,6 +552,7 @@ int cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field field, long
 	case CL_ENGINE_DB_OPTIONS:
 	case CL_ENGINE_DB_VERSION:
 	case CL_ENGINE_DB_TIME:
+	case CL_ENGINE_SCANWORK_HITS:
 	    cli_warnmsg("cl_engine_set_num: The field is read only\n");
 	    return CL_EARG;
 	case CL_ENGINE_AC_ONLY:
@@ -565,6 +573,12 @@ int cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field field, long
 	    else
 	        engine->engine_options &= ~(ENGINE_OPTIONS_FORCE_TO_DISK);
 	    break;
+	case CL_ENGINE_DIRECT_MMAP:
+	    if(num)
+	        engine->engine_options |= ENGINE_OPTIONS_DIRECT_MMAP;
+	    else
+	        engine->engine_options &= ~(ENGINE_OPTIONS_DIRECT_MMAP);
+	    break;
 	case CL_ENGINE_BYTECODE_SECURITY:
 	    if (engine->dboptions & CL_DB_COMPILED) {
 		cli_errmsg("cl_engine_set_num: CL_ENGINE_BYTECODE_SECURITY cannot be set after engine was compiled\n");
@@ -597,6 +611,12 @@ int cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field field, long
 		    cli_cache_init(engine);
 	    }
 	    break;
+	case CL_ENGINE_FAST_CACHE_KEY:
+	    if (num)
+		engine->engine_options |= ENGINE_OPTIONS_FAST_CACHE_KEY;
+	    else
+		engine->engine_options &= ~(ENGINE_OPTIONS_FAST_CACHE_KEY);
+	    break;
 	case CL_ENGINE_DISABLE_PE_STATS:
 	    if (num) {
 		engine->engine_options |= ENGINE_OPTIONS_DISABLE_PE_STATS;
@@ -632,6 +652,19 @@ int cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field field, long
 	case CL_ENGINE_PCRE_MAX_FILESIZE:
 	    engine->pcre_max_filesize = (uint64_t)num;
 	    break;
+	case CL_ENGINE_MAX_SCANWORK:
+	    engine->maxscanwork = (uint64_t)num;
+	    break;
+	case CL_ENGINE_SCANWORK_ACTION:
+	    if (num < CL_SCANWORK_ALERT || num > CL_SCANWORK_ERROR) {
+		cli_errmsg("cl_engine_set_num: Incorrect CL_ENGINE_SCANWORK_ACTION value\n");
+		return CL_EARG;
+	    }
+	    engine->scanwork_action = num;
+	    break;
+	case CL_ENGINE_MAX_RATIO:
+	    engine->maxratio = (uint32_t)num;
+	    break;
 	case CL_ENGINE_DISABLE_PE_CERTS:
 	    if (num) {
 		engine->engine_options |= ENGINE_OPTIONS_DISABLE_PE_CERTS;
@@ -705,6 +738,8 @@ long long cl_engine_get_num(const struct cl_engine *engine, enum cl_engine_field
 	    return engine->keeptmp;
 	case CL_ENGINE_FORCETODISK:
 	    return engine->engine_options & ENGINE_OPTIONS_FORCE_TO_DISK;
+	case CL_ENGINE_DIRECT_MMAP:
+	    return engine->engine_options & ENGINE_OPTIONS_DIRECT_MMAP;
 	case CL_ENGINE_BYTECODE_SECURITY:
 	    return engine->bytecode_security;
 	case CL_ENGINE_BYTECODE_TIMEOUT:
@@ -713,6 +748,8 @@ long long cl_engine_get_num(const struct cl_engine *engine, enum cl_engine_field
 	    return engine->bytecode_mode;
 	case CL_ENGINE_DISABLE_CACHE:
 	    return engine->engine_options & ENGINE_OPTIONS_DISABLE_CACHE;
+	case CL_ENGINE_FAST_CACHE_KEY:
+	    return engine->engine_options & ENGINE_OPTIONS_FAST_CACHE_KEY;
 	case CL_ENGINE_STATS_TIMEOUT:
 	    return ((cli_intel_t *)(engine->stats_data))->timeout;
 	case CL_ENGINE_MAX_PARTITIONS:
@@ -729,6 +766,14 @@ long long cl_engine_get_num(const struct cl_engine *engine, enum cl_engine_field
 	    return engine->pcre_recmatch_limit;
 	case CL_ENGINE_PCRE_MAX_FILESIZE:
 	    return engine->pcre_max_filesize;
+	case CL_ENGINE_MAX_SCANWORK:
+	    return engine->maxscanwork;
+	case CL_ENGINE_SCANWORK_ACTION:
+	    return engine->scanwork_action;
+	case CL_ENGINE_SCANWORK_HITS:
+	    return engine->scanwork_hits;
+	case CL_ENGINE_MAX_RATIO:
+	    return engine->maxratio;
 	default:
 	    cli_errmsg("cl_engine_get: Incorrect field number\n");
 	    if(err)
@@ -847,6 +892,11 @@ struct cl_settings *cl_engine_settings_copy(const struct cl_engine *engine)
     settings->pcre_recmatch_limit = engine->pcre_recmatch_limit;
     settings->pcre_max_filesize = engine->pcre_max_filesize;
 
+    settings->maxscanwork = engine->maxscanwork;
+    settings->scanwork_action = engine->scanwork_action;
+
+    settings->maxratio = engine->maxratio;
+
     return settings;
 }
 
@@ -920,6 +970,11 @@ int cl_engine_settings_apply(struct cl_engine *engine, const struct cl_settings
     engine->pcre_recmatch_limit = settings->pcre_recmatch_limit;
     engine->pcre_max_filesize = settings->pcre_max_filesize;
 
+    engine->maxscanwork = settings->maxscanwork;
+    engine->scanwork_action = settings->scanwork_action;
+
+    engine->maxratio = settings->maxratio;
+
     return CL_SUCCESS;
 }
 
@@ -1007,6 +1062,58 @@ int cli_checktimelimit(cli_ctx *ctx)
     return CL_SUCCESS;
 }
 
+#ifdef CL_THREAD_SAFE
+static pthread_mutex_t cli_scanwork_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Charges units of work to the current scan and returns CL_ETIMEOUT once
+ * the engine's MaxScanWork budget is spent. Loops that can be made to spin
+ * on crafted input (inflating, matching, PDF objects, bytecode, mail
+ * parsing) call this and bail out; scan_common() turns the flag into the
+ * configured verdict when the scan unwinds.
+ */
+int cli_updatescanwork(cli_ctx *ctx, uint64_t units)
+{
+    struct cl_engine *engine;
+
+    /* streamed data is accounted for when the object is complete */
+    if (!ctx || !ctx->engine->maxscanwork || (ctx->scanstate && ctx->scanstate->feeding))
+        return CL_SUCCESS;
+    if (ctx->scanwork_exceeded)
+        return CL_ETIMEOUT;
+
+    ctx->scanwork += units;
+    if (ctx->scanwork <= ctx->engine->maxscanwork)
+        return CL_SUCCESS;
+
+    ctx->scanwork_exceeded = 1;
+    cli_dbgmsg("cli_updatescanwork: work budget of %llu units exhausted, scanning will be incomplete\n",
+               (long long unsigned)ctx->engine->maxscanwork);
+
+    /* the counter is statistics only, the engine is otherwise read-only here */
+    engine = (struct cl_engine *)ctx->engine;
+#ifdef CL_THREAD_SAFE
+    pthread_mutex_lock(&cli_scanwork_mutex);
+#endif
+    engine->scanwork_hits++;
+#ifdef CL_THREAD_SAFE
+    pthread_mutex_unlock(&cli_scanwork_mutex);
+#endif
+
+    /* alert once per scan, like cli_check_blockmax() does for the other limits */
+    if (ctx->engine->scanwork_action == CL_SCANWORK_ALERT) {
+        if (!ctx->limit_exceeded) {
+            cli_append_virus(ctx, "Heuristic.Limits.Exceeded.ScanWork");
+            ctx->limit_exceeded = 1;
+        }
+    } else {
+        cli_check_blockmax(ctx, CL_ETIMEOUT);
+    }
+
+    return CL_ETIMEOUT;
+}
+
 /*
  * Type: 1 = MD5, 2 = SHA1, 3 = SHA256
  */
@@ -1092,6 +1199,18 @@ void cli_append_virus(cli_ctx * ctx, const char * virname)
 {
     if (ctx->virname == NULL)
         return;
+    if (ctx->scanstate && ctx->scanstate->feeding && SCAN_ALL) {
+        /* reported with the rest when the streamed object is complete */
+        cli_scanstate_addvirus(ctx->scanstate, virname);
+        return;
+    }
+    /* matches of removed signatures are skipped by the matchers, this
+     * catches ignored names reported by anything else (bytecode, icons...) */
+    if (ctx->engine->delta_dead && cli_delta_isdead(ctx->engine, virname) == CLI_DELTA_IGNORED) {
+        cli_dbgmsg("cli_append_virus: %s was ignored by a database delta\n", virname);
+        ctx->delta_dropped++;
+        return;
+    }
     if (ctx->engine->cb_virus_found)
         ctx->engine->cb_virus_found(fmap_fd(*ctx->fmap), virname, ctx->cb_ctx);
     ctx->num_viruses++;
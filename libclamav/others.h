@@ -50,6 +50,7 @@
 #include "bytecode_api.h"
 #include "events.h"
 #include "crtmgr.h"
+#include "arena.h"
 
 #ifdef HAVE_JSON
 #include "json.h"
@@ -148,6 +149,7 @@ typedef struct cli_ctx_tag {
     bitset_t* hook_lsig_matches;
     void *cb_ctx;
     cli_events_t* perf;
+    cli_arena_t *arena;
 #ifdef HAVE__INTERNAL__SHA_COLLECT
     char entry_filename[2048];
     int sha_collect;
@@ -158,6 +160,10 @@ typedef struct cli_ctx_tag {
 #endif
     struct timeval time_limit;
     int limit_exceeded;
+    uint64_t scanwork;
+    int scanwork_exceeded;
+    unsigned int delta_dropped;
+    struct cli_scanstate *scanstate; /* streamed object, see cl_scan_stream_feed() */
 } cli_ctx;
 
 #define STATS_ANON_UUID "5b585e8f-3be5-11e3-bf0b-18037319526c"
@@ -383,6 +389,16 @@ struct cl_engine {
     /* millisecond time limit for preclassification scanning */
     uint32_t time_limit;
 
+    /* work units (bytes matched/inflated/parsed, bytecode opcodes) a
+     * single scan may spend before it's cut short */
+    uint64_t maxscanwork;
+    enum scanwork_action scanwork_action;
+    uint64_t scanwork_hits;
+
+    /* decompressed:compressed ratio above which an archive member is
+     * reported as a decompression bomb, 0 to disable */
+    uint32_t maxratio;
+
     /* PCRE matching limitations */
     uint64_t pcre_match_limit;
     uint64_t pcre_recmatch_limit;
@@ -392,6 +408,13 @@ struct cl_engine {
     /* YARA */
     struct _yara_global * yara_global;
 #endif
+
+    /* Set by cl_engine_delta(): the engine this one shares its data with,
+     * the names of the signatures the delta removed and the roots holding
+     * the body and logical signatures it added */
+    struct cl_engine *delta_base;
+    struct cli_hashtable *delta_dead;
+    struct cli_matcher **delta_root;
 };
 
 struct cl_settings {
@@ -457,6 +480,12 @@ struct cl_settings {
     uint64_t pcre_match_limit;
     uint64_t pcre_recmatch_limit;
     uint64_t pcre_max_filesize;
+
+    /* Scan work budget */
+    uint64_t maxscanwork;
+    enum scanwork_action scanwork_action;
+
+    uint32_t maxratio;
 };
 
 extern int (*cli_unrar_open)(int fd, const char *dirname, unrar_state_t *state);
@@ -721,6 +750,7 @@ int cli_matchregex(const char *str, const char *regex);
 void cli_qsort(void *a, size_t n, size_t es, int (*cmp)(const void *, const void *));
 void cli_qsort_r(void *a, size_t n, size_t es, int (*cmp)(const void*, const void *, const void *), void *arg);
 int cli_checktimelimit(cli_ctx *ctx);
+int cli_updatescanwork(cli_ctx *ctx, uint64_t units);
 
 /* symlink behaviour */
 #define CLI_FTW_FOLLOW_FILE_SYMLINK 0x01
@@ -206,10 +206,14 @@ int pdf_findobj(struct pdf_struct *pdf)
     unsigned genid, objid;
 
     pdf->nobjs++;
-    pdf->objs = cli_realloc2(pdf->objs, sizeof(*pdf->objs)*pdf->nobjs);
-    if (!pdf->objs) {
-        cli_warnmsg("cli_pdf: out of memory parsing objects (%u)\n", pdf->nobjs);
-        return -1;
+    if (pdf->nobjs > pdf->maxobjs) {
+        /* grow geometrically, large PDFs have hundreds of thousands of objects */
+        pdf->maxobjs = pdf->maxobjs ? pdf->maxobjs * 2 : 64;
+        pdf->objs = cli_realloc2(pdf->objs, sizeof(*pdf->objs)*pdf->maxobjs);
+        if (!pdf->objs) {
+            cli_warnmsg("cli_pdf: out of memory parsing objects (%u)\n", pdf->nobjs);
+            return -1;
+        }
     }
 
     obj = &pdf->objs[pdf->nobjs-1];
@@ -287,7 +291,7 @@ int pdf_findobj(struct pdf_struct *pdf)
     return 1;/* truncated */
 }
 
-static int filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, int fout, const char *buf, off_t len, off_t *sum)
+static int filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_output *out, const char *buf, off_t len, off_t *sum)
 {
     UNUSEDPARAM(obj);
 
@@ -296,7 +300,152 @@ static int filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, int fout,
 
     *sum += len;
 
-    return cli_writen(fout, buf, len);
+    return pdf_output_write(out, buf, len);
+}
+
+static void pdf_output_init(struct pdf_struct *pdf, struct pdf_output *out, const char *name)
+{
+    out->buf = NULL;
+    out->len = 0;
+    out->size = 0;
+    out->fd = -1;
+    snprintf(out->path, sizeof(out->path), "%s"PATHSEP"%s", pdf->dir, name);
+}
+
+static int pdf_output_dump(struct pdf_output *out)
+{
+    out->fd = open(out->path, O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
+    if (out->fd < 0) {
+        char err[128];
+
+        cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", out->path, cli_strerror(errno, err, sizeof(err)));
+        return CL_ETMPFILE;
+    }
+
+    if (out->len && cli_writen(out->fd, out->buf, out->len) != (int)out->len) {
+        cli_errmsg("cli_pdf: can't write to temporary file %s\n", out->path);
+        return CL_EWRITE;
+    }
+
+    return CL_SUCCESS;
+}
+
+int pdf_output_write(struct pdf_output *out, const char *buf, size_t len)
+{
+    if (!len)
+        return 0;
+
+    if (out->fd < 0 && out->len + len > PDF_OUTPUT_MEMMAX) {
+        cli_dbgmsg("cli_pdf: decoded object larger than %u bytes, spilling to %s\n", PDF_OUTPUT_MEMMAX, out->path);
+        if (pdf_output_dump(out) != CL_SUCCESS)
+            return -1;
+
+        free(out->buf);
+        out->buf = NULL;
+        out->size = 0;
+    }
+
+    if (out->fd >= 0) {
+        if (cli_writen(out->fd, buf, len) != (int)len)
+            return -1;
+
+        out->len += len;
+        return len;
+    }
+
+    /* keep the buffer NUL terminated for the string parsers in pdfng.c */
+    if (out->len + len + 1 > out->size) {
+        size_t size = out->size ? out->size : 4096;
+        char *p;
+
+        while (size < out->len + len + 1)
+            size *= 2;
+
+        p = cli_realloc(out->buf, size);
+        if (!p)
+            return -1;
+
+        out->buf = p;
+        out->size = size;
+    }
+
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+    out->buf[out->len] = '\0';
+
+    return len;
+}
+
+static fmap_t *pdf_output_map(struct pdf_output *out)
+{
+    if (out->fd >= 0)
+        return fmap(out->fd, 0, 0);
+
+    return cl_fmap_open_memory(out->buf, out->len);
+}
+
+static int pdf_output_close(struct pdf_struct *pdf, struct pdf_output *out)
+{
+    int rc = CL_SUCCESS;
+
+    /* with --leave-temps the decoded object still ends up on disk */
+    if (pdf->ctx->engine->keeptmp && out->fd < 0 && out->len)
+        pdf_output_dump(out);
+
+    if (out->fd >= 0) {
+        close(out->fd);
+        out->fd = -1;
+
+        if (!pdf->ctx->engine->keeptmp && cli_unlink(out->path))
+            rc = CL_EUNLINK;
+    }
+
+    free(out->buf);
+    out->buf = NULL;
+
+    return rc;
+}
+
+/* the object index comes from the scan arena when there is one; the
+ * object table itself keeps growing with realloc, which doesn't leave the
+ * smaller copies behind until the end of the scan */
+static void pdf_free_objs(struct pdf_struct *pdf)
+{
+    free(pdf->objs);
+    if (!pdf->ctx || !pdf->ctx->arena)
+        free(pdf->objhash);
+    pdf->objs = NULL;
+    pdf->objhash = NULL;
+}
+
+static void pdf_free_cache(struct pdf_struct *pdf)
+{
+    unsigned i;
+
+    for (i = 0; i < pdf->nobjs; i++) {
+        free(pdf->objs[i].decoded);
+        pdf->objs[i].decoded = NULL;
+        pdf->objs[i].decodedlen = 0;
+    }
+
+    pdf->cachesz = 0;
+}
+
+/* Keep an object's decoded contents for later references to it */
+static void pdf_cache_obj(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_output *out)
+{
+    if (out->fd >= 0 || !out->len)
+        return;
+
+    if (pdf->cachesz + out->len > PDF_CACHE_MAX) {
+        cli_dbgmsg("cli_pdf: decoded object cache full, flushing\n");
+        pdf_free_cache(pdf);
+    }
+
+    obj->decoded = out->buf;
+    obj->decodedlen = out->len;
+    pdf->cachesz += out->len;
+    out->buf = NULL;
 }
 
 void pdfobj_flag(struct pdf_struct *pdf, struct pdf_obj *obj, enum pdf_flag flag)
@@ -376,6 +525,47 @@ void pdfobj_flag(struct pdf_struct *pdf, struct pdf_obj *obj, enum pdf_flag flag
     cli_dbgmsg("cli_pdf: %s flagged in object %u %u\n", s, obj->id>>8, obj->id&0xff);
 }
 
+#define PDF_OBJHASH(id, bits) (((uint32_t)(id) * 0x9e3779b1u) >> (32 - (bits)))
+
+/*
+ * Index pdf->objs by id. The table uses open addressing and holds every
+ * object, so redefinitions of an id (incremental updates) are all found
+ * along the same probe sequence.
+ */
+void pdf_index_objs(struct pdf_struct *pdf)
+{
+    unsigned bits = 4;
+    uint32_t i, h, mask;
+
+    if (!pdf->ctx || !pdf->ctx->arena)
+        free(pdf->objhash);
+    pdf->objhash = NULL;
+    pdf->objhashbits = 0;
+
+    while (bits < 31 && (1u << bits) < pdf->nobjs * 2)
+        bits++;
+
+    if (pdf->ctx && pdf->ctx->arena)
+        pdf->objhash = cli_arena_calloc(pdf->ctx->arena, 1u << bits, sizeof(*pdf->objhash));
+    else
+        pdf->objhash = cli_calloc(1u << bits, sizeof(*pdf->objhash));
+    if (!pdf->objhash) {
+        cli_dbgmsg("cli_pdf: no memory for the object index, using linear lookups\n");
+        return;
+    }
+
+    pdf->objhashbits = bits;
+    mask = (1u << bits) - 1;
+
+    for (i = 0; i < pdf->nobjs; i++) {
+        h = PDF_OBJHASH(pdf->objs[i].id, bits);
+        while (pdf->objhash[h])
+            h = (h + 1) & mask;
+
+        pdf->objhash[h] = i + 1;
+    }
+}
+
 struct pdf_obj *find_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t objid)
 {
     uint32_t j;
@@ -384,6 +574,30 @@ struct pdf_obj *find_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t o
     /* search starting at previous obj (if exists) */
     i = (obj != pdf->objs) ? obj - pdf->objs : 0;
 
+    if (pdf->objhash) {
+        uint32_t h, mask = (1u << pdf->objhashbits) - 1;
+        uint32_t first = 0, next = 0;
+
+        /* same preference as the linear search below: the first definition
+         * at or after obj, else the first one in the file */
+        for (h = PDF_OBJHASH(objid, pdf->objhashbits); pdf->objhash[h]; h = (h + 1) & mask) {
+            j = pdf->objhash[h] - 1;
+            if (pdf->objs[j].id != objid)
+                continue;
+
+            if (!first || j < first - 1)
+                first = j + 1;
+
+            if (j >= i && (!next || j < next - 1))
+                next = j + 1;
+        }
+
+        if (next)
+            return &pdf->objs[next - 1];
+
+        return first ? &pdf->objs[first - 1] : NULL;
+    }
+
     for (j=i;j<pdf->nobjs;j++) {
         obj = &pdf->objs[j];
         if (obj->id == objid)
@@ -491,12 +705,11 @@ static int obj_size(struct pdf_struct *pdf, struct pdf_obj *obj, int binary)
     return pdf->offset - obj->start - 6;
 }
 
-static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, int fd, int dumpid)
+static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, fmap_t *map, int dumpid)
 {
     int ret;
     struct cli_bc_ctx *bc_ctx;
     cli_ctx *ctx = pdf->ctx;
-    fmap_t *map;
 
     UNUSEDPARAM(dumpid);
 
@@ -506,24 +719,14 @@ static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, int fd, i
         return CL_EMEM;
     }
 
-    map = *ctx->fmap;
-    if (fd != -1) {
-        map = fmap(fd, 0, 0);
-        if (!map) {
-            cli_warnmsg("can't mmap pdf extracted obj\n");
-            map = *ctx->fmap;
-            fd = -1;
-        }
-    }
+    if (!map)
+        map = *ctx->fmap;
 
     cli_bytecode_context_setpdf(bc_ctx, phase, pdf->nobjs, pdf->objs, &pdf->flags, pdf->size, pdf->startoff);
     cli_bytecode_context_setctx(bc_ctx, ctx);
     ret = cli_bytecode_runhook(ctx, ctx->engine, bc_ctx, BC_PDF, map);
     cli_bytecode_context_destroy(bc_ctx);
 
-    if (fd != -1)
-        funmap(map);
-
     return ret;
 }
 
@@ -726,7 +929,7 @@ enum cstate {
     CSTATE_TJ_PAROPEN
 };
 
-static void process(struct text_norm_state *s, enum cstate *st, const char *buf, int length, int fout)
+static void process(struct text_norm_state *s, enum cstate *st, const char *buf, int length, struct pdf_output *out)
 {
     do {
         switch (*st) {
@@ -753,7 +956,7 @@ static void process(struct text_norm_state *s, enum cstate *st, const char *buf,
                 *st = CSTATE_TJ;
             } else {
                 if (text_normalize_buffer(s, (const unsigned char *)buf, 1) != 1) {
-                    cli_writen(fout, s->out, s->out_pos);
+                    pdf_output_write(out, (const char *)s->out, s->out_pos);
                     text_normalize_reset(s);
                 }
             }
@@ -766,42 +969,49 @@ static void process(struct text_norm_state *s, enum cstate *st, const char *buf,
     } while (length > 0);
 }
 
-static int pdf_scan_contents(int fd, struct pdf_struct *pdf)
+static int pdf_scan_contents(fmap_t *map, struct pdf_struct *pdf)
 {
     struct text_norm_state s;
-    char fullname[1024];
+    struct pdf_output out;
+    char name[32];
     char outbuff[BUFSIZ];
-    char inbuf[BUFSIZ];
-    int fout, n, rc;
+    const char *inbuf;
+    size_t offset, n;
+    fmap_t *outmap;
+    int rc = CL_CLEAN, rc2;
     enum cstate st = CSTATE_NONE;
 
-    snprintf(fullname, sizeof(fullname), "%s"PATHSEP"pdf%02u_c", pdf->dir, (pdf->files-1));
-    fout = open(fullname,O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
-    if (fout < 0) {
-        char err[128];
-
-        cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", fullname, cli_strerror(errno, err, sizeof(err)));
-        return CL_ETMPFILE;
-    }
+    snprintf(name, sizeof(name), "pdf%02u_c", (pdf->files-1));
+    pdf_output_init(pdf, &out, name);
 
     text_normalize_init(&s, (unsigned char *)outbuff, sizeof(outbuff));
-    while (1) {
-        n = cli_readn(fd, inbuf, sizeof(inbuf));
-        if (n <= 0)
+    for (offset = 0; offset < map->len; offset += n) {
+        n = map->len - offset;
+        if (n > BUFSIZ)
+            n = BUFSIZ;
+
+        inbuf = fmap_need_off_once(map, offset, n);
+        if (!inbuf)
             break;
 
-        process(&s, &st, inbuf, n, fout);
+        process(&s, &st, inbuf, n, &out);
     }
 
-    cli_writen(fout, s.out, s.out_pos);
+    pdf_output_write(&out, (const char *)s.out, s.out_pos);
 
-    lseek(fout, 0, SEEK_SET);
-    rc = cli_magic_scandesc(fout, pdf->ctx);
-    close(fout);
+    if (out.len) {
+        outmap = pdf_output_map(&out);
+        if (outmap) {
+            rc = cli_map_scan(outmap, 0, outmap->len, pdf->ctx, CL_TYPE_ANY);
+            funmap(outmap);
+        } else {
+            rc = CL_EMEM;
+        }
+    }
 
-    if (!pdf->ctx->engine->keeptmp)
-        if (cli_unlink(fullname) && rc != CL_VIRUS)
-            rc = CL_EUNLINK;
+    rc2 = pdf_output_close(pdf, &out);
+    if (rc2 != CL_SUCCESS && rc != CL_VIRUS)
+        rc = rc2;
 
     return rc;
 }
@@ -812,11 +1022,13 @@ static char *pdf_readstring(const char *q0, int len, const char *key, unsigned *
 
 int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 {
-    char fullname[NAME_MAX + 1];
-    int fout;
+    char name[32];
+    struct pdf_output output;
+    fmap_t *map;
     off_t sum = 0;
     int rc = CL_SUCCESS;
     int dump = 1;
+    int cached = 0;
 
     cli_dbgmsg("pdf_extract_obj: obj %u %u\n", obj->id>>8, obj->id&0xff);
 
@@ -839,21 +1051,28 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
     if (!dump)
         return CL_CLEAN;
 
+    /* already decoded while resolving a reference to it */
+    if (obj->decoded && !(flags & PDF_EXTRACT_OBJ_SCAN))
+        return CL_SUCCESS;
+
     cli_dbgmsg("cli_pdf: dumping obj %u %u\n", obj->id>>8, obj->id&0xff);
 
-    snprintf(fullname, sizeof(fullname), "%s"PATHSEP"pdf%02u", pdf->dir, pdf->files++);
-    fout = open(fullname,O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
-    if (fout < 0) {
-        char err[128];
-        cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", fullname, cli_strerror(errno, err, sizeof(err)));
+    snprintf(name, sizeof(name), "pdf%02u", pdf->files++);
+    pdf_output_init(pdf, &output, name);
 
-        return CL_ETMPFILE;
-    }
+    if (obj->decoded) {
+        cli_dbgmsg("cli_pdf: reusing decoded obj %u %u\n", obj->id>>8, obj->id&0xff);
 
-    if (!(flags & PDF_EXTRACT_OBJ_SCAN))
-        obj->path = strdup(fullname);
+        output.buf = obj->decoded;
+        output.len = obj->decodedlen;
+        output.size = obj->decodedlen + 1;
+        sum = output.len;
 
-    do {
+        pdf->cachesz -= obj->decodedlen;
+        obj->decoded = NULL;
+        obj->decodedlen = 0;
+        cached = 1;
+    } else do {
         if (obj->flags & (1 << OBJ_STREAM)) {
             const char *start = pdf->map + obj->start;
             off_t p_stream = 0, p_endstream = 0;
@@ -957,7 +1176,7 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
                         cli_dbgmsg("cli_pdf: failed to locate DecodeParms dictionary start\n");
                 }
 
-                sum = pdf_decodestream(pdf, obj, dparams, start + p_stream, length, xref, fout, &rc);
+                sum = pdf_decodestream(pdf, obj, dparams, start + p_stream, length, xref, &output, &rc);
                 if (dparams)
                     pdf_free_dict(dparams);
 
@@ -1010,7 +1229,7 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
                         }
                     }
 
-                    if (filter_writen(pdf, obj, fout, out, js_len, &sum) != js_len) {
+                    if (filter_writen(pdf, obj, &output, out, js_len, &sum) != js_len) {
                         rc = CL_EWRITE;
                                 free(js);
                         break;
@@ -1035,7 +1254,7 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 
                         if (q2 > q) {
                             q--;
-                            filter_writen(pdf, obj, fout, q, q2 - q, &sum);
+                            filter_writen(pdf, obj, &output, q, q2 - q, &sum);
                             q++;
                         }
                     }
@@ -1047,48 +1266,57 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 
             if (bytesleft < 0)
                 rc = CL_EFORMAT;
-            else if (filter_writen(pdf, obj, fout , pdf->map + obj->start, bytesleft,&sum) != bytesleft)
+            else if (filter_writen(pdf, obj, &output, pdf->map + obj->start, bytesleft,&sum) != bytesleft)
                 rc = CL_EWRITE;
         }
     } while (0);
 
     cli_dbgmsg("cli_pdf: extracted %ld bytes %u %u obj\n", sum, obj->id>>8, obj->id&0xff);
-    cli_dbgmsg("         ... to %s\n", fullname);
+    if (output.fd >= 0)
+        cli_dbgmsg("         ... to %s\n", output.path);
 
-    if (flags & PDF_EXTRACT_OBJ_SCAN && sum) {
+    if (flags & PDF_EXTRACT_OBJ_SCAN && sum && output.len) {
         int rc2;
 
         cli_updatelimits(pdf->ctx, sum);
 
+        map = pdf_output_map(&output);
+        if (!map) {
+            cli_errmsg("cli_pdf: can't map extracted obj %u %u\n", obj->id>>8, obj->id&0xff);
+            pdf_output_close(pdf, &output);
+            return CL_EMEM;
+        }
+
         /* TODO: invoke bytecode on this pdf obj with metainformation associated */
-        lseek(fout, 0, SEEK_SET);
-        rc2 = cli_magic_scandesc(fout, pdf->ctx);
+        rc2 = cli_map_scan(map, 0, map->len, pdf->ctx, CL_TYPE_ANY);
         if (rc2 == CL_VIRUS || rc == CL_SUCCESS)
             rc = rc2;
 
         if ((rc == CL_CLEAN) || ((rc == CL_VIRUS) && (pdf->ctx->options & CL_SCAN_ALLMATCHES))) {
-            rc2 = run_pdf_hooks(pdf, PDF_PHASE_POSTDUMP, fout, obj - pdf->objs);
+            rc2 = run_pdf_hooks(pdf, PDF_PHASE_POSTDUMP, map, obj - pdf->objs);
             if (rc2 == CL_VIRUS)
                 rc = rc2;
         }
 
         if (((rc == CL_CLEAN) || ((rc == CL_VIRUS) && (pdf->ctx->options & CL_SCAN_ALLMATCHES))) && (obj->flags & (1 << OBJ_CONTENTS))) {
-            lseek(fout, 0, SEEK_SET);
             cli_dbgmsg("cli_pdf: dumping contents %u %u\n", obj->id>>8, obj->id&0xff);
 
-            rc2 = pdf_scan_contents(fout, pdf);
+            rc2 = pdf_scan_contents(map, pdf);
             if (rc2 == CL_VIRUS)
                 rc = rc2;
 
             noisy_msg(pdf, "extracted text from obj %u %u\n", obj->id>>8, obj->id&0xff);
         }
+
+        funmap(map);
     }
 
-    close(fout);
+    /* objects extracted for their contents (see pdfng.c) are kept for reuse */
+    if (!(flags & PDF_EXTRACT_OBJ_SCAN) || cached)
+        pdf_cache_obj(pdf, obj, &output);
 
-    if (flags & PDF_EXTRACT_OBJ_SCAN && !pdf->ctx->engine->keeptmp)
-        if (cli_unlink(fullname) && rc != CL_VIRUS)
-            rc = CL_EUNLINK;
+    if (pdf_output_close(pdf, &output) != CL_SUCCESS && rc != CL_VIRUS)
+        rc = CL_EUNLINK;
 
     return rc;
 }
@@ -2409,7 +2637,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 
     pdf.startoff = offset;
 
-    rc = run_pdf_hooks(&pdf, PDF_PHASE_PRE, -1, -1);
+    rc = run_pdf_hooks(&pdf, PDF_PHASE_PRE, NULL, -1);
     if ((rc == CL_VIRUS) && SCAN_ALL) {
         cli_dbgmsg("cli_pdf: (pre hooks) returned %d\n", rc);
         alerts++;
@@ -2435,16 +2663,21 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
     if (rc == -1)
         pdf.flags |= 1 << BAD_PDF_TOOMANYOBJS;
 
+    pdf_index_objs(&pdf);
+
     /* must parse after finding all objs, so we can flag indirect objects */
     for (i=0;i<pdf.nobjs;i++) {
         struct pdf_obj *obj = &pdf.objs[i];
 
-        if (cli_checktimelimit(ctx) != CL_SUCCESS) {
-            cli_errmsg("Timeout reached in the PDF parser\n");
+        if (cli_checktimelimit(ctx) != CL_SUCCESS ||
+            cli_updatescanwork(ctx, obj_size(&pdf, obj, 1)) != CL_SUCCESS) {
+            if (!ctx->scanwork_exceeded)
+                cli_errmsg("Timeout reached in the PDF parser\n");
 #if HAVE_JSON
             pdf_export_json(&pdf);
 #endif
-            free(pdf.objs);
+            pdf_free_cache(&pdf);
+            pdf_free_objs(&pdf);
             if (pdf.fileID)
                 free(pdf.fileID);
             if (pdf.key)
@@ -2480,7 +2713,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
     }
 
     if (!rc) {
-        rc = run_pdf_hooks(&pdf, PDF_PHASE_PARSED, -1, -1);
+        rc = run_pdf_hooks(&pdf, PDF_PHASE_PARSED, NULL, -1);
         cli_dbgmsg("cli_pdf: (parsed hooks) returned %d\n", rc);
         if (rc == CL_VIRUS) {
             alerts++;
@@ -2494,12 +2727,15 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
     for (i=0;!rc && i<pdf.nobjs;i++) {
         struct pdf_obj *obj = &pdf.objs[i];
 
-        if (cli_checktimelimit(ctx) != CL_SUCCESS) {
-            cli_errmsg("Timeout reached in the PDF parser\n");
+        if (cli_checktimelimit(ctx) != CL_SUCCESS ||
+            cli_updatescanwork(ctx, obj_size(&pdf, obj, 1)) != CL_SUCCESS) {
+            if (!ctx->scanwork_exceeded)
+                cli_errmsg("Timeout reached in the PDF parser\n");
 #if HAVE_JSON
             pdf_export_json(&pdf);
 #endif
-            free(pdf.objs);
+            pdf_free_cache(&pdf);
+            pdf_free_objs(&pdf);
             if (pdf.fileID)
                 free(pdf.fileID);
             if (pdf.key)
@@ -2532,7 +2768,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 
    if (pdf.flags && !rc) {
         cli_dbgmsg("cli_pdf: flags 0x%02x\n", pdf.flags);
-        rc = run_pdf_hooks(&pdf, PDF_PHASE_END, -1, -1);
+        rc = run_pdf_hooks(&pdf, PDF_PHASE_END, NULL, -1);
         if (rc == CL_VIRUS) {
             alerts++;
             if (SCAN_ALL) {
@@ -2575,7 +2811,8 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 #endif
 
     cli_dbgmsg("cli_pdf: returning %d\n", rc);
-    free(pdf.objs);
+    pdf_free_cache(&pdf);
+    pdf_free_objs(&pdf);
     free(pdf.fileID);
     free(pdf.key);
 
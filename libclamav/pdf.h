@@ -31,7 +31,8 @@ struct pdf_obj {
     uint32_t statsflags;
     uint32_t numfilters;
     uint32_t filterlist[PDF_FILTERLIST_MAX];
-    char *path;
+    char *decoded;      /* decoded contents kept from an earlier pdf_extract_obj() */
+    size_t decodedlen;
 };
 
 enum pdf_array_type { PDF_ARR_UNKNOWN=0, PDF_ARR_STRING, PDF_ARR_ARRAY, PDF_ARR_DICT };
@@ -126,6 +127,9 @@ enum enc_method {
 struct pdf_struct {
     struct pdf_obj *objs;
     unsigned nobjs;
+    unsigned maxobjs;
+    uint32_t *objhash;      /* index of objs by id, see pdf_index_objs() */
+    unsigned objhashbits;
     unsigned flags;
     unsigned enc_method_stream;
     unsigned enc_method_string;
@@ -144,9 +148,27 @@ struct pdf_struct {
     unsigned fileIDlen;
     char *key;
     unsigned keylen;
+    size_t cachesz;
     struct pdf_stats stats;
 };
 
+/*
+ * Output of pdf_extract_obj(). Decoded objects are kept in memory and
+ * scanned from there; anything larger than PDF_OUTPUT_MEMMAX is spilled
+ * to a temporary file in pdf->dir.
+ */
+#define PDF_OUTPUT_MEMMAX (16*1024*1024)
+/* Upper bound for the decoded object contents cached across pdf_extract_obj() calls */
+#define PDF_CACHE_MAX (32*1024*1024)
+
+struct pdf_output {
+    char *buf;
+    size_t len;
+    size_t size;
+    int fd;
+    char path[1024];
+};
+
 #define OBJ_FLAG_PDFNAME_NONE 0x0
 #define OBJ_FLAG_PDFNAME_DONE 0x1
 
@@ -156,7 +178,9 @@ struct pdf_struct {
 int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset);
 void pdf_parseobj(struct pdf_struct *pdf, struct pdf_obj *obj);
 int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags);
+int pdf_output_write(struct pdf_output *out, const char *buf, size_t len);
 int pdf_findobj(struct pdf_struct *pdf);
+void pdf_index_objs(struct pdf_struct *pdf);
 struct pdf_obj *find_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t objid);
 
 void pdf_handle_enc(struct pdf_struct *pdf);
@@ -61,12 +61,17 @@
 #include "pdf.h"
 #include "pdfdecode.h"
 #include "str.h"
+#include "decoders.h"
 #include "bytecode.h"
 #include "bytecode_api.h"
 #include "lzw/lzwdec.h"
+#include "inflate_iface.h"
 
 #define PDFTOKEN_FLAG_XREF 0x1
 
+/* largest single growth of a FlateDecode output buffer */
+#define PDF_FLATE_MAXGROW (1024 * 1024)
+
 struct pdf_token {
     uint32_t flags;    /* tracking flags */
     uint32_t success;  /* successfully decoded filters */
@@ -85,12 +90,12 @@ static  int filter_asciihexdecode(struct pdf_struct *pdf, struct pdf_obj *obj, s
 static  int filter_decrypt(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params, struct pdf_token *token, int mode);
 static  int filter_lzwdecode(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params, struct pdf_token *token);
 
-off_t pdf_decodestream(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params, const char *stream, uint32_t streamlen, int xref, int fout, int *rc)
+off_t pdf_decodestream(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dict *params, const char *stream, uint32_t streamlen, int xref, struct pdf_output *out, int *rc)
 {
     struct pdf_token *token;
     off_t rv;
 
-    if (!stream || !streamlen || fout < 0) {
+    if (!stream || !streamlen || !out) {
         cli_dbgmsg("cli_pdf: no filters or stream on obj %u %u\n", obj->id>>8, obj->id&0xff);
         if (rc)
             *rc = CL_ENULLARG;
@@ -138,10 +143,12 @@ off_t pdf_decodestream(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_d
 
     if (token->success) {
         if (!cli_checklimits("pdf", pdf->ctx, token->length, 0, 0)) {
-            if (cli_writen(fout, token->content, token->length) != token->length) {
+            if (pdf_output_write(out, (const char *)token->content, token->length) != (int)token->length) {
                 cli_errmsg("cli_pdf: failed to write output file\n");
                 if (rc)
                     *rc = CL_EWRITE;
+                free(token->content);
+                free(token);
                 return -1;
             }
             rv = token->length;
@@ -150,10 +157,12 @@ off_t pdf_decodestream(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_d
         if (!cli_checklimits("pdf", pdf->ctx, streamlen, 0, 0)) {
             cli_dbgmsg("cli_pdf: no non-forced filters decoded, returning raw stream\n");
 
-            if (cli_writen(fout, stream, streamlen) != streamlen) {
+            if (pdf_output_write(out, stream, streamlen) != (int)streamlen) {
                 cli_errmsg("cli_pdf: failed to write output file\n");
                 if (rc)
                     *rc = CL_EWRITE;
+                free(token->content);
+                free(token);
                 return -1;
             }
             rv = streamlen;
@@ -530,7 +539,7 @@ static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, struc
 
     uint8_t *content = (uint8_t *)token->content;
     uint32_t length = token->length;
-    z_stream stream;
+    struct cli_zstream stream;
     int zstat, skip = 0, rc = CL_SUCCESS;
 
     UNUSEDPARAM(params);
@@ -559,7 +568,7 @@ static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, struc
     stream.next_out = (Bytef *)decoded;
     stream.avail_out = BUFSIZ;
 
-    zstat = inflateInit(&stream);
+    zstat = cli_inflate_init(&stream, MAX_WBITS, pdf->ctx);
     if(zstat != Z_OK) {
         cli_warnmsg("cli_pdf: inflateInit failed\n");
         free(decoded);
@@ -567,14 +576,14 @@ static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, struc
     }
 
     /* initial inflate */
-    zstat = inflate(&stream, Z_NO_FLUSH);
+    zstat = cli_inflate(&stream, Z_NO_FLUSH);
     /* check if nothing written whatsoever */
     if ((zstat != Z_OK) && (stream.avail_out == BUFSIZ)) {
         /* skip till EOL, and try inflating from there, sometimes
          * PDFs contain extra whitespace */
         uint8_t *q = decode_nextlinestart(content, length);
         if (q) {
-            (void)inflateEnd(&stream);
+            (void)cli_inflate_end(&stream);
             length -= q - content;
             content = q;
 
@@ -583,7 +592,7 @@ static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, struc
             stream.next_out = (Bytef *)decoded;
             stream.avail_out = capacity;
 
-            zstat = inflateInit(&stream);
+            zstat = cli_inflate_init(&stream, MAX_WBITS, pdf->ctx);
             if(zstat != Z_OK) {
                 cli_warnmsg("cli_pdf: inflateInit failed\n");
                 free(decoded);
@@ -593,33 +602,34 @@ static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, struc
             pdfobj_flag(pdf, obj, BAD_FLATESTART);
         }
 
-        zstat = inflate(&stream, Z_NO_FLUSH);
+        zstat = cli_inflate(&stream, Z_NO_FLUSH);
     }
 
     while (zstat == Z_OK && stream.avail_in) {
-        /* extend output capacity if needed,*/
+        /* extend output capacity if needed, doubling it up to steps of
+         * PDF_FLATE_MAXGROW so large streams aren't copied over and over */
         if(stream.avail_out == 0) {
-            if ((rc = cli_checklimits("pdf", pdf->ctx, capacity+BUFSIZ, 0, 0)) != CL_SUCCESS)
+            uint32_t grow = MIN(capacity, PDF_FLATE_MAXGROW);
+
+            if ((rc = cli_checklimits("pdf", pdf->ctx, capacity+grow, 0, 0)) != CL_SUCCESS)
                 break;
 
-            if (!(temp = cli_realloc(decoded, capacity + BUFSIZ))) {
+            if (!(temp = cli_realloc(decoded, capacity + grow))) {
                 cli_errmsg("cli_pdf: cannot reallocate memory for decoded output\n");
                 rc = CL_EMEM;
                 break;
             }
             decoded = temp;
             stream.next_out = decoded + capacity;
-            stream.avail_out = BUFSIZ;
-            declen += BUFSIZ;
-            capacity += BUFSIZ;
+            stream.avail_out = grow;
+            capacity += grow;
         }
 
         /* continue inflation */
-        zstat = inflate(&stream, Z_NO_FLUSH);
+        zstat = cli_inflate(&stream, Z_NO_FLUSH);
     }
 
-    /* add stream end fragment to decoded length */
-    declen += (BUFSIZ - stream.avail_out);
+    declen = stream.next_out - decoded;
 
     /* error handling */
     switch(zstat) {
@@ -655,7 +665,7 @@ static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, struc
         break;
     }
 
-    (void)inflateEnd(&stream);
+    (void)cli_inflate_end(&stream);
 
     if (rc == CL_SUCCESS) {
         free(token->content);
@@ -677,7 +687,7 @@ static int filter_asciihexdecode(struct pdf_struct *pdf, struct pdf_obj *obj, st
 
     const uint8_t *content = (uint8_t *)token->content;
     uint32_t length = token->length;
-    uint32_t i, j;
+    size_t i, j;
     int rc = CL_SUCCESS;
 
     if (!(decoded = (uint8_t *)cli_calloc(length/2 + 1, sizeof(uint8_t)))) {
@@ -685,24 +695,10 @@ static int filter_asciihexdecode(struct pdf_struct *pdf, struct pdf_obj *obj, st
         return CL_EMEM;
     }
 
-    for (i = 0, j = 0; i+1 < length; i++) {
-        if (content[i] == ' ')
-            continue;
-
-        if (content[i] == '>')
-            break;
-
-        if (cli_hex2str_to((const char *)content+i, (char *)decoded+j, 2) == -1) {
-            if (length - i < 4)
-                continue;
-
-            rc = CL_EFORMAT;
-            break;
-        }
-
-        i++;
-        j++;
-    }
+    /* stops at the EOD marker, or at the first character that isn't hex or white space */
+    j = cli_hex_decode(content, length, decoded, &i);
+    if (i < length && content[i] != '>' && length - i >= 4)
+        rc = CL_EFORMAT;
 
     if (rc == CL_SUCCESS) {
         free(token->content);
@@ -429,9 +429,7 @@ char *pdf_parse_string(struct pdf_struct *pdf, struct pdf_obj *obj, const char *
     if (is_object_reference(p1, &p2, &objid)) {
         struct pdf_obj *newobj;
         char *begin, *p3;
-        STATBUF sb;
         uint32_t objflags;
-        int fd;
         size_t objsize2;
 
         newobj = find_obj(pdf, obj, objid);
@@ -457,90 +455,44 @@ char *pdf_parse_string(struct pdf_struct *pdf, struct pdf_obj *obj, const char *
 
         newobj->flags = objflags;
 
-        if (!(newobj->path))
+        if (!(newobj->decoded))
             return NULL;
 
-        fd = open(newobj->path, O_RDONLY);
-        if (fd == -1) {
-            cli_unlink(newobj->path);
-            free(newobj->path);
-            newobj->path = NULL;
-            return NULL;
+        begin = newobj->decoded;
+        p3 = begin;
+        objsize2 = newobj->decodedlen;
+        while ((size_t)(p3 - begin) < objsize2 && isspace(p3[0])) {
+            p3++;
+            objsize2--;
         }
 
-        if (FSTAT(fd, &sb)) {
-            close(fd);
-            cli_unlink(newobj->path);
-            free(newobj->path);
-            newobj->path = NULL;
-            return NULL;
-        }
-
-        if (sb.st_size) {
-            begin = calloc(1, sb.st_size+1);
-            if (!(begin)) {
-                close(fd);
-                cli_unlink(newobj->path);
-                free(newobj->path);
-                newobj->path = NULL;
-                return NULL;
-            }
-
-            if (read(fd, begin, sb.st_size) != sb.st_size) {
-                close(fd);
-                cli_unlink(newobj->path);
-                free(newobj->path);
-                newobj->path = NULL;
-                free(begin);
-                return NULL;
-            }
+        switch (*p3) {
+            case '(':
+            case '<':
+                res = pdf_parse_string(pdf, obj, p3, objsize2, NULL, NULL, meta);
+                break;
+            default:
+                res = pdf_finalize_string(pdf, obj, begin, objsize2);
+                if (!res) {
+                    res = cli_calloc(1, objsize2+1);
+                    if (!(res))
+                        return NULL;
 
-            p3 = begin;
-            objsize2 = sb.st_size;
-            while ((size_t)(p3 - begin) < objsize2 && isspace(p3[0])) {
-                p3++;
-                objsize2--;
-            }
+                    memcpy(res, begin, objsize2);
+                    res[objsize2] = '\0';
 
-            switch (*p3) {
-                case '(':
-                case '<':
-                    res = pdf_parse_string(pdf, obj, p3, objsize2, NULL, NULL, meta);
-                    break;
-                default:
-                    res = pdf_finalize_string(pdf, obj, begin, objsize2);
-                    if (!res) {
-                        res = cli_calloc(1, objsize2+1);
-                        if (!(res)) {
-                            close(fd);
-                            cli_unlink(newobj->path);
-                            free(newobj->path);
-                            newobj->path = NULL;
-                            free(begin);
-                            return NULL;
-                        }
-                        memcpy(res, begin, objsize2);
-                        res[objsize2] = '\0';
-
-                        if (meta) {
-                            meta->length = objsize2;
-                            meta->obj = obj;
-                            meta->success = 0;
-                        }
-                    } else if (meta) {
-                        meta->length = strlen(res);
+                    if (meta) {
+                        meta->length = objsize2;
                         meta->obj = obj;
-                        meta->success = 1;
+                        meta->success = 0;
                     }
-            }
-            free(begin);
+                } else if (meta) {
+                    meta->length = strlen(res);
+                    meta->obj = obj;
+                    meta->success = 1;
+                }
         }
 
-        close(fd);
-        cli_unlink(newobj->path);
-        free(newobj->path);
-        newobj->path = NULL;
-
         if (endchar)
             *endchar = p2;
 
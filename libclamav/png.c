@@ -37,6 +37,7 @@
 #include "clamav.h"
 #include "others.h"
 #include "png.h"
+#include "inflate_iface.h"
 
 typedef unsigned char  uch;
 typedef unsigned short ush;
@@ -348,7 +349,7 @@ int cli_parsepng(cli_ctx *ctx)
   int check_zlib = 1;           /* validate zlib stream (just IDATs for now) */
   unsigned zlib_windowbits = 15;
   uch outbuf[BS];
-  z_stream zstrm;
+  struct cli_zstream zstrm;
   unsigned int offset = 0;
   fmap_t *map = *ctx->fmap;
 
@@ -593,10 +594,7 @@ int cli_parsepng(cli_ctx *ctx)
         if (first_idat) {
           zstrm.next_out = p = outbuf;
           zstrm.avail_out = BS;
-          zstrm.zalloc = (alloc_func)Z_NULL;
-          zstrm.zfree = (free_func)Z_NULL;
-          zstrm.opaque = (voidpf)Z_NULL;
-          if ((err = inflateInit2(&zstrm, zlib_windowbits)) != Z_OK) {
+          if ((err = cli_inflate_init(&zstrm, zlib_windowbits, ctx)) != Z_OK) {
             cli_dbgmsg("PNG: zlib: can't initialize (error = %d)\n", err);
 	    return CL_EUNPACK;
           }
@@ -639,10 +637,10 @@ int cli_parsepng(cli_ctx *ctx)
 
         while (err != Z_STREAM_END && zstrm.avail_in > 0) {
           /* know zstrm.avail_out > 0:  get some image/filter data */
-          err = inflate(&zstrm, Z_SYNC_FLUSH);
+          err = cli_inflate(&zstrm, Z_SYNC_FLUSH);
           if (err != Z_OK && err != Z_STREAM_END) {
             cli_dbgmsg("PNG: zlib: inflate error\n");
-	    inflateEnd(&zstrm);
+	    cli_inflate_end(&zstrm);
 	    return CL_EPARSE;
           }
 
@@ -658,13 +656,13 @@ int cli_parsepng(cli_ctx *ctx)
                 if (numfilt_this_block == 0) {
                   /* warn only on first one per block; don't break */
                   cli_dbgmsg("PNG: private (invalid?) row-filter type (%d)\n", filttype);
-		  inflateEnd(&zstrm);
+		  cli_inflate_end(&zstrm);
                   return CL_EPARSE;
                 }
               } else if (filttype > 4) {
                 if (lace <= 1) {
                   cli_dbgmsg("PNG: invalid row-filter type (%d)\n", filttype);
-		  inflateEnd(&zstrm);
+		  cli_inflate_end(&zstrm);
                   return CL_EPARSE;
                 } /* else assume it's due to unknown interlace method */
                 break;
@@ -708,7 +706,7 @@ int cli_parsepng(cli_ctx *ctx)
                     cur_linebytes = 0;	/* GRP 20000727:  added fix */
               }
             } else if (cur_y >= h) {
-                inflateEnd(&zstrm);
+                cli_inflate_end(&zstrm);
 		if(eod - p > 0) {
 		    cli_dbgmsg("PNG:  %d bytes remaining in buffer before inflateEnd()", eod-p);
 		    return CL_EPARSE;
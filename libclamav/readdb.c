@@ -78,6 +78,7 @@
 #include "bytecode_priv.h"
 #include "cache.h"
 #include "openioc.h"
+#include "delta.h"
 
 #ifdef CL_THREAD_SAFE
 #  include <pthread.h>
@@ -677,18 +678,10 @@ char *cli_dbgets(char *buff, unsigned int size, FILE *fs, struct cli_dbio *dbio)
 		if(!dbio->size)
 		    return NULL;
 
-		if(dbio->gzs) {
-		    bread = gzread(dbio->gzs, dbio->readpt, dbio->readsize);
-		    if(bread == -1) {
-			cli_errmsg("cli_dbgets: gzread() failed\n");
-			return NULL;
-		    }
-		} else {
-		    bread = fread(dbio->readpt, 1, dbio->readsize, dbio->fs);
-		    if(!bread && ferror(dbio->fs)) {
-			cli_errmsg("cli_dbgets: fread() failed\n");
-			return NULL;
-		    }
+		bread = cli_dbio_read(dbio, dbio->readpt, dbio->readsize);
+		if(bread == -1) {
+		    cli_errmsg("cli_dbgets: Can't read database data\n");
+		    return NULL;
 		}
 		if(!bread)
 		    return NULL;
@@ -4889,6 +4882,32 @@ int cl_statfree(struct cl_stat *dbstat)
     return CL_SUCCESS;
 }
 
+void cli_freeroot(struct cl_engine *engine, struct cli_matcher *root)
+{
+	unsigned int i;
+
+
+    if(!root)
+	return;
+
+    if(!root->ac_only)
+	cli_bm_free(root);
+    cli_ac_free(root);
+    if(root->ac_lsigtable) {
+	for(i = 0; i < root->ac_lsigs; i++) {
+	    if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL)
+		mpool_free(engine->mempool, root->ac_lsigtable[i]->u.logic);
+	    FREE_TDB(root->ac_lsigtable[i]->tdb);
+	    mpool_free(engine->mempool, root->ac_lsigtable[i]);
+	}
+	mpool_free(engine->mempool, root->ac_lsigtable);
+    }
+#if HAVE_PCRE
+    cli_pcre_freetable(root);
+#endif /* HAVE_PCRE */
+    mpool_free(engine->mempool, root);
+}
+
 int cl_engine_free(struct cl_engine *engine)
 {
 	unsigned int i, j;
@@ -4914,6 +4933,14 @@ int cl_engine_free(struct cl_engine *engine)
 	return CL_SUCCESS;
     }
 
+    if(engine->delta_base) {
+#ifdef CL_THREAD_SAFE
+	pthread_mutex_unlock(&cli_ref_mutex);
+#endif
+	cli_delta_free(engine);
+	return CL_SUCCESS;
+    }
+
     if (engine->cb_stats_submit)
         engine->cb_stats_submit(engine, engine->stats_data);
 
@@ -4930,27 +4957,11 @@ int cl_engine_free(struct cl_engine *engine)
         free(engine->stats_data);
 
     if(engine->root) {
-	for(i = 0; i < CLI_MTARGETS; i++) {
-	    if((root = engine->root[i])) {
-		if(!root->ac_only)
-		    cli_bm_free(root);
-		cli_ac_free(root);
-		if(root->ac_lsigtable) {
-		    for(j = 0; j < root->ac_lsigs; j++) {
-			if (root->ac_lsigtable[j]->type == CLI_LSIG_NORMAL)
-			    mpool_free(engine->mempool, root->ac_lsigtable[j]->u.logic);
-			FREE_TDB(root->ac_lsigtable[j]->tdb);
-			mpool_free(engine->mempool, root->ac_lsigtable[j]);
-		    }
-		    mpool_free(engine->mempool, root->ac_lsigtable);
-		}
-#if HAVE_PCRE
-                cli_pcre_freetable(root);
-#endif /* HAVE_PCRE */
-		mpool_free(engine->mempool, root);
-	    }
-	}
+	for(i = 0; i < CLI_MTARGETS; i++)
+	    cli_freeroot(engine, engine->root[i]);
 	mpool_free(engine->mempool, engine->root);
+	/* cached match state was sized for these roots */
+	cli_ac_dropcache();
     }
 
     if((root = engine->hm_hdb)) {
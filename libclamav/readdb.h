@@ -120,6 +120,8 @@ char *cli_dbgets(char *buff, unsigned int size, FILE *fs, struct cli_dbio *dbio)
 
 int cli_initroots(struct cl_engine *engine, unsigned int options);
 
+void cli_freeroot(struct cl_engine *engine, struct cli_matcher *root);
+
 #ifdef HAVE_YARA
 int cli_yara_init(struct cl_engine *engine);
 
@@ -240,8 +240,13 @@ static int decode_and_scan(struct rtf_object_data* data, cli_ctx* ctx)
 
 	cli_dbgmsg("RTF:Scanning embedded object:%s\n",data->name);
 	if(data->bread == 1 && data->fd > 0) {
+		fmap_t *map;
+
 		cli_dbgmsg("Decoding ole object\n");
-		ret = cli_scan_ole10(data->fd, ctx);
+		if((map = fmap(data->fd, 0, 0))) {
+			ret = cli_scan_ole10(map, ctx);
+			funmap(map);
+		}
 	}
 	else if(data->fd > 0)
 		ret = cli_magic_scandesc(data->fd,ctx);
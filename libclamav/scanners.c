@@ -97,6 +97,8 @@
 #include "xar.h"
 #include "hfsplus.h"
 #include "xz_iface.h"
+#include "inflate_iface.h"
+#include "dsink.h"
 #include "mbr.h"
 #include "gpt.h"
 #include "apm.h"
@@ -543,76 +545,82 @@ static int cli_scangzip_with_zib_from_the_80s(cli_ctx *ctx, unsigned char *buff)
 
 static int cli_scangzip(cli_ctx *ctx)
 {
-	int fd, ret = CL_CLEAN;
+	int ret = CL_CLEAN, rc;
 	unsigned char buff[FILEBUFF];
-	char *tmpname;
-	z_stream z;
-	size_t at = 0, outsize = 0;
+	struct cli_dsink sink;
+	struct cli_zstream z;
+	size_t at = 0, avail;
 	fmap_t *map = *ctx->fmap;
+	const unsigned char *src;
+	uint32_t isize;
  	
     cli_dbgmsg("in cli_scangzip()\n");
 
     memset(&z, 0, sizeof(z));
-    if((ret = inflateInit2(&z, MAX_WBITS + 16)) != Z_OK) {
+    if((ret = cli_inflate_init(&z, MAX_WBITS + 16, ctx)) != Z_OK) {
 	cli_dbgmsg("GZip: InflateInit failed: %d\n", ret);
 	return cli_scangzip_with_zib_from_the_80s(ctx, buff);
     }
 
-    if((ret = cli_gentempfd(ctx->engine->tmpdir, &tmpname, &fd)) != CL_SUCCESS) {
-	cli_dbgmsg("GZip: Can't generate temporary file.\n");
-	inflateEnd(&z);
-	return ret;
+    cli_dsink_init(&sink, ctx, "GZip", NULL);
+
+    /* a single member file ends with its decompressed size */
+    if(cli_inflate_native() && map->len > 18 && (src = fmap_need_off_once(map, map->len - 4, 4)) &&
+       (isize = le32_to_host(cli_readint32(src))) <= CLI_DSINK_MEMMAX && (src = fmap_need_off_once(map, 0, map->len))) {
+	rc = cli_dsink_inflate(&sink, src, map->len, isize, MAX_WBITS + 16);
+	if(rc == CL_SUCCESS || rc == CL_BREAK) {
+	    at = map->len;
+	} else if(rc != CL_EUNPACK) {
+	    cli_inflate_end(&z);
+	    cli_dsink_close(&sink);
+	    return rc;
+	}
     }
 
     while (at < map->len) {
 	unsigned int bytes = MIN(map->len - at, map->pgsz);
 	if(!(z.next_in = (void*)fmap_need_off_once(map, at, bytes))) {
 	    cli_dbgmsg("GZip: Can't read %u bytes @ %lu.\n", bytes, (long unsigned)at);
-	    inflateEnd(&z);
-	    close(fd);
-	    if (cli_unlink(tmpname)) {
-		free(tmpname);
+	    cli_inflate_end(&z);
+	    if (cli_dsink_close(&sink))
 		return CL_EUNLINK;
-	    }
-	    free(tmpname);
 	    return CL_EREAD;
 	}
 	at += bytes;
 	z.avail_in = bytes;
 	do {
 	    int inf;
-	    z.avail_out = sizeof(buff);
-            z.next_out = buff;
-	    inf = inflate(&z, Z_NO_FLUSH);
+	    unsigned int in = z.avail_in;
+	    if(!(z.next_out = cli_dsink_space(&sink, &avail))) {
+		cli_inflate_end(&z);
+		cli_dsink_close(&sink);
+		return CL_EMEM;
+	    }
+	    z.avail_out = avail;
+	    inf = cli_inflate(&z, Z_NO_FLUSH);
 	    if(inf != Z_OK && inf != Z_STREAM_END && inf != Z_BUF_ERROR) {
-		if (sizeof(buff) == z.avail_out) {
+		if (avail == z.avail_out) {
 		    cli_dbgmsg("GZip: Bad stream, nothing in output buffer.\n");
 		    at = map->len;
 		    break;
 		}
 		else {
 		    cli_dbgmsg("GZip: Bad stream, data in output buffer.\n");
-		    /* no break yet, flush extracted bytes to file */
+		    /* no break yet, keep the extracted bytes */
 		}
 	    }
-	    if(cli_writen(fd, buff, sizeof(buff) - z.avail_out) < 0) {
-		inflateEnd(&z);	    
-		close(fd);
-		if (cli_unlink(tmpname)) {
-		    free(tmpname);
-		    return CL_EUNLINK;
-		}
-		free(tmpname);
-		return CL_EWRITE;
-	    }
-	    outsize += sizeof(buff) - z.avail_out;
-	    if(cli_checklimits("GZip", ctx, outsize, 0, 0)!=CL_CLEAN) {
+	    rc = cli_dsink_commit(&sink, avail - z.avail_out, in - z.avail_in);
+	    if(rc == CL_BREAK) {
 		at = map->len;
 		break;
+	    } else if(rc != CL_SUCCESS) {
+		cli_inflate_end(&z);
+		cli_dsink_close(&sink);
+		return rc;
 	    }
 	    if(inf == Z_STREAM_END) {
 		at -= z.avail_in;
-		inflateReset(&z);
+		cli_inflate_reset(&z);
 		break;
 	    }
 	    else if(inf != Z_OK && inf != Z_BUF_ERROR) {
@@ -622,24 +630,13 @@ static int cli_scangzip(cli_ctx *ctx)
 	} while (z.avail_out == 0);
     }
 
-    inflateEnd(&z);	    
+    cli_inflate_end(&z);	    
 
-    if((ret = cli_magic_scandesc(fd, ctx)) == CL_VIRUS) {
+    if((ret = cli_dsink_scan(&sink)) == CL_VIRUS)
 	cli_dbgmsg("GZip: Infected with %s\n", cli_get_last_virus(ctx));
-	close(fd);
-	if(!ctx->engine->keeptmp) {
-	    if (cli_unlink(tmpname)) {
-	    	free(tmpname);
-		return CL_EUNLINK;
-	    }
-	}
-	free(tmpname);
-	return CL_VIRUS;
-    }
-    close(fd);
-    if(!ctx->engine->keeptmp)
-	if (cli_unlink(tmpname)) ret = CL_EUNLINK;
-    free(tmpname);
+
+    if(cli_dsink_close(&sink) && ret != CL_VIRUS)
+	ret = CL_EUNLINK;
     return ret;
 }
 
@@ -659,28 +656,21 @@ static int cli_scanbzip(cli_ctx *ctx) {
 
 static int cli_scanbzip(cli_ctx *ctx)
 {
-    int ret = CL_CLEAN, fd, rc;
-    unsigned long int size = 0;
-    char *tmpname;
+    int ret = CL_CLEAN, rc;
+    struct cli_dsink sink;
     bz_stream strm;
     size_t off = 0;
     size_t avail;
-    char buf[FILEBUFF];
+    unsigned int in, out;
 
     memset(&strm, 0, sizeof(strm));
-    strm.next_out = buf;
-    strm.avail_out = sizeof(buf);
     rc = BZ2_bzDecompressInit(&strm, 0, 0);
     if (BZ_OK != rc) {
 	cli_dbgmsg("Bzip: DecompressInit failed: %d\n", rc);
 	return CL_EOPEN;
     }
 
-    if((ret = cli_gentempfd(ctx->engine->tmpdir, &tmpname, &fd))) {
-	cli_dbgmsg("Bzip: Can't generate temporary file.\n");
-	BZ2_bzDecompressEnd(&strm);
-	return ret;
-    }
+    cli_dsink_init(&sink, ctx, "Bzip", NULL);
 
     do {
 	if (!strm.avail_in) {
@@ -693,57 +683,38 @@ static int cli_scanbzip(cli_ctx *ctx)
 	    }
 	}
 
+	if (!(strm.next_out = (char *)cli_dsink_space(&sink, &avail))) {
+	    BZ2_bzDecompressEnd(&strm);
+	    cli_dsink_close(&sink);
+	    return CL_EMEM;
+	}
+	strm.avail_out = out = avail;
+	in = strm.avail_in;
+
 	rc = BZ2_bzDecompress(&strm);
 	if (BZ_OK != rc && BZ_STREAM_END != rc) {
 	    cli_dbgmsg("Bzip: decompress error: %d\n", rc);
 	    break;
 	}
 
-	if (!strm.avail_out || BZ_STREAM_END == rc) {
-
-	    size += sizeof(buf) - strm.avail_out;
-
-	    if(cli_writen(fd, buf, sizeof(buf) - strm.avail_out) != sizeof(buf) - strm.avail_out) {
-		cli_dbgmsg("Bzip: Can't write to file.\n");
-		BZ2_bzDecompressEnd(&strm);
-		close(fd);
-		if(!ctx->engine->keeptmp) {
-		    if (cli_unlink(tmpname)) {
-			free(tmpname);
-			return CL_EUNLINK;
-		    }
-		}
-		free(tmpname);
-		return CL_EWRITE;
-	    }
-
-	    if(cli_checklimits("Bzip", ctx, size, 0, 0) != CL_CLEAN)
-		break;
-
-	    strm.next_out = buf;
-	    strm.avail_out = sizeof(buf);
+	ret = cli_dsink_commit(&sink, out - strm.avail_out, in - strm.avail_in);
+	if (ret == CL_BREAK) {
+	    ret = CL_CLEAN;
+	    break;
+	} else if (ret != CL_SUCCESS) {
+	    BZ2_bzDecompressEnd(&strm);
+	    cli_dsink_close(&sink);
+	    return ret;
 	}
     } while (BZ_STREAM_END != rc);
 
     BZ2_bzDecompressEnd(&strm);
 
-    if((ret = cli_magic_scandesc(fd, ctx)) == CL_VIRUS ) {
+    if((ret = cli_dsink_scan(&sink)) == CL_VIRUS)
 	cli_dbgmsg("Bzip: Infected with %s\n", cli_get_last_virus(ctx));
-	close(fd);
-	if(!ctx->engine->keeptmp) {
-	    if (cli_unlink(tmpname)) {
-		ret = CL_EUNLINK;
-		free(tmpname);
-		return ret;
-	    }
-	}
-	free(tmpname);
-	return CL_VIRUS;
-    }
-    close(fd);
-    if(!ctx->engine->keeptmp)
-	if (cli_unlink(tmpname)) ret = CL_EUNLINK;
-    free(tmpname);
+
+    if(cli_dsink_close(&sink) && ret != CL_VIRUS)
+	ret = CL_EUNLINK;
 
     return ret;
 }
@@ -751,36 +722,21 @@ static int cli_scanbzip(cli_ctx *ctx)
 
 static int cli_scanxz(cli_ctx *ctx)
 {
-    int ret = CL_CLEAN, fd, rc;
-    unsigned long int size = 0;
-    char *tmpname;
+    int ret = CL_CLEAN, rc;
+    struct cli_dsink sink;
     struct CLI_XZ strm;
     size_t off = 0;
     size_t avail;
-    unsigned char *buf;
+    SizeT in, out;
 
-    buf = cli_malloc(CLI_XZ_OBUF_SIZE);
-    if (buf == NULL) {
-	cli_errmsg("cli_scanxz: nomemory for decompress buffer.\n");
-        return CL_EMEM;
-    }
     memset(&strm, 0x00, sizeof(struct CLI_XZ));
-    strm.next_out = buf;
-    strm.avail_out = CLI_XZ_OBUF_SIZE;
     rc = cli_XzInit(&strm);
     if (rc != XZ_RESULT_OK) {
 	cli_errmsg("cli_scanxz: DecompressInit failed: %i\n", rc);
-        free(buf);
 	return CL_EOPEN;
     }
 
-    if ((ret = cli_gentempfd(ctx->engine->tmpdir, &tmpname, &fd))) {
-	cli_errmsg("cli_scanxz: Can't generate temporary file.\n");
-	cli_XzShutdown(&strm);
-        free(buf);
-	return ret;
-    }
-    cli_dbgmsg("cli_scanxz: decompressing to file %s\n", tmpname);
+    cli_dsink_init(&sink, ctx, "cli_scanxz", NULL);
 
     do {
         /* set up input buffer */
@@ -795,6 +751,14 @@ static int cli_scanxz(cli_ctx *ctx)
 	    }
 	}
 
+        /* decompress straight into the sink */
+	if (!(strm.next_out = cli_dsink_space(&sink, &avail))) {
+            ret = CL_EMEM;
+            goto xz_exit;
+	}
+	strm.avail_out = out = avail;
+	in = strm.avail_in;
+
         /* xz decompress a chunk */
 	rc = cli_XzDecode(&strm);
 	if (XZ_RESULT_OK != rc && XZ_STREAM_END != rc) {
@@ -802,45 +766,26 @@ static int cli_scanxz(cli_ctx *ctx)
             ret = CL_EFORMAT;
             goto xz_exit;
 	}
-        //cli_dbgmsg("cli_scanxz: xz decompressed %li of %li available bytes\n",
-        //           avail - strm.avail_in, avail);
-        
-        /* write decompress buffer */
-	if (!strm.avail_out || rc == XZ_STREAM_END) {            
-	    size_t towrite = CLI_XZ_OBUF_SIZE - strm.avail_out;
-	    size += towrite;
-
-            //cli_dbgmsg("Writing %li bytes to XZ decompress temp file(%li byte total)\n",
-            //           towrite, size);
-
-	    if((size_t)cli_writen(fd, buf, towrite) != towrite) {
-		cli_errmsg("cli_scanxz: Can't write to file.\n");
-                ret = CL_EWRITE;
-                goto xz_exit;
-	    }
-	    if (cli_checklimits("cli_scanxz", ctx, size, 0, 0) != CL_CLEAN) {
-                cli_warnmsg("cli_scanxz: decompress file size exceeds limits - "
-                            "only scanning %li bytes\n", size);
-		break;
-            }
-	    strm.next_out = buf;
-	    strm.avail_out = CLI_XZ_OBUF_SIZE;
+
+	ret = cli_dsink_commit(&sink, out - strm.avail_out, in - strm.avail_in);
+	if (ret == CL_BREAK) {
+            cli_warnmsg("cli_scanxz: decompress file size exceeds limits - "
+                        "only scanning %lu bytes\n", (unsigned long)sink.len);
+            break;
+	} else if (ret != CL_SUCCESS) {
+            goto xz_exit;
 	}
     } while (XZ_STREAM_END != rc);
 
-    /* scan decompressed file */
-    if ((ret = cli_magic_scandesc(fd, ctx)) == CL_VIRUS ) {
+    /* scan decompressed data */
+    if ((ret = cli_dsink_scan(&sink)) == CL_VIRUS ) {
 	cli_dbgmsg("cli_scanxz: Infected with %s\n", cli_get_last_virus(ctx));
     }
 
  xz_exit:
     cli_XzShutdown(&strm);
-    close(fd);
-    if(!ctx->engine->keeptmp)
-	if (cli_unlink(tmpname) && ret == CL_CLEAN)
-            ret = CL_EUNLINK;
-    free(tmpname);
-    free(buf);
+    if (cli_dsink_close(&sink) && ret == CL_CLEAN)
+        ret = CL_EUNLINK;
     return ret;
 }
 
@@ -914,40 +859,29 @@ static int vba_scandata(const unsigned char *data, unsigned int len, cli_ctx *ct
     return (ret != CL_CLEAN)?ret:viruses_found?CL_VIRUS:CL_CLEAN;
 }
 
-static int cli_vba_scandir(const char *dirname, cli_ctx *ctx, struct uniq *U)
+static int cli_vba_scandir(struct ole2_vfs *vfs, uint32_t storage, cli_ctx *ctx)
 {
-	int ret = CL_CLEAN, i, j, fd, data_len, hasmacros = 0;
+	int ret = CL_CLEAN, i, j, data_len, hasmacros = 0;
 	vba_project_t *vba_project;
-	DIR *dd;
-	struct dirent *dent;
-#if defined(HAVE_READDIR_R_3) || defined(HAVE_READDIR_R_2)
-	union {
-	    struct dirent d;
-	    char b[offsetof(struct dirent, d_name) + NAME_MAX + 1];
-	} result;
-#endif
-	STATBUF statbuf;
-	char *fullname, vbaname[1024];
+	fmap_t *map;
+	char *fullname;
 	unsigned char *data;
-	char *hash;
 	uint32_t hashcnt;
 	unsigned int viruses_found = 0;
 
 
-    cli_dbgmsg("VBADir: %s\n", dirname);
-    hashcnt = uniq_get(U, "_vba_project", 12, NULL);
+    cli_dbgmsg("VBADir: storage %u\n", storage);
+    hashcnt = cli_ole2_vfs_count(vfs, storage, "_vba_project");
     while(hashcnt--) {
-	if(!(vba_project = (vba_project_t *)cli_vba_readdir(dirname, U, hashcnt))) continue;
+	if(!(vba_project = (vba_project_t *)cli_vba_readdir(vfs, storage, hashcnt))) continue;
 
 	for(i = 0; i < vba_project->count; i++) {
 	    for(j = 0; (unsigned int)j < vba_project->colls[i]; j++) {
-		snprintf(vbaname, 1024, "%s"PATHSEP"%s_%u", vba_project->dir, vba_project->name[i], j);
-		vbaname[sizeof(vbaname)-1] = '\0';
-		fd = open(vbaname, O_RDONLY|O_BINARY);
-		if(fd == -1) continue;
+		map = cli_ole2_vfs_map(vfs, storage, vba_project->name[i], j);
+		if(!map) continue;
 		cli_dbgmsg("VBADir: Decompress VBA project '%s_%u'\n", vba_project->name[i], j);
-		data = (unsigned char *)cli_vba_inflate(fd, vba_project->offset[i], &data_len);
-		close(fd);
+		data = (unsigned char *)cli_vba_inflate(map, vba_project->offset[i], &data_len);
+		funmap(map);
 		hasmacros++;
 		if(!data) {
 		    cli_dbgmsg("VBADir: WARNING: VBA project '%s_%u' decompressed to NULL\n", vba_project->name[i], j);
@@ -961,16 +895,21 @@ static int cli_vba_scandir(const char *dirname, cli_ctx *ctx, struct uniq *U)
 
 			if ((ret = cli_gentempfd(ctx->engine->tmpdir, &tempfile, &of)) != CL_SUCCESS) {
 			    cli_warnmsg("VBADir: WARNING: VBA project '%s_%u' cannot be dumped to file\n", vba_project->name[i], j);
+			    free(data);
+			    cli_free_vba_project(vba_project);
 			    return ret;
 			}
 			if (cli_writen(of, data, data_len) != data_len) {
 			    cli_warnmsg("VBADir: WARNING: VBA project '%s_%u' failed to write to file\n", vba_project->name[i], j);
 			    close(of);
 			    free(tempfile);
+			    free(data);
+			    cli_free_vba_project(vba_project);
 			    return CL_EWRITE;
 			}
 
 			cli_dbgmsg("VBADir: VBA project '%s_%u' dumped to %s\n", vba_project->name[i], j, tempfile);
+			close(of);
 			free(tempfile);
 		    }
 
@@ -988,23 +927,17 @@ static int cli_vba_scandir(const char *dirname, cli_ctx *ctx, struct uniq *U)
 	    }
 	}
 
-	free(vba_project->name);
-	free(vba_project->colls);
-	free(vba_project->dir);
-	free(vba_project->offset);
-	free(vba_project);
+	cli_free_vba_project(vba_project);
 	if (ret == CL_VIRUS && !SCAN_ALL)
 	    break;
     }
 
     if((ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) && 
-	(hashcnt = uniq_get(U, "powerpoint document", 19, &hash))) {
+	(hashcnt = cli_ole2_vfs_count(vfs, storage, "powerpoint document"))) {
 	while(hashcnt--) {
-	    snprintf(vbaname, 1024, "%s"PATHSEP"%s_%u", dirname, hash, hashcnt);
-	    vbaname[sizeof(vbaname)-1] = '\0';
-	    fd = open(vbaname, O_RDONLY|O_BINARY);
-	    if (fd == -1) continue;
-	    if ((fullname = cli_ppt_vba_read(fd, ctx))) {
+	    map = cli_ole2_vfs_map(vfs, storage, "powerpoint document", hashcnt);
+	    if (!map) continue;
+	    if ((fullname = cli_ppt_vba_read(map, ctx))) {
 		if(cli_scandir(fullname, ctx) == CL_VIRUS) {
 		    ret = CL_VIRUS;
 		    viruses_found++;
@@ -1013,28 +946,26 @@ static int cli_vba_scandir(const char *dirname, cli_ctx *ctx, struct uniq *U)
 		    cli_rmdirs(fullname);
 		free(fullname);
 	    }
-	    close(fd);
+	    funmap(map);
 	}
     }
 
     if ((ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) && 
-	(hashcnt = uniq_get(U, "worddocument", 12, &hash))) {
+	(hashcnt = cli_ole2_vfs_count(vfs, storage, "worddocument"))) {
 	while(hashcnt--) {
-	    snprintf(vbaname, sizeof(vbaname), "%s"PATHSEP"%s_%u", dirname, hash, hashcnt);
-	    vbaname[sizeof(vbaname)-1] = '\0';
-	    fd = open(vbaname, O_RDONLY|O_BINARY);
-	    if (fd == -1) continue;
+	    map = cli_ole2_vfs_map(vfs, storage, "worddocument", hashcnt);
+	    if (!map) continue;
 	    
-	    if (!(vba_project = (vba_project_t *)cli_wm_readdir(fd))) {
-		close(fd);
+	    if (!(vba_project = (vba_project_t *)cli_wm_readdir(map))) {
+		funmap(map);
 		continue;
 	    }
 
 	    for (i = 0; i < vba_project->count; i++) {
 		cli_dbgmsg("VBADir: Decompress WM project macro:%d key:%d length:%d\n", i, vba_project->key[i], vba_project->length[i]);
-		data = (unsigned char *)cli_wm_decrypt_macro(fd, vba_project->offset[i], vba_project->length[i], vba_project->key[i]);
+		data = (unsigned char *)cli_wm_decrypt_macro(map, vba_project->offset[i], vba_project->length[i], vba_project->key[i]);
 		if(!data) {
-			cli_dbgmsg("VBADir: WARNING: WM project '%s' macro %d decrypted to NULL\n", vba_project->name[i], i);
+			cli_dbgmsg("VBADir: WARNING: WM project macro %d decrypted to NULL\n", i);
 		} else {
 			cli_dbgmsg("Project content:\n%s", data);
 			if(ctx->scanned)
@@ -1052,14 +983,8 @@ static int cli_vba_scandir(const char *dirname, cli_ctx *ctx, struct uniq *U)
 		}
 	    }
 
-	    close(fd);
-	    free(vba_project->name);
-	    free(vba_project->colls);
-	    free(vba_project->dir);
-	    free(vba_project->offset);
-	    free(vba_project->key);
-	    free(vba_project->length);
-	    free(vba_project);
+	    funmap(map);
+	    cli_free_vba_project(vba_project);
 	    if(ret == CL_VIRUS) {
 		if (SCAN_ALL)
 		    viruses_found++;
@@ -1075,99 +1000,42 @@ static int cli_vba_scandir(const char *dirname, cli_ctx *ctx, struct uniq *U)
 #if HAVE_JSON
     /* JSON Output Summary Information */
     if (ctx->options & CL_SCAN_FILE_PROPERTIES && ctx->wrkproperty != NULL) {
-        hashcnt = uniq_get(U, "_5_summaryinformation", 21, &hash);
+        hashcnt = cli_ole2_vfs_count(vfs, storage, "_5_summaryinformation");
         while(hashcnt--) {
-            snprintf(vbaname, sizeof(vbaname), "%s"PATHSEP"%s_%u", dirname, hash, hashcnt);
-            vbaname[sizeof(vbaname)-1] = '\0';
-
-            fd = open(vbaname, O_RDONLY|O_BINARY);
-            if (fd >= 0) {
+            map = cli_ole2_vfs_map(vfs, storage, "_5_summaryinformation", hashcnt);
+            if (map) {
                 cli_dbgmsg("VBADir: detected a '_5_summaryinformation' stream\n");
                 /* JSONOLE2 - what to do if something breaks? */
-                cli_ole2_summary_json(ctx, fd, 0);
-                close(fd);
+                cli_ole2_summary_json(ctx, map, 0);
+                funmap(map);
             }
         }
 
-        hashcnt = uniq_get(U, "_5_documentsummaryinformation", 29, &hash);
+        hashcnt = cli_ole2_vfs_count(vfs, storage, "_5_documentsummaryinformation");
         while(hashcnt--) {
-            snprintf(vbaname, sizeof(vbaname), "%s"PATHSEP"%s_%u", dirname, hash, hashcnt);
-            vbaname[sizeof(vbaname)-1] = '\0';
-
-            fd = open(vbaname, O_RDONLY|O_BINARY);
-            if (fd >= 0) {
+            map = cli_ole2_vfs_map(vfs, storage, "_5_documentsummaryinformation", hashcnt);
+            if (map) {
                 cli_dbgmsg("VBADir: detected a '_5_documentsummaryinformation' stream\n");
                 /* JSONOLE2 - what to do if something breaks? */
-                cli_ole2_summary_json(ctx, fd, 1);
-                close(fd);
+                cli_ole2_summary_json(ctx, map, 1);
+                funmap(map);
             }
         }
     }
 #endif    
 
-    /* Check directory for embedded OLE objects */
-    hashcnt = uniq_get(U, "_1_ole10native", 14, &hash);
+    /* Check storage for embedded OLE objects */
+    hashcnt = cli_ole2_vfs_count(vfs, storage, "_1_ole10native");
     while(hashcnt--) {
-	snprintf(vbaname, sizeof(vbaname), "%s"PATHSEP"%s_%u", dirname, hash, hashcnt);
-	vbaname[sizeof(vbaname)-1] = '\0';
-
-	fd = open(vbaname, O_RDONLY|O_BINARY);
-	if (fd >= 0) {
-	    ret = cli_scan_ole10(fd, ctx);
-	    close(fd);
+	map = cli_ole2_vfs_map(vfs, storage, "_1_ole10native", hashcnt);
+	if (map) {
+	    ret = cli_scan_ole10(map, ctx);
+	    funmap(map);
 	    if(ret != CL_CLEAN && !(ret == CL_VIRUS && SCAN_ALL))
 		return ret;
 	}
     }
 
-
-    /* ACAB: since we now hash filenames and handle collisions we
-     * could avoid recursion by removing the block below and by
-     * flattening the paths in ole2_walk_property_tree (case 1) */
-
-    if((dd = opendir(dirname)) != NULL) {
-#ifdef HAVE_READDIR_R_3
-	while(!readdir_r(dd, &result.d, &dent) && dent) {
-#elif defined(HAVE_READDIR_R_2)
-	while((dent = (struct dirent *) readdir_r(dd, &result.d))) {
-#else
-	while((dent = readdir(dd))) {
-#endif
-	    if(dent->d_ino)
-	    {
-		if(strcmp(dent->d_name, ".") && strcmp(dent->d_name, "..")) {
-		    /* build the full name */
-		    fullname = cli_malloc(strlen(dirname) + strlen(dent->d_name) + 2);
-		    if(!fullname) {
-                cli_dbgmsg("cli_vba_scandir: Unable to allocate memory for fullname\n");
-			ret = CL_EMEM;
-			break;
-		    }
-		    sprintf(fullname, "%s"PATHSEP"%s", dirname, dent->d_name);
-
-		    /* stat the file */
-		    if(LSTAT(fullname, &statbuf) != -1) {
-			if(S_ISDIR(statbuf.st_mode) && !S_ISLNK(statbuf.st_mode))
-			  if (cli_vba_scandir(fullname, ctx, U) == CL_VIRUS) {
-			      if (SCAN_ALL)
-				  viruses_found++;
-			      else {
-				  ret = CL_VIRUS;
-				  free(fullname);
-				  break;
-			      }
-			  }
-		    }
-		    free(fullname);
-		}
-	    }
-	}
-    } else {
-	cli_dbgmsg("VBADir: Can't open directory %s.\n", dirname);
-	return CL_EOPEN;
-    }
-
-    closedir(dd);
 #if HAVE_JSON
     if (hasmacros && ctx->options & CL_SCAN_FILE_PROPERTIES && ctx->wrkproperty != NULL)
         cli_jsonbool(ctx->wrkproperty, "HasMacros", 1);
@@ -1182,6 +1050,56 @@ static int cli_vba_scandir(const char *dirname, cli_ctx *ctx, struct uniq *U)
     return ret;
 }
 
+static int cli_scanhtml_mem(cli_ctx *ctx)
+{
+    html_norm_output_t out;
+    fmap_t *map = *ctx->fmap;
+    unsigned int i, viruses_found = 0;
+    int ret;
+
+    cli_dbgmsg("cli_scanhtml: normalising in memory\n");
+
+    if (!html_normalise_map_mem(map, &out, ctx->dconf) && out.error) {
+        cli_errmsg("cli_scanhtml: normalised output is incomplete\n");
+        ret = out.error;
+        html_norm_output_free(&out);
+        return ret;
+    }
+    if ((ret = cli_scandesc_mem(out.nocomment.data, out.nocomment.len, ctx, CL_TYPE_HTML, 0, NULL, AC_SCAN_VIR, NULL)) == CL_VIRUS)
+        viruses_found++;
+
+    if(ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) {
+        /* CL_ENGINE_MAX_HTMLNOTAGS */
+        if (map->len > ctx->engine->maxhtmlnotags) {
+            cli_dbgmsg("cli_scanhtml: skipping notags (normalized size over MaxHTMLNoTags)\n");
+        } else if ((ret = cli_scandesc_mem(out.notags.data, out.notags.len, ctx, CL_TYPE_HTML, 0, NULL, AC_SCAN_VIR, NULL)) == CL_VIRUS) {
+            viruses_found++;
+        }
+    }
+
+    if(out.javascript.len && (ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL))) {
+        if ((ret = cli_scandesc_mem(out.javascript.data, out.javascript.len, ctx, CL_TYPE_HTML, 0, NULL, AC_SCAN_VIR, NULL)) == CL_VIRUS)
+            viruses_found++;
+        if (ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) {
+            if ((ret = cli_scandesc_mem(out.javascript.data, out.javascript.len, ctx, CL_TYPE_TEXT_ASCII, 0, NULL, AC_SCAN_VIR, NULL)) == CL_VIRUS)
+                viruses_found++;
+        }
+    }
+
+    /* data: URIs, as the small mail messages the normaliser wraps them in */
+    for(i = 0; i < out.rfc2397_cnt && (ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)); i++) {
+        if(!out.rfc2397[i].len)
+            continue;
+        if ((ret = cli_mem_scandesc(out.rfc2397[i].data, out.rfc2397[i].len, ctx)) == CL_VIRUS)
+            viruses_found++;
+    }
+
+    html_norm_output_free(&out);
+    if (SCAN_ALL && viruses_found)
+	return CL_VIRUS;
+    return ret;
+}
+
 static int cli_scanhtml(cli_ctx *ctx)
 {
     char *tempname, fullname[1024];
@@ -1198,6 +1116,10 @@ static int cli_scanhtml(cli_ctx *ctx)
 	return CL_CLEAN;
     }
 
+    /* only spill the normalised forms to disk when they could get big */
+    if(curr_len <= HTML_NORM_MEM_MAX && !ctx->engine->keeptmp)
+	return cli_scanhtml_mem(ctx);
+
     if(!(tempname = cli_gentemp(ctx->engine->tmpdir)))
 	return CL_EMEM;
 
@@ -1503,48 +1425,47 @@ static int cli_scanhtml_utf16(cli_ctx *ctx)
 
 static int cli_scanole2(cli_ctx *ctx)
 {
-	char *dir;
 	int ret = CL_CLEAN;
-	struct uniq *vba = NULL;
+	struct ole2_vfs *vba = NULL;
+	uint32_t storage, storages;
+	unsigned int viruses_found = 0;
 
     cli_dbgmsg("in cli_scanole2()\n");
 
     if(ctx->engine->maxreclevel && ctx->recursion >= ctx->engine->maxreclevel)
         return CL_EMAXREC;
 
-    /* generate the temporary directory */
-    if(!(dir = cli_gentemp(ctx->engine->tmpdir)))
-	return CL_EMEM;
-
-    if(mkdir(dir, 0700)) {
-	cli_dbgmsg("OLE2: Can't create temporary directory %s\n", dir);
-	free(dir);
-	return CL_ETMPDIR;
-    }
-
-    ret = cli_ole2_extract(dir, ctx, &vba);
+    ret = cli_ole2_extract(ctx, &vba);
     if(ret!=CL_CLEAN && ret!=CL_VIRUS) {
 	cli_dbgmsg("OLE2: %s\n", cl_strerror(ret));
-	if(!ctx->engine->keeptmp)
-	    cli_rmdirs(dir);
-	free(dir);
+	cli_ole2_vfs_free(vba);
 	return ret;
     }
 
     if (vba) {
         ctx->recursion++;
 
-	ret = cli_vba_scandir(dir, ctx, vba);
-	uniq_free(vba);
+	/* storages are flat in the VFS, no need to recurse */
+	storages = cli_ole2_vfs_storages(vba);
+	for(storage = 0; storage < storages; storage++) {
+	    ret = cli_vba_scandir(vba, storage, ctx);
+	    if(ret == CL_VIRUS) {
+		if(!SCAN_ALL)
+		    break;
+		viruses_found++;
+	    } else if(ret != CL_CLEAN) {
+		break;
+	    }
+	}
+	if(SCAN_ALL && viruses_found)
+	    ret = CL_VIRUS;
 	if(ret != CL_VIRUS)
-	    if(cli_scandir(dir, ctx) == CL_VIRUS)
+	    if(cli_ole2_vfs_scan(vba, ctx) == CL_VIRUS)
 	        ret = CL_VIRUS;
+	cli_ole2_vfs_free(vba);
 	ctx->recursion--;
     }
 
-    if(!ctx->engine->keeptmp)
-	cli_rmdirs(dir);
-    free(dir);
     return ret;
 }
 
@@ -1770,6 +1691,15 @@ static int cli_scanmail(cli_ctx *ctx)
 
     cli_dbgmsg("Starting cli_scanmail(), recursion = %u\n", ctx->recursion);
 
+    /*
+     * Plain MIME messages are decoded and scanned in place, anything
+     * else goes through the temporary directory
+     */
+    if(DCONF_MAIL & MAIL_CONF_STREAM) {
+	if((ret = cli_mbox_stream(ctx)) != CL_BREAK)
+	    return ret;
+    }
+
     /* generate the temporary directory */
     if(!(dir = cli_gentemp(ctx->engine->tmpdir)))
 	return CL_EMEM;
@@ -1999,6 +1929,7 @@ static struct {
     {PERFT_RAWTYPENO, "raw container", ev_time},
     {PERFT_MAP, "map", ev_time},
     {PERFT_BYTECODE,"bytecode", ev_time},
+    {PERFT_INFLATE,"inflate", ev_time},
     {PERFT_KTIME,"kernel", ev_int},
     {PERFT_UTIME,"user", ev_int}
 };
@@ -2432,7 +2363,7 @@ static void emax_reached(cli_ctx *ctx) {
 	return retcode;							\
     } while(0)
 
-static int magic_scandesc_cleanup(cli_ctx *ctx, cli_file_t type, unsigned char *hash, size_t hashed_size, int cache_clean, int retcode, void *parent_property)
+static int magic_scandesc_cleanup(cli_ctx *ctx, cli_file_t type, unsigned char *hash, unsigned char *md5, size_t hashed_size, int cache_clean, int retcode, void *parent_property)
 {
     int cb_retcode;
 #if HAVE_JSON
@@ -2464,7 +2395,7 @@ static int magic_scandesc_cleanup(cli_ctx *ctx, cli_file_t type, unsigned char *
             cli_append_virus(ctx, "Detected.By.Callback");
             perf_stop(ctx, PERFT_POSTCB);
             if (retcode != CL_VIRUS)
-                return cli_checkfp(hash, hashed_size, ctx);
+                return cli_checkfp(md5, hashed_size, ctx);
             return CL_VIRUS;
         case CL_CLEAN:
             break;
@@ -2473,6 +2404,11 @@ static int magic_scandesc_cleanup(cli_ctx *ctx, cli_file_t type, unsigned char *
         }
         perf_stop(ctx, PERFT_POSTCB);
     }
+    /* past the work budget, this file and its parents were scanned only in part */
+    if (ctx->scanwork_exceeded) {
+        emax_reached(ctx);
+        cache_clean = 0;
+    }
     if (cb_retcode == CL_CLEAN && cache_clean) {
         perf_start(ctx, PERFT_CACHE);
         if (!(SCAN_PROPERTIES))
@@ -2524,14 +2460,14 @@ static int dispatch_prescan(clcb_pre_scan cb, cli_ctx *ctx, const char *filetype
     return res;
 }
 
-static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
+static int magic_scandesc_internal(cli_ctx *ctx, cli_file_t type)
 {
 	int ret = CL_CLEAN;
 	cli_file_t dettype = 0;
 	uint8_t typercg = 1;
 	cli_file_t current_container_type = ctx->container_type;
 	size_t current_container_size = ctx->container_size, hashed_size;
-	unsigned char hash[16] = {'\0'};
+	unsigned char hash[16] = {'\0'}, *md5 = NULL;
 	bitset_t *old_hook_lsig_matches;
 	const char *filetype;
 	int cache_clean = 0, res;
@@ -2578,6 +2514,7 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 	early_ret_from_magicscan(CL_EREAD);
     }
     filetype = cli_ftname(type);
+    cli_arena_settype(ctx->arena, type);
 
 #if HAVE_JSON
     if (ctx->options & CL_SCAN_FILE_PROPERTIES) {
@@ -2651,14 +2588,14 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
     ret = dispatch_prescan(ctx->engine->cb_pre_cache, ctx, filetype, old_hook_lsig_matches, parent_property, hash, hashed_size, &run_cleanup);
     if (run_cleanup) {
         if (ret == CL_VIRUS)
-            return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, cli_checkfp(hash, hashed_size, ctx), parent_property);
+            return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, cli_checkfp(md5, hashed_size, ctx), parent_property);
         else
-            return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, CL_CLEAN, parent_property);
+            return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, CL_CLEAN, parent_property);
     }
 
     perf_start(ctx, PERFT_CACHE);
     if (!(SCAN_PROPERTIES))
-        res = cache_check(hash, ctx);
+        res = cache_check(hash, ctx, &md5);
 
 #if HAVE_JSON
     if (SCAN_PROPERTIES /* ctx.options & CL_SCAN_FILE_PROPERTIES && ctx->wrkproperty != NULL */) {
@@ -2674,6 +2611,8 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
         ret = cli_jsonstr(ctx->wrkproperty, "FileMD5", hashstr);
         if (ctx->engine->engine_options & ENGINE_OPTIONS_DISABLE_CACHE)
             memset(hash, 0, sizeof(hash));
+        else
+            md5 = hash;
         if (ret != CL_SUCCESS) {
             early_ret_from_magicscan(ret);
         }
@@ -2704,12 +2643,12 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
     ret = dispatch_prescan(ctx->engine->cb_pre_scan, ctx, filetype, old_hook_lsig_matches, parent_property, hash, hashed_size, &run_cleanup);
     if (run_cleanup) {
         if (ret == CL_VIRUS)
-            return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, cli_checkfp(hash, hashed_size, ctx), parent_property);
+            return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, cli_checkfp(md5, hashed_size, ctx), parent_property);
         else
-            return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, ret, parent_property);
+            return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, ret, parent_property);
     }
 	/* ret_from_magicscan can be used below here*/
-	if((ret = cli_fmap_scandesc(ctx, 0, 0, NULL, AC_SCAN_VIR, NULL, hash)) == CL_VIRUS)
+	if((ret = cli_fmap_scandesc(ctx, 0, 0, NULL, AC_SCAN_VIR, NULL, md5)) == CL_VIRUS)
 	    cli_dbgmsg("%s found in descriptor %d\n", cli_get_last_virus(ctx), fmap_fd(*ctx->fmap));
 	else if(ret == CL_CLEAN) {
 	    if(ctx->recursion != ctx->engine->maxreclevel)
@@ -2719,15 +2658,15 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 	}
 
 	ctx->hook_lsig_matches = old_hook_lsig_matches;
-	return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, ret, parent_property);
+	return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, ret, parent_property);
     }
 
     ret = dispatch_prescan(ctx->engine->cb_pre_scan, ctx, filetype, old_hook_lsig_matches, parent_property, hash, hashed_size, &run_cleanup);
     if (run_cleanup) {
         if (ret == CL_VIRUS)
-            return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, cli_checkfp(hash, hashed_size, ctx), parent_property);
+            return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, cli_checkfp(md5, hashed_size, ctx), parent_property);
         else
-            return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, ret, parent_property);
+            return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, ret, parent_property);
     }
     /* ret_from_magicscan can be used below here*/
 
@@ -2738,15 +2677,15 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
     ctx->hook_lsig_matches = cli_bitset_init();
     if (!ctx->hook_lsig_matches) {
 	ctx->hook_lsig_matches = old_hook_lsig_matches;
-    return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, CL_EMEM, parent_property);
+    return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, CL_EMEM, parent_property);
     }
 
     if(type != CL_TYPE_IGNORED && ctx->engine->sdb) {
-	if((ret = cli_scanraw(ctx, type, 0, &dettype, (ctx->engine->engine_options & ENGINE_OPTIONS_DISABLE_CACHE) ? NULL : hash)) == CL_VIRUS) {
-	    ret = cli_checkfp(hash, hashed_size, ctx);
+	if((ret = cli_scanraw(ctx, type, 0, &dettype, md5)) == CL_VIRUS) {
+	    ret = cli_checkfp(md5, hashed_size, ctx);
 	    cli_bitset_free(ctx->hook_lsig_matches);
 	    ctx->hook_lsig_matches = old_hook_lsig_matches;
-        return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, ret, parent_property);
+        return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, ret, parent_property);
 	}
     }
 
@@ -3096,10 +3035,10 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
     ctx->container_size = current_container_size;
 
     if(ret == CL_VIRUS) {
-	ret = cli_checkfp(hash, hashed_size, ctx);
+	ret = cli_checkfp(md5, hashed_size, ctx);
 	cli_bitset_free(ctx->hook_lsig_matches);
 	ctx->hook_lsig_matches = old_hook_lsig_matches;
-    return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, ret, parent_property);
+    return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, ret, parent_property);
     }
 
     if(type == CL_TYPE_ZIP && SCAN_ARCHIVE && (DCONF_ARCH & ARCH_CONF_ZIP)) {
@@ -3113,7 +3052,7 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 
     /* CL_TYPE_HTML: raw HTML files are not scanned, unless safety measure activated via DCONF */
     if(type != CL_TYPE_IGNORED && (type != CL_TYPE_HTML || !(SCAN_HTML) || !(DCONF_DOC & DOC_CONF_HTML_SKIPRAW)) && !ctx->engine->sdb) {
-	res = cli_scanraw(ctx, type, typercg, &dettype, (ctx->engine->engine_options & ENGINE_OPTIONS_DISABLE_CACHE) ? NULL : hash);
+	res = cli_scanraw(ctx, type, typercg, &dettype, md5);
 	if(res != CL_CLEAN) {
 	    switch(res) {
 		/* List of scan halts, runtime errors only! */
@@ -3129,15 +3068,15 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 		    cli_dbgmsg("Descriptor[%d]: cli_scanraw error %s\n", fmap_fd(*ctx->fmap), cl_strerror(res));
 		    cli_bitset_free(ctx->hook_lsig_matches);
 		    ctx->hook_lsig_matches = old_hook_lsig_matches;
-            return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, res, parent_property);
+            return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, res, parent_property);
 		/* CL_VIRUS = malware found, check FP and report */
 		case CL_VIRUS:
-		    ret = cli_checkfp(hash, hashed_size, ctx);
+		    ret = cli_checkfp(md5, hashed_size, ctx);
 		    if (SCAN_ALL)
 			break;
 		    cli_bitset_free(ctx->hook_lsig_matches);
 		    ctx->hook_lsig_matches = old_hook_lsig_matches;
-            return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, ret, parent_property);
+            return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, ret, parent_property);
 		/* "MAX" conditions should still fully scan the current file */
 		case CL_EMAXREC:
 		case CL_EMAXSIZE:
@@ -3194,7 +3133,7 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
     }
 
     if(ret == CL_VIRUS)
-	ret = cli_checkfp(hash, hashed_size, ctx);
+	ret = cli_checkfp(md5, hashed_size, ctx);
     ctx->recursion--;
     cli_bitset_free(ctx->hook_lsig_matches);
     ctx->hook_lsig_matches = old_hook_lsig_matches;
@@ -3212,18 +3151,31 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 #if HAVE_JSON
         ctx->wrkproperty = parent_property;
 #endif
-        return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, CL_CLEAN, parent_property);
+        return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, CL_CLEAN, parent_property);
 	case CL_CLEAN:
 	    cache_clean = 1;
 #if HAVE_JSON
         ctx->wrkproperty = parent_property;
 #endif
-        return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, CL_CLEAN, parent_property);
+        return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, CL_CLEAN, parent_property);
 	default:
-        return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, ret, parent_property);
+        return magic_scandesc_cleanup(ctx, type, hash, md5, hashed_size, cache_clean, ret, parent_property);
     }
 }
 
+static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
+{
+    cli_arena_mark_t mark;
+    int ret;
+
+    /* parser temporaries allocated from the scan arena live exactly as
+     * long as the object they were allocated for */
+    cli_arena_mark(ctx->arena, &mark);
+    ret = magic_scandesc_internal(ctx, type);
+    cli_arena_release(ctx->arena, &mark);
+    return ret;
+}
+
 static int cli_base_scandesc(int desc, cli_ctx *ctx, cli_file_t type)
 {
     STATBUF sb;
@@ -3244,7 +3196,11 @@ static int cli_base_scandesc(int desc, cli_ctx *ctx, cli_file_t type)
 
     ctx->fmap++;
     perf_start(ctx, PERFT_MAP);
-    if(!(*ctx->fmap = fmap(desc, 0, sb.st_size))) {
+    if (ctx->engine->engine_options & ENGINE_OPTIONS_DIRECT_MMAP)
+	*ctx->fmap = fmap_direct(desc, 0, sb.st_size);
+    else
+	*ctx->fmap = fmap(desc, 0, sb.st_size);
+    if(!*ctx->fmap) {
 	cli_errmsg("CRITICAL: fmap() failed\n");
 	ctx->fmap--;
 	perf_stop(ctx, PERFT_MAP);
@@ -3421,7 +3377,51 @@ int cli_mem_scandesc(const void *buffer, size_t length, cli_ctx *ctx)
     return ret;
 }
 
-static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
+/* context allocations that don't depend on what's scanned, shared by the
+ * items of a batch */
+struct scan_reuse {
+    fmap_t **fmap;
+    bitset_t *hook_lsig_matches;
+    cli_arena_t *arena;
+    cli_arena_mark_t empty;
+    struct cli_scanstate *scanstate;
+};
+
+static int scan_reuse_init(struct scan_reuse *reuse, const struct cl_engine *engine)
+{
+    memset(reuse, 0, sizeof(*reuse));
+    reuse->fmap = cli_calloc(sizeof(fmap_t *), engine->maxreclevel + 2);
+    if(!reuse->fmap)
+	return CL_EMEM;
+    if (!(reuse->hook_lsig_matches = cli_bitset_init())) {
+	free(reuse->fmap);
+	return CL_EMEM;
+    }
+    if (!(reuse->arena = cli_arena_create())) {
+	cli_bitset_free(reuse->hook_lsig_matches);
+	free(reuse->fmap);
+	return CL_EMEM;
+    }
+    cli_arena_mark(reuse->arena, &reuse->empty);
+    return CL_SUCCESS;
+}
+
+static void scan_reuse_reset(struct scan_reuse *reuse, const struct cl_engine *engine)
+{
+    memset(reuse->fmap, 0, sizeof(fmap_t *) * (engine->maxreclevel + 2));
+    memset(reuse->hook_lsig_matches->bitset, 0, reuse->hook_lsig_matches->length);
+    /* hand the chunks back to the idle pool */
+    cli_arena_release(reuse->arena, &reuse->empty);
+}
+
+static void scan_reuse_free(struct scan_reuse *reuse)
+{
+    cli_bitset_free(reuse->hook_lsig_matches);
+    cli_arena_destroy(reuse->arena);
+    free(reuse->fmap);
+}
+
+static int scan_common_reuse(int desc, cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context, struct scan_reuse *reuse)
 {
     cli_ctx ctx;
     int rc;
@@ -3449,13 +3449,10 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
     ctx.container_size = 0;
     ctx.dconf = (struct cli_dconf *) engine->dconf;
     ctx.cb_ctx = context;
-    ctx.fmap = cli_calloc(sizeof(fmap_t *), ctx.engine->maxreclevel + 2);
-    if(!ctx.fmap)
-	return CL_EMEM;
-    if (!(ctx.hook_lsig_matches = cli_bitset_init())) {
-	free(ctx.fmap);
-	return CL_EMEM;
-    }
+    ctx.fmap = reuse->fmap;
+    ctx.hook_lsig_matches = reuse->hook_lsig_matches;
+    ctx.arena = reuse->arena;
+    ctx.scanstate = reuse->scanstate;
     perf_init(&ctx);
 
     if (ctx.options & CL_SCAN_FILE_PROPERTIES && ctx.engine->time_limit != 0) {
@@ -3594,18 +3591,46 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
     }
 #endif
 
-    cli_bitset_free(ctx.hook_lsig_matches);
-    free(ctx.fmap);
+    /* whatever the scanners made of CL_ETIMEOUT, report what was asked for */
+    if (ctx.scanwork_exceeded && rc != CL_VIRUS) {
+        switch (ctx.engine->scanwork_action) {
+            case CL_SCANWORK_ALERT:
+                rc = CL_VIRUS;
+                break;
+            case CL_SCANWORK_CLEAN:
+                rc = CL_CLEAN;
+                break;
+            case CL_SCANWORK_ERROR:
+                rc = CL_ETIMEOUT;
+                break;
+        }
+    }
+
     if (rc == CL_CLEAN) {
         if ((ctx.num_viruses != 0 && (ctx.options & (CL_SCAN_ALLMATCHES | CL_SCAN_BLOCKMAX))) ||
             ctx.found_possibly_unwanted)
                 rc = CL_VIRUS;
+    } else if (rc == CL_VIRUS && ctx.delta_dropped && !ctx.num_viruses && !ctx.found_possibly_unwanted) {
+        /* the only detections were of signatures removed since the engine was built */
+        rc = CL_CLEAN;
     }
     cli_logg_unsetup();
     perf_done(&ctx);
     return rc;
 }
 
+static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
+{
+    struct scan_reuse reuse;
+    int rc;
+
+    if ((rc = scan_reuse_init(&reuse, engine)) != CL_SUCCESS)
+        return rc;
+    rc = scan_common_reuse(desc, map, virname, scanned, engine, scanoptions, context, &reuse);
+    scan_reuse_free(&reuse);
+    return rc;
+}
+
 int cl_scandesc_callback(int desc, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
 {
     return scan_common(desc, NULL, virname, scanned, engine, scanoptions, context);
@@ -3616,6 +3641,281 @@ int cl_scanmap_callback(cl_fmap_t *map, const char **virname, unsigned long int
     return scan_common(-1, map, virname, scanned, engine, scanoptions, context);
 }
 
+int cl_scan_batch(struct cl_scan_item *items, size_t count, const struct cl_engine *engine, unsigned int scanoptions)
+{
+    struct scan_reuse reuse;
+    struct cl_scan_item *item;
+    cl_fmap_t *map;
+    size_t i;
+    int rc;
+
+    if(!items || !engine)
+        return CL_ENULLARG;
+
+    if ((rc = scan_reuse_init(&reuse, engine)) != CL_SUCCESS)
+        return rc;
+
+    for(i = 0; i < count; i++) {
+        item = &items[i];
+        item->virname = NULL;
+        item->scanned = 0;
+        if(item->desc >= 0) {
+            item->result = scan_common_reuse(item->desc, NULL, &item->virname, &item->scanned, engine, scanoptions, item->context, &reuse);
+        } else if(!item->len) {
+            item->result = CL_CLEAN;
+            continue;
+        } else if(!item->data) {
+            item->result = CL_ENULLARG;
+            continue;
+        } else if(!(map = cl_fmap_open_memory(item->data, item->len))) {
+            item->result = CL_EMEM;
+            continue;
+        } else {
+            item->result = scan_common_reuse(-1, map, &item->virname, &item->scanned, engine, scanoptions, item->context, &reuse);
+            cl_fmap_close(map);
+        }
+        scan_reuse_reset(&reuse, engine);
+    }
+
+    scan_reuse_free(&reuse);
+    return CL_SUCCESS;
+}
+
+/*
+ * Streaming scans
+ *
+ * Data handed to cl_scan_stream_feed() is spooled to a temporary file,
+ * hashed as it arrives, and matched in the SCANBUFF windows
+ * cli_fmap_scandesc() will use for the type the start of the object has
+ * (struct cli_scanstate), so the AC match data and logical signature
+ * counters carry over from one window to the next. A window is matched
+ * once the object extends past it by more than the farthest EOF-n offset
+ * of the signatures, when every offset that may point into it is known.
+ * Roots with offsets relative to the entry point or to sections, and the
+ * target root of types that the rest of the object could still change,
+ * are left to the final scan.
+ *
+ * cl_scan_stream_finish() runs the normal scan over the spooled object for
+ * containers, hashes and logical signatures; the top level raw scan takes
+ * over the state and only matches what was still pending. If a signature
+ * already matched, and all matches weren't requested, the verdict is
+ * returned straight away.
+ */
+struct cl_scan_stream {
+    cli_ctx ctx;
+    fmap_t *fmap[2];
+    const char *virname;
+    struct cli_scanstate state;
+    unsigned char *window;
+    int fd;
+    char *tmpname;
+    int typed;
+    int infected;
+    int ret;
+};
+
+static void scan_stream_free(cl_scan_stream_t *stream)
+{
+    if(stream->fd != -1) {
+        close(stream->fd);
+        if(!stream->ctx.engine->keeptmp)
+            cli_unlink(stream->tmpname);
+    }
+    free(stream->tmpname);
+    cli_scanstate_free(&stream->state);
+    free(stream->window);
+    free(stream);
+}
+
+cl_scan_stream_t *cl_scan_stream_open(const struct cl_engine *engine, unsigned int scanoptions, void *context)
+{
+    cl_scan_stream_t *stream;
+
+    if(!engine || !engine->root || !engine->root[0]) {
+        cli_errmsg("cl_scan_stream_open: engine not initialised\n");
+        return NULL;
+    }
+
+    if(!(stream = cli_calloc(1, sizeof(*stream)))) {
+        cli_errmsg("cl_scan_stream_open: Can't allocate memory for stream\n");
+        return NULL;
+    }
+    stream->fd = -1;
+    stream->ctx.engine = engine;
+    stream->ctx.virname = &stream->virname;
+    stream->ctx.options = scanoptions;
+    stream->ctx.container_type = CL_TYPE_ANY;
+    stream->ctx.dconf = (struct cli_dconf *) engine->dconf;
+    stream->ctx.cb_ctx = context;
+    stream->ctx.fmap = stream->fmap;
+    stream->ctx.scanstate = &stream->state;
+
+    if(!(stream->window = cli_malloc(SCANBUFF))) {
+        cli_errmsg("cl_scan_stream_open: Can't allocate memory for scan window\n");
+        free(stream);
+        return NULL;
+    }
+
+    if(cli_gentempfd(engine->tmpdir, &stream->tmpname, &stream->fd) != CL_SUCCESS) {
+        cli_errmsg("cl_scan_stream_open: Can't create temporary file\n");
+        scan_stream_free(stream);
+        return NULL;
+    }
+    if(cli_scanstate_init(&stream->state, engine, stream->fd) != CL_SUCCESS) {
+        cli_errmsg("cl_scan_stream_open: Can't initialise hash contexts\n");
+        scan_stream_free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+/* reads back the next window from the spooled data */
+static int scan_stream_read(cl_scan_stream_t *stream)
+{
+    if(lseek(stream->fd, stream->state.offset, SEEK_SET) == -1 ||
+       cli_readn(stream->fd, stream->window, SCANBUFF) != SCANBUFF ||
+       lseek(stream->fd, 0, SEEK_END) == -1) {
+        cli_errmsg("cl_scan_stream_feed: Can't read back from %s\n", stream->tmpname);
+        return CL_EREAD;
+    }
+    return CL_SUCCESS;
+}
+
+/* sets up the raw scan cli_magic_scandesc() is going to do at the top
+ * level, the first window is in stream->window */
+static int scan_stream_settype(cl_scan_stream_t *stream)
+{
+    cli_ctx *ctx = &stream->ctx;
+    unsigned int acmode = AC_SCAN_VIR;
+    cli_file_t type;
+    fmap_t *map;
+
+    /* raw mode */
+    if(!(ctx->options & ~CL_SCAN_ALLMATCHES) || !ctx->engine->maxreclevel)
+        return cli_scanstate_settype(&stream->state, ctx->engine, 0, acmode, 0);
+
+    if(!(map = cl_fmap_open_memory(stream->window, SCANBUFF)))
+        return CL_EMEM;
+    type = cli_filetype2(map, ctx->engine, CL_TYPE_ANY);
+    cl_fmap_close(map);
+    if(type == CL_TYPE_ERROR)
+        return CL_EREAD;
+
+    /* types that aren't scanned raw */
+    if(type == CL_TYPE_IGNORED || (type == CL_TYPE_HTML && SCAN_HTML && (DCONF_DOC & DOC_CONF_HTML_SKIPRAW)) || ctx->engine->sdb)
+        return CL_SUCCESS;
+
+    if(type != CL_TYPE_ZIP || !(SCAN_ARCHIVE && (DCONF_ARCH & ARCH_CONF_ZIP)) || stream->state.len <= ctx->engine->maxziptypercg)
+        acmode |= AC_SCAN_FT;
+
+    /* zip files may turn out to be OOXML, and partition tables depend on
+     * the size, don't trust the target root of those before the end */
+    return cli_scanstate_settype(&stream->state, ctx->engine, type == CL_TYPE_TEXT_ASCII ? 0 : type, acmode,
+                                 type != CL_TYPE_ZIP && type != CL_TYPE_MBR && type != CL_TYPE_GPT);
+}
+
+int cl_scan_stream_feed(cl_scan_stream_t *stream, const void *data, size_t len, const char **virname)
+{
+    struct cli_scanstate *st;
+    int ret;
+
+    if(virname)
+        *virname = NULL;
+    if(!stream || (!data && len))
+        return CL_ENULLARG;
+    if(stream->ret != CL_CLEAN)
+        return stream->ret;
+    if(stream->infected) {
+        if(virname)
+            *virname = stream->virname;
+        return CL_VIRUS;
+    }
+
+    if(cli_writen(stream->fd, data, len) != (int)len) {
+        cli_errmsg("cl_scan_stream_feed: Can't write to %s\n", stream->tmpname);
+        return stream->ret = CL_EWRITE;
+    }
+    st = &stream->state;
+    cli_scanstate_hash(st, data, len);
+
+    /* objects too large for the final scan aren't scanned at all */
+    if(st->len > (uint64_t)(INT_MAX - 2)) {
+        cli_scanstate_drop(st);
+        return CL_CLEAN;
+    }
+
+    if(!stream->typed) {
+        if(st->len <= SCANBUFF)
+            return CL_CLEAN;
+        if((ret = scan_stream_read(stream)) != CL_SUCCESS || (ret = scan_stream_settype(stream)) != CL_SUCCESS)
+            return stream->ret = ret;
+        stream->typed = 1;
+    }
+
+    while(st->ready && st->len > (uint64_t)st->offset + SCANBUFF + st->lag) {
+        if((ret = scan_stream_read(stream)) != CL_SUCCESS)
+            return stream->ret = ret;
+
+        /* the virus callback wants a map */
+        if(!(stream->fmap[0] = cl_fmap_open_memory(stream->window, SCANBUFF)))
+            return stream->ret = CL_EMEM;
+        ret = cli_scanstate_window(&stream->ctx, stream->window, SCANBUFF);
+        cl_fmap_close(stream->fmap[0]);
+        stream->fmap[0] = NULL;
+
+        if(ret == CL_VIRUS) {
+            if(!stream->ctx.num_viruses) {
+                /* the signature was removed by a delta, the match data
+                 * is incomplete now */
+                cli_scanstate_drop(st);
+                break;
+            }
+            cli_dbgmsg("cl_scan_stream_feed: %s found before offset %u\n", stream->virname, st->offset + SCANBUFF);
+            stream->infected = 1;
+            if(virname)
+                *virname = stream->virname;
+            return CL_VIRUS;
+        }
+        if(ret != CL_CLEAN)
+            return stream->ret = ret;
+    }
+    if(!st->ready)
+        cli_scanstate_drop(st);
+    return CL_CLEAN;
+}
+
+int cl_scan_stream_finish(cl_scan_stream_t *stream, const char **virname, unsigned long int *scanned)
+{
+    struct scan_reuse reuse;
+    int ret;
+
+    if(virname)
+        *virname = NULL;
+    if(!stream)
+        return CL_ENULLARG;
+
+    if(stream->ret != CL_CLEAN) {
+        ret = stream->ret;
+    } else if(stream->infected) {
+        if(virname)
+            *virname = stream->virname;
+        ret = CL_VIRUS;
+    } else if(lseek(stream->fd, 0, SEEK_SET) == -1) {
+        cli_errmsg("cl_scan_stream_finish: Can't seek in %s\n", stream->tmpname);
+        ret = CL_ESEEK;
+    } else if((ret = scan_reuse_init(&reuse, stream->ctx.engine)) == CL_SUCCESS) {
+        cli_scanstate_final(&stream->state);
+        reuse.scanstate = &stream->state;
+        ret = scan_common_reuse(stream->fd, NULL, virname, scanned, stream->ctx.engine, stream->ctx.options, stream->ctx.cb_ctx, &reuse);
+        scan_reuse_free(&reuse);
+    }
+    if(stream->ctx.engine->keeptmp)
+        cli_dbgmsg("cl_scan_stream_finish: stream saved to %s\n", stream->tmpname);
+
+    scan_stream_free(stream);
+    return ret;
+}
+
 int cli_found_possibly_unwanted(cli_ctx* ctx)
 {
     if(cli_get_last_virus(ctx)) {
@@ -43,6 +43,7 @@
 #include "clamav.h"
 #include "scanners.h"
 #include "sis.h"
+#include "inflate_iface.h"
 
 #define EC32(x) cli_readint32(&(x))
 #define EC16(x) cli_readint16(&(x))
@@ -450,7 +451,7 @@ static int real_scansis(cli_ctx *ctx, const char *tmpd) {
 	  void *decomp = NULL;
 	  const void *comp;
 	  const void *decompp = NULL;
-	  uLongf olen;
+	  size_t olen;
 
 	  if (!lens[j]) {
 	    cli_dbgmsg("\tSkipping empty file\n");
@@ -478,7 +479,7 @@ static int real_scansis(cli_ctx *ctx, const char *tmpd) {
 	      free(alangs);
 	      return CL_CLEAN;
 	    }
-	    if (uncompress(decomp, &olen, comp, lens[j])!=Z_OK) {
+	    if (cli_inflate_buffer(comp, lens[j], decomp, &olen, MAX_WBITS, ctx)!=Z_OK) {
 	      cli_dbgmsg("\tUnpacking failure\n");
 	      free(decomp);
 	      continue;
@@ -694,7 +695,7 @@ static int real_scansis9x(cli_ctx *ctx, const char *tmpd) {
 	    uint32_t usize, usizeh, len;
 	    void *src, *dst;
 	    char tempf[1024];
-	    uLongf uusize;
+	    size_t uusize;
 	    int fd;
 
 	    cli_dbgmsg("SIS: %d:Got filedata element with size %x\n", s->level, s->fsize[s->level]);
@@ -740,15 +741,15 @@ static int real_scansis9x(cli_ctx *ctx, const char *tmpd) {
 		  free(src);
 		  break;
 		}
-		zresult=uncompress(dst, &uusize, src, s->fsize[s->level]);
+		zresult=cli_inflate_buffer(src, s->fsize[s->level], dst, &uusize, MAX_WBITS, ctx);
 		free(src);
 		if (zresult!=Z_OK) {
 		  cli_dbgmsg("SIS: Inflate failure (%d)\n", zresult);
 		  free(dst);
 		  break;
 		}
-		if ((uLongf)usize != uusize)
-		  cli_dbgmsg("SIS: Warning: expected size %lx but got %lx\n", (uLongf)usize, uusize);
+		if ((size_t)usize != uusize)
+		  cli_dbgmsg("SIS: Warning: expected size %lx but got %lx\n", (unsigned long)usize, (unsigned long)uusize);
 		else
 		  cli_dbgmsg("SIS: File successfully inflated\n");
 	      } else { /* not compressed */
@@ -50,6 +50,7 @@
 #include "clamav.h"
 #include "scanners.h"
 #include "lzma_iface.h"
+#include "inflate_iface.h"
 
 #define EC16(v)        le16_to_host(v)
 #define EC32(v)        le32_to_host(v)
@@ -301,7 +302,7 @@ static int scanzws(cli_ctx *ctx, struct swf_file_hdr *hdr)
 
 static int scancws(cli_ctx *ctx, struct swf_file_hdr *hdr)
 {
-        z_stream stream;
+        struct cli_zstream stream;
         char inbuff[FILEBUFF], outbuff[FILEBUFF];
         fmap_t *map = *ctx->fmap;
         int offset = 8, ret, zret, outsize = 8, count, zend;
@@ -325,15 +326,13 @@ static int scancws(cli_ctx *ctx, struct swf_file_hdr *hdr)
         return CL_EWRITE;
     }
 
+    memset(&stream, 0, sizeof(stream));
     stream.avail_in = 0;
     stream.next_in = (Bytef *)inbuff;
     stream.next_out = (Bytef *)outbuff;
-    stream.zalloc = (alloc_func) NULL;
-    stream.zfree = (free_func) NULL;
-    stream.opaque = (voidpf) 0;
     stream.avail_out = FILEBUFF;
 
-    zret = inflateInit(&stream);
+    zret = cli_inflate_init(&stream, MAX_WBITS, ctx);
     if(zret != Z_OK) {
         cli_errmsg("scancws: inflateInit() failed\n");
         close(fd);
@@ -352,7 +351,7 @@ static int scancws(cli_ctx *ctx, struct swf_file_hdr *hdr)
             if(ret < 0) {
                 cli_errmsg("scancws: Error reading SWF file\n");
                 close(fd);
-                inflateEnd(&stream);
+                cli_inflate_end(&stream);
                 if(cli_unlink(tmpname)) {
                     free(tmpname);
                     return CL_EUNLINK;
@@ -365,14 +364,14 @@ static int scancws(cli_ctx *ctx, struct swf_file_hdr *hdr)
             stream.avail_in = ret;
             offset += ret;
         }
-        zret = inflate(&stream, Z_SYNC_FLUSH);
+        zret = cli_inflate(&stream, Z_SYNC_FLUSH);
         count = FILEBUFF - stream.avail_out;
         if(count) {
             if(cli_checklimits("SWF", ctx, outsize + count, 0, 0) != CL_SUCCESS)
                 break;
             if(cli_writen(fd, outbuff, count) != count) {
                 cli_errmsg("scancws: Can't write to file %s\n", tmpname);
-                inflateEnd(&stream);
+                cli_inflate_end(&stream);
                 close(fd);
                 if(cli_unlink(tmpname)) {
                     free(tmpname);
@@ -387,7 +386,7 @@ static int scancws(cli_ctx *ctx, struct swf_file_hdr *hdr)
         stream.avail_out = FILEBUFF;
     } while(zret == Z_OK);
 
-    zend = inflateEnd(&stream);
+    zend = cli_inflate_end(&stream);
 
     if((zret != Z_STREAM_END && zret != Z_OK) || zend != Z_OK) {
         /*
@@ -38,7 +38,7 @@
 #include <stdio.h>
 
 #include <zlib.h>
-#include "inflate64.h"
+#include "inflate_iface.h"
 #if HAVE_BZLIB_H
 #include <bzlib.h>
 #endif
@@ -50,6 +50,8 @@
 #include "matcher.h"
 #include "fmap.h"
 #include "json_api.h"
+#include "dsink.h"
+#include "cache.h"
 
 #define UNZIP_PRIVATE
 #include "unzip.h"
@@ -61,27 +63,25 @@
     } while(0)
 
 
-static int wrap_inflateinit2(void *a, int b) {
-  return inflateInit2(a, b);
+int zip_scan_cb(fmap_t *map, cli_ctx *ctx)
+{
+  return cli_map_scan(map, 0, map->len, ctx, CL_TYPE_ANY);
 }
 
 static int unz(const uint8_t *src, uint32_t csize, uint32_t usize, uint16_t method, uint16_t flags, unsigned int *fu, cli_ctx *ctx, char *tmpd, zip_cb zcb) {
-  char name[1024], obuf[BUFSIZ];
-  char *tempfile = name;
-  int of, ret=CL_CLEAN;
-  unsigned int res=1, written=0;
+  char name[1024];
+  struct cli_dsink sink;
+  fmap_t *map;
+  size_t avail;
+  int ret=CL_CLEAN, rc;
+  unsigned int res=1;
 
   if(tmpd) {
     snprintf(name, sizeof(name), "%s"PATHSEP"zip.%03u", tmpd, *fu);
     name[sizeof(name)-1]='\0';
-  } else {
-    if(!(tempfile = cli_gentemp(ctx->engine->tmpdir))) return CL_EMEM;
-  }
-  if((of = open(tempfile, O_RDWR|O_CREAT|O_TRUNC|O_BINARY, S_IRUSR|S_IWUSR))==-1) {
-    cli_warnmsg("cli_unzip: failed to create temporary file %s\n", tempfile);
-    if(!tmpd) free(tempfile);
-    return CL_ETMPFILE;
   }
+  cli_dsink_init(&sink, ctx, "cli_unzip", tmpd ? name : NULL);
+
   switch (method) {
   case ALG_STORED:
     if(csize<usize) {
@@ -94,85 +94,60 @@ static int unz(const uint8_t *src, uint32_t csize, uint32_t usize, uint16_t meth
       else break;
     }
     if(res==1) {
-      if(ctx->engine->maxfilesize && csize > ctx->engine->maxfilesize) {
-	cli_dbgmsg("cli_unzip: trimming output size to maxfilesize (%lu)\n", (long unsigned int) ctx->engine->maxfilesize);
-	csize = ctx->engine->maxfilesize;
-      }
-      if(cli_writen(of, src, csize)!=(int)csize) ret = CL_EWRITE;
-      else res=0;
+      rc = cli_dsink_write(&sink, src, csize, csize);
+      if(rc == CL_SUCCESS || rc == CL_BREAK) res=0;
+      else ret = rc;
     }
     break;
 
   case ALG_DEFLATE:
   case ALG_DEFLATE64: {
-    union {
-      z_stream64 strm64;
-      z_stream strm;
-    } strm;
-    typedef int (*unz_init_) (void *, int);
-    typedef int (*unz_unz_) (void *, int);
-    typedef int (*unz_end_) (void *);
-    unz_init_ unz_init;
-    unz_unz_ unz_unz;
-    unz_end_ unz_end;
-    int wbits;
-    void **next_in;
-    void **next_out;
-    unsigned int *avail_in;
-    unsigned int *avail_out;
-
-    if(method == ALG_DEFLATE64) {
-      unz_init = (unz_init_)inflate64Init2;
-      unz_unz = (unz_unz_)inflate64;
-      unz_end = (unz_end_)inflate64End;
-      next_in = (void *)&strm.strm64.next_in;
-      next_out = (void *)&strm.strm64.next_out;
-      avail_in = &strm.strm64.avail_in;
-      avail_out = &strm.strm64.avail_out;
-      wbits=MAX_WBITS64;
-    } else {
-      unz_init = (unz_init_)wrap_inflateinit2;
-      unz_unz = (unz_unz_)inflate;
-      unz_end = (unz_end_)inflateEnd;
-      next_in = (void *)&strm.strm.next_in;
-      next_out = (void *)&strm.strm.next_out;
-      avail_in = &strm.strm.avail_in;
-      avail_out = &strm.strm.avail_out;
-      wbits=MAX_WBITS;
+    struct cli_zstream strm;
+    unsigned int in;
+
+    if(method == ALG_DEFLATE && (rc = cli_dsink_inflate(&sink, src, csize, usize, -MAX_WBITS)) != CL_EUNPACK) {
+      if(rc == CL_SUCCESS || rc == CL_BREAK) res=0;
+      else ret = rc;
+      break;
     }
 
     memset(&strm, 0, sizeof(strm));
-
-    *next_in = (void*) src;
-    *next_out = obuf;
-    *avail_in = csize;
-    *avail_out = sizeof(obuf);
-    if (unz_init(&strm, -wbits)!=Z_OK) {
+    strm.next_in = (void*) src;
+    strm.avail_in = csize;
+    if(method == ALG_DEFLATE64)
+      rc = cli_inflate64_init(&strm, ctx);
+    else
+      rc = cli_inflate_init(&strm, -MAX_WBITS, ctx);
+    if (rc!=Z_OK) {
       cli_dbgmsg("cli_unzip: zinit failed\n");
       break;
     }
     while(1) {
-      while((res = unz_unz(&strm, Z_NO_FLUSH))==Z_OK) {};
-      if(*avail_out!=sizeof(obuf)) {
-	written+=sizeof(obuf)-(*avail_out);
-	if(ctx->engine->maxfilesize && written > ctx->engine->maxfilesize) {
-	  cli_dbgmsg("cli_unzip: trimming output size to maxfilesize (%lu)\n", (long unsigned int) ctx->engine->maxfilesize);
+      if(!(strm.next_out = cli_dsink_space(&sink, &avail))) {
+	ret = CL_EMEM;
+	res = 100;
+	break;
+      }
+      strm.avail_out = avail;
+      in = strm.avail_in;
+      res = cli_inflate(&strm, Z_NO_FLUSH);
+      if(strm.avail_out!=avail) {
+	rc = cli_dsink_commit(&sink, avail-strm.avail_out, in-strm.avail_in);
+	if(rc == CL_BREAK) {
+	  cli_dbgmsg("cli_unzip: trimming output size to %lu\n", (long unsigned int)sink.len);
 	  res = Z_STREAM_END;
 	  break;
 	}
-	if(cli_writen(of, obuf, sizeof(obuf)-(*avail_out)) != (int)(sizeof(obuf)-(*avail_out))) {
-            cli_warnmsg("cli_unzip: falied to write %lu inflated bytes\n", (unsigned long int)sizeof(obuf)-(*avail_out));
-	  ret = CL_EWRITE;
+	if(rc != CL_SUCCESS) {
+	  ret = rc;
 	  res = 100;
 	  break;
 	}
-	*next_out = obuf;
-	*avail_out = sizeof(obuf);
-	continue;
       }
+      if(res == Z_OK) continue;
       break;
     }
-    unz_end(&strm);
+    cli_inflate_end(&strm);
     if (res == Z_STREAM_END) res=0;
     break;
   }
@@ -187,31 +162,36 @@ static int unz(const uint8_t *src, uint32_t csize, uint32_t usize, uint16_t meth
 
   case ALG_BZIP2: {
     bz_stream strm;
+    unsigned int in;
     memset(&strm, 0, sizeof(strm));
     strm.next_in = (char *)src;
-    strm.next_out = obuf;
     strm.avail_in = csize;
-    strm.avail_out = sizeof(obuf);
     if (BZ2_bzDecompressInit(&strm, 0, 0)!=BZ_OK) {
       cli_dbgmsg("cli_unzip: bzinit failed\n");
       break;
     }
-    while((res = BZ2_bzDecompress(&strm))==BZ_OK || res==BZ_STREAM_END) {
-      if(strm.avail_out!=sizeof(obuf)) {
-	written+=sizeof(obuf)-strm.avail_out;
-	if(ctx->engine->maxfilesize && written > ctx->engine->maxfilesize) {
-	  cli_dbgmsg("cli_unzip: trimming output size to maxfilesize (%lu)\n", (unsigned long int) ctx->engine->maxfilesize);
+    while(1) {
+      if(!(strm.next_out = (char *)cli_dsink_space(&sink, &avail))) {
+	ret = CL_EMEM;
+	res = 100;
+	break;
+      }
+      strm.avail_out = avail;
+      in = strm.avail_in;
+      res = BZ2_bzDecompress(&strm);
+      if(res != BZ_OK && res != BZ_STREAM_END) break;
+      if(strm.avail_out!=avail) {
+	rc = cli_dsink_commit(&sink, avail-strm.avail_out, in-strm.avail_in);
+	if(rc == CL_BREAK) {
+	  cli_dbgmsg("cli_unzip: trimming output size to %lu\n", (long unsigned int)sink.len);
 	  res = BZ_STREAM_END;
 	  break;
 	}
-	if(cli_writen(of, obuf, sizeof(obuf)-strm.avail_out) != (int)(sizeof(obuf)-strm.avail_out)) {
-            cli_warnmsg("cli_unzip: falied to write %lu bunzipped bytes\n", (long unsigned int)sizeof(obuf)-strm.avail_out);
-	  ret = CL_EWRITE;
+	if(rc != CL_SUCCESS) {
+	  ret = rc;
 	  res = 100;
 	  break;
 	}
-	strm.next_out = obuf;
-	strm.avail_out = sizeof(obuf);
 	if (res == BZ_OK) continue; /* after returning BZ_STREAM_END once, decompress returns an error */
       }
       break;
@@ -225,30 +205,34 @@ static int unz(const uint8_t *src, uint32_t csize, uint32_t usize, uint16_t meth
 
   case ALG_IMPLODE: {
     struct xplstate strm;
+    unsigned int in;
     strm.next_in = (void*)src;
-    strm.next_out = (uint8_t *)obuf;
     strm.avail_in = csize;
-    strm.avail_out = sizeof(obuf);
     if (explode_init(&strm, flags)!=EXPLODE_OK) {
       cli_dbgmsg("cli_unzip: explode_init() failed\n");
       break;
     }
-    while((res = explode(&strm))==EXPLODE_OK) {
-      if(strm.avail_out!=sizeof(obuf)) {
-	written+=sizeof(obuf)-strm.avail_out;
-	if(ctx->engine->maxfilesize && written > ctx->engine->maxfilesize) {
-	  cli_dbgmsg("cli_unzip: trimming output size to maxfilesize (%lu)\n", (unsigned long int) ctx->engine->maxfilesize);
+    while(1) {
+      if(!(strm.next_out = cli_dsink_space(&sink, &avail))) {
+	ret = CL_EMEM;
+	res = 100;
+	break;
+      }
+      strm.avail_out = avail;
+      in = strm.avail_in;
+      if((res = explode(&strm))!=EXPLODE_OK) break;
+      if(strm.avail_out!=avail) {
+	rc = cli_dsink_commit(&sink, avail-strm.avail_out, in-strm.avail_in);
+	if(rc == CL_BREAK) {
+	  cli_dbgmsg("cli_unzip: trimming output size to %lu\n", (long unsigned int)sink.len);
 	  res = 0;
 	  break;
 	}
-	if(cli_writen(of, obuf, sizeof(obuf)-strm.avail_out) != (int)(sizeof(obuf)-strm.avail_out)) {
-            cli_warnmsg("cli_unzip: falied to write %lu exploded bytes\n", (unsigned long int) sizeof(obuf)-strm.avail_out);
-	  ret = CL_EWRITE;
+	if(rc != CL_SUCCESS) {
+	  ret = rc;
 	  res = 100;
 	  break;
 	}
-	strm.next_out = (uint8_t *)obuf;
-	strm.avail_out = sizeof(obuf);
 	continue;
       }
       break;
@@ -288,26 +272,18 @@ static int unz(const uint8_t *src, uint32_t csize, uint32_t usize, uint16_t meth
 
   if(!res) {
     (*fu)++;
-    cli_dbgmsg("cli_unzip: extracted to %s\n", tempfile);
-    if (lseek(of, 0, SEEK_SET) == -1) {
-        cli_dbgmsg("cli_unzip: call to lseek() failed\n");
-        if (!(tmpd))
-            free(tempfile);
-        close(of);
-        return CL_ESEEK;
+    cli_dbgmsg("cli_unzip: extracted %lu bytes\n", (long unsigned int)sink.len);
+    if(!(map = cli_dsink_map(&sink))) {
+      cli_dsink_close(&sink);
+      return CL_EMEM;
     }
-    ret = zcb(of, ctx);
-    close(of);
-    if(!ctx->engine->keeptmp)
-      if(cli_unlink(tempfile)) ret = CL_EUNLINK;
-    if(!tmpd) free(tempfile);
+    ret = zcb(map, ctx);
+    funmap(map);
+    if(cli_dsink_close(&sink)) ret = CL_EUNLINK;
     return ret;
   }
 
-  close(of);
-  if(!ctx->engine->keeptmp)
-    if(cli_unlink(tempfile)) ret = CL_EUNLINK;
-  if(!tmpd) free(tempfile);
+  if(cli_dsink_close(&sink)) ret = CL_EUNLINK;
   cli_dbgmsg("cli_unzip: extraction failed\n");
   return ret;
 }
@@ -500,6 +476,7 @@ static inline int zdecrypt(const uint8_t *src, uint32_t csize, uint32_t usize, c
     return CL_SUCCESS;
 }
 
+/* with a NULL zcb the header is checked but the data is not extracted */
 static unsigned int lhdr(fmap_t *map, uint32_t loff,uint32_t zsize, unsigned int *fu, unsigned int fc, const uint8_t *ch, int *ret, cli_ctx *ctx, char *tmpd, int detect_encrypted, zip_cb zcb) {
   const uint8_t *lh, *zip;
   char name[256];
@@ -590,7 +567,11 @@ static unsigned int lhdr(fmap_t *map, uint32_t loff,uint32_t zsize, unsigned int
 	  fmap_unneed_off(map, loff, SIZEOF_LH);
 	  return 0;
       }
-      if(LH_flags & F_ENCR) {
+      if(!zcb) {
+	  /* still counts towards the files limit */
+	  cli_dbgmsg("cli_unzip: lh - same data as an entry already scanned, skipping\n");
+	  (*fu)++;
+      } else if(LH_flags & F_ENCR) {
 	  if(fmap_need_ptr_once(map, zip, csize))
 	      *ret = zdecrypt(zip, csize, usize, lh, fu, ctx, tmpd, zcb);
       } else {
@@ -625,11 +606,240 @@ static unsigned int lhdr(fmap_t *map, uint32_t loff,uint32_t zsize, unsigned int
   return zip-lh;
 }
 
-static unsigned int chdr(fmap_t *map, uint32_t coff, uint32_t zsize, unsigned int *fu, unsigned int fc, int *ret, cli_ctx *ctx, char *tmpd, struct zip_requests *requests) {
+/*
+ * Entries of the central directory, collected before anything is extracted
+ * so they can be unpacked in file order and entries carrying the same data
+ * are only scanned once.
+ */
+struct zip_entry {
+    uint32_t coff;      /* central header */
+    uint32_t loff;      /* local header */
+    uint32_t crc32;
+    uint32_t csize;
+    uint32_t usize;
+    uint16_t method;
+    unsigned int fc;    /* position in the central directory */
+    unsigned int dup;   /* fc of an entry with the same data, 0 if none */
+    uint32_t doff;      /* start of the data, 0 if it can't be deduplicated */
+    unsigned char hash[16]; /* of the data at doff */
+};
+
+struct zip_index {
+    struct zip_entry *entries;
+    unsigned int count;
+    unsigned int size;
+};
+
+static int zip_index_add(struct zip_index *index, const uint8_t *ch, uint32_t coff, unsigned int fc) {
+    struct zip_entry *e;
+
+    if(index->count == index->size) {
+        unsigned int size = index->size ? index->size * 2 : 64;
+
+        if(!(e = cli_realloc(index->entries, size * sizeof(*e)))) {
+            cli_errmsg("cli_unzip: can't grow central directory index to %u entries\n", size);
+            return CL_EMEM;
+        }
+        index->entries = e;
+        index->size = size;
+    }
+
+    e = &index->entries[index->count++];
+    e->coff = coff;
+    e->loff = CH_off;
+    e->crc32 = CH_crc32;
+    e->csize = CH_csize;
+    e->usize = CH_usize;
+    e->method = CH_method;
+    e->fc = fc;
+    e->dup = 0;
+    e->doff = 0;
+    return CL_SUCCESS;
+}
+
+static int zip_entry_cmp_data(const void *a, const void *b) {
+    const struct zip_entry *e1 = a, *e2 = b;
+
+    if(e1->crc32 != e2->crc32) return e1->crc32 < e2->crc32 ? -1 : 1;
+    if(e1->csize != e2->csize) return e1->csize < e2->csize ? -1 : 1;
+    if(e1->usize != e2->usize) return e1->usize < e2->usize ? -1 : 1;
+    if(e1->method != e2->method) return e1->method < e2->method ? -1 : 1;
+    if(e1->loff != e2->loff) return e1->loff < e2->loff ? -1 : 1;
+    return e1->fc < e2->fc ? -1 : (e1->fc > e2->fc);
+}
+
+static int zip_entry_cmp_hash(const void *a, const void *b) {
+    const struct zip_entry *e1 = a, *e2 = b;
+    int cmp;
+
+    if((cmp = memcmp(e1->hash, e2->hash, sizeof(e1->hash))))
+        return cmp;
+    if(e1->loff != e2->loff) return e1->loff < e2->loff ? -1 : 1;
+    return e1->fc < e2->fc ? -1 : (e1->fc > e2->fc);
+}
+
+static int zip_entry_cmp_off(const void *a, const void *b) {
+    const struct zip_entry *e1 = a, *e2 = b;
+
+    if(e1->loff != e2->loff) return e1->loff < e2->loff ? -1 : 1;
+    return e1->fc < e2->fc ? -1 : (e1->fc > e2->fc);
+}
+
+/* locates the data of an entry and the parameters lhdr() would unpack it with */
+static uint32_t zip_entry_data(fmap_t *map, uint32_t fsize, const struct zip_entry *e, uint32_t *csize, uint32_t *usize, uint16_t *method, uint16_t *flags) {
+    const uint8_t *lh;
+    uint32_t off;
+
+    if(!(lh = fmap_need_off_once(map, e->loff, SIZEOF_LH)) || LH_magic != 0x04034b50)
+        return 0;
+
+    *flags = LH_flags;
+    *method = LH_method;
+    if(LH_flags & F_USEDD) {
+        *csize = e->csize;
+        *usize = e->usize;
+    } else {
+        *csize = LH_csize;
+        *usize = LH_usize;
+    }
+
+    off = e->loff + SIZEOF_LH + LH_flen + LH_elen;
+    if(off < e->loff || !*csize || !CLI_ISCONTAINED(0, fsize, off, *csize))
+        return 0;
+    return off;
+}
+
+/*
+ * Checks whether two entries would unpack to the same file. Only the bytes
+ * in the archive are trusted for this, the crc32 is set by whoever made it.
+ */
+static int zip_entry_same(fmap_t *map, uint32_t fsize, const struct zip_entry *e1, const struct zip_entry *e2) {
+    uint32_t off1, off2, csize1, csize2, usize1, usize2;
+    uint16_t method1, method2, flags1, flags2;
+    const uint8_t *d1, *d2;
+
+    if(!(off1 = zip_entry_data(map, fsize, e1, &csize1, &usize1, &method1, &flags1)) ||
+       !(off2 = zip_entry_data(map, fsize, e2, &csize2, &usize2, &method2, &flags2)))
+        return 0;
+
+    if((flags1 & (F_ENCR|F_MSKED)) || flags1 != flags2 || method1 != method2 ||
+       csize1 != csize2 || usize1 != usize2)
+        return 0;
+
+    if(off1 == off2)
+        return 1;
+    /* partially overlapping data is left alone, comparing it could be made
+     * quadratic in the size of the archive */
+    if(off1 < off2 + csize2 && off2 < off1 + csize1)
+        return 0;
+
+    if(!(d1 = fmap_need_off_once(map, off1, csize1)) || !(d2 = fmap_need_off_once(map, off2, csize2)))
+        return 0;
+    return !memcmp(d1, d2, csize1);
+}
+
+/* hashes the data of e so entries can be grouped by content, returns 0 if it can't be */
+static int zip_entry_hash(fmap_t *map, uint32_t fsize, struct zip_entry *e, const uint64_t seed[2]) {
+    struct cli_fasthash fh;
+    uint32_t off, csize, usize, todo;
+    uint16_t method, flags;
+    const void *buf;
+
+    if(!(off = zip_entry_data(map, fsize, e, &csize, &usize, &method, &flags)) || (flags & (F_ENCR|F_MSKED)))
+        return 0;
+
+    cli_fasthash_init(&fh, seed);
+    e->doff = off;
+    for(todo = csize; todo; ) {
+        uint32_t readme = todo < FILEBUFF ? todo : FILEBUFF;
+
+        if(!(buf = fmap_need_off_once(map, off, readme)))
+            return 0;
+        cli_fasthash_update(&fh, buf, readme);
+        off += readme;
+        todo -= readme;
+    }
+    cli_fasthash_final(&fh, e->hash);
+    return 1;
+}
+
+/*
+ * Marks duplicate entries within a group of entries sharing the same
+ * metadata. The group is keyed by a hash of the data, and each entry is
+ * checked against every earlier entry with the same hash that isn't a
+ * duplicate itself, so an entry matching any member of the group is found.
+ */
+static unsigned int zip_group_dedup(fmap_t *map, uint32_t fsize, struct zip_entry *group, unsigned int count, const uint64_t seed[2]) {
+    unsigned int i, j, hashed = 0, dups = 0;
+
+    for(i = 0; i < count; i++) {
+        struct zip_entry *e = &group[i];
+
+        /* entries sharing a local header (sorted next to each other) share data */
+        if(i && e->loff == group[i - 1].loff && group[i - 1].doff) {
+            e->doff = group[i - 1].doff;
+            memcpy(e->hash, group[i - 1].hash, sizeof(e->hash));
+        } else if(!zip_entry_hash(map, fsize, e, seed)) {
+            e->doff = 0;
+            memset(e->hash, 0, sizeof(e->hash));
+            continue;
+        }
+        hashed++;
+    }
+    if(hashed < 2)
+        return 0;
+
+    qsort(group, count, sizeof(*group), zip_entry_cmp_hash);
+    for(i = 1; i < count; i++) {
+        if(!group[i].doff)
+            continue;
+        for(j = i; j-- > 0 && !memcmp(group[j].hash, group[i].hash, sizeof(group[i].hash)); ) {
+            if(!group[j].doff || group[j].dup)
+                continue;
+            if(zip_entry_same(map, fsize, &group[j], &group[i])) {
+                group[i].dup = group[j].fc;
+                dups++;
+                break;
+            }
+        }
+    }
+    return dups;
+}
+
+/* marks duplicate entries, then puts the index in local header order */
+static void zip_index_sort(fmap_t *map, uint32_t fsize, struct zip_index *index) {
+    struct zip_entry *entries = index->entries;
+    unsigned int i, first = 0, dups = 0;
+    uint64_t seed[2];
+
+    if(index->count < 2)
+        return;
+
+    /* seeded per archive so colliding entries can't be prepared in advance */
+    seed[0] = ((uint64_t)cli_rndnum(0xffffffff) << 32) ^ cli_rndnum(0xffffffff);
+    seed[1] = ((uint64_t)cli_rndnum(0xffffffff) << 32) ^ cli_rndnum(0xffffffff);
+
+    qsort(entries, index->count, sizeof(*entries), zip_entry_cmp_data);
+    for(i = 1; i <= index->count; i++) {
+        if(i < index->count && entries[i].crc32 == entries[first].crc32 && entries[i].csize == entries[first].csize &&
+           entries[i].usize == entries[first].usize && entries[i].method == entries[first].method)
+            continue;
+        if(i - first > 1)
+            dups += zip_group_dedup(map, fsize, &entries[first], i - first, seed);
+        first = i;
+    }
+    if(dups)
+        cli_dbgmsg("cli_unzip: %u of %u entries duplicate the data of another entry\n", dups, index->count);
+
+    qsort(entries, index->count, sizeof(*entries), zip_entry_cmp_off);
+}
+
+static unsigned int chdr(fmap_t *map, uint32_t coff, uint32_t zsize, unsigned int fc, int *ret, cli_ctx *ctx, struct zip_index *index, struct zip_requests *requests) {
   char name[256];
   int last = 0;
   const uint8_t *ch;
   int virus_found = 0;
+  uint32_t choff = coff;
 
   if(!(ch = fmap_need_off(map, coff, SIZEOF_CH)) || CH_magic != 0x02014b50) {
       if(ch) fmap_unneed_ptr(map, ch, SIZEOF_CH);
@@ -675,7 +885,10 @@ static unsigned int chdr(fmap_t *map, uint32_t coff, uint32_t zsize, unsigned in
 
   if (!requests) {
       if(CH_off<zsize-SIZEOF_LH) {
-          lhdr(map, CH_off, zsize-CH_off, fu, fc, ch, ret, ctx, tmpd, 1, zip_scan_cb);
+          if(zip_index_add(index, ch, choff, fc) != CL_SUCCESS) {
+              *ret = CL_EMEM;
+              last = 1;
+          }
       } else cli_dbgmsg("cli_unzip: ch - local hdr out of file\n");
   }
   else {
@@ -745,13 +958,14 @@ int cli_unzip(cli_ctx *ctx) {
   }
 
   if(coff) {
+      struct zip_index index;
+      unsigned int i;
+      int truncated = 0;
+
+      memset(&index, 0, sizeof(index));
       cli_dbgmsg("cli_unzip: central @%x\n", coff);
-      while((coff=chdr(map, coff, fsize, &fu, fc+1, &ret, ctx, tmpd, NULL))) {
+      while((coff=chdr(map, coff, fsize, fc+1, &ret, ctx, &index, NULL))) {
 	  fc++;
-	  if (ctx->engine->maxfiles && fu>=ctx->engine->maxfiles) {
-	      cli_dbgmsg("cli_unzip: Files limit reached (max: %u)\n", ctx->engine->maxfiles);
-	      ret=CL_EMAXFILES;
-	  }
 #if HAVE_JSON
           if (cli_json_timeout_cycle_check(ctx, &toval) != CL_SUCCESS) {
               ret=CL_ETIMEOUT;
@@ -764,7 +978,44 @@ int cli_unzip(cli_ctx *ctx) {
               } else
                   break;
           }
+          /* nothing past maxfiles entries gets unpacked, don't index it */
+	  if (ctx->engine->maxfiles && index.count>=ctx->engine->maxfiles) {
+	      cli_dbgmsg("cli_unzip: Files limit reached (max: %u), not indexing further entries\n", ctx->engine->maxfiles);
+	      truncated = 1;
+	      break;
+	  }
+      }
+
+      if (ret == CL_CLEAN)
+          zip_index_sort(map, fsize, &index);
+      for(i = 0; ret == CL_CLEAN && i < index.count; i++) {
+          const struct zip_entry *e = &index.entries[i];
+          const uint8_t *ch;
+
+          if(!(ch = fmap_need_off(map, e->coff, SIZEOF_CH)))
+              continue;
+          if(e->dup)
+              cli_dbgmsg("cli_unzip: entry %u has the same data as entry %u\n", e->fc, e->dup);
+          lhdr(map, e->loff, fsize-e->loff, &fu, e->fc, ch, &ret, ctx, tmpd, 1, e->dup ? NULL : zip_scan_cb);
+          fmap_unneed_ptr(map, ch, SIZEOF_CH);
+
+	  if (ctx->engine->maxfiles && fu>=ctx->engine->maxfiles) {
+	      cli_dbgmsg("cli_unzip: Files limit reached (max: %u)\n", ctx->engine->maxfiles);
+	      ret=CL_EMAXFILES;
+	  }
+#if HAVE_JSON
+          if (cli_json_timeout_cycle_check(ctx, &toval) != CL_SUCCESS) {
+              ret=CL_ETIMEOUT;
+          }
+#endif
+          if (ret == CL_VIRUS && SCAN_ALL) {
+              ret = CL_CLEAN;
+              virus_found = 1;
+          }
       }
+      free(index.entries);
+      if (truncated && ret == CL_CLEAN)
+          ret = CL_EMAXFILES;
   } else cli_dbgmsg("cli_unzip: central not found, using localhdrs\n");
   if (virus_found == 1)
       ret = CL_VIRUS;
@@ -887,7 +1138,7 @@ int unzip_search(cli_ctx *ctx, fmap_t *map, struct zip_requests *requests)
 
     if(coff) {
         cli_dbgmsg("unzip_search: central @%x\n", coff);
-        while(ret==CL_CLEAN && (coff=chdr(zmap, coff, fsize, NULL, fc+1, &ret, ctx, NULL, requests))) {
+        while(ret==CL_CLEAN && (coff=chdr(zmap, coff, fsize, fc+1, &ret, ctx, NULL, requests))) {
             if (requests->match) {
                 ret=CL_VIRUS;
             }
@@ -27,9 +27,10 @@
 #endif
 
 #include "others.h"
+#include "fmap.h"
 
-typedef int (*zip_cb)(int fd, cli_ctx *ctx);
-#define zip_scan_cb cli_magic_scandesc
+typedef int (*zip_cb)(fmap_t *map, cli_ctx *ctx);
+int zip_scan_cb(fmap_t *map, cli_ctx *ctx);
 
 #define MAX_ZIP_REQUESTS 10
 struct zip_requests {
@@ -40,10 +40,12 @@
 #include "others.h"
 #include "scanners.h"
 #include "vba_extract.h"
+#include "fmap.h"
 #ifdef	CL_DEBUG
 #include "mbox.h"
 #endif
 #include "blob.h"
+#include "inflate_iface.h"
 #ifdef HAVE_JSON
 #include "json.h"
 #endif
@@ -72,11 +74,22 @@ typedef struct {
 	int	big_endian;	/* e.g. MAC Office */
 } vba_version_t;
 
-static	int	skip_past_nul(int fd);
-static	int	read_uint16(int fd, uint16_t *u, int big_endian);
-static	int	read_uint32(int fd, uint32_t *u, int big_endian);
-static	int	seekandread(int fd, off_t offset, int whence, void *data, size_t len);
-static	vba_project_t	*create_vba_project(int record_count, const char *dir, struct uniq *U);
+/*
+ * The readers walk a stream with a file position, as they did when each
+ * stream was dumped to a file, but over a map of the stream
+ */
+typedef struct {
+	fmap_t	*map;
+	off_t	pos;
+} vba_cursor_t;
+
+static	int	vba_read(vba_cursor_t *vc, void *data, size_t len);
+static	off_t	vba_seek(vba_cursor_t *vc, off_t offset, int whence);
+static	int	skip_past_nul(vba_cursor_t *vc);
+static	int	read_uint16(vba_cursor_t *vc, uint16_t *u, int big_endian);
+static	int	read_uint32(vba_cursor_t *vc, uint32_t *u, int big_endian);
+static	int	seekandread(vba_cursor_t *vc, off_t offset, int whence, void *data, size_t len);
+static	vba_project_t	*create_vba_project(int record_count, struct ole2_vfs *vfs, uint32_t storage);
 
 static uint16_t
 vba_endian_convert_16(uint16_t value, int big_endian)
@@ -153,7 +166,7 @@ get_unicode_name(const char *name, int size, int big_endian)
 }
 
 
-static void vba56_test_middle(int fd)
+static void vba56_test_middle(vba_cursor_t *vc)
 {
 	char test_middle[MIDDLE_SIZE];
 
@@ -168,13 +181,13 @@ static void vba56_test_middle(int fd)
 		0x85, 0x2e, 0x02, 0x60, 0x8c, 0x4d, 0x0b, 0xb4, 0x00, 0x00
 	};
 
-	if(cli_readn(fd, &test_middle, MIDDLE_SIZE) != MIDDLE_SIZE)
+	if(vba_read(vc, &test_middle, MIDDLE_SIZE) != MIDDLE_SIZE)
 		return;
 
 	if((memcmp(test_middle, middle1_str, MIDDLE_SIZE) != 0) &&
 	   (memcmp(test_middle, middle2_str, MIDDLE_SIZE) != 0)) {
 		cli_dbgmsg("middle not found\n");
-		if (lseek(fd, -MIDDLE_SIZE, SEEK_CUR) == -1) {
+		if (vba_seek(vc, -MIDDLE_SIZE, SEEK_CUR) == -1) {
             cli_dbgmsg("vba_test_middle: call to lseek() failed\n");
             return;
         }
@@ -184,7 +197,7 @@ static void vba56_test_middle(int fd)
 
 /* return count of valid strings found, 0 on error */
 static int
-vba_read_project_strings(int fd, int big_endian)
+vba_read_project_strings(vba_cursor_t *vc, int big_endian)
 {
     unsigned char *buf = NULL;
     uint16_t buflen = 0;
@@ -196,7 +209,7 @@ vba_read_project_strings(int fd, int big_endian)
         char *name;
 
         /* if no initial name length, exit */
-        if(getnewlength && !read_uint16(fd, &length, big_endian)) {
+        if(getnewlength && !read_uint16(vc, &length, big_endian)) {
             ret = 0;
             break;
         }
@@ -204,7 +217,7 @@ vba_read_project_strings(int fd, int big_endian)
 
         /* if too short, break */
         if (length < 6) {
-            if (lseek(fd, -2, SEEK_CUR) == -1) {
+            if (vba_seek(vc, -2, SEEK_CUR) == -1) {
                 cli_dbgmsg("vba_read_project_strings: call to lseek() has failed\n");
                 ret = 0;
             }
@@ -222,7 +235,7 @@ vba_read_project_strings(int fd, int big_endian)
         }
 
         /* save current offset */
-        offset = lseek(fd, 0, SEEK_CUR);
+        offset = vba_seek(vc, 0, SEEK_CUR);
         if (offset == -1) {
             cli_dbgmsg("vba_read_project_strings: call to lseek() has failed\n");
             ret = 0;
@@ -230,9 +243,9 @@ vba_read_project_strings(int fd, int big_endian)
         }
 
         /* if read name failed, break */
-        if(cli_readn(fd, buf, length) != (int)length) {
+        if(vba_read(vc, buf, length) != (int)length) {
             cli_dbgmsg("read name failed - rewinding\n");
-            if (lseek(fd, offset, SEEK_SET) == -1) {
+            if (vba_seek(vc, offset, SEEK_SET) == -1) {
                 cli_dbgmsg("call to lseek() in read name failed\n");
                 ret = 0;
             }
@@ -245,7 +258,7 @@ vba_read_project_strings(int fd, int big_endian)
         if((name == NULL) || (memcmp("*\\", name, 2) != 0) ||
            (strchr("ghcd", name[2]) == NULL)) {
             /* Not a valid string, rewind */
-            if (lseek(fd, -(length+2), SEEK_CUR) == -1) {
+            if (vba_seek(vc, -(length+2), SEEK_CUR) == -1) {
                 cli_dbgmsg("call to lseek() after get_unicode_name has failed\n");
                 ret = 0;
             }
@@ -255,7 +268,7 @@ vba_read_project_strings(int fd, int big_endian)
         free(name);
 
         /* can't get length, break */
-        if(!read_uint16(fd, &length, big_endian)) {
+        if(!read_uint16(vc, &length, big_endian)) {
             break;
         }
 
@@ -267,14 +280,14 @@ vba_read_project_strings(int fd, int big_endian)
         }
 
         /* determine offset and run middle test */
-        offset = lseek(fd, 10, SEEK_CUR);
+        offset = vba_seek(vc, 10, SEEK_CUR);
         if (offset == -1) {
             cli_dbgmsg("call to lseek() has failed\n");
             ret = 0;
             break;
         }
         cli_dbgmsg("offset: %lu\n", (unsigned long)offset);
-        vba56_test_middle(fd);
+        vba56_test_middle(vc);
         getnewlength = 1;
     }
 
@@ -283,67 +296,63 @@ vba_read_project_strings(int fd, int big_endian)
 }
 
 vba_project_t *
-cli_vba_readdir(const char *dir, struct uniq *U, uint32_t which)
+cli_vba_readdir(struct ole2_vfs *vfs, uint32_t storage, uint32_t which)
 {
 	unsigned char *buf;
 	const unsigned char vba56_signature[] = { 0xcc, 0x61 };
 	uint16_t record_count, buflen, ffff, byte_count;
 	uint32_t offset;
-	int i, j, fd, big_endian = FALSE;
+	int i, j, big_endian = FALSE;
 	vba_project_t *vba_project;
 	struct vba56_header v56h;
 	off_t seekback;
-	char fullname[1024], *hash;
+	vba_cursor_t cursor, *vc = &cursor;
 
 	cli_dbgmsg("in cli_vba_readdir()\n");
 
-	if(dir == NULL)
+	if(vfs == NULL)
 		return NULL;
 
 	/*
 	 * _VBA_PROJECT files are embedded within office documents (OLE2)
 	 */
-	
-	if (!uniq_get(U, "_vba_project", 12, &hash))
-		return NULL;
-	snprintf(fullname, sizeof(fullname), "%s"PATHSEP"%s_%u", dir, hash, which);
-	fullname[sizeof(fullname)-1] = '\0';
-	fd = open(fullname, O_RDONLY|O_BINARY);
 
-	if(fd == -1)
+	vc->map = cli_ole2_vfs_map(vfs, storage, "_vba_project", which);
+	if(vc->map == NULL)
 		return NULL;
+	vc->pos = 0;
 
-	if(cli_readn(fd, &v56h, sizeof(struct vba56_header)) != sizeof(struct vba56_header)) {
-		close(fd);
+	if(vba_read(vc, &v56h, sizeof(struct vba56_header)) != sizeof(struct vba56_header)) {
+		funmap(vc->map);
 		return NULL;
 	}
 	if (memcmp(v56h.magic, vba56_signature, sizeof(v56h.magic)) != 0) {
-		close(fd);
+		funmap(vc->map);
 		return NULL;
 	}
 
-	i = vba_read_project_strings(fd, TRUE);
-	if ((seekback = lseek(fd, 0, SEEK_CUR)) == -1) {
+	i = vba_read_project_strings(vc, TRUE);
+	if ((seekback = vba_seek(vc, 0, SEEK_CUR)) == -1) {
 		cli_dbgmsg("vba_readdir: lseek() failed. Unable to guess VBA type\n");
-		close(fd);
+		funmap(vc->map);
 		return NULL;
 	}
-	if (lseek(fd, sizeof(struct vba56_header), SEEK_SET) == -1) {
+	if (vba_seek(vc, sizeof(struct vba56_header), SEEK_SET) == -1) {
 		cli_dbgmsg("vba_readdir: lseek() failed. Unable to guess VBA type\n");
-		close(fd);
+		funmap(vc->map);
 		return NULL;
 	}
-	j = vba_read_project_strings(fd, FALSE);
+	j = vba_read_project_strings(vc, FALSE);
 	if(!i && !j) {
-		close(fd);
+		funmap(vc->map);
 		cli_dbgmsg("vba_readdir: Unable to guess VBA type\n");
 		return NULL;
 	}
 	if (i > j) {
 		big_endian = TRUE;
-		if (lseek(fd, seekback, SEEK_SET) == -1) {
+		if (vba_seek(vc, seekback, SEEK_SET) == -1) {
 			cli_dbgmsg("vba_readdir: call to lseek() while guessing big-endian has failed\n");
-			close(fd);
+			funmap(vc->map);
 			return NULL;
 		}
 		cli_dbgmsg("vba_readdir: Guessing big-endian\n");
@@ -353,72 +362,72 @@ cli_vba_readdir(const char *dir, struct uniq *U, uint32_t which)
 
 	/* junk some more stuff */
 	do
-		if (cli_readn(fd, &ffff, 2) != 2) {
-			close(fd);
+		if (vba_read(vc, &ffff, 2) != 2) {
+			funmap(vc->map);
 			return NULL;
 		}
 	while(ffff != 0xFFFF);
 
 	/* check for alignment error */
-	if(!seekandread(fd, -3, SEEK_CUR, &ffff, sizeof(uint16_t))) {
-		close(fd);
+	if(!seekandread(vc, -3, SEEK_CUR, &ffff, sizeof(uint16_t))) {
+		funmap(vc->map);
 		return NULL;
 	}
 	if (ffff != 0xFFFF) {
-		if (lseek(fd, 1, SEEK_CUR) == -1) {
+		if (vba_seek(vc, 1, SEEK_CUR) == -1) {
             cli_dbgmsg("call to lseek() while checking alignment error has failed\n");
-            close(fd);
+            funmap(vc->map);
             return NULL;
         }
     }
 
-	if(!read_uint16(fd, &ffff, big_endian)) {
-		close(fd);
+	if(!read_uint16(vc, &ffff, big_endian)) {
+		funmap(vc->map);
 		return NULL;
 	}
 
 	if(ffff != 0xFFFF) {
-		if (lseek(fd, ffff, SEEK_CUR) == -1) {
+		if (vba_seek(vc, ffff, SEEK_CUR) == -1) {
             cli_dbgmsg("call to lseek() while checking alignment error has failed\n");
-            close(fd);
+            funmap(vc->map);
             return NULL;
         }
     }
 
-	if(!read_uint16(fd, &ffff, big_endian)) {
-		close(fd);
+	if(!read_uint16(vc, &ffff, big_endian)) {
+		funmap(vc->map);
 		return NULL;
 	}
 
 	if(ffff == 0xFFFF)
 		ffff = 0;
 
-	if (lseek(fd, ffff + 100, SEEK_CUR) == -1) {
+	if (vba_seek(vc, ffff + 100, SEEK_CUR) == -1) {
         cli_dbgmsg("call to lseek() failed\n");
-        close(fd);
+        funmap(vc->map);
         return NULL;
     }
 
-	if(!read_uint16(fd, &record_count, big_endian)) {
-		close(fd);
+	if(!read_uint16(vc, &record_count, big_endian)) {
+		funmap(vc->map);
 		return NULL;
 	}
 	cli_dbgmsg("vba_readdir: VBA Record count %d\n", record_count);
 	if (record_count == 0) {
 		/* No macros, assume clean */
-		close(fd);
+		funmap(vc->map);
 		return NULL;
 	}
 	if (record_count > MAX_VBA_COUNT) {
 		/* Almost certainly an error */
 		cli_dbgmsg("vba_readdir: VBA Record count too big\n");
-		close(fd);
+		funmap(vc->map);
 		return NULL;
 	}
 
-	vba_project = create_vba_project(record_count, dir, U);
+	vba_project = create_vba_project(record_count, vfs, storage);
 	if(vba_project == NULL) {
-		close(fd);
+		funmap(vc->map);
 		return NULL;
 	}
 	buf = NULL;
@@ -428,7 +437,7 @@ cli_vba_readdir(const char *dir, struct uniq *U, uint32_t which)
 		char *ptr;
 
 		vba_project->colls[i] = 0;
-		if(!read_uint16(fd, &length, big_endian))
+		if(!read_uint16(vc, &length, big_endian))
 			break;
 
 		if (length == 0) {
@@ -442,55 +451,50 @@ cli_vba_readdir(const char *dir, struct uniq *U, uint32_t which)
 			buflen = length;
 			buf = newbuf;
 		}
-		if (cli_readn(fd, buf, length) != length) {
+		if (vba_read(vc, buf, length) != length) {
 			cli_dbgmsg("vba_readdir: read name failed\n");
 			break;
 		}
 		ptr = get_unicode_name((const char *)buf, length, big_endian);
 		if(ptr == NULL) break;
-		if (!(vba_project->colls[i]=uniq_get(U, ptr, strlen(ptr), &hash))) {
-			cli_dbgmsg("vba_readdir: cannot find project %s (%s)\n", ptr, hash);
+		if (!(vba_project->colls[i]=cli_ole2_vfs_count(vfs, storage, ptr))) {
+			cli_dbgmsg("vba_readdir: cannot find project %s\n", ptr);
 			free(ptr);
 			break;
 		}
-		cli_dbgmsg("vba_readdir: project name: %s (%s)\n", ptr, hash);
-		free(ptr);
-		vba_project->name[i] = hash;
-		if(!read_uint16(fd, &length, big_endian))
+		cli_dbgmsg("vba_readdir: project name: %s\n", ptr);
+		vba_project->name[i] = ptr;
+		if(!read_uint16(vc, &length, big_endian))
 			break;
-		lseek(fd, length, SEEK_CUR);
+		vba_seek(vc, length, SEEK_CUR);
 
-		if(!read_uint16(fd, &ffff, big_endian))
+		if(!read_uint16(vc, &ffff, big_endian))
 			break;
 		if (ffff == 0xFFFF) {
-			lseek(fd, 2, SEEK_CUR);
-			if(!read_uint16(fd, &ffff, big_endian))
+			vba_seek(vc, 2, SEEK_CUR);
+			if(!read_uint16(vc, &ffff, big_endian))
 				break;
-			lseek(fd, ffff + 8, SEEK_CUR);
+			vba_seek(vc, ffff + 8, SEEK_CUR);
 		} else
-			lseek(fd, ffff + 10, SEEK_CUR);
+			vba_seek(vc, ffff + 10, SEEK_CUR);
 
-		if(!read_uint16(fd, &byte_count, big_endian))
+		if(!read_uint16(vc, &byte_count, big_endian))
 			break;
-		lseek(fd, (8 * byte_count) + 5, SEEK_CUR);
-		if(!read_uint32(fd, &offset, big_endian))
+		vba_seek(vc, (8 * byte_count) + 5, SEEK_CUR);
+		if(!read_uint32(vc, &offset, big_endian))
 			break;
 		cli_dbgmsg("vba_readdir: offset: %u\n", (unsigned int)offset);
 		vba_project->offset[i] = offset;
-		lseek(fd, 2, SEEK_CUR);
+		vba_seek(vc, 2, SEEK_CUR);
 	}
 
 	if(buf)
 		free(buf);
 
-	close(fd);
+	funmap(vc->map);
 
 	if(i < record_count) {
-		free(vba_project->name);
-		free(vba_project->colls);
-		free(vba_project->dir);
-		free(vba_project->offset);
-		free(vba_project);
+		cli_free_vba_project(vba_project);
 		return NULL;
 	}
 
@@ -498,15 +502,16 @@ cli_vba_readdir(const char *dir, struct uniq *U, uint32_t which)
 }
 
 unsigned char *
-cli_vba_inflate(int fd, off_t offset, int *size)
+cli_vba_inflate(fmap_t *map, off_t offset, int *size)
 {
 	unsigned int pos, shift, mask, distance, clean;
 	uint8_t flag;
 	uint16_t token;
 	blob *b;
 	unsigned char buffer[VBA_COMPRESSION_WINDOW];
+	vba_cursor_t cursor, *vc = &cursor;
 
-	if(fd < 0)
+	if(map == NULL)
 		return NULL;
 
 	b = blobCreate();
@@ -515,18 +520,20 @@ cli_vba_inflate(int fd, off_t offset, int *size)
 		return NULL;
 
 	memset(buffer, 0, sizeof(buffer));
-	lseek(fd, offset+3, SEEK_SET); /* 1byte ?? , 2byte length ?? */
+	vc->map = map;
+	vc->pos = 0;
+	vba_seek(vc, offset+3, SEEK_SET); /* 1byte ?? , 2byte length ?? */
 	clean = TRUE;
 	pos = 0;
 
-	while (cli_readn(fd, &flag, 1) == 1) {
+	while (vba_read(vc, &flag, 1) == 1) {
 		for(mask = 1; mask < 0x100; mask<<=1) {
 			unsigned int winpos = pos % VBA_COMPRESSION_WINDOW;
 			if (flag & mask) {
 				uint16_t len;
 				unsigned int srcpos;
 
-				if(!read_uint16(fd, &token, FALSE)) {
+				if(!read_uint16(vc, &token, FALSE)) {
 					blobDestroy(b);
 					if(size)
 						*size = 0;
@@ -559,7 +566,7 @@ cli_vba_inflate(int fd, off_t offset, int *size)
 					}
 			} else {
 				if((pos != 0) && (winpos == 0) && clean) {
-					if (cli_readn(fd, &token, 2) != 2) {
+					if (vba_read(vc, &token, 2) != 2) {
 						blobDestroy(b);
 						if(size)
 							*size = 0;
@@ -569,7 +576,7 @@ cli_vba_inflate(int fd, off_t offset, int *size)
 					clean = FALSE;
 					break;
 				}
-				if(cli_readn(fd, &buffer[winpos], 1) == 1)
+				if(vba_read(vc, &buffer[winpos], 1) == 1)
 					pos++;
 			}
 			clean = TRUE;
@@ -588,88 +595,52 @@ cli_vba_inflate(int fd, off_t offset, int *size)
 	return (unsigned char *)blobToMem(b);
 }
 
-/*
- * See also cli_filecopy()
- */
-static void
-ole_copy_file_data(int s, int d, uint32_t len)
-{
-	unsigned char data[FILEBUFF];
-
-	while(len > 0) {
-		int todo = MIN(sizeof(data), len);
-
-		if(cli_readn(s, data, (unsigned int)todo) != todo)
-			break;
-		if(cli_writen(d, data, (unsigned int)todo) != todo)
-			break;
-		len -= todo;
-	}
-}
-
 int
-cli_scan_ole10(int fd, cli_ctx *ctx)
+cli_scan_ole10(fmap_t *map, cli_ctx *ctx)
 {
-	int ofd, ret;
 	uint32_t object_size;
-	STATBUF statbuf;
-	char *fullname;
+	vba_cursor_t cursor, *vc = &cursor;
 
-	if(fd < 0)
+	if(map == NULL)
 		return CL_CLEAN;
 
-	lseek(fd, 0, SEEK_SET);
-	if(!read_uint32(fd, &object_size, FALSE))
+	vc->map = map;
+	vc->pos = 0;
+	if(!read_uint32(vc, &object_size, FALSE))
 		return CL_CLEAN;
 
-	if(FSTAT(fd, &statbuf) == -1)
-		return CL_ESTAT;
-
-	if ((statbuf.st_size - object_size) >= 4) {
+	if (((off_t)map->len - object_size) >= 4) {
 		/* Probably the OLE type id */
-		if (lseek(fd, 2, SEEK_CUR) == -1) {
+		if (vba_seek(vc, 2, SEEK_CUR) == -1) {
 			return CL_CLEAN;
 		}
 
 		/* Attachment name */
-		if(!skip_past_nul(fd))
+		if(!skip_past_nul(vc))
 			return CL_CLEAN;
 
 		/* Attachment full path */
-		if(!skip_past_nul(fd))
+		if(!skip_past_nul(vc))
 			return CL_CLEAN;
 
 		/* ??? */
-		if(lseek(fd, 8, SEEK_CUR) == -1)
+		if(vba_seek(vc, 8, SEEK_CUR) == -1)
 			return CL_CLEAN;
 
 		/* Attachment full path */
-		if(!skip_past_nul(fd))
+		if(!skip_past_nul(vc))
 			return CL_CLEAN;
 
-		if(!read_uint32(fd, &object_size, FALSE))
+		if(!read_uint32(vc, &object_size, FALSE))
 			return CL_CLEAN;
 	}
-	if(!(fullname = cli_gentemp(ctx ? ctx->engine->tmpdir : NULL))) {
-		return CL_EMEM;
-	}
-	ofd = open(fullname, O_RDWR|O_CREAT|O_TRUNC|O_BINARY|O_EXCL,
-		S_IWUSR|S_IRUSR);
-	if (ofd < 0) {
-		cli_warnmsg("cli_decode_ole_object: can't create %s\n",	fullname);
-		free(fullname);
-		return CL_ECREAT;
-	}
-	cli_dbgmsg("cli_decode_ole_object: decoding to %s\n", fullname);
-	ole_copy_file_data(fd, ofd, object_size);
-	lseek(ofd, 0, SEEK_SET);
-	ret = cli_magic_scandesc(ofd, ctx);
-	close(ofd);
-	if(ctx && !ctx->engine->keeptmp)
-	  if (cli_unlink(fullname))
-	    ret = CL_EUNLINK;
-	free(fullname);
-	return ret;
+	if(object_size == 0 || (size_t)vc->pos >= map->len)
+		return CL_CLEAN;
+
+	/* scan the object in place, cut down to what the stream holds */
+	cli_dbgmsg("cli_scan_ole10: scanning %u bytes at offset %lu\n",
+		(unsigned int)object_size, (unsigned long)vc->pos);
+	return cli_map_scan(map, vc->pos, MIN(object_size, map->len - vc->pos), ctx, CL_TYPE_ANY);
 }
 
 /*
@@ -681,7 +652,7 @@ typedef struct {
 } atom_header_t;
 
 static int
-ppt_read_atom_header(int fd, atom_header_t *atom_header)
+ppt_read_atom_header(vba_cursor_t *vc, atom_header_t *atom_header)
 {
 	uint16_t v;
 	struct ppt_header {
@@ -691,7 +662,7 @@ ppt_read_atom_header(int fd, atom_header_t *atom_header)
 	} h;
 
 	cli_dbgmsg("in ppt_read_atom_header\n");
-	if(cli_readn(fd, &h, sizeof(struct ppt_header)) != sizeof(struct ppt_header)) {
+	if(vba_read(vc, &h, sizeof(struct ppt_header)) != sizeof(struct ppt_header)) {
 		cli_dbgmsg("read ppt_header failed\n");
 		return FALSE;
 	}
@@ -712,15 +683,15 @@ ppt_read_atom_header(int fd, atom_header_t *atom_header)
  *	Needs cli_unzip_single to have a "length" argument
  */
 static int
-ppt_unlzw(const char *dir, int fd, uint32_t length)
+ppt_unlzw(const char *dir, vba_cursor_t *vc, uint32_t length)
 {
 	int ofd;
-	z_stream stream;
+	struct cli_zstream stream;
 	unsigned char inbuff[PPT_LZW_BUFFSIZE], outbuff[PPT_LZW_BUFFSIZE];
 	char fullname[NAME_MAX + 1];
 
 	snprintf(fullname, sizeof(fullname) - 1, "%s"PATHSEP"ppt%.8lx.doc",
-		dir, (long)lseek(fd, 0L, SEEK_CUR));
+		dir, (long)vba_seek(vc, 0L, SEEK_CUR));
 
 	ofd = open(fullname, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY|O_EXCL,
 		S_IWUSR|S_IRUSR);
@@ -729,22 +700,20 @@ ppt_unlzw(const char *dir, int fd, uint32_t length)
 		return FALSE;
 	}
 
-	stream.zalloc = Z_NULL;
-	stream.zfree = Z_NULL;
-	stream.opaque = (void *)NULL;
+	memset(&stream, 0, sizeof(stream));
 	stream.next_in = (Bytef *)inbuff;
 	stream.next_out = outbuff;
 	stream.avail_out = sizeof(outbuff);
 	stream.avail_in = MIN(length, PPT_LZW_BUFFSIZE);
 
-	if(cli_readn(fd, inbuff, stream.avail_in) != (int)stream.avail_in) {
+	if(vba_read(vc, inbuff, stream.avail_in) != (int)stream.avail_in) {
 		close(ofd);
 		cli_unlink(fullname);
 		return FALSE;
 	}
 	length -= stream.avail_in;
 
-	if(inflateInit(&stream) != Z_OK) {
+	if(cli_inflate_init(&stream, MAX_WBITS, NULL) != Z_OK) {
 		close(ofd);
 		cli_unlink(fullname);
 		cli_warnmsg("ppt_unlzw: inflateInit failed\n");
@@ -756,7 +725,7 @@ ppt_unlzw(const char *dir, int fd, uint32_t length)
 			if (cli_writen(ofd, outbuff, PPT_LZW_BUFFSIZE)
 						!= PPT_LZW_BUFFSIZE) {
 				close(ofd);
-				inflateEnd(&stream);
+				cli_inflate_end(&stream);
 				return FALSE;
 			}
 			stream.next_out = outbuff;
@@ -765,30 +734,30 @@ ppt_unlzw(const char *dir, int fd, uint32_t length)
 		if (stream.avail_in == 0) {
 			stream.next_in = inbuff;
 			stream.avail_in = MIN(length, PPT_LZW_BUFFSIZE);
-			if (cli_readn(fd, inbuff, stream.avail_in) != (int)stream.avail_in) {
+			if (vba_read(vc, inbuff, stream.avail_in) != (int)stream.avail_in) {
 				close(ofd);
-				inflateEnd(&stream);
+				cli_inflate_end(&stream);
 				return FALSE;
 			}
 			length -= stream.avail_in;
 		}
-	} while(inflate(&stream, Z_NO_FLUSH) == Z_OK);
+	} while(cli_inflate(&stream, Z_NO_FLUSH) == Z_OK);
 
 	if (cli_writen(ofd, outbuff, PPT_LZW_BUFFSIZE-stream.avail_out) != (int)(PPT_LZW_BUFFSIZE-stream.avail_out)) {
 		close(ofd);
-		inflateEnd(&stream);
+		cli_inflate_end(&stream);
 		return FALSE;
 	}
 	close(ofd);
-	return inflateEnd(&stream) == Z_OK;
+	return cli_inflate_end(&stream) == Z_OK;
 }
 
 static const char *
-ppt_stream_iter(int fd, const char *dir)
+ppt_stream_iter(vba_cursor_t *vc, const char *dir)
 {
 	atom_header_t atom_header;
 
-	while(ppt_read_atom_header(fd, &atom_header)) {
+	while(ppt_read_atom_header(vc, &atom_header)) {
 		if(atom_header.length == 0)
 			return NULL;
 
@@ -796,24 +765,24 @@ ppt_stream_iter(int fd, const char *dir)
 			uint32_t length;
 
 			/* Skip over ID */
-			if(lseek(fd, sizeof(uint32_t), SEEK_CUR) == -1) {
+			if(vba_seek(vc, sizeof(uint32_t), SEEK_CUR) == -1) {
 				cli_dbgmsg("ppt_stream_iter: seek failed\n");
 				return NULL;
 			}
 			length = atom_header.length - 4;
 			cli_dbgmsg("length: %d\n", (int)length);
-			if (!ppt_unlzw(dir, fd, length)) {
+			if (!ppt_unlzw(dir, vc, length)) {
 				cli_dbgmsg("ppt_unlzw failed\n");
 				return NULL;
 			}
 		} else {
-			off_t offset = lseek(fd, 0, SEEK_CUR);
+			off_t offset = vba_seek(vc, 0, SEEK_CUR);
 			/* Check we don't wrap */
 			if ((offset + (off_t)atom_header.length) < offset) {
 				break;
 			}
 			offset += atom_header.length;
-			if (lseek(fd, offset, SEEK_SET) != offset) {
+			if (vba_seek(vc, offset, SEEK_SET) != offset) {
 				break;
 			}
 		}
@@ -822,10 +791,16 @@ ppt_stream_iter(int fd, const char *dir)
 }
 
 char *
-cli_ppt_vba_read(int ifd, cli_ctx *ctx)
+cli_ppt_vba_read(fmap_t *map, cli_ctx *ctx)
 {
 	char *dir;
 	const char *ret;
+	vba_cursor_t cursor;
+
+	if(map == NULL)
+		return NULL;
+	cursor.map = map;
+	cursor.pos = 0;
 
 	/* Create a directory to store the extracted OLE2 objects */
 	dir = cli_gentemp(ctx ? ctx->engine->tmpdir : NULL);
@@ -836,7 +811,7 @@ cli_ppt_vba_read(int ifd, cli_ctx *ctx)
 		free(dir);
 		return NULL;
 	}
-	ret = ppt_stream_iter(ifd, dir);
+	ret = ppt_stream_iter(&cursor, dir);
 	if(ret == NULL) {
 		cli_rmdirs(dir);
 		free(dir);
@@ -866,14 +841,14 @@ typedef struct macro_info_tag {
 } macro_info_t;
 
 static int
-word_read_fib(int fd, mso_fib_t *fib)
+word_read_fib(vba_cursor_t *vc, mso_fib_t *fib)
 {
 	struct {
 		uint32_t offset;
 		uint32_t len;
 	} macro_details;
 
-	if(!seekandread(fd, 0x118, SEEK_SET, &macro_details, sizeof(macro_details))) {
+	if(!seekandread(vc, 0x118, SEEK_SET, &macro_details, sizeof(macro_details))) {
 		cli_dbgmsg("read word_fib failed\n");
 		return FALSE;
 	}
@@ -884,7 +859,7 @@ word_read_fib(int fd, mso_fib_t *fib)
 }
 
 static int
-word_read_macro_entry(int fd, macro_info_t *macro_info)
+word_read_macro_entry(vba_cursor_t *vc, macro_info_t *macro_info)
 {
 	int msize;
 	int count = macro_info->count;
@@ -922,7 +897,7 @@ word_read_macro_entry(int fd, macro_info_t *macro_info)
 		return FALSE;
     }
 
-	if(cli_readn(fd, m, msize) != msize) {
+	if(vba_read(vc, m, msize) != msize) {
 		free(m);
 		cli_warnmsg("read %d macro_entries failed\n", count);
 		return FALSE;
@@ -941,9 +916,9 @@ word_read_macro_entry(int fd, macro_info_t *macro_info)
 }
 
 static macro_info_t *
-word_read_macro_info(int fd, macro_info_t *macro_info)
+word_read_macro_info(vba_cursor_t *vc, macro_info_t *macro_info)
 {
-	if(!read_uint16(fd, &macro_info->count, FALSE)) {
+	if(!read_uint16(vc, &macro_info->count, FALSE)) {
 		cli_dbgmsg("read macro_info failed\n");
 		macro_info->count = 0;
 		return NULL;
@@ -957,7 +932,7 @@ word_read_macro_info(int fd, macro_info_t *macro_info)
         cli_errmsg("word_read_macro_info: Unable to allocate memory for macro_info->entries\n");
 		return NULL;
 	}
-	if(!word_read_macro_entry(fd, macro_info)) {
+	if(!word_read_macro_entry(vc, macro_info)) {
 		free(macro_info->entries);
 		macro_info->count = 0;
 		return NULL;
@@ -966,17 +941,17 @@ word_read_macro_info(int fd, macro_info_t *macro_info)
 }
 
 static int
-word_skip_oxo3(int fd)
+word_skip_oxo3(vba_cursor_t *vc)
 {
 	uint8_t count;
 
-	if (cli_readn(fd, &count, 1) != 1) {
+	if (vba_read(vc, &count, 1) != 1) {
 		cli_dbgmsg("read oxo3 record1 failed\n");
 		return FALSE;
 	}
 	cli_dbgmsg("oxo3 records1: %d\n", count);
 
-	if(!seekandread(fd, count * 14, SEEK_CUR, &count, 1)) {
+	if(!seekandread(vc, count * 14, SEEK_CUR, &count, 1)) {
 		cli_dbgmsg("read oxo3 record2 failed\n");
 		return FALSE;
 	}
@@ -984,18 +959,18 @@ word_skip_oxo3(int fd)
 	if(count == 0) {
 		uint8_t twobytes[2];
 
-		if(cli_readn(fd, twobytes, 2) != 2) {
+		if(vba_read(vc, twobytes, 2) != 2) {
 			cli_dbgmsg("read oxo3 failed\n");
 			return FALSE;
 		}
 		if(twobytes[0] != 2) {
-			lseek(fd, -2, SEEK_CUR);
+			vba_seek(vc, -2, SEEK_CUR);
 			return TRUE;
 		}
 		count = twobytes[1];
 	}
 	if(count > 0)
-		if (lseek(fd, (count*4)+1, SEEK_CUR) == -1) {
+		if (vba_seek(vc, (count*4)+1, SEEK_CUR) == -1) {
 			cli_dbgmsg("lseek oxo3 failed\n");
 			return FALSE;
 		}
@@ -1005,34 +980,34 @@ word_skip_oxo3(int fd)
 }
 
 static int
-word_skip_menu_info(int fd)
+word_skip_menu_info(vba_cursor_t *vc)
 {
 	uint16_t count;
 
-	if(!read_uint16(fd, &count, FALSE)) {
+	if(!read_uint16(vc, &count, FALSE)) {
 		cli_dbgmsg("read menu_info failed\n");
 		return FALSE;
 	}
 	cli_dbgmsg("menu_info count: %d\n", count);
 
 	if(count)
-		if(lseek(fd, count * 12, SEEK_CUR) == -1)
+		if(vba_seek(vc, count * 12, SEEK_CUR) == -1)
 			return FALSE;
 	return TRUE;
 }
 
 static int
-word_skip_macro_extnames(int fd)
+word_skip_macro_extnames(vba_cursor_t *vc)
 {
 	int is_unicode, nbytes;
 	int16_t size;
 
-	if(!read_uint16(fd, (uint16_t *)&size, FALSE)) {
+	if(!read_uint16(vc, (uint16_t *)&size, FALSE)) {
 		cli_dbgmsg("read macro_extnames failed\n");
 		return FALSE;
 	}
 	if (size == -1) { /* Unicode flag */
-		if(!read_uint16(fd, (uint16_t *)&size, FALSE)) {
+		if(!read_uint16(vc, (uint16_t *)&size, FALSE)) {
 			cli_dbgmsg("read macro_extnames failed\n");
 			return FALSE;
 		}
@@ -1047,7 +1022,7 @@ word_skip_macro_extnames(int fd)
 		uint8_t length;
 		off_t offset;
 
-		if (cli_readn(fd, &length, 1) != 1) {
+		if (vba_read(vc, &length, 1) != 1) {
 			cli_dbgmsg("read macro_extnames failed\n");
 			return FALSE;
 		}
@@ -1058,7 +1033,7 @@ word_skip_macro_extnames(int fd)
 			offset = (off_t)length;
 
 		/* ignore numref as well */
-		if(lseek(fd, offset + sizeof(uint16_t), SEEK_CUR) == -1) {
+		if(vba_seek(vc, offset + sizeof(uint16_t), SEEK_CUR) == -1) {
 			cli_dbgmsg("read macro_extnames failed to seek\n");
 			return FALSE;
 		}
@@ -1068,11 +1043,11 @@ word_skip_macro_extnames(int fd)
 }
 
 static int
-word_skip_macro_intnames(int fd)
+word_skip_macro_intnames(vba_cursor_t *vc)
 {
 	uint16_t count;
 
-	if(!read_uint16(fd, &count, FALSE)) {
+	if(!read_uint16(vc, &count, FALSE)) {
 		cli_dbgmsg("read macro_intnames failed\n");
 		return FALSE;
 	}
@@ -1082,13 +1057,13 @@ word_skip_macro_intnames(int fd)
 		uint8_t length;
 
 		/* id */
-		if(!seekandread(fd, sizeof(uint16_t), SEEK_CUR, &length, sizeof(uint8_t))) {
+		if(!seekandread(vc, sizeof(uint16_t), SEEK_CUR, &length, sizeof(uint8_t))) {
 			cli_dbgmsg("skip_macro_intnames failed\n");
 			return FALSE;
 		}
 
 		/* Internal name, plus one byte of unknown data */
-		if(lseek(fd, length + 1, SEEK_CUR) == -1) {
+		if(vba_seek(vc, length + 1, SEEK_CUR) == -1) {
 			cli_dbgmsg("skip_macro_intnames failed\n");
 			return FALSE;
 		}
@@ -1097,7 +1072,7 @@ word_skip_macro_intnames(int fd)
 }
 
 vba_project_t *
-cli_wm_readdir(int fd)
+cli_wm_readdir(fmap_t *map)
 {
 	int done;
 	off_t end_offset;
@@ -1105,8 +1080,14 @@ cli_wm_readdir(int fd)
 	macro_info_t macro_info;
 	vba_project_t *vba_project;
 	mso_fib_t fib;
+	vba_cursor_t cursor, *vc = &cursor;
+
+	if(map == NULL)
+		return NULL;
+	vc->map = map;
+	vc->pos = 0;
 
-	if (!word_read_fib(fd, &fib))
+	if (!word_read_fib(vc, &fib))
 		return NULL;
 
 	if(fib.macro_len == 0) {
@@ -1118,7 +1099,7 @@ cli_wm_readdir(int fd)
 	cli_dbgmsg("wm_readdir: macro len: 0x%.4x\n\n", (int)fib.macro_len);
 
 	/* Go one past the start to ignore start_id */
-	if (lseek(fd, fib.macro_offset + 1, SEEK_SET) != (off_t)(fib.macro_offset + 1)) {
+	if (vba_seek(vc, fib.macro_offset + 1, SEEK_SET) != (off_t)(fib.macro_offset + 1)) {
 		cli_dbgmsg("wm_readdir: lseek macro_offset failed\n");
 		return NULL;
 	}
@@ -1128,8 +1109,8 @@ cli_wm_readdir(int fd)
 	macro_info.entries = NULL;
 	macro_info.count = 0;
 
-	while((lseek(fd, 0, SEEK_CUR) < end_offset) && !done) {
-		if (cli_readn(fd, &info_id, 1) != 1) {
+	while((vba_seek(vc, 0, SEEK_CUR) < end_offset) && !done) {
+		if (vba_read(vc, &info_id, 1) != 1) {
 			cli_dbgmsg("wm_readdir: read macro_info failed\n");
 			break;
 		}
@@ -1137,23 +1118,23 @@ cli_wm_readdir(int fd)
 			case 0x01:
 				if(macro_info.count)
 					free(macro_info.entries);
-				word_read_macro_info(fd, &macro_info);
+				word_read_macro_info(vc, &macro_info);
 				done = TRUE;
 				break;
 			case 0x03:
-				if(!word_skip_oxo3(fd))
+				if(!word_skip_oxo3(vc))
 					done = TRUE;
 				break;
 			case 0x05:
-				if(!word_skip_menu_info(fd))
+				if(!word_skip_menu_info(vc))
 					done = TRUE;
 				break;
 			case 0x10:
-				if(!word_skip_macro_extnames(fd))
+				if(!word_skip_macro_extnames(vc))
 					done = TRUE;
 				break;
 			case 0x11:
-				if(!word_skip_macro_intnames(fd))
+				if(!word_skip_macro_intnames(vc))
 					done = TRUE;
 				break;
 			case 0x40:	/* end marker */
@@ -1170,7 +1151,7 @@ cli_wm_readdir(int fd)
 	if(macro_info.count == 0)
 		return NULL;
 
-	vba_project = create_vba_project(macro_info.count, "", NULL);
+	vba_project = create_vba_project(macro_info.count, NULL, 0);
 
 	if(vba_project) {
 		vba_project->length = (uint32_t *)cli_malloc(sizeof(uint32_t) *
@@ -1190,15 +1171,7 @@ cli_wm_readdir(int fd)
 			}
 		} else {
             cli_errmsg("cli_wm_readdir: Unable to allocate memory for vba_project\n");
-			free(vba_project->name);
-			free(vba_project->colls);
-			free(vba_project->dir);
-			free(vba_project->offset);
-			if(vba_project->length)
-				free(vba_project->length);
-			if(vba_project->key)
-				free(vba_project->key);
-			free(vba_project);
+			cli_free_vba_project(vba_project);
 			vba_project = NULL;
 		}
 	}
@@ -1208,14 +1181,14 @@ cli_wm_readdir(int fd)
 }
 
 unsigned char *
-cli_wm_decrypt_macro(int fd, off_t offset, uint32_t len, unsigned char key)
+cli_wm_decrypt_macro(fmap_t *map, off_t offset, uint32_t len, unsigned char key)
 {
 	unsigned char *buff;
 
 	if(len == 0)
 		return NULL;
 
-	if(fd < 0)
+	if(map == NULL)
 		return NULL;
 
 	buff = (unsigned char *)cli_malloc(len);
@@ -1224,7 +1197,7 @@ cli_wm_decrypt_macro(int fd, off_t offset, uint32_t len, unsigned char key)
 		return NULL;
     }
 
-	if(!seekandread(fd, offset, SEEK_SET, buff, len)) {
+	if(offset < 0 || fmap_readn(map, buff, offset, len) != (int)len) {
 		free(buff);
 		return NULL;
 	}
@@ -1237,22 +1210,48 @@ cli_wm_decrypt_macro(int fd, off_t offset, uint32_t len, unsigned char key)
 	return buff;
 }
 
+/*
+ * read() and lseek() over the map of a stream
+ */
+static int
+vba_read(vba_cursor_t *vc, void *data, size_t len)
+{
+	int nread;
+
+	nread = fmap_readn(vc->map, data, vc->pos, len);
+	if(nread > 0)
+		vc->pos += nread;
+	return nread;
+}
+
+static off_t
+vba_seek(vba_cursor_t *vc, off_t offset, int whence)
+{
+	off_t pos;
+
+	pos = (whence == SEEK_CUR) ? vc->pos + offset : offset;
+	if(pos < 0)
+		return (off_t)-1;
+	vc->pos = pos;
+	return pos;
+}
+
 /*
  * Keep reading bytes until we reach a NUL. Returns 0 if none is found
  */
 static int
-skip_past_nul(int fd)
+skip_past_nul(vba_cursor_t *vc)
 {
     char *end;
     char smallbuf[128];
 
     do {
-	int nread = cli_readn(fd, smallbuf, sizeof(smallbuf));
+	int nread = vba_read(vc, smallbuf, sizeof(smallbuf));
 	if (nread <= 0)
 	    return FALSE;
 	end = memchr(smallbuf, '\0', nread);
 	if (end) {
-	    if (lseek(fd, 1 + (end-smallbuf) - nread, SEEK_CUR) < 0)
+	    if (vba_seek(vc, 1 + (end-smallbuf) - nread, SEEK_CUR) < 0)
 		return FALSE;
 	    return TRUE;
 	}
@@ -1263,9 +1262,9 @@ skip_past_nul(int fd)
  * Read 2 bytes as a 16-bit number, host byte order. Return success or fail
  */
 static int
-read_uint16(int fd, uint16_t *u, int big_endian)
+read_uint16(vba_cursor_t *vc, uint16_t *u, int big_endian)
 {
-	if(cli_readn(fd, u, sizeof(uint16_t)) != sizeof(uint16_t))
+	if(vba_read(vc, u, sizeof(uint16_t)) != sizeof(uint16_t))
 		return FALSE;
 
 	*u = vba_endian_convert_16(*u, big_endian);
@@ -1277,9 +1276,9 @@ read_uint16(int fd, uint16_t *u, int big_endian)
  * Read 4 bytes as a 32-bit number, host byte order. Return success or fail
  */
 static int
-read_uint32(int fd, uint32_t *u, int big_endian)
+read_uint32(vba_cursor_t *vc, uint32_t *u, int big_endian)
 {
-	if(cli_readn(fd, u, sizeof(uint32_t)) != sizeof(uint32_t))
+	if(vba_read(vc, u, sizeof(uint32_t)) != sizeof(uint32_t))
 		return FALSE;
 
 	*u = vba_endian_convert_32(*u, big_endian);
@@ -1291,50 +1290,62 @@ read_uint32(int fd, uint32_t *u, int big_endian)
  * Miss some bytes then read a bit
  */
 static int
-seekandread(int fd, off_t offset, int whence, void *data, size_t len)
+seekandread(vba_cursor_t *vc, off_t offset, int whence, void *data, size_t len)
 {
-	if(lseek(fd, offset, whence) == (off_t)-1) {
+	if(vba_seek(vc, offset, whence) == (off_t)-1) {
 		cli_dbgmsg("lseek failed\n");
 		return FALSE;
 	}
-	return cli_readn(fd, data, (unsigned int)len) == (int)len;
+	return vba_read(vc, data, (unsigned int)len) == (int)len;
 }
 
 /*
  * Create and initialise a vba_project structure
  */
 static vba_project_t *
-create_vba_project(int record_count, const char *dir, struct uniq *U)
+create_vba_project(int record_count, struct ole2_vfs *vfs, uint32_t storage)
 {
 	vba_project_t *ret;
 
-	ret = (vba_project_t *) cli_malloc(sizeof(struct vba_project_tag));
+	ret = (vba_project_t *) cli_calloc(1, sizeof(struct vba_project_tag));
 
 	if(ret == NULL) {
         cli_errmsg("create_vba_project: Unable to allocate memory for vba project structure\n");
 		return NULL;
     }
 
-	ret->name = (char **)cli_malloc(sizeof(char *) * record_count);
+	ret->name = (char **)cli_calloc(record_count, sizeof(char *));
 	ret->colls = (uint32_t *)cli_malloc(sizeof(uint32_t) * record_count);
-	ret->dir = cli_strdup(dir);
 	ret->offset = (uint32_t *)cli_malloc (sizeof(uint32_t) * record_count);
+	ret->count = record_count;
 
-	if((ret->name == NULL) || (ret->dir == NULL) || (ret->offset == NULL)) {
-		if(ret->dir)
-			free(ret->dir);
-		if(ret->colls)
-			free(ret->colls);
-		if(ret->name)
-			free(ret->name);
-		if(ret->offset)
-			free(ret->offset);
-		free(ret);
+	if((ret->name == NULL) || (ret->colls == NULL) || (ret->offset == NULL)) {
+		cli_free_vba_project(ret);
         cli_errmsg("create_vba_project: Unable to allocate memory for vba project elements\n");
 		return NULL;
 	}
-	ret->count = record_count;
-	ret->U = U;
+	ret->vfs = vfs;
+	ret->storage = storage;
 
 	return ret;
 }
+
+void
+cli_free_vba_project(vba_project_t *vba_project)
+{
+	int i;
+
+	if(vba_project == NULL)
+		return;
+
+	if(vba_project->name) {
+		for(i = 0; i < vba_project->count; i++)
+			free(vba_project->name[i]);
+		free(vba_project->name);
+	}
+	free(vba_project->colls);
+	free(vba_project->offset);
+	free(vba_project->length);
+	free(vba_project->key);
+	free(vba_project);
+}
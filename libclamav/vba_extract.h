@@ -26,7 +26,8 @@
 
 #include "others.h"
 #include "cltypes.h"
-#include "uniq.h"
+#include "fmap.h"
+#include "ole2_extract.h"
 
 typedef struct vba_project_tag {
 	char **name;
@@ -34,16 +35,17 @@ typedef struct vba_project_tag {
 	uint32_t *offset;
 	uint32_t *length;	/* for Word 6 macros */
 	unsigned char *key;	/* for Word 6 macros */
-	char *dir;
-	struct uniq *U;
+	struct ole2_vfs *vfs;	/* where the module streams live */
+	uint32_t storage;
 	int count;
 } vba_project_t;
 
-vba_project_t	*cli_vba_readdir(const char *dir, struct uniq *U, uint32_t which);
-vba_project_t	*cli_wm_readdir(int fd);
-unsigned char	*cli_vba_inflate(int fd, off_t offset, int *size);
-int	cli_scan_ole10(int fd, cli_ctx *ctx);
-char	*cli_ppt_vba_read(int fd, cli_ctx *ctx);
-unsigned char	*cli_wm_decrypt_macro(int fd, off_t offset, uint32_t len,
+vba_project_t	*cli_vba_readdir(struct ole2_vfs *vfs, uint32_t storage, uint32_t which);
+vba_project_t	*cli_wm_readdir(fmap_t *map);
+void	cli_free_vba_project(vba_project_t *vba_project);
+unsigned char	*cli_vba_inflate(fmap_t *map, off_t offset, int *size);
+int	cli_scan_ole10(fmap_t *map, cli_ctx *ctx);
+char	*cli_ppt_vba_read(fmap_t *map, cli_ctx *ctx);
+unsigned char	*cli_wm_decrypt_macro(fmap_t *map, off_t offset, uint32_t len,
 					unsigned char key);
 #endif
@@ -36,7 +36,7 @@
 #include "clamav.h"
 #include "str.h"
 #include "scanners.h"
-#include "inflate64.h"
+#include "inflate_iface.h"
 #include "lzma_iface.h"
 
 /*
@@ -432,7 +432,7 @@ int cli_scanxar(cli_ctx *ctx)
     fmap_t *map = *ctx->fmap;
     size_t length, offset, size, at;
     int encoding;
-    z_stream strm;
+    struct cli_zstream strm;
     char *toc, *tmpname;
     xmlTextReaderPtr reader = NULL;
     int a_hash, e_hash;
@@ -440,7 +440,7 @@ int cli_scanxar(cli_ctx *ctx)
     void *a_hash_ctx = NULL, *e_hash_ctx = NULL;
     char result[SHA1_HASH_SIZE];
 
-    memset(&strm, 0x00, sizeof(z_stream));
+    memset(&strm, 0x00, sizeof(strm));
 
     /* retrieve xar header */
     if (fmap_readn(*ctx->fmap, &hdr, 0, sizeof(hdr)) != sizeof(hdr)) {
@@ -484,19 +484,20 @@ int cli_scanxar(cli_ctx *ctx)
     toc[hdr.toc_length_decompressed] = '\0';
     strm.avail_out = hdr.toc_length_decompressed;
     strm.next_out = (unsigned char *)toc;
-    rc = inflateInit(&strm);
+    rc = cli_inflate_init(&strm, MAX_WBITS, ctx);
     if (rc != Z_OK) {
         cli_dbgmsg("cli_scanxar:inflateInit error %i \n", rc);
         rc = CL_EFORMAT;
         goto exit_toc;
     }    
-    rc = inflate(&strm, Z_SYNC_FLUSH);
+    rc = cli_inflate(&strm, Z_SYNC_FLUSH);
     if (rc != Z_OK && rc != Z_STREAM_END) {
         cli_dbgmsg("cli_scanxar:inflate error %i \n", rc);
+        cli_inflate_end(&strm);
         rc = CL_EFORMAT;
         goto exit_toc;
     }
-    rc = inflateEnd(&strm);
+    rc = cli_inflate_end(&strm);
     if (rc != Z_OK) {
         cli_dbgmsg("cli_scanxar:inflateEnd error %i \n", rc);
         rc = CL_EFORMAT;
@@ -589,7 +590,7 @@ int cli_scanxar(cli_ctx *ctx)
         case CL_TYPE_GZ:
             /* inflate gzip directly because file segments do not contain magic */
             memset(&strm, 0, sizeof(strm));
-            if ((rc = inflateInit(&strm)) != Z_OK) {
+            if ((rc = cli_inflate_init(&strm, MAX_WBITS, ctx)) != Z_OK) {
                 cli_dbgmsg("cli_scanxar: InflateInit failed: %d\n", rc);
                 rc = CL_EFORMAT;
                 extract_errors++;
@@ -603,7 +604,7 @@ int cli_scanxar(cli_ctx *ctx)
                 bytes = MIN(length, bytes);
                 if(!(strm.next_in = next_in = (void*)fmap_need_off_once(map, at, bytes))) {
                     cli_dbgmsg("cli_scanxar: Can't read %u bytes @ %lu.\n", bytes, (long unsigned)at);
-                    inflateEnd(&strm);
+                    cli_inflate_end(&strm);
                     rc = CL_EREAD;
                     goto exit_tmpfile;
                 }
@@ -614,7 +615,7 @@ int cli_scanxar(cli_ctx *ctx)
                     unsigned char buff[FILEBUFF];
                     strm.avail_out = sizeof(buff);
                     strm.next_out = buff;
-                    inf = inflate(&strm, Z_SYNC_FLUSH);
+                    inf = cli_inflate(&strm, Z_SYNC_FLUSH);
                     if (inf != Z_OK && inf != Z_STREAM_END && inf != Z_BUF_ERROR) {
                         cli_dbgmsg("cli_scanxar: inflate error %i %s.\n", inf, strm.msg?strm.msg:"");
                         rc = CL_EFORMAT;
@@ -629,7 +630,7 @@ int cli_scanxar(cli_ctx *ctx)
                    
                     if (cli_writen(fd, buff, bytes) < 0) {
                         cli_dbgmsg("cli_scanxar: cli_writen error file %s.\n", tmpname);
-                        inflateEnd(&strm);
+                        cli_inflate_end(&strm);
                         rc = CL_EWRITE;
                         goto exit_tmpfile;
                     }
@@ -650,7 +651,7 @@ int cli_scanxar(cli_ctx *ctx)
                     xar_hash_update(a_hash_ctx, next_in, avail_in, a_hash);
             }
 
-            inflateEnd(&strm);
+            cli_inflate_end(&strm);
             break;
         case CL_TYPE_7Z:
 #define CLI_LZMA_OBUF_SIZE 1024*1024
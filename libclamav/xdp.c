@@ -55,7 +55,7 @@
 #include "clamav.h"
 #include "str.h"
 #include "scanners.h"
-#include "conv.h"
+#include "decoders.h"
 #include "xdp.h"
 #include "bignum_fast.h"
 #include "filetypes.h"
@@ -137,7 +137,7 @@ int cli_scanxdp(cli_ctx *ctx)
         if (!strcmp((const char *)name, "chunk") && xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT) {
             value = xmlTextReaderReadInnerXml(reader);
             if (value) {
-                decoded = cl_base64_decode((char *)value, strlen((const char *)value), NULL, &decodedlen, 0);
+                decoded = (char *)cli_base64_decode_mem(value, strlen((const char *)value), &decodedlen);
                 if (decoded) {
                     unsigned int shouldscan=0;
 
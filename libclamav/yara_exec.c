@@ -440,6 +440,7 @@ int yr_execute_code(
 #else
         {
             rule_matches++;
+            cli_ac_lsig_touch(acdata, aclsig->id);
             acdata->yr_matches[aclsig->id] = 1;
         }
 #endif
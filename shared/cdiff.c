@@ -65,6 +65,7 @@ struct cdiff_ctx {
     struct cdiff_node *add_start, *add_last;
     struct cdiff_node *del_start;
     struct cdiff_node *xchg_start, *xchg_last;
+    FILE *journal;
 };
 
 struct cdiff_cmd {
@@ -140,6 +141,26 @@ static void cdiff_ctx_free(struct cdiff_ctx *ctx)
     }
 }
 
+/* records a line added to (+) or removed from (-) a database, or a change
+ * to a whole database (!), for freshclam's delta journal */
+static void cdiff_journal(struct cdiff_ctx *ctx, char op, const char *db, const char *line)
+{
+	size_t len;
+
+
+    if(!ctx->journal)
+	return;
+
+    fprintf(ctx->journal, "%c%s", op, db);
+    if(line) {
+	len = strlen(line);
+	while(len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+	    len--;
+	fprintf(ctx->journal, " %.*s", (int) len, line);
+    }
+    fputc('\n', ctx->journal);
+}
+
 static char *cdiff_token(const char *line, unsigned int token, unsigned int last)
 {
 	unsigned int counter = 0, i, j;
@@ -394,6 +415,7 @@ static int cdiff_cmd_close(const char *cmdstr, struct cdiff_ctx *ctx, char *lbuf
 		    logg("!cdiff_cmd_close: Can't apply DEL at line %d of %s\n", lines, ctx->open_db);
 		    return -1;
 		}
+		cdiff_journal(ctx, '-', ctx->open_db, lbuf);
 		del = del->next;
 		continue;
 	    }
@@ -416,6 +438,8 @@ static int cdiff_cmd_close(const char *cmdstr, struct cdiff_ctx *ctx, char *lbuf
 		    free(tmp);
 		    return -1;
 		}
+		cdiff_journal(ctx, '-', ctx->open_db, lbuf);
+		cdiff_journal(ctx, '+', ctx->open_db, xchg->str2);
 		xchg = xchg->next;
 		continue;
 	    }
@@ -470,6 +494,7 @@ static int cdiff_cmd_close(const char *cmdstr, struct cdiff_ctx *ctx, char *lbuf
 		logg("!cdiff_cmd_close: Can't write to %s\n", ctx->open_db);
 		return -1;
 	    }
+	    cdiff_journal(ctx, '+', ctx->open_db, add->str);
 	    add = add->next;
 	}
 
@@ -556,6 +581,8 @@ static int cdiff_cmd_move(const char *cmdstr, struct cdiff_ctx *ctx, char *lbuf,
 	free(dstdb);
 	return -1;
     }
+    cdiff_journal(ctx, '!', srcdb, NULL);
+    cdiff_journal(ctx, '!', dstdb, NULL);
 
     if(!(tmpdb = cli_gentemp("."))) {
 	logg("!cdiff_cmd_move: Can't generate temporary name\n");
@@ -719,6 +746,7 @@ static int cdiff_cmd_unlink(const char *cmdstr, struct cdiff_ctx *ctx, char *lbu
 	free(db);
 	return -1;
     }
+    cdiff_journal(ctx, '!', db, NULL);
 
     free(db);
     return 0;
@@ -767,7 +795,7 @@ static int cdiff_execute(const char *cmdstr, struct cdiff_ctx *ctx, char *lbuf,
     return 0;
 }
 
-int cdiff_apply(int fd, unsigned short mode)
+int cdiff_apply(int fd, unsigned short mode, FILE *journal)
 {
 	struct cdiff_ctx ctx;
 	FILE *fh;
@@ -784,6 +812,7 @@ int cdiff_apply(int fd, unsigned short mode)
 #define DSIGBUFF 350
 
     memset(&ctx, 0, sizeof(ctx));
+    ctx.journal = journal;
 
     if((desc = dup(fd)) == -1) {
 	logg("!cdiff_apply: Can't duplicate descriptor %d\n", fd);
@@ -21,6 +21,10 @@
 #ifndef __CDIFF_H
 #define __CDIFF_H
 
-int cdiff_apply(int fd, unsigned short mode);
+#include <stdio.h>
+
+/* if journal isn't NULL, the changes made to the databases are recorded
+ * there in the format read by cl_engine_delta() */
+int cdiff_apply(int fd, unsigned short mode, FILE *journal);
 
 #endif
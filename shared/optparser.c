@@ -278,6 +278,10 @@ const struct clam_option __clam_options[] = {
 
     { "DisableCache", "disable-cache", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "This option allows you to disable clamd's caching feature.", "no" },
 
+    { "VerdictCache", NULL, 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 1, NULL, 0, OPT_CLAMD, "Remember clean files by their inode, size and modification times, and don't\nscan them again until one of these changes or the database is reloaded.\nThis avoids reading files that are opened over and over (on-access scanning)\nor scanned repeatedly. Disabled together with DisableCache.", "yes" },
+
+    { "FastCacheKey", "fast-cache-key", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "Key the cache of clean files with a fast non-cryptographic hash instead of\nMD5. The MD5 of a file is then only computed when hash signatures of its size\nare loaded or a callback needs it.", "no" },
+
     { "VirusEvent", NULL, 0, CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_CLAMD, "Execute a command when a virus is found. In the command string %v will be\nreplaced with the virus name. Additionally, two environment variables will\nbe defined: $CLAM_VIRUSEVENT_FILENAME and $CLAM_VIRUSEVENT_VIRUSNAME.", "/usr/bin/mailx -s \"ClamAV VIRUS ALERT: %v\" alert < /dev/null" },
 
     { "ExitOnOOM", NULL, 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD, "Stop the daemon when libclamav reports an out of memory condition.", "yes" },
@@ -369,6 +373,8 @@ const struct clam_option __clam_options[] = {
 
     { "ForceToDisk", "force-to-disk", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "This option causes memory or nested map scans to dump the content to disk.\nIf you turn on this option, more data is written to disk and is available\nwhen the leave-temps option is enabled at the cost of more disk writes.", "no" },
 
+    { "DirectMapping", "direct-mapping", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "Map regular files directly from the page cache instead of reading them into\nprivate memory. This saves a full copy of every scanned file, but a file that\nis truncated while it is being scanned will crash the scanner.", "no" },
+
     { "MaxScanSize", "max-scansize", 0, CLOPT_TYPE_SIZE, MATCH_SIZE, CLI_DEFAULT_MAXSCANSIZE, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "This option sets the maximum amount of data to be scanned for each input file.\nArchives and other containers are recursively extracted and scanned up to this\nvalue.\nThe value of 0 disables the limit.\nWARNING: disabling this limit or setting it too high may result in severe\ndamage.", "100M" },
 
     { "MaxFileSize", "max-filesize", 0, CLOPT_TYPE_SIZE, MATCH_SIZE, CLI_DEFAULT_MAXFILESIZE, NULL, 0, OPT_CLAMD | OPT_MILTER | OPT_CLAMSCAN, "Files/messages larger than this limit won't be scanned. Affects the input\nfile itself as well as files contained inside it (when the input file is\nan archive, a document or some other kind of container).\nThe value of 0 disables the limit.\nWARNING: disabling this limit or setting it too high may result in severe\ndamage to the system.", "25M" },
@@ -402,6 +408,12 @@ const struct clam_option __clam_options[] = {
 
     { "PCREMaxFileSize", "pcre-max-filesize", 0, CLOPT_TYPE_SIZE, MATCH_SIZE, CLI_DEFAULT_PCRE_MAX_FILESIZE, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "This option sets the maximum filesize for which PCRE subsigs will be executed.\nFiles exceeding this limit will not have PCRE subsigs executed unless a subsig is encompassed to a smaller buffer.\nNegative values are not allowed.\nSetting this value to zero disables the limit.\nWARNING: setting this limit too high or disabling it may severely impact performance.", "25M" },
 
+    { "MaxScanWork", "max-scanwork", 0, CLOPT_TYPE_SIZE, MATCH_SIZE, 0, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "This option sets how much work a single scan may do before it is cut short.\nWork is counted in bytes matched, decompressed and parsed plus bytecode instructions executed, summed over the file and everything extracted from it.\nIt protects scan latency against decompression bombs and pathological documents.\nSetting this value to zero disables the limit.", "0" },
+
+    { "MaxScanWorkAction", "max-scanwork-action", 0, CLOPT_TYPE_STRING, "^(Alert|Clean|Error)$", -1, "Alert", 0, OPT_CLAMD | OPT_CLAMSCAN, "What to report when a scan exceeds MaxScanWork.\nPossible values:\n\tAlert - report Heuristic.Limits.Exceeded.ScanWork\n\tClean - report the result of the partial scan\n\tError - fail the scan with a timeout error", "Alert" },
+
+    { "MaxCompressionRatio", "max-ratio", 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, CLI_DEFAULT_MAXRATIO, NULL, 0, OPT_CLAMD | OPT_CLAMSCAN, "Compressed data (zip, gzip, bzip2, xz) that decompresses to more than this many times its own size\nis reported as Heuristic.Limits.Exceeded.Ratio. The check applies once 4 MB have been decompressed.\nSetting this value to zero disables the check.", "1000" },
+
     /* OnAccess settings */
     { "ScanOnAccess", NULL, 0, CLOPT_TYPE_BOOL, MATCH_BOOL, -1, NULL, 0, OPT_CLAMD, "This option enables on-access scanning (Linux only)", "no" },
 
@@ -421,6 +433,14 @@ const struct clam_option __clam_options[] = {
 
     { "OnAccessExtraScanning", NULL, 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD, "Enables extra scanning and notification after catching certain inotify events. Only works with the DDD system enabled.", "yes" },
 
+    { "OnAccessMaxThreads", NULL, 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, 5, NULL, 0, OPT_CLAMD, "Maximum number of threads scanning files on access. The fanotify events are\nread by a separate thread, so a slow scan does not hold up the other accesses.", "5" },
+
+    { "OnAccessMaxQueue", NULL, 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, 50, NULL, 0, OPT_CLAMD, "Maximum number of on-access events being scanned or waiting for a scanning\nthread. Further events are left in the kernel queue until there is room.", "50" },
+
+    { "OnAccessResponseTimeout", NULL, 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, 0, NULL, 0, OPT_CLAMD, "Answer an access attempt if no verdict has been reached after this many\nseconds (OnAccessPrevention only). The scan of the file is still completed\nand reported. 0 waits for the scan to finish.", "10" },
+
+    { "OnAccessDenyOnTimeout", NULL, 0, CLOPT_TYPE_BOOL, MATCH_BOOL, 0, NULL, 0, OPT_CLAMD, "Deny instead of allow access attempts that hit OnAccessResponseTimeout.", "no" },
+
     /* FIXME: mark these as private and don't output into clamd.conf/man */
     { "DevACOnly", "dev-ac-only", 0, CLOPT_TYPE_BOOL, MATCH_BOOL, -1, NULL, FLAG_HIDDEN, OPT_CLAMD | OPT_CLAMSCAN, "", "" },
 
@@ -518,7 +538,13 @@ const struct clam_option __clam_options[] = {
 
     /* Milter specific options */
 
-    { "ClamdSocket", NULL, 0, CLOPT_TYPE_STRING, NULL, -1, NULL, FLAG_MULTIPLE, OPT_MILTER, "Define the clamd socket to connect to for scanning.\nThis option is mandatory! Syntax:\n  ClamdSocket unix:path\n  ClamdSocket tcp:host:port\nThe first syntax specifies a local unix socket (needs an absolute path) e.g.:\n  ClamdSocket unix:/var/run/clamd/clamd.socket\nThe second syntax specifies a tcp local or remote tcp socket: the\nhost can be a hostname or an ip address; the \":port\" field is only required\nfor IPv6 addresses, otherwise it defaults to 3310\n  ClamdSocket tcp:192.168.0.1\nThis option can be repeated several times with different sockets or even\nwith the same socket: clamd servers will be selected in a round-robin fashion.", "tcp:scanner.mydomain:7357" },
+    { "ClamdSocket", NULL, 0, CLOPT_TYPE_STRING, NULL, -1, NULL, FLAG_MULTIPLE, OPT_MILTER, "Define the clamd socket to connect to for scanning.\nThis option is mandatory! Syntax:\n  ClamdSocket unix:path\n  ClamdSocket tcp:host:port\nThe first syntax specifies a local unix socket (needs an absolute path) e.g.:\n  ClamdSocket unix:/var/run/clamd/clamd.socket\nThe second syntax specifies a tcp local or remote tcp socket: the\nhost can be a hostname or an ip address; the \":port\" field is only required\nfor IPv6 addresses, otherwise it defaults to 3310\n  ClamdSocket tcp:192.168.0.1\nThis option can be repeated several times with different sockets or even\nwith the same socket: each message is sent to the clamd server with the\nleast work pending.", "tcp:scanner.mydomain:7357" },
+
+    { "ClamdConnections", NULL, 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, 8, NULL, 0, OPT_MILTER, "Maximum number of persistent (IDSESSION) connections kept open to each\nclamd server. Scan requests are pipelined over these connections; when\nthey are all in use a new connection is made for the message.\nThe value of 0 disables persistent connections.", "8" },
+
+    { "ClamdPipelineDepth", NULL, 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, 4, NULL, 0, OPT_MILTER, "Maximum number of messages waiting for a verdict on a single persistent\nconnection.", "4" },
+
+    { "ClamdStatsInterval", NULL, 0, CLOPT_TYPE_NUMBER, MATCH_NUMBER, 30, NULL, 0, OPT_MILTER, "Query the load (running and queued jobs) of the clamd servers with the\nSTATS command every this many seconds; it is used along with the number\nof messages in flight and the recent reply times to pick the server.\nThe value of 0 disables the queries.", "30" },
 
     { "MilterSocket",NULL, 0, CLOPT_TYPE_STRING, NULL, -1, NULL, 0, OPT_MILTER, "Define the interface through which we communicate with sendmail.\nThis option is mandatory! Possible formats are:\n[[unix|local]:]/path/to/file - to specify a unix domain socket;\ninet:port@[hostname|ip-address] - to specify an ipv4 socket;\ninet6:port@[hostname|ip-address] - to specify an ipv6 socket.", "/tmp/clamav-milter.socket\ninet:7357" },
 
@@ -23,6 +23,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -49,7 +50,129 @@ struct tar_header {
 };
 #define TARBLK 512
 
-int tar_addfile(int fd, gzFile gzs, const char *file)
+/*
+ * Blocked gzip output: the archive is cut into members of at most
+ * TAR_GZBLK_INPUT bytes, each a complete gzip stream whose compressed
+ * size is stored in a "BC" extra field (the BGZF layout used by bgzip).
+ * Any gzip reader still sees one file, but libclamav can find the member
+ * boundaries without inflating and decompress them on several cores.
+ */
+#define TAR_GZBLK_INPUT	    0xff00
+#define TAR_GZBLK_HDRLEN    18
+#define TAR_GZBLK_MAXSIZE   65536
+
+struct tar_gzblk {
+    int fd;
+    z_stream strm;
+    unsigned int len;
+    unsigned char in[TAR_GZBLK_INPUT];
+    unsigned char out[TAR_GZBLK_MAXSIZE];
+};
+
+static void tar_putle(unsigned char *pt, unsigned int val, unsigned int len)
+{
+    while(len--) {
+	*pt++ = val & 0xff;
+	val >>= 8;
+    }
+}
+
+static int tar_gzblk_flush(struct tar_gzblk *blk)
+{
+	unsigned int clen, bsize;
+	unsigned char *pt = blk->out;
+
+
+    if(deflateReset(&blk->strm) != Z_OK)
+	return -1;
+    blk->strm.next_in = blk->in;
+    blk->strm.avail_in = blk->len;
+    blk->strm.next_out = blk->out + TAR_GZBLK_HDRLEN;
+    blk->strm.avail_out = TAR_GZBLK_MAXSIZE - TAR_GZBLK_HDRLEN - 8;
+    if(deflate(&blk->strm, Z_FINISH) != Z_STREAM_END)
+	return -1;
+    clen = blk->strm.total_out;
+    bsize = TAR_GZBLK_HDRLEN + clen + 8;
+
+    memset(pt, 0, TAR_GZBLK_HDRLEN);
+    pt[0] = 0x1f;
+    pt[1] = 0x8b;
+    pt[2] = Z_DEFLATED;
+    pt[3] = 4;	    /* FEXTRA */
+    pt[9] = 0xff;   /* OS unknown */
+    tar_putle(pt + 10, 6, 2);
+    pt[12] = 'B';
+    pt[13] = 'C';
+    tar_putle(pt + 14, 2, 2);
+    tar_putle(pt + 16, bsize - 1, 2);
+    pt += TAR_GZBLK_HDRLEN + clen;
+    tar_putle(pt, crc32(crc32(0, Z_NULL, 0), blk->in, blk->len), 4);
+    tar_putle(pt + 4, blk->len, 4);
+
+    if(write(blk->fd, blk->out, bsize) != (ssize_t) bsize)
+	return -1;
+    blk->len = 0;
+    return 0;
+}
+
+struct tar_gzblk *tar_gzblk_open(int fd, int level)
+{
+	struct tar_gzblk *blk;
+
+
+    if(!(blk = calloc(1, sizeof(*blk))))
+	return NULL;
+    blk->fd = fd;
+    if(deflateInit2(&blk->strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_FILTERED) != Z_OK) {
+	free(blk);
+	return NULL;
+    }
+    return blk;
+}
+
+static int tar_gzblk_write(struct tar_gzblk *blk, const void *buff, unsigned int len)
+{
+	const unsigned char *pt = buff;
+	unsigned int n;
+
+
+    while(len) {
+	n = TAR_GZBLK_INPUT - blk->len;
+	if(n > len)
+	    n = len;
+	memcpy(blk->in + blk->len, pt, n);
+	blk->len += n;
+	pt += n;
+	len -= n;
+	if(blk->len == TAR_GZBLK_INPUT && tar_gzblk_flush(blk) == -1)
+	    return -1;
+    }
+    return 0;
+}
+
+int tar_gzblk_close(struct tar_gzblk *blk)
+{
+	int ret = 0;
+
+
+    /* the last member, then an empty one as the end-of-file marker */
+    if(blk->len && tar_gzblk_flush(blk) == -1)
+	ret = -1;
+    if(!ret && tar_gzblk_flush(blk) == -1)
+	ret = -1;
+    deflateEnd(&blk->strm);
+    free(blk);
+    return ret;
+}
+
+static int tar_write(int fd, struct tar_gzblk *blk, const void *buff, unsigned int len)
+{
+    if(blk)
+	return tar_gzblk_write(blk, buff, len);
+    return write(fd, buff, len) == (ssize_t) len ? 0 : -1;
+}
+
+int tar_addfile(int fd, struct tar_gzblk *blk, const char *file)
 {
 	int s, bytes;
 	struct tar_header hdr;
@@ -75,42 +198,23 @@ int tar_addfile(int fd, gzFile gzs, const char *file)
 	chksum += *pt++;
     snprintf(hdr.chksum, 8, "%06o", chksum + 256);
 
-    if(gzs) {
-	if(!gzwrite(gzs, &hdr, TARBLK)) {
-	    close(s);
-	    return -1;
-	}
-    } else {
-	if(write(fd, &hdr, TARBLK) != TARBLK) {
-	    close(s);
-	    return -1;
-	}
+    if(tar_write(fd, blk, &hdr, TARBLK) == -1) {
+	close(s);
+	return -1;
     }
 
     while((bytes = read(s, buff, FILEBUFF)) > 0) {
-	if(gzs) {
-	    if(!gzwrite(gzs, buff, bytes)) {
-		close(s);
-		return -1;
-	    }
-	} else {
-	    if(write(fd, buff, bytes) != bytes) {
-		close(s);
-		return -1;
-	    }
+	if(tar_write(fd, blk, buff, bytes) == -1) {
+	    close(s);
+	    return -1;
 	}
     }
     close(s);
 
     if(sb.st_size % TARBLK) {
 	memset(&hdr, 0, TARBLK);
-	if(gzs) {
-	    if(!gzwrite(gzs, &hdr, TARBLK - (sb.st_size % TARBLK)))
-		return -1;
-	} else {
-	    if(write(fd, &hdr, TARBLK - (sb.st_size % TARBLK)) == -1)
-		return -1;
-	}
+	if(tar_write(fd, blk, &hdr, TARBLK - (sb.st_size % TARBLK)) == -1)
+	    return -1;
     }
 
     return 0;
@@ -24,6 +24,10 @@
 
 #include <zlib.h>
 
-int tar_addfile(int fd, gzFile gzs, const char *file);
+struct tar_gzblk;
+
+struct tar_gzblk *tar_gzblk_open(int fd, int level);
+int tar_gzblk_close(struct tar_gzblk *blk);
+int tar_addfile(int fd, struct tar_gzblk *blk, const char *file);
 
 #endif
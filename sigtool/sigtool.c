@@ -853,7 +853,8 @@ static int build(const struct optstruct *opts)
 	const char *newcvd, *localdbdir = NULL;
         struct cl_engine *engine;
 	FILE *cvd, *fh;
-	gzFile tar;
+	struct tar_gzblk *tar;
+	int tarfd;
 	time_t timet;
 	struct tm *brokent;
 	struct cl_cvd *oldcvd;
@@ -1075,16 +1076,26 @@ static int build(const struct optstruct *opts)
 	return -1;
     }
 
-    if((tar = gzopen(tarfile, "wb9f")) == NULL) {
+    if((tarfd = open(tarfile, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0644)) == -1) {
 	mprintf("!build: Can't open file %s for writing\n", tarfile);
 	free(tarfile);
 	FREE_LS(dblist2);
 	return -1;
     }
 
-    if(tar_addfile(-1, tar, "COPYING") == -1) {
+    if(!(tar = tar_gzblk_open(tarfd, 9))) {
+	mprintf("!build: Can't initialize compression for %s\n", tarfile);
+	close(tarfd);
+	unlink(tarfile);
+	free(tarfile);
+	FREE_LS(dblist2);
+	return -1;
+    }
+
+    if(tar_addfile(tarfd, tar, "COPYING") == -1) {
 	mprintf("!build: Can't add COPYING to tar archive\n");
-	gzclose(tar);
+	tar_gzblk_close(tar);
+	close(tarfd);
 	unlink(tarfile);
 	free(tarfile);
 	FREE_LS(dblist2);
@@ -1092,16 +1103,18 @@ static int build(const struct optstruct *opts)
     }
 
     if(bc || hy) {
-	if(!hy && tar_addfile(-1, tar, "bytecode.info") == -1) {
-	    gzclose(tar);
+	if(!hy && tar_addfile(tarfd, tar, "bytecode.info") == -1) {
+	    tar_gzblk_close(tar);
+	    close(tarfd);
 	    unlink(tarfile);
 	    free(tarfile);
 	    FREE_LS(dblist2);
 	    return -1;
 	}
 	for(i = 0; i < dblist2cnt; i++) {
-	    if(tar_addfile(-1, tar, dblist2[i]) == -1) {
-		gzclose(tar);
+	    if(tar_addfile(tarfd, tar, dblist2[i]) == -1) {
+		tar_gzblk_close(tar);
+		close(tarfd);
 		unlink(tarfile);
 		free(tarfile);
 		FREE_LS(dblist2);
@@ -1113,8 +1126,9 @@ static int build(const struct optstruct *opts)
 	for(i = 0; dblist[i].ext; i++) {
 	    snprintf(dbfile, sizeof(dbfile), "%s.%s", dbname, dblist[i].ext);
 	    if(!access(dbfile, R_OK)) {
-		if(tar_addfile(-1, tar, dbfile) == -1) {
-		    gzclose(tar);
+		if(tar_addfile(tarfd, tar, dbfile) == -1) {
+		    tar_gzblk_close(tar);
+		    close(tarfd);
 		    unlink(tarfile);
 		    free(tarfile);
 		    FREE_LS(dblist2);
@@ -1123,7 +1137,15 @@ static int build(const struct optstruct *opts)
 	    }
 	}
     }
-    gzclose(tar);
+    if(tar_gzblk_close(tar) == -1) {
+	mprintf("!build: Can't write tar archive %s\n", tarfile);
+	close(tarfd);
+	unlink(tarfile);
+	free(tarfile);
+	FREE_LS(dblist2);
+	return -1;
+    }
+    close(tarfd);
     FREE_LS(dblist2);
 
     /* MD5 + dsig */
@@ -1704,9 +1726,9 @@ static int listsigs(const struct optstruct *opts, int mode)
 static int vbadump(const struct optstruct *opts)
 {
 	int fd, hex_output;
-	char *dir;
 	const char *pt;
-	struct uniq *vba = NULL;
+	struct ole2_vfs *vba = NULL;
+	uint32_t storage;
 	cli_ctx *ctx;
 
 
@@ -1723,35 +1745,20 @@ static int vbadump(const struct optstruct *opts)
 	return -1;
     }
 
-    /* generate the temporary directory */
-    if(!(dir = cli_gentemp(NULL))) {
-	mprintf("!vbadump: Can't generate temporary name\n");
-	close(fd);
-	return -1;
-    }
-
-    if(mkdir(dir, 0700)) {
-	mprintf("!vbadump: Can't create temporary directory %s\n", dir);
-	free(dir);
-	close(fd);
-        return -1;
-    }
     if(!(ctx = convenience_ctx(fd))) {
 	close(fd);
-    free(dir);
 	return -1;
     }
-    if(cli_ole2_extract(dir, ctx, &vba)) {
+    if(cli_ole2_extract(ctx, &vba)) {
+	cli_ole2_vfs_free(vba);
 	destroy_ctx(-1, ctx);
-	cli_rmdirs(dir);
-        free(dir);
         return -1;
     }
+    /* the VFS reads streams from ctx's map, so keep it alive until done */
+    for(storage = 0; storage < cli_ole2_vfs_storages(vba); storage++)
+	sigtool_vba_scandir(vba, storage, hex_output);
+    cli_ole2_vfs_free(vba);
     destroy_ctx(-1, ctx);
-    if (vba) 
-      sigtool_vba_scandir(dir, hex_output, vba);
-    cli_rmdirs(dir);
-    free(dir);
     return 0;
 }
 
@@ -1842,7 +1849,7 @@ static int rundiff(const struct optstruct *opts)
 	return -1;
     }
 
-    ret = cdiff_apply(fd, mode);
+    ret = cdiff_apply(fd, mode, NULL);
     close(fd);
 
     if(!ret)
@@ -2162,7 +2169,7 @@ static int verifydiff(const char *diff, const char *cvd, const char *incdir)
 	return -1;
     }
 
-    if(cdiff_apply(fd, mode) == -1) {
+    if(cdiff_apply(fd, mode, NULL) == -1) {
 	mprintf("!verifydiff: Can't apply %s\n", diff);
 	if(chdir(cwd) == -1)
 	    mprintf("^verifydiff: Can't chdir to %s\n", cwd);
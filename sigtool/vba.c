@@ -98,8 +98,6 @@ void destroy_ctx(int desc, cli_ctx *ctx) {
     free(ctx);
 }
 
-int sigtool_vba_scandir(const char *dirname, int hex_output, struct uniq *U);
-
 static char *get_unicode_name (char *name, int size)
 {
     int i, j;
@@ -1011,8 +1009,6 @@ static int sigtool_scandir (const char *dirname, int hex_output)
     struct dirent *dent;
     STATBUF statbuf;
     char *fname;
-    const char *tmpdir;
-    char *dir;
     int ret = CL_CLEAN, desc;
     cli_ctx *ctx;
 
@@ -1039,31 +1035,13 @@ static int sigtool_scandir (const char *dirname, int hex_output)
 			    }
 			} else {
 			    if (S_ISREG (statbuf.st_mode)) {
-			        struct uniq *vba = NULL;
-				tmpdir = cli_gettmpdir();
-
-				/* generate the temporary directory */
-				dir = cli_gentemp (tmpdir);
-				if(!dir) {
-				    printf("cli_gentemp() failed\n");
-				    free(fname);
-				    closedir (dd);
-				    return -1;
-				}
-
-				if (mkdir (dir, 0700)) {
-				    printf ("Can't create temporary directory %s\n", dir);
-				    free(fname);
-				    closedir (dd);
-				    free(dir);
-				    return CL_ETMPDIR;
-				}
+			        struct ole2_vfs *vba = NULL;
+				uint32_t storage;
 
 				if ((desc = open (fname, O_RDONLY|O_BINARY)) == -1) {
 				    printf ("Can't open file %s\n", fname);
 				    free(fname);
 				    closedir (dd);
-				    free(dir);
 				    return 1;
 				}
 
@@ -1071,24 +1049,21 @@ static int sigtool_scandir (const char *dirname, int hex_output)
 				    free(fname);	
 				    close(desc);
 				    closedir(dd);
-				    free(dir);
 				    return 1;
 				}
-				if ((ret = cli_ole2_extract (dir, ctx, &vba))) {
+				if ((ret = cli_ole2_extract (ctx, &vba))) {
 				    printf ("ERROR %s\n", cl_strerror (ret));
+				    cli_ole2_vfs_free (vba);
 				    destroy_ctx(desc, ctx);
-				    cli_rmdirs (dir);
-				    free (dir);
 				    closedir (dd);
 				    free(fname);
 				    return ret;
 				}
 
-				if(vba)
-				    sigtool_vba_scandir (dir, hex_output, vba);
+				for (storage = 0; storage < cli_ole2_vfs_storages (vba); storage++)
+				    sigtool_vba_scandir (vba, storage, hex_output);
+				cli_ole2_vfs_free (vba);
 				destroy_ctx(desc, ctx);
-				cli_rmdirs (dir);
-				free (dir);
 			    }
 			}
 
@@ -1106,30 +1081,26 @@ static int sigtool_scandir (const char *dirname, int hex_output)
     return 0;
 }
 
-int sigtool_vba_scandir (const char *dirname, int hex_output, struct uniq *U)
+int sigtool_vba_scandir (struct ole2_vfs *vfs, uint32_t storage, int hex_output)
 {
-    int ret = CL_CLEAN, i, fd, data_len;
+    int ret = CL_CLEAN, i, data_len;
     vba_project_t *vba_project;
-    DIR *dd;
-    struct dirent *dent;
-    STATBUF statbuf;
-    char *fullname, vbaname[1024], *hash;
+    fmap_t *map;
+    char *fullname;
     unsigned char *data;
     uint32_t hashcnt;
     unsigned int j;
 
-    hashcnt = uniq_get(U, "_vba_project", 12, NULL);
+    hashcnt = cli_ole2_vfs_count(vfs, storage, "_vba_project");
     while(hashcnt--) {
-	if(!(vba_project = (vba_project_t *)cli_vba_readdir(dirname, U, hashcnt))) continue;
+	if(!(vba_project = (vba_project_t *)cli_vba_readdir(vfs, storage, hashcnt))) continue;
 
 	for(i = 0; i < vba_project->count; i++) {
 	    for(j = 0; j < vba_project->colls[i]; j++) {
-		snprintf(vbaname, 1024, "%s"PATHSEP"%s_%u", vba_project->dir, vba_project->name[i], j);
-		vbaname[sizeof(vbaname)-1] = '\0';
-		fd = open(vbaname, O_RDONLY|O_BINARY);
-		if(fd == -1) continue;
-		data = (unsigned char *)cli_vba_inflate(fd, vba_project->offset[i], &data_len);
-		close(fd);
+		map = cli_ole2_vfs_map(vfs, storage, vba_project->name[i], j);
+		if(!map) continue;
+		data = (unsigned char *)cli_vba_inflate(map, vba_project->offset[i], &data_len);
+		funmap(map);
 
 		if(data) {
 		    data = (unsigned char *) realloc (data, data_len + 1);
@@ -1140,45 +1111,37 @@ int sigtool_vba_scandir (const char *dirname, int hex_output, struct uniq *U)
 	    }
 	}
 
-	free(vba_project->name);
-	free(vba_project->colls);
-	free(vba_project->dir);
-	free(vba_project->offset);
-	free(vba_project);
+	cli_free_vba_project(vba_project);
     }
 
 
-    if((hashcnt = uniq_get(U, "powerpoint document", 19, &hash))) {
+    if((hashcnt = cli_ole2_vfs_count(vfs, storage, "powerpoint document"))) {
 	while(hashcnt--) {
-	    snprintf(vbaname, 1024, "%s"PATHSEP"%s_%u", dirname, hash, hashcnt);
-	    vbaname[sizeof(vbaname)-1] = '\0';
-	    fd = open(vbaname, O_RDONLY|O_BINARY);
-	    if (fd == -1) continue;
-	    if ((fullname = cli_ppt_vba_read(fd, NULL))) {
+	    map = cli_ole2_vfs_map(vfs, storage, "powerpoint document", hashcnt);
+	    if (!map) continue;
+	    if ((fullname = cli_ppt_vba_read(map, NULL))) {
 	      sigtool_scandir(fullname, hex_output);
 	      cli_rmdirs(fullname);
 	      free(fullname);
 	    }
-	    close(fd);
+	    funmap(map);
 	}
     }
 
 
-    if ((hashcnt = uniq_get(U, "worddocument", 12, &hash))) {
+    if ((hashcnt = cli_ole2_vfs_count(vfs, storage, "worddocument"))) {
 	while(hashcnt--) {
-	    snprintf(vbaname, sizeof(vbaname), "%s"PATHSEP"%s_%u", dirname, hash, hashcnt);
-	    vbaname[sizeof(vbaname)-1] = '\0';
-	    fd = open(vbaname, O_RDONLY|O_BINARY);
-	    if (fd == -1) continue;
+	    map = cli_ole2_vfs_map(vfs, storage, "worddocument", hashcnt);
+	    if (!map) continue;
 	    
-	    if (!(vba_project = (vba_project_t *)cli_wm_readdir(fd))) {
-		close(fd);
+	    if (!(vba_project = (vba_project_t *)cli_wm_readdir(map))) {
+		funmap(map);
 		continue;
 	    }
 
 	    for (i = 0; i < vba_project->count; i++) {
 		data_len = vba_project->length[i];
-		data = (unsigned char *)cli_wm_decrypt_macro(fd, vba_project->offset[i], data_len , vba_project->key[i]);
+		data = (unsigned char *)cli_wm_decrypt_macro(map, vba_project->offset[i], data_len , vba_project->key[i]);
 		if(data) {
 		    data = (unsigned char *) realloc (data, data_len + 1);
 		    data[data_len]='\0';
@@ -1187,40 +1150,10 @@ int sigtool_vba_scandir (const char *dirname, int hex_output, struct uniq *U)
 		}
 	    }
 
-	    close(fd);
-	    free(vba_project->name);
-	    free(vba_project->colls);
-	    free(vba_project->dir);
-	    free(vba_project->offset);
-	    free(vba_project->key);
-	    free(vba_project->length);
-	    free(vba_project);
+	    funmap(map);
+	    cli_free_vba_project(vba_project);
 	}
     }
 
-    if ((dd = opendir (dirname)) != NULL) {
-	while ((dent = readdir (dd))) {
-	    if (dent->d_ino) {
-		if (strcmp (dent->d_name, ".") && strcmp (dent->d_name, "..")) {
-		    /* build the full name */
-		    fullname = calloc (strlen (dirname) + strlen (dent->d_name) + 2, sizeof (char));
-		    sprintf (fullname, "%s"PATHSEP"%s", dirname, dent->d_name);
-
-		    /* stat the file */
-		    if (LSTAT (fullname, &statbuf) != -1) {
-			if (S_ISDIR (statbuf.st_mode) && !S_ISLNK (statbuf.st_mode))
-			    sigtool_vba_scandir (fullname, hex_output, U); 
-		    }
-		    free (fullname);
-		}
-	    }
-	}
-    } else {
-	logg("!ScanDir -> Can't open directory %s.\n", dirname);
-	return CL_EOPEN;
-    }
-
-
-    closedir (dd);
     return ret;
 }
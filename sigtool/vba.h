@@ -20,10 +20,10 @@
 #ifndef __VBA_H
 #define __VBA_H
 
-#include "libclamav/uniq.h"
 #include "libclamav/others.h"
+#include "libclamav/ole2_extract.h"
 
-int sigtool_vba_scandir(const char *dirname, int hex_output, struct uniq *U);
+int sigtool_vba_scandir(struct ole2_vfs *vfs, uint32_t storage, int hex_output);
 cli_ctx *convenience_ctx(int fd);
 void destroy_ctx(int desc, cli_ctx *ctx);
 
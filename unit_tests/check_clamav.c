@@ -22,6 +22,7 @@
 #include "../libclamav/matcher.h"
 #include "../libclamav/version.h"
 #include "../libclamav/dsig.h"
+#include "../libclamav/cache.h"
 #include "../libclamav/fpu.h"
 #include "checks.h"
 
@@ -461,6 +462,333 @@ static void engine_teardown(void)
     cl_engine_free(g_engine);
 }
 
+static void delta_write(const char *dir, const char *name, const char *data, size_t len)
+{
+    char path[512];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    f = fopen(path, "wb");
+    fail_unless_fmt(!!f, "fopen %s", path);
+    fail_unless_fmt(fwrite(data, 1, len, f) == len, "fwrite %s", path);
+    fclose(f);
+}
+
+static int delta_scan(struct cl_engine *engine, const char *data, const char **virname)
+{
+    cl_fmap_t *map;
+    int ret;
+
+    map = cl_fmap_open_memory(data, strlen(data));
+    fail_unless(!!map, "cl_fmap_open_memory");
+    *virname = NULL;
+    ret = cl_scanmap_callback(map, virname, NULL, engine, CL_SCAN_STDOPT, NULL);
+    cl_fmap_close(map);
+    return ret;
+}
+
+/* struct cl_engine *cl_engine_delta(struct cl_engine *engine, const char *path, unsigned int *signo, unsigned int dboptions, int *err) */
+START_TEST (test_cl_engine_delta)
+{
+    struct cl_engine *engine, *delta, *again;
+    const char *virname;
+    char *dir, *cvd, journal[512];
+    unsigned int sigs = 0;
+    ssize_t len;
+    int fd, err;
+
+    if (!inited)
+	fail_unless(cl_init(CL_INIT_DEFAULT) == 0, "cl_init");
+    inited = 1;
+
+    /* daily.cvd supplies the version the journal continues from */
+    fd = open_testfile("input/bytecode.cvd");
+    cvd = cli_malloc(1024 * 1024);
+    fail_unless(!!cvd, "cli_malloc");
+    len = read(fd, cvd, 1024 * 1024);
+    close(fd);
+    fail_unless(len > 512, "read bytecode.cvd");
+
+    dir = cli_gentemp(NULL);
+    fail_unless(dir && !mkdir(dir, 0700), "mkdir");
+    delta_write(dir, "daily.cld", cvd, len);
+    free(cvd);
+    delta_write(dir, "test.hdb",
+		"6d1aee2a2728c8f640fe834d2341fe80:18:Delta.A\n"
+		"c4cd1a71cfe0ad0dbe723ed1d2df0331:18:Delta.B\n", 88);
+#define DELTA_NDB \
+    "Delta.N1:0:*:6e626f6479??6f6e65\n" \
+    "Delta.N2:0:*:6e626f64792074776f\n" \
+    "Delta.M:0:*:6f6c64207061747465726e206d\n"
+    delta_write(dir, "test.ndb", DELTA_NDB, strlen(DELTA_NDB));
+#define DELTA_JOURNAL \
+    "BATCH daily 19 20\n" \
+    "+daily.hdb c081006685d28e5e274d366371d0e137:18:Delta.D\n" \
+    "-daily.hdb 6d1aee2a2728c8f640fe834d2341fe80:18:Delta.A\n" \
+    "+daily.ign2 Delta.B.UNOFFICIAL\n" \
+    "-daily.ndb Delta.N1.UNOFFICIAL:0:*:6e626f6479??6f6e65\n" \
+    "-daily.ndb Delta.M.UNOFFICIAL:0:*:6f6c64207061747465726e206d\n" \
+    "+daily.ndb Delta.M.UNOFFICIAL:0:*:6e6577207061747465726e206d\n" \
+    "+daily.ndb Delta.E:0:*:64656c746120746573742066696c652045\n" \
+    "+daily.ldb Delta.L;Target:0;0&1;6c64622070617274206f6e65;6c646220706172742074776f\n" \
+    "END 20 1300000000\n"
+    delta_write(dir, "freshclam.delta", DELTA_JOURNAL, strlen(DELTA_JOURNAL));
+    snprintf(journal, sizeof(journal), "%s/freshclam.delta", dir);
+
+    engine = cl_engine_new();
+    fail_unless(!!engine, "cl_engine_new");
+    fail_unless(cl_load(dir, engine, &sigs, CL_DB_STDOPT) == CL_SUCCESS, "cl_load");
+    fail_unless(cl_engine_compile(engine) == CL_SUCCESS, "cl_engine_compile");
+
+    delta = cl_engine_delta(engine, journal, &sigs, CL_DB_STDOPT, &err);
+    fail_unless_fmt(!!delta, "cl_engine_delta: %s", cl_strerror(err));
+    fail_unless(cl_engine_get_num(delta, CL_ENGINE_DB_VERSION, NULL) == 20, "delta version");
+
+    fail_unless(delta_scan(engine, "delta test file A\n", &virname) == CL_VIRUS, "base A");
+    fail_unless(delta_scan(delta, "delta test file A\n", &virname) == CL_CLEAN, "removed hash");
+    fail_unless(delta_scan(engine, "delta test file B\n", &virname) == CL_VIRUS, "base B");
+    fail_unless(delta_scan(delta, "delta test file B\n", &virname) == CL_CLEAN, "ignored name");
+    fail_unless(delta_scan(engine, "delta test file D\n", &virname) == CL_CLEAN, "base D");
+    fail_unless(delta_scan(delta, "delta test file D\n", &virname) == CL_VIRUS, "added hash");
+    fail_unless_fmt(virname && !strcmp(virname, "Delta.D"), "virname %s", virname);
+
+    /* a removed body signature doesn't stop the scan */
+    fail_unless(delta_scan(engine, "nbody one\n", &virname) == CL_VIRUS, "base N1");
+    fail_unless(delta_scan(delta, "nbody one\n", &virname) == CL_CLEAN, "removed ndb");
+    fail_unless(delta_scan(delta, "nbody one nbody two\n", &virname) == CL_VIRUS, "removed ndb, live ndb");
+    fail_unless_fmt(virname && !strcmp(virname, "Delta.N2.UNOFFICIAL"), "virname %s", virname);
+
+    /* added body and logical signatures, one replacing a removed one */
+    fail_unless(delta_scan(delta, "old pattern m\n", &virname) == CL_CLEAN, "replaced ndb");
+    fail_unless(delta_scan(engine, "new pattern m\n", &virname) == CL_CLEAN, "base M");
+    fail_unless(delta_scan(delta, "new pattern m\n", &virname) == CL_VIRUS, "replacing ndb");
+    fail_unless_fmt(virname && !strcmp(virname, "Delta.M.UNOFFICIAL"), "virname %s", virname);
+    fail_unless(delta_scan(engine, "delta test file E\n", &virname) == CL_CLEAN, "base E");
+    fail_unless(delta_scan(delta, "delta test file E\n", &virname) == CL_VIRUS, "added ndb");
+    fail_unless_fmt(virname && !strcmp(virname, "Delta.E"), "virname %s", virname);
+    fail_unless(delta_scan(delta, "ldb part one\n", &virname) == CL_CLEAN, "added ldb, one subsig");
+    fail_unless(delta_scan(delta, "ldb part one, ldb part two\n", &virname) == CL_VIRUS, "added ldb");
+    fail_unless_fmt(virname && !strcmp(virname, "Delta.L"), "virname %s", virname);
+
+    /* nothing newer than the delta engine */
+    again = cl_engine_delta(delta, journal, &sigs, CL_DB_STDOPT, &err);
+    fail_unless(again == delta, "cl_engine_delta without new batches");
+    cl_engine_free(again);
+
+    /* signatures that can't be applied to a compiled engine */
+#define DELTA_CDB "BATCH daily 19 20\n+daily.cdb X:CL_TYPE_ZIP:*:x\\.exe:*:*:*:*:*:*\nEND 20 1\n"
+    delta_write(dir, "freshclam.delta", DELTA_CDB, strlen(DELTA_CDB));
+    fail_unless(!cl_engine_delta(engine, journal, &sigs, CL_DB_STDOPT, &err), "cdb addition");
+    fail_unless(err == CL_EFORMAT, "cdb addition: CL_EFORMAT");
+
+    cl_engine_free(engine);
+    fail_unless(delta_scan(delta, "delta test file D\n", &virname) == CL_VIRUS, "delta outlives base");
+    cl_engine_free(delta);
+    cli_rmdirs(dir);
+    free(dir);
+}
+END_TEST
+
+/* MIME mail carrying test/clam.exe, scanned from memory */
+static const struct {
+    const char *name;
+    const char *mbox;   /* From_ line of a mailbox, the parser handles those */
+    const char *enc;    /* encoding of the attachment, NULL for none */
+    int nested;         /* attachment in a multipart/alternative */
+    int stream;         /* scanned without a temporary directory */
+} mail_tests[] = {
+    { "base64", "", "base64", 0, 1 },
+    { "quoted-printable", "", "quoted-printable", 0, 1 },
+    { "nested base64", "", "base64", 1, 1 },
+    { "nested quoted-printable", "", "quoted-printable", 1, 1 },
+    { "no attachment", "", NULL, 0, 1 },
+    { "mailbox", "From sender@example.com Thu Jan  1 00:00:00 1970\n", "base64", 0, 0 }
+};
+
+static size_t mail_base64(const unsigned char *in, size_t len, char *out)
+{
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *o = out;
+    size_t i;
+
+    for (i = 0; i < len; i += 3) {
+        uint32_t v = in[i] << 16;
+
+        if (i + 1 < len)
+            v |= in[i + 1] << 8;
+        if (i + 2 < len)
+            v |= in[i + 2];
+        *o++ = b64[(v >> 18) & 0x3f];
+        *o++ = b64[(v >> 12) & 0x3f];
+        *o++ = i + 1 < len ? b64[(v >> 6) & 0x3f] : '=';
+        *o++ = i + 2 < len ? b64[v & 0x3f] : '=';
+        if ((i / 3) % 19 == 18)
+            *o++ = '\n';
+    }
+    *o++ = '\n';
+    return o - out;
+}
+
+static size_t mail_qp(const unsigned char *in, size_t len, char *out)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char *o = out, *line = out;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (o - line > 70) {
+            /* soft line break */
+            *o++ = '=';
+            *o++ = '\n';
+            line = o;
+        }
+        if (in[i] >= 33 && in[i] <= 126 && in[i] != '=') {
+            *o++ = in[i];
+        } else {
+            *o++ = '=';
+            *o++ = hex[in[i] >> 4];
+            *o++ = hex[in[i] & 0xf];
+        }
+    }
+    *o++ = '\n';
+    return o - out;
+}
+
+static char *mail_build(unsigned i, const unsigned char *exe, size_t exelen, size_t *len)
+{
+    char *msg, *p;
+
+    msg = cli_malloc(exelen * 4 + 4096);
+    fail_unless(!!msg, "cli_malloc");
+    p = msg;
+    p += sprintf(p, "%s"
+                 "From: sender@example.com\n"
+                 "To: recipient@example.com\n"
+                 "Subject: %s\n"
+                 "MIME-Version: 1.0\n"
+                 "Content-Type: multipart/mixed; boundary=\"outer\"\n"
+                 "\n"
+                 "This is a multi-part message in MIME format.\n"
+                 "--outer\n"
+                 "Content-Type: text/plain; charset=us-ascii\n"
+                 "\n"
+                 "The file is attached.\n",
+                 mail_tests[i].mbox, mail_tests[i].name);
+    if (mail_tests[i].nested)
+        p += sprintf(p, "--outer\n"
+                     "Content-Type: multipart/alternative; boundary=\"inner\"\n"
+                     "\n"
+                     "--inner\n"
+                     "Content-Type: text/plain\n"
+                     "\n"
+                     "The file is attached here too.\n"
+                     "--inner\n");
+    else
+        p += sprintf(p, "--outer\n");
+    if (mail_tests[i].enc) {
+        p += sprintf(p, "Content-Type: application/octet-stream; name=\"clam.exe\"\n"
+                     "Content-Transfer-Encoding: %s\n"
+                     "Content-Disposition: attachment; filename=\"clam.exe\"\n"
+                     "\n", mail_tests[i].enc);
+        if (!strcmp(mail_tests[i].enc, "base64"))
+            p += mail_base64(exe, exelen, p);
+        else
+            p += mail_qp(exe, exelen, p);
+    } else {
+        p += sprintf(p, "Content-Type: text/plain\n"
+                     "\n"
+                     "Nothing to see.\n");
+    }
+    if (mail_tests[i].nested)
+        p += sprintf(p, "--inner--\n");
+    p += sprintf(p, "--outer--\n");
+
+    *len = p - msg;
+    return msg;
+}
+
+static unsigned count_dirs(const char *dir)
+{
+    struct dirent *dirent;
+    char path[512];
+    unsigned n = 0;
+    STATBUF sb;
+    DIR *d;
+
+    d = opendir(dir);
+    fail_unless_fmt(!!d, "opendir %s", dir);
+    while ((dirent = readdir(d))) {
+        if (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, dirent->d_name);
+        if (!CLAMSTAT(path, &sb) && S_ISDIR(sb.st_mode))
+            n++;
+    }
+    closedir(d);
+    return n;
+}
+
+START_TEST (test_cl_scanmap_mail)
+{
+    struct cl_engine *engine;
+    const char *virname;
+    unsigned char exe[4096];
+    unsigned int sigs = 0;
+    char *dir, *msg;
+    cl_fmap_t *map;
+    size_t len;
+    ssize_t exelen;
+    unsigned i;
+    int fd, ret;
+
+    if (!inited)
+	fail_unless(cl_init(CL_INIT_DEFAULT) == 0, "cl_init");
+    inited = 1;
+
+    fd = open(OBJDIR"/../test/clam.exe", O_RDONLY);
+    fail_unless(fd >= 0, "open clam.exe");
+    exelen = read(fd, exe, sizeof(exe));
+    close(fd);
+    fail_unless(exelen > 0, "read clam.exe");
+
+    /* with --leave-temps the directory the parser extracts the message to
+     * stays behind, the streaming path doesn't make one */
+    dir = cli_gentemp(NULL);
+    fail_unless(dir && !mkdir(dir, 0700), "mkdir");
+    engine = cl_engine_new();
+    fail_unless(!!engine, "cl_engine_new");
+    fail_unless(cl_engine_set_str(engine, CL_ENGINE_TMPDIR, dir) == CL_SUCCESS, "tmpdir");
+    fail_unless(cl_engine_set_num(engine, CL_ENGINE_KEEPTMP, 1) == CL_SUCCESS, "keeptmp");
+    fail_unless(cl_load(OBJDIR"/clamav.hdb", engine, &sigs, CL_DB_STDOPT) == CL_SUCCESS, "cl_load");
+    fail_unless(cl_engine_compile(engine) == CL_SUCCESS, "cl_engine_compile");
+
+    for (i = 0; i < sizeof(mail_tests) / sizeof(mail_tests[0]); i++) {
+        msg = mail_build(i, exe, exelen, &len);
+        map = cl_fmap_open_memory(msg, len);
+        fail_unless(!!map, "cl_fmap_open_memory");
+        virname = NULL;
+        ret = cl_scanmap_callback(map, &virname, NULL, engine, CL_SCAN_STDOPT, NULL);
+        cl_fmap_close(map);
+        free(msg);
+
+        if (mail_tests[i].enc) {
+            fail_unless_fmt(ret == CL_VIRUS, "%s: %s", mail_tests[i].name, cl_strerror(ret));
+            fail_unless_fmt(virname && !strcmp(virname, "ClamAV-Test-File.UNOFFICIAL"), "%s: virname %s", mail_tests[i].name, virname);
+        } else {
+            fail_unless_fmt(ret == CL_CLEAN, "%s: %s", mail_tests[i].name, cl_strerror(ret));
+        }
+        if (mail_tests[i].stream)
+            fail_unless_fmt(count_dirs(dir) == 0, "%s: not scanned in place", mail_tests[i].name);
+        else
+            fail_unless_fmt(count_dirs(dir) > 0, "%s: no temporary directory", mail_tests[i].name);
+    }
+
+    cl_engine_free(engine);
+    cli_rmdirs(dir);
+    free(dir);
+}
+END_TEST
+
 static int get_test_file(int i, char *file, unsigned fsize, unsigned long *size)
 {
     int fd;
@@ -534,6 +862,173 @@ START_TEST (test_cl_scanmap_callback_handle_allscan)
 }
 END_TEST
 
+START_TEST (test_cl_scandesc_scanwork)
+{
+    const char *virname = NULL;
+    char file[256];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    long long hits;
+    int ret;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+    hits = cl_engine_get_num(g_engine, CL_ENGINE_SCANWORK_HITS, NULL);
+    fail_unless(cl_engine_set_num(g_engine, CL_ENGINE_MAX_SCANWORK, 1) == CL_SUCCESS, "set CL_ENGINE_MAX_SCANWORK");
+    fail_unless(cl_engine_set_num(g_engine, CL_ENGINE_SCANWORK_ACTION, CL_SCANWORK_ERROR) == CL_SUCCESS, "set CL_ENGINE_SCANWORK_ACTION");
+
+    cli_dbgmsg("scanning (scanwork) %s\n", file);
+    ret = cl_scandesc(fd, &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+    cli_dbgmsg("scan end (scanwork) %s\n", file);
+
+    cl_engine_set_num(g_engine, CL_ENGINE_MAX_SCANWORK, 0);
+    cl_engine_set_num(g_engine, CL_ENGINE_SCANWORK_ACTION, CL_SCANWORK_ALERT);
+    fail_unless_fmt(ret == CL_ETIMEOUT, "cl_scandesc with 1 unit of work for %s: %s", file, cl_strerror(ret));
+    fail_unless(cl_engine_get_num(g_engine, CL_ENGINE_SCANWORK_HITS, NULL) == hits + 1, "CL_ENGINE_SCANWORK_HITS");
+    close(fd);
+}
+END_TEST
+
+/* appends the low n bits of v to a deflate stream, LSB first */
+static void ratio_bits(unsigned char *buf, size_t *pos, unsigned v, unsigned n)
+{
+    while (n--) {
+        if (v & 1)
+            buf[*pos / 8] |= 1 << (*pos % 8);
+        v >>= 1;
+        (*pos)++;
+    }
+}
+
+/* Huffman codes go out MSB first */
+static void ratio_code(unsigned char *buf, size_t *pos, unsigned code, unsigned n)
+{
+    while (n--)
+        ratio_bits(buf, pos, code >> n, 1);
+}
+
+START_TEST (test_cl_scandesc_ratio)
+{
+    /* a gzip of 8 MB of zeros, as one fixed Huffman block of 258 byte matches */
+    static const unsigned char gzhdr[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    const unsigned nmatch = 32768;
+    const char *virname = NULL;
+    unsigned long int scanned = 0;
+    unsigned char *gz;
+    size_t len, pos = 0;
+    long long ratio;
+    unsigned i;
+    FILE *f;
+    int ret;
+
+    len = sizeof(gzhdr) + (3 + 9 + nmatch * 13 + 7) / 8 + 1 + 8;
+    gz = calloc(1, len);
+    fail_unless(!!gz, "calloc");
+    memcpy(gz, gzhdr, sizeof(gzhdr));
+    pos = sizeof(gzhdr) * 8;
+    ratio_bits(gz, &pos, 1, 1);               /* BFINAL */
+    ratio_bits(gz, &pos, 1, 2);               /* fixed Huffman */
+    ratio_code(gz, &pos, 0x30, 8);            /* literal 0 */
+    for (i = 0; i < nmatch; i++) {
+        ratio_code(gz, &pos, 0xc5, 8);        /* length 258 */
+        ratio_code(gz, &pos, 0, 5);           /* distance 1 */
+    }
+    ratio_code(gz, &pos, 0, 7);               /* end of block */
+    /* the CRC and size are left zero, the ratio check stops it first */
+
+    f = tmpfile();
+    fail_unless(!!f, "tmpfile");
+    fail_unless(fwrite(gz, 1, len, f) == len, "fwrite");
+    fflush(f);
+    free(gz);
+
+    /* about 160:1 */
+    ratio = cl_engine_get_num(g_engine, CL_ENGINE_MAX_RATIO, NULL);
+    fail_unless(cl_engine_set_num(g_engine, CL_ENGINE_MAX_RATIO, 100) == CL_SUCCESS, "set CL_ENGINE_MAX_RATIO");
+    ret = cl_scandesc(fileno(f), &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+    fail_unless_fmt(ret == CL_VIRUS, "cl_scandesc with a ratio of 100: %s", cl_strerror(ret));
+    fail_unless_fmt(virname && !strcmp(virname, "Heuristic.Limits.Exceeded.Ratio"), "virusname: %s", virname);
+
+    fail_unless(cl_engine_set_num(g_engine, CL_ENGINE_MAX_RATIO, 0) == CL_SUCCESS, "set CL_ENGINE_MAX_RATIO");
+    rewind(f);
+    ret = cl_scandesc(fileno(f), &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+    fail_unless_fmt(ret == CL_CLEAN, "cl_scandesc with the ratio check disabled: %s", cl_strerror(ret));
+
+    cl_engine_set_num(g_engine, CL_ENGINE_MAX_RATIO, ratio);
+    fclose(f);
+}
+END_TEST
+
+START_TEST (test_cl_scan_batch)
+{
+    struct cl_scan_item items[3];
+    int ret;
+    void *mem;
+    unsigned long size;
+    char file[256];
+    unsigned i;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+
+    mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    fail_unless(mem != MAP_FAILED, "mmap");
+
+    memset(items, 0, sizeof(items));
+    items[0].desc = fd;
+    items[1].desc = -1;
+    items[1].data = mem;
+    items[1].len = size;
+    items[2].desc = -1;
+
+    cli_dbgmsg("scanning (batch) %s\n", file);
+    ret = cl_scan_batch(items, 3, g_engine, CL_SCAN_STDOPT);
+    cli_dbgmsg("scan end (batch) %s\n", file);
+    fail_unless_fmt(ret == CL_SUCCESS, "cl_scan_batch failed for %s: %s", file, cl_strerror(ret));
+    if (!FALSE_NEGATIVE) {
+      for (i = 0; i < 2; i++) {
+        fail_unless_fmt(items[i].result == CL_VIRUS, "cl_scan_batch item %u failed for %s: %s", i, file, cl_strerror(items[i].result));
+        fail_unless_fmt(items[i].virname && !strcmp(items[i].virname, "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s for %s", items[i].virname, file);
+      }
+    }
+    fail_unless_fmt(items[2].result == CL_CLEAN, "cl_scan_batch empty item: %s", cl_strerror(items[2].result));
+    close(fd);
+    munmap(mem, size);
+}
+END_TEST
+
+START_TEST (test_cl_scan_stream)
+{
+    const char *virname = NULL;
+    unsigned long int scanned = 0;
+    cl_scan_stream_t *stream;
+    int ret = CL_CLEAN;
+    char buf[1000];
+    ssize_t nread;
+    unsigned long size;
+    char file[256];
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+
+    stream = cl_scan_stream_open(g_engine, CL_SCAN_STDOPT, NULL);
+    fail_unless(!!stream, "cl_scan_stream_open");
+
+    cli_dbgmsg("scanning (stream) %s\n", file);
+    /* odd sized chunks, so that windows don't line up with them */
+    while((nread = read(fd, buf, sizeof(buf))) > 0) {
+        ret = cl_scan_stream_feed(stream, buf, nread, &virname);
+        fail_unless_fmt(ret == CL_CLEAN || ret == CL_VIRUS, "cl_scan_stream_feed failed for %s: %s", file, cl_strerror(ret));
+        if(ret == CL_VIRUS)
+            break;
+    }
+    ret = cl_scan_stream_finish(stream, &virname, &scanned);
+    cli_dbgmsg("scan end (stream) %s\n", file);
+    if (!FALSE_NEGATIVE) {
+      fail_unless_fmt(ret == CL_VIRUS, "cl_scan_stream_finish failed for %s: %s", file, cl_strerror(ret));
+      fail_unless_fmt(virname && !strcmp(virname, "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s for %s", virname, file);
+    }
+    close(fd);
+}
+END_TEST
+
 START_TEST (test_cl_scanmap_callback_mem)
 {
     const char *virname = NULL;
@@ -620,6 +1115,8 @@ static Suite *test_cl_suite(void)
     tcase_add_test(tc_cl, test_cl_cvdhead);
     tcase_add_test(tc_cl, test_cl_cvdparse);
     tcase_add_test(tc_cl, test_cl_load);
+    tcase_add_test(tc_cl, test_cl_engine_delta);
+    tcase_add_test(tc_cl, test_cl_scanmap_mail);
     tcase_add_test(tc_cl, test_cl_cvdverify);
     tcase_add_test(tc_cl, test_cl_statinidir);
     tcase_add_test(tc_cl, test_cl_statchkdir);
@@ -628,12 +1125,14 @@ static Suite *test_cl_suite(void)
 
     suite_add_tcase(s, tc_cl_scan);
     tcase_add_checked_fixture (tc_cl_scan, engine_setup, engine_teardown);
+    tcase_add_test(tc_cl_scan, test_cl_scandesc_ratio);
 #ifdef CHECK_HAVE_LOOPS
     if (get_fpu_endian() == FPU_ENDIAN_UNKNOWN)
         expect--;
     expect -= skip_files();
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_allscan, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_scanwork, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_allscan, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_callback, 0, expect);
@@ -644,6 +1143,8 @@ static Suite *test_cl_suite(void)
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_handle_allscan, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_mem, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_mem_allscan, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scan_stream, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scan_batch, 0, expect);
 
     user_timeout = getenv("T");
     if (user_timeout) {
@@ -832,11 +1333,87 @@ START_TEST (test_sha256)
 }
 END_TEST
 
+static const uint64_t fasthash_seeds[2][2] = {
+    {0, 0},
+    {0x0123456789abcdefULL, 0xfedcba9876543210ULL}
+};
+
+/* the cache key must not change behind the back of existing callers */
+static struct fasthash_test {
+    unsigned int seed;
+    const char *data;
+    const char *digest;
+} fasthash_tests[] = {
+    {0, "",
+     "\x2b\xe7\x6a\xb0\xd7\x1f\xa3\x67\xac\xe0\x8e\x60\x48\xed\x02\x4f"},
+    {0, "a",
+     "\x0e\xc2\xba\x13\xf7\xe7\xbb\x87\x59\x50\x1e\x74\x76\x94\x7b\xc4"},
+    {0, "abc",
+     "\x77\xdc\x22\x06\x08\xdc\xb0\x0f\x76\xe5\x7c\xaa\x95\x77\x79\x85"},
+    {0, "0123456789abcdef0123456789abcdef",
+     "\xa1\xd7\xcb\xa0\x76\xea\xdb\xf6\x9e\x07\x92\x92\x5f\x06\xe3\x53"},
+    {0, "The quick brown fox jumps over the lazy dog, twice: the quick brown fox jumps over the lazy dog",
+     "\x67\x9a\xce\xcf\x97\xfb\xdd\x04\x8a\x65\xee\x03\xfa\xef\x3a\x05"},
+    {1, "",
+     "\xe5\xce\x5c\x40\x6c\x84\x2c\xe9\x7f\x9a\x58\xad\x0f\x2f\x5d\xdf"},
+    {1, "a",
+     "\x23\xb0\xa2\x99\xcd\x0f\x4a\xe1\xab\x73\xf1\x52\x87\x94\x26\x9e"},
+    {1, "abc",
+     "\xab\xe0\x62\x8d\xe5\x67\x41\xa7\x35\x1e\x74\x61\xdb\xfb\x12\xa1"},
+    {1, "0123456789abcdef0123456789abcdef",
+     "\x4d\xad\xf9\xe3\x93\xbe\x5c\x3f\x8f\xf8\xea\xc0\x5f\xde\x60\x58"},
+    {1, "The quick brown fox jumps over the lazy dog, twice: the quick brown fox jumps over the lazy dog",
+     "\x40\x5d\x0e\x32\x41\xb8\xae\x19\x35\xf0\x36\x42\x36\xcd\xfb\x29"}
+};
+
+START_TEST (test_cli_fasthash)
+{
+    const struct fasthash_test *test = &fasthash_tests[_i];
+    struct cli_fasthash fh;
+    unsigned char digest[16];
+
+    cli_fasthash_init(&fh, fasthash_seeds[test->seed]);
+    cli_fasthash_update(&fh, (const unsigned char *)test->data, strlen(test->data));
+    cli_fasthash_final(&fh, digest);
+    fail_unless_fmt(!memcmp(digest, test->digest, sizeof(digest)), "fasthash known answer #%d failed", _i);
+}
+END_TEST
+
+/* feeding the data in pieces must not change the digest */
+START_TEST (test_cli_fasthash_update)
+{
+    unsigned char buf[1000], digest[16], digest2[16];
+    struct cli_fasthash fh;
+    size_t i, len;
+
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = (i * 7919) >> 3;
+
+    cli_fasthash_init(&fh, fasthash_seeds[1]);
+    cli_fasthash_update(&fh, buf, sizeof(buf));
+    cli_fasthash_final(&fh, digest);
+
+    for (len = 1; len <= 2 * CLI_FASTHASH_STRIPE + 1; len++) {
+        cli_fasthash_init(&fh, fasthash_seeds[1]);
+        for (i = 0; i < sizeof(buf); i += len)
+            cli_fasthash_update(&fh, buf + i, i + len > sizeof(buf) ? sizeof(buf) - i : len);
+        cli_fasthash_final(&fh, digest2);
+        fail_unless_fmt(!memcmp(digest, digest2, sizeof(digest)), "fasthash differs with %u byte updates", (unsigned)len);
+    }
+
+    cli_fasthash_init(&fh, fasthash_seeds[0]);
+    cli_fasthash_update(&fh, buf, sizeof(buf));
+    cli_fasthash_final(&fh, digest2);
+    fail_unless(memcmp(digest, digest2, sizeof(digest)), "fasthash ignores the seed");
+}
+END_TEST
+
 static Suite *test_cli_suite(void)
 {
     Suite *s = suite_create("cli");
     TCase *tc_cli_others = tcase_create("byteorder_macros");
     TCase *tc_cli_dsig = tcase_create("digital signatures");
+    TCase *tc_cli_fasthash = tcase_create("fast cache key");
 
     suite_add_tcase (s, tc_cli_others);
     tcase_add_checked_fixture (tc_cli_others, data_setup, data_teardown);
@@ -848,6 +1425,10 @@ static Suite *test_cli_suite(void)
     tcase_add_loop_test(tc_cli_dsig, test_cli_dsig, 0, dsig_tests_cnt);
     tcase_add_test(tc_cli_dsig, test_sha256);
 
+    suite_add_tcase (s, tc_cli_fasthash);
+    tcase_add_loop_test(tc_cli_fasthash, test_cli_fasthash, 0, sizeof(fasthash_tests)/sizeof(fasthash_tests[0]));
+    tcase_add_test(tc_cli_fasthash, test_cli_fasthash_update);
+
     return s;
 }
 #endif /* CHECK_HAVE_LOOPS */
@@ -147,6 +147,39 @@ START_TEST (test_htmlnorm_api)
 	close(fd);
 }
 END_TEST
+
+static void check_mem(const html_norm_buf_t *buf, const char *ref)
+{
+	int reffd;
+
+	if (!ref)
+		return;
+	reffd = open_testfile(ref);
+	diff_file_mem(reffd, (const char *)buf->data, buf->len);
+}
+
+START_TEST (test_htmlnorm_mem)
+{
+	int fd;
+	fmap_t *map;
+	html_norm_output_t out;
+
+	fd = open_testfile(tests[_i].input);
+	fail_unless(fd > 0,"open_testfile failed");
+
+	map = fmap(fd, 0, 0);
+	fail_unless(!!map, "fmap failed");
+
+	fail_unless(html_normalise_map_mem(map, &out, dconf) == 1, "html_normalise_map_mem failed");
+	check_mem(&out.nocomment, tests[_i].nocommentref);
+	check_mem(&out.notags, tests[_i].notagsref);
+	check_mem(&out.javascript, tests[_i].jsref);
+	html_norm_output_free(&out);
+
+	funmap(map);
+	close(fd);
+}
+END_TEST
 #endif
 
 START_TEST(test_screnc_nullterminate)
@@ -173,6 +206,7 @@ Suite *test_htmlnorm_suite(void)
 	suite_add_tcase (s, tc_htmlnorm_api);
 #ifdef CHECK_HAVE_LOOPS	
 	tcase_add_loop_test(tc_htmlnorm_api, test_htmlnorm_api, 0, sizeof(tests)/sizeof(tests[0]));
+	tcase_add_loop_test(tc_htmlnorm_api, test_htmlnorm_mem, 0, sizeof(tests)/sizeof(tests[0]));
 #endif
 	tcase_add_unchecked_fixture(tc_htmlnorm_api,
 					htmlnorm_setup, htmlnorm_teardown);
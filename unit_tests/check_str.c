@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
 #include <check.h>
 
 #include "../libclamav/clamav.h"
@@ -36,6 +37,7 @@
 #include "../libclamav/str.h"
 #include "../libclamav/mbox.h"
 #include "../libclamav/message.h"
+#include "../libclamav/decoders.h"
 #include "../libclamav/jsparse/textbuf.h"
 #include "checks.h"
 
@@ -211,6 +213,157 @@ START_TEST (test_base64)
 }
 END_TEST
 
+START_TEST (test_base64_decoders)
+{
+    unsigned char buf[1024];
+    const struct base64lines *test = &base64tests[_i];
+    cli_base64_state_t state;
+    size_t len;
+    int level;
+
+    for (level = CLI_DECODERS_SCALAR; level <= CLI_DECODERS_AVX2; level++) {
+        if (cli_decoders_set_simd(level) != level)
+            continue;
+        cli_base64_init(&state);
+        len = cli_base64_decode(&state, (const unsigned char *)test->line, strlen(test->line), buf);
+        len += cli_base64_finish(&state, buf + len);
+        fail_unless_fmt(len == test->len, "invalid base64 decoded length: %u expected %u (level %d)\n",
+                        (unsigned)len, test->len, level);
+        fail_unless_fmt(!memcmp(buf, test->decoded, test->len),
+                        "invalid base64 decoded data for %s (level %d)\n", test->line, level);
+    }
+    cli_decoders_set_simd(CLI_DECODERS_AVX2);
+}
+END_TEST
+
+#endif
+
+static const char b64chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* line wrapped base64, with the odd bit of junk thrown in */
+static size_t base64_encode_wrapped(const unsigned char *in, size_t len, char *out)
+{
+    size_t i, o = 0, col = 0;
+
+    for (i = 0; i < len; i += 3) {
+        unsigned int v = in[i] << 16;
+        if (i + 1 < len)
+            v |= in[i + 1] << 8;
+        if (i + 2 < len)
+            v |= in[i + 2];
+        out[o++] = b64chars[(v >> 18) & 0x3f];
+        out[o++] = b64chars[(v >> 12) & 0x3f];
+        out[o++] = (i + 1 < len) ? b64chars[(v >> 6) & 0x3f] : '=';
+        out[o++] = (i + 2 < len) ? b64chars[v & 0x3f] : '=';
+        if ((col += 4) == 76) {
+            out[o++] = '\r';
+            out[o++] = '\n';
+            col = 0;
+        }
+        if (i % 30000 == 0)
+            out[o++] = ' ';
+    }
+    return o;
+}
+
+/*
+ * All kernels must agree with each other and with the input. Set
+ * DECODERS_BENCH in the environment to also get their throughput
+ */
+START_TEST (test_base64_kernels)
+{
+    size_t n = getenv("DECODERS_BENCH") ? 64 * 1024 * 1024 : 1024 * 1024;
+    unsigned char *data, *out;
+    char *enc;
+    size_t i, enclen, len;
+    cli_base64_state_t state;
+    int level;
+
+    data = malloc(n);
+    enc = malloc(n / 3 * 4 + n / 16 + 16);
+    out = malloc(CLI_BASE64_MAXLEN(n / 3 * 4 + n / 16 + 16));
+    fail_unless(data && enc && out, "malloc failed");
+
+    srand(42);
+    for (i = 0; i < n; i++)
+        data[i] = rand() & 0xff;
+    enclen = base64_encode_wrapped(data, n, enc);
+
+    for (level = CLI_DECODERS_SCALAR; level <= CLI_DECODERS_AVX2; level++) {
+        clock_t start;
+
+        if (cli_decoders_set_simd(level) != level)
+            continue;
+        start = clock();
+        cli_base64_init(&state);
+        len = cli_base64_decode(&state, (const unsigned char *)enc, enclen, out);
+        len += cli_base64_finish(&state, out + len);
+        if (getenv("DECODERS_BENCH"))
+            fprintf(stderr, "base64 level %d: %.1f MB/s\n", level,
+                    (double)enclen / (1024 * 1024) / ((double)(clock() - start) / CLOCKS_PER_SEC));
+        fail_unless_fmt(len == n, "level %d decoded %u bytes, expected %u", level, (unsigned)len, (unsigned)n);
+        fail_unless_fmt(!memcmp(out, data, n), "level %d decoded wrong data", level);
+    }
+    cli_decoders_set_simd(CLI_DECODERS_AVX2);
+
+    free(data);
+    free(enc);
+    free(out);
+}
+END_TEST
+
+#ifdef CHECK_HAVE_LOOPS
+static const struct {
+    const char *in;
+    const char *out;
+    size_t outlen;
+} qp_tests[] = {
+    {"plain text", "plain text", 10},
+    {"a=3Db", "a=b", 3},
+    {"soft=\nbreak", "softbreak", 9},
+    {"soft=\r\nbreak", "softbreak", 9},
+    {"broken=ZZ", "broken=ZZ", 9},
+    {"trailing=", "trailing", 8},
+    {"=e9t=E9", "\xe9t\xe9", 3}
+};
+
+START_TEST (test_qp_decode)
+{
+    unsigned char buf[64];
+    size_t len, used, inlen = strlen(qp_tests[_i].in), k;
+
+    len = cli_qp_decode((const unsigned char *)qp_tests[_i].in, inlen, buf, &used, 1);
+    fail_unless_fmt(len == qp_tests[_i].outlen, "qp %s: decoded %u bytes, expected %u", qp_tests[_i].in,
+                    (unsigned)len, (unsigned)qp_tests[_i].outlen);
+    fail_unless_fmt(!memcmp(buf, qp_tests[_i].out, len), "qp %s: wrong data", qp_tests[_i].in);
+    fail_unless(used == inlen, "qp: input not consumed");
+
+    /* the same thing, a byte at a time */
+    for (k = 0, len = 0; k < inlen; k += used)
+        len += cli_qp_decode((const unsigned char *)qp_tests[_i].in + k, k + 3 < inlen ? 3 : inlen - k,
+                             buf + len, &used, k + 3 >= inlen);
+    fail_unless_fmt(len == qp_tests[_i].outlen && !memcmp(buf, qp_tests[_i].out, len),
+                    "qp %s: split decode differs", qp_tests[_i].in);
+}
+END_TEST
+
+#endif
+
+START_TEST (test_hex_uu_decode)
+{
+    unsigned char buf[64];
+    size_t len, used;
+
+    len = cli_hex_decode((const unsigned char *)"48 65\n6c6C6f7>", 14, buf, &used);
+    fail_unless(len == 6 && !memcmp(buf, "Hellop", 6), "hex decode");
+    fail_unless(used == 13, "hex decode stops at >");
+
+    len = cli_uudecode_line("#0V%T", 5, buf);
+    fail_unless(len == 3 && !memcmp(buf, "Cat", 3), "uudecode");
+}
+END_TEST
+
+#ifdef CHECK_HAVE_LOOPS
 static struct {
     const char* u16;
     const char* u8;
@@ -257,7 +410,7 @@ END_TEST
 Suite *test_str_suite(void)
 {
     Suite *s = suite_create("str");
-    TCase *tc_cli_unescape, *tc_tbuf, *tc_str, *tc_decodeline;
+    TCase *tc_cli_unescape, *tc_tbuf, *tc_str, *tc_decodeline, *tc_decoders;
 
     tc_cli_unescape = tcase_create("cli_unescape");
     suite_add_tcase (s, tc_cli_unescape);
@@ -285,6 +438,15 @@ Suite *test_str_suite(void)
 #ifdef CHECK_HAVE_LOOPS
     tcase_add_loop_test(tc_decodeline, test_base64, 0, sizeof(base64tests)/sizeof(base64tests[0]));
 #endif
+
+    tc_decoders = tcase_create("decoders");
+    suite_add_tcase (s, tc_decoders);
+    tcase_add_test(tc_decoders, test_base64_kernels);
+    tcase_add_test(tc_decoders, test_hex_uu_decode);
+#ifdef CHECK_HAVE_LOOPS
+    tcase_add_loop_test(tc_decoders, test_base64_decoders, 0, sizeof(base64tests)/sizeof(base64tests[0]));
+    tcase_add_loop_test(tc_decoders, test_qp_decode, 0, sizeof(qp_tests)/sizeof(qp_tests[0]));
+#endif
     return s;
 }
 
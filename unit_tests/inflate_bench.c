@@ -0,0 +1,304 @@
+/*
+ *  Copyright (C) 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <zlib.h>
+
+#include "../libclamav/clamav.h"
+#include "../libclamav/inflate_iface.h"
+
+/*
+ * Inflate throughput of the libclamav decoders.
+ *
+ *   inflate_bench [-n runs] [file...]
+ *
+ * Every sample is deflated with zlib level 6 and then decoded as
+ *   stream   - zlib in 256KB windows, as unzip and gzip do without a size
+ *   zlib     - cli_inflate_buffer() with the native decoder turned off
+ *   native   - cli_inflate_buffer() with the native decoder (libdeflate)
+ * reporting the best of the runs in MB/s of output. Without files the
+ * samples are generated from a fixed seed, so results are comparable
+ * between builds and machines.
+ */
+
+#define SAMPLE_SIZE (8 * 1024 * 1024)
+#define STREAM_WINDOW (256 * 1024)
+
+static uint32_t seed = 0x2545f491;
+
+static uint32_t rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static void gen_text(unsigned char *buf, size_t len)
+{
+    static const char *words[] = {
+        "the", "of", "and", "to", "in", "is", "that", "for", "it", "as",
+        "with", "was", "on", "be", "by", "this", "are", "from", "or", "have",
+        "signature", "archive", "database", "scanner", "virus", "engine",
+        "compressed", "function", "return", "static", "unsigned", "while"
+    };
+    size_t i = 0;
+
+    while (i < len) {
+        const char *w = words[rnd() % (sizeof(words) / sizeof(words[0]))];
+        size_t n = strlen(w);
+
+        if (i + n + 1 > len)
+            n = len - i - 1;
+        memcpy(buf + i, w, n);
+        i += n;
+        buf[i++] = (rnd() % 12) ? ' ' : '\n';
+    }
+}
+
+static void gen_binary(unsigned char *buf, size_t len)
+{
+    size_t i;
+
+    /* small integers, opcodes and repeated records */
+    for (i = 0; i < len; i++) {
+        uint32_t r = rnd();
+
+        if (i >= 64 && (r & 7) == 0)
+            buf[i] = buf[i - 64 + ((r >> 3) & 31)];
+        else if (r & 0x100)
+            buf[i] = (r >> 9) & 0x0f;
+        else
+            buf[i] = (r >> 9) & 0xff;
+    }
+}
+
+static void gen_random(unsigned char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = rnd() & 0xff;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static unsigned char *deflate_sample(const unsigned char *src, size_t len, size_t *clen)
+{
+    z_stream z;
+    unsigned char *dst;
+    size_t size = len + len / 100 + 1024;
+
+    if (!(dst = malloc(size)))
+        return NULL;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, 6, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(dst);
+        return NULL;
+    }
+    z.next_in = (unsigned char *)src;
+    z.avail_in = len;
+    z.next_out = dst;
+    z.avail_out = size;
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&z);
+        free(dst);
+        return NULL;
+    }
+    *clen = z.total_out;
+    deflateEnd(&z);
+    return dst;
+}
+
+static int inflate_stream(const unsigned char *src, size_t clen, unsigned char *dst, size_t len)
+{
+    z_stream z;
+    int ret;
+
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+        return -1;
+    z.next_in = (unsigned char *)src;
+    z.avail_in = clen;
+    z.next_out = dst;
+    do {
+        z.avail_out = MIN(STREAM_WINDOW, len - z.total_out);
+        ret = inflate(&z, Z_NO_FLUSH);
+    } while (ret == Z_OK && z.total_out < len);
+    inflateEnd(&z);
+    return z.total_out == len ? 0 : -1;
+}
+
+/* best time of runs, or a negative value if the output was wrong */
+static double bench(int mode, const unsigned char *src, size_t clen, const unsigned char *orig, size_t len, unsigned char *dst, int runs)
+{
+    double best = -1;
+    int i;
+
+    for (i = 0; i < runs; i++) {
+        size_t out = len;
+        double t;
+        int ret;
+
+        memset(dst, 0, len);
+        t = now();
+        if (mode)
+            ret = cli_inflate_buffer(src, clen, dst, &out, -MAX_WBITS, NULL) == Z_OK ? 0 : -1;
+        else
+            ret = inflate_stream(src, clen, dst, len);
+        t = now() - t;
+
+        if (ret || out != len || memcmp(dst, orig, len))
+            return -1;
+        if (best < 0 || t < best)
+            best = t;
+    }
+    return best;
+}
+
+static void report(double t, size_t len)
+{
+    if (t < 0)
+        printf(" %10s", "FAILED");
+    else
+        printf(" %10.1f", t > 0 ? len / t / (1024 * 1024) : 0.0);
+}
+
+static int run(const char *name, const unsigned char *sample, size_t len, int runs)
+{
+    unsigned char *comp, *dst;
+    size_t clen;
+    double t;
+    int ret = 0;
+
+    if (!(comp = deflate_sample(sample, len, &clen))) {
+        fprintf(stderr, "%s: can't deflate sample\n", name);
+        return 1;
+    }
+    if (!(dst = malloc(len))) {
+        free(comp);
+        return 1;
+    }
+
+    printf("%-24.24s %10lu %6.1f%%", name, (unsigned long)len, len ? clen * 100.0 / len : 0.0);
+
+    report(t = bench(0, comp, clen, sample, len, dst, runs), len);
+    ret |= t < 0;
+    cli_inflate_set_native(0);
+    report(t = bench(1, comp, clen, sample, len, dst, runs), len);
+    ret |= t < 0;
+    if (cli_inflate_set_native(1)) {
+        report(t = bench(1, comp, clen, sample, len, dst, runs), len);
+        ret |= t < 0;
+    } else {
+        printf(" %10s", "-");
+    }
+    printf("\n");
+
+    free(dst);
+    free(comp);
+    return ret;
+}
+
+static unsigned char *load(const char *path, size_t *len)
+{
+    unsigned char *buf;
+    struct stat sb;
+    FILE *f;
+
+    if (!(f = fopen(path, "rb")))
+        return NULL;
+    if (fstat(fileno(f), &sb) || !(buf = malloc(sb.st_size + 1))) {
+        fclose(f);
+        return NULL;
+    }
+    *len = fread(buf, 1, sb.st_size, f);
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        void (*gen)(unsigned char *buf, size_t len);
+    } samples[] = {
+        { "text", gen_text },
+        { "binary", gen_binary },
+        { "random", gen_random }
+    };
+    unsigned char *buf;
+    size_t len;
+    int i, runs = 5, ret = 0;
+
+    if (argc > 2 && !strcmp(argv[1], "-n")) {
+        runs = atoi(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+    if (runs < 1 || (argc > 1 && argv[1][0] == '-')) {
+        fprintf(stderr, "Usage: inflate_bench [-n runs] [file...]\n");
+        return 2;
+    }
+
+    if (cl_init(CL_INIT_DEFAULT) != CL_SUCCESS) {
+        fprintf(stderr, "cl_init failed\n");
+        return 2;
+    }
+
+    printf("zlib %s, native decoder: %s, best of %d runs\n\n", zlibVersion(),
+           cli_inflate_native() ? cli_inflate_native() : "none", runs);
+    printf("%-24s %10s %7s %10s %10s %10s\n", "sample", "bytes", "ratio", "stream", "zlib", "native");
+
+    if (argc < 2) {
+        if (!(buf = malloc(SAMPLE_SIZE)))
+            return 2;
+        for (i = 0; i < (int)(sizeof(samples) / sizeof(samples[0])); i++) {
+            samples[i].gen(buf, SAMPLE_SIZE);
+            ret |= run(samples[i].name, buf, SAMPLE_SIZE, runs);
+        }
+        free(buf);
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (!(buf = load(argv[i], &len))) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        ret |= run(argv[i], buf, len, runs);
+        free(buf);
+    }
+
+    printf("\nMB/s of decompressed output\n");
+    return ret;
+}